@@ -24,6 +24,10 @@
 #include "support.h" /* provides printf() */
 #include "wago_steppers.h" /* shared code with soem */
 #include "state_machine.h" /* shared code with soem */
+#include "cycle.h" /* shared code with soem */
+#include "safety.h" /* shared code with soem */
+#include "output_events.h" /* shared code with soem */
+#include "log.h" /* shared code with soem */
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -146,6 +150,11 @@ HRESULT CModule1::SetObjStatePS(PTComInitDataHdr pInitData)
 	wago_steppers[1][WAGO_OUTPUT_SPACE] = (struct wago_stepper_t*) &(m_Outputs.wago_stepper_outputs1);
 	wago_steppers[2][WAGO_OUTPUT_SPACE] = (struct wago_stepper_t*) &(m_Outputs.wago_stepper_outputs2);
 
+	/* the sick laser scanner field outputs, checked first thing every cycle */
+	safety_inputs = &m_Inputs.EK1002_BITS;
+	/* the digital outputs driving the magnet gripper, switched by scheduled output events */
+	output_events_outputs = &m_Outputs.EK2008_BITS;
+
 	m_Trace.Log(tlVerbose, FLEAVEA "hr=0x%08x", hr);
 	return hr;
 }
@@ -221,7 +230,8 @@ HRESULT CModule1::SetObjStateSP()
  *
  * This function is effectively the 'main' function of a TwinCAT3 based program
  * It is run cyclically at a timing specified in the System,Tasks,Taskname settings
- * Currently this function notifies when the state of the sick laser sensors changes
+ * The sick laser sensors are checked first thing by cycle_update() which stops the axes on a field
+ * violation, this function also notifies when their state changes
  * This function also runs a state machine which is used to control the WAGO Stepper motors. 
  * The state machine does not work correctly as there seems to be a mismatch in the size of the data
  * the wago devices report and the size that TwinCAT3 detects.
@@ -237,16 +247,22 @@ HRESULT CModule1::CycleUpdate(ITcTask* ipTask, ITcUnknown* ipCaller, ULONG_PTR c
 	static uint8_t current_sick;
 	static uint8_t last_sick = 0;
 
-	/* notify about changes to state of sick sensors */
+	/* per cycle work (safety reaction, move queues), outputs written here go out with this cycle */
+	cycle_update();
+
+	/* notify about changes to state of sick sensors, the reaction has already happened in cycle_update() */
 	current_sick = m_Inputs.EK1002_BITS;
 	
 	if (current_sick != last_sick)
-		printf("sick: changed to %x from %x\n", current_sick, last_sick);
+		log_write("sick: changed to %x from %x\n", current_sick, last_sick);
 	last_sick = current_sick;
 
 	/* update the state_machine, also causes updates of io's */
 	state_machine(m_Trace);
 
+	/* format a little of what was logged, there is no thread of our own to hand it to */
+	log_flush(m_Trace, LOG_FLUSH_PER_CYCLE);
+
 	return hr;
 }
 ///</AutoGeneratedContent>
@@ -0,0 +1,245 @@
+/** \file
+ * \brief Cyclic synchronous position driver for the AX5000 servo drives
+ *
+ * Every axis has an MDT (control word, position and velocity command) and an AT (status word,
+ * position and velocity feedback) in the process image. ax5000_update() runs every cycle: it takes
+ * the drive through drive on and enable once the application asks for it, toggles the sync bit and
+ * writes the latest position setpoint. The setpoint may not move further than max_step in a cycle,
+ * a source that jumps is held back rather than passed on to the drive.
+ * While the axis is not following setpoints (disabled, enabling, halted, faulted) the command
+ * tracks the actual position, so picking the setpoints up again never makes the drive jump.
+ * A violated safety field clears restart, the drive then stops on its own ramp and holds.
+ *
+ * Under SOEM the telegrams are configured and the process image is found by ax5000_soe.c. Under
+ * TwinCAT3 the drives belong to the NC, the pointers stay NULL and nothing here runs.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include "ax5000.h"
+#include "safety.h"
+#include "log.h"
+
+struct ax5000_mdt_t *ax5000_mdt[AX5000_NUM_AXES] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+struct ax5000_at_t *ax5000_at[AX5000_NUM_AXES] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+int (*ax5000_clear_fault)(int axis) = NULL;
+
+/* every field is listed, the file is built as C++ under TwinCAT3 so there are no designated initializers */
+#define AX5000_AXIS_DEFAULT { \
+	0, 0, 0, 0, AX5000_DEFAULT_MAX_STEP, \
+	AX5000_DISABLED, 0, 0, 0, 0, 0, \
+	0, 0 \
+}
+
+struct ax5000_axis_t ax5000_axes[AX5000_NUM_AXES] = {
+	AX5000_AXIS_DEFAULT,
+	AX5000_AXIS_DEFAULT,
+	AX5000_AXIS_DEFAULT,
+	AX5000_AXIS_DEFAULT,
+	AX5000_AXIS_DEFAULT,
+	AX5000_AXIS_DEFAULT,
+	AX5000_AXIS_DEFAULT,
+	AX5000_AXIS_DEFAULT,
+	AX5000_AXIS_DEFAULT
+};
+
+/**
+ * Asks for an axis to be enabled
+ *
+ * The cycle switches the drive on and enables it, the axis follows setpoints once
+ * ax5000_state() reports AX5000_ENABLED.
+ * @param[in]	axis The axis, should start from 0 and go to AX5000_NUM_AXES-1
+ * @return AX5000_ERR_SUCCESS on success, AX5000_ERR_NO_DRIVE if the axis has no drive,
+ * AX5000_ERR_FAULT if the drive has to be reset first
+ */
+int ax5000_enable(int axis)
+{
+	if (ax5000_mdt[axis] == NULL || ax5000_at[axis] == NULL)
+		return AX5000_ERR_NO_DRIVE;
+	if (ax5000_axes[axis].state == AX5000_FAULT)
+		return AX5000_ERR_FAULT;
+	ax5000_axes[axis].enable = 1;
+	return AX5000_ERR_SUCCESS;
+}
+
+/**
+ * Switches an axis's drive off
+ *
+ * @param[in]	axis The axis, should start from 0 and go to AX5000_NUM_AXES-1
+ */
+void ax5000_disable(int axis)
+{
+	ax5000_axes[axis].enable = 0;
+}
+
+/**
+ * Stops an axis on the drive's own ramp and holds it, or lets it follow setpoints again
+ *
+ * @param[in]	axis The axis, should start from 0 and go to AX5000_NUM_AXES-1
+ * @param[in]	halt 1 to halt, 0 to carry on
+ */
+void ax5000_halt(int axis, int halt)
+{
+	ax5000_axes[axis].halt = halt;
+}
+
+/**
+ * Clears a drive's error
+ *
+ * May block, must not be called from the cycle. The axis is disabled and has to be enabled again.
+ * @param[in]	axis The axis, should start from 0 and go to AX5000_NUM_AXES-1
+ * @return AX5000_ERR_SUCCESS on success, AX5000_ERR_NO_RESET if the platform cannot clear errors
+ * or the drive refused
+ */
+int ax5000_reset(int axis)
+{
+	ax5000_axes[axis].enable = 0;
+	if (ax5000_axes[axis].state != AX5000_FAULT)
+		return AX5000_ERR_SUCCESS;
+	if (ax5000_clear_fault == NULL || ax5000_clear_fault(axis) < 0)
+		return AX5000_ERR_NO_RESET;
+	return AX5000_ERR_SUCCESS;
+}
+
+/**
+ * Sets the position an axis should be at in the next cycle
+ *
+ * Meant to be called every cycle, only the latest value is used.
+ * @param[in]	axis The axis, should start from 0 and go to AX5000_NUM_AXES-1
+ * @param[in]	position The position setpoint, drive position units
+ * @param[in]	velocity The velocity at that point, fed forward to the drive
+ * @return AX5000_ERR_SUCCESS on success, AX5000_ERR_NOT_ENABLED if the axis is not following setpoints
+ */
+int ax5000_set_position(int axis, int32_t position, int32_t velocity)
+{
+	if (ax5000_axes[axis].state != AX5000_ENABLED)
+		return AX5000_ERR_NOT_ENABLED;
+	ax5000_axes[axis].target = position;
+	ax5000_axes[axis].target_velocity = velocity;
+	return AX5000_ERR_SUCCESS;
+}
+
+/**
+ * Reads the position an axis reported in the last cycle
+ *
+ * @param[in]	axis The axis, should start from 0 and go to AX5000_NUM_AXES-1
+ * @return the actual position, drive position units
+ */
+int32_t ax5000_actual_position(int axis)
+{
+	return ax5000_axes[axis].actual_position;
+}
+
+/**
+ * Reports the state of an axis
+ *
+ * @param[in]	axis The axis, should start from 0 and go to AX5000_NUM_AXES-1
+ * @return the state
+ */
+enum ax5000_states ax5000_state(int axis)
+{
+	return ax5000_axes[axis].state;
+}
+
+/**
+ * Moves an axis to a new state
+ *
+ * @param[in,out]	a The axis
+ * @param[in]		state The new state
+ */
+static void ax5000_set_state(struct ax5000_axis_t *a, enum ax5000_states state)
+{
+	a->state = state;
+	a->state_cycles = 0;
+}
+
+/**
+ * Services one axis
+ *
+ * Must be called once per cycle, the io lock must already be held (see cycle_update()).
+ * @param[in]	axis The axis, should start from 0 and go to AX5000_NUM_AXES-1
+ */
+void ax5000_update(int axis)
+{
+	struct ax5000_mdt_t *mdt = ax5000_mdt[axis];
+	struct ax5000_at_t *at = ax5000_at[axis];
+	struct ax5000_axis_t *a = &ax5000_axes[axis];
+	uint16_t control;
+	int32_t delta;
+	int following;
+
+	if (mdt == NULL || at == NULL)
+		return;
+
+	a->status = at->status;
+	a->actual_position = at->position;
+	a->actual_velocity = at->velocity;
+	a->state_cycles++;
+
+	if ((a->status & AX5000_STATUS_ERROR) && a->state != AX5000_FAULT) {
+		a->enable = 0;
+		a->faults++;
+		ax5000_set_state(a, AX5000_FAULT);
+		log_write("ax5000 %d: drive error, status %x\n", axis, a->status);
+	}
+
+	switch (a->state) {
+	case AX5000_DISABLED:
+		if (a->enable)
+			ax5000_set_state(a, AX5000_ENABLING);
+		break;
+	case AX5000_ENABLING:
+		if (!a->enable) {
+			ax5000_set_state(a, AX5000_DISABLED);
+		} else if ((a->status & AX5000_STATUS_READY_MASK) == AX5000_STATUS_OPERATING) {
+			/* start from where the axis is */
+			a->target = a->actual_position;
+			a->target_velocity = 0;
+			ax5000_set_state(a, AX5000_ENABLED);
+		} else if (a->state_cycles > AX5000_ENABLE_TIMEOUT) {
+			a->enable = 0;
+			ax5000_set_state(a, AX5000_DISABLED);
+			log_write("ax5000 %d: not operating after %u cycles, status %x\n", axis, AX5000_ENABLE_TIMEOUT, a->status);
+		}
+		break;
+	case AX5000_ENABLED:
+		if (!a->enable) {
+			ax5000_set_state(a, AX5000_DISABLED);
+		} else if ((a->status & AX5000_STATUS_READY_MASK) != AX5000_STATUS_OPERATING) {
+			/* no error but the drive dropped out, power lost or the enable input opened */
+			a->enable = 0;
+			ax5000_set_state(a, AX5000_DISABLED);
+			log_write("ax5000 %d: drive stopped operating, status %x\n", axis, a->status);
+		}
+		break;
+	case AX5000_FAULT:
+		/* leaves once ax5000_reset() has cleared the error */
+		if (!(a->status & AX5000_STATUS_ERROR))
+			ax5000_set_state(a, AX5000_DISABLED);
+		break;
+	}
+
+	following = (a->state == AX5000_ENABLED && !a->halt && safety_state == SAFETY_RUN);
+	if (following) {
+		delta = a->target - a->command;
+		if (delta > a->max_step || delta < -a->max_step) {
+			delta = (delta > 0) ? a->max_step : -a->max_step;
+			a->limited_cycles++;
+		}
+		a->command += delta;
+		mdt->velocity = a->target_velocity;
+	} else {
+		a->command = a->actual_position;
+		if (a->state == AX5000_ENABLED)
+			a->target = a->actual_position;
+		mdt->velocity = 0;
+	}
+	mdt->position = a->command;
+
+	control = (mdt->control & AX5000_CONTROL_SYNC) ^ AX5000_CONTROL_SYNC;
+	if (a->state == AX5000_ENABLING || a->state == AX5000_ENABLED)
+		control |= AX5000_CONTROL_DRIVE_ON | AX5000_CONTROL_ENABLE;
+	if (following)
+		control |= AX5000_CONTROL_RESTART;
+	mdt->control = control;
+}
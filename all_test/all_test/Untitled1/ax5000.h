@@ -0,0 +1,119 @@
+/* ax5000.h
+ * this file defines the driver for the AX5000 servo drives (AX5103, AX5203) over SoE process data
+ * every axis is commanded in cyclic synchronous position mode: a position setpoint is written to
+ * the MDT every cycle and the drive closes the position loop itself
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __AX5000_H__
+#define __AX5000_H__
+
+#include "wago_steppers.h"
+
+/* up to three delta robots of three axes each on the segment, an AX5203 drives two axes, an AX5103 one
+ * the drives are taken in bus order, robot by robot (see planner.h) */
+#define AX5000_NUM_AXES 9
+
+/* drive control word (S-0-0134) */
+#define AX5000_CONTROL_DRIVE_ON 0x8000
+#define AX5000_CONTROL_ENABLE 0x4000
+#define AX5000_CONTROL_RESTART 0x2000 /* the drive holds its position while this is clear */
+#define AX5000_CONTROL_SYNC 0x0400 /* toggled every cycle */
+
+/* drive status word (S-0-0135) */
+#define AX5000_STATUS_READY_MASK 0xc000
+#define AX5000_STATUS_NOT_READY 0x0000
+#define AX5000_STATUS_LOGIC_READY 0x4000
+#define AX5000_STATUS_POWER_READY 0x8000
+#define AX5000_STATUS_OPERATING 0xc000
+#define AX5000_STATUS_ERROR 0x2000 /* class 1 diagnostic, the drive has shut down */
+#define AX5000_STATUS_WARNING 0x1000
+
+/* default largest change of the position setpoint per cycle, drive position units */
+#define AX5000_DEFAULT_MAX_STEP 10000
+/* cycles an axis may take to report it is operating before enabling is abandoned */
+#define AX5000_ENABLE_TIMEOUT 10000
+
+#define AX5000_ERR_SUCCESS 0
+#define AX5000_ERR_NO_DRIVE -1
+#define AX5000_ERR_FAULT -2
+#define AX5000_ERR_NOT_ENABLED -3
+#define AX5000_ERR_NO_RESET -4
+
+/* the MDT and AT as configured by ax5000_soe_configure(), one of each per axis */
+#ifdef _MSC_VER
+__pragma( pack(push, 1) )
+struct ax5000_mdt_t {
+#else
+struct __attribute__((__packed__)) ax5000_mdt_t {
+#endif /* _MSC_VER */
+	uint16_t control; /* S-0-0134 master control word */
+	int32_t position; /* S-0-0047 position command value */
+	int32_t velocity; /* S-0-0036 velocity command value, used as feed forward */
+};
+
+#ifdef _MSC_VER
+struct ax5000_at_t {
+#else
+struct __attribute__((__packed__)) ax5000_at_t {
+#endif /* _MSC_VER */
+	uint16_t status; /* S-0-0135 drive status word */
+	int32_t position; /* S-0-0051 position feedback value 1 */
+	int32_t velocity; /* S-0-0040 velocity feedback value 1 */
+};
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+__pragma( pack(pop) )
+#endif /* _MSC_VER */
+
+enum ax5000_states {
+	AX5000_DISABLED = 0,	/* drive off, the setpoint follows the actual position */
+	AX5000_ENABLING,	/* drive on requested, waiting for the drive to report it is operating */
+	AX5000_ENABLED,		/* following the setpoints */
+	AX5000_FAULT		/* the drive reported an error, needs ax5000_reset() */
+};
+
+struct ax5000_axis_t {
+	/* set by the application */
+	volatile int enable;
+	volatile int halt;
+	volatile int32_t target; /* position setpoint for the next cycle */
+	volatile int32_t target_velocity;
+	int32_t max_step;
+
+	/* updated every cycle */
+	enum ax5000_states state;
+	uint32_t state_cycles;
+	int32_t command; /* position written to the drive this cycle */
+	int32_t actual_position;
+	int32_t actual_velocity;
+	uint16_t status;
+
+	/* statistics */
+	uint32_t faults;
+	uint32_t limited_cycles; /* cycles where the setpoint moved further than max_step */
+};
+
+/* point at each axis's part of the process image, set up by the platform code, NULL for none */
+extern struct ax5000_mdt_t *ax5000_mdt[AX5000_NUM_AXES];
+extern struct ax5000_at_t *ax5000_at[AX5000_NUM_AXES];
+/* clears a drive's class 1 diagnostic (S-0-0099), provided by the platform code, NULL if there is none
+ * may block, never called from the cycle */
+extern int (*ax5000_clear_fault)(int axis);
+
+extern struct ax5000_axis_t ax5000_axes[AX5000_NUM_AXES];
+
+int ax5000_enable(int axis);
+void ax5000_disable(int axis);
+void ax5000_halt(int axis, int halt);
+int ax5000_reset(int axis);
+int ax5000_set_position(int axis, int32_t position, int32_t velocity);
+int32_t ax5000_actual_position(int axis);
+enum ax5000_states ax5000_state(int axis);
+
+void ax5000_update(int axis);
+
+#endif /* __AX5000_H__ */
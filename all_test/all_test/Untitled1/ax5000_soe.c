@@ -0,0 +1,224 @@
+/** \file
+ * \brief SOEM side of the AX5000 driver
+ *
+ * ax5000_soe_find() numbers the drives' axes in bus order (two on an AX52xx, one on an AX51xx)
+ * and hooks ax5000_soe_setup() into the pre-op to safe-op transition, where the telegrams are
+ * made configurable and given the position and velocity command in the MDT and the position and
+ * velocity feedback in the AT. The control and status words always lead the telegrams, SOEM adds
+ * them when it works out the sizes from S-0-0016 and S-0-0024. SOEM maps the drives of a slave one
+ * after the other, which is what ax5000_soe_map() relies on to find each axis.
+ *
+ * The drives only take the position setpoints at a fixed point in the cycle, so SYNC0 is switched
+ * on for every drive and the ethercat thread follows the distributed clock (see ec_sync()).
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ethercattype.h"
+#include "nicdrv.h"
+#include "ethercatbase.h"
+#include "ethercatmain.h"
+#include "ethercatdc.h"
+#include "ethercatsoe.h"
+
+#include "ax5000_soe.h"
+#include "ax5000.h"
+
+#define AX5000_SOE_MAX_LIST 8
+
+/* cyclic data after the control and status words, in the order of struct ax5000_mdt_t and ax5000_at_t */
+static const uint16 ax5000_soe_mdt_list[] = {47, 36};
+static const uint16 ax5000_soe_at_list[] = {51, 40};
+
+static struct {
+	uint16 slave;
+	uint8 drive;
+} ax5000_soe_axes[AX5000_NUM_AXES];
+static int ax5000_soe_count = 0;
+static uint16 ax5000_soe_cycle_us = 0;
+
+/**
+ * Works out how many axes a slave drives
+ *
+ * @param[in]	slave The slave number
+ * @return 2 for an AX52xx, 1 for an AX51xx, 0 for anything else
+ */
+static int ax5000_soe_drives(uint16 slave)
+{
+	if (strncmp(ec_slave[slave].name, "AX52", 4) == 0)
+		return 2;
+	if (strncmp(ec_slave[slave].name, "AX51", 4) == 0)
+		return 1;
+	return 0;
+}
+
+/**
+ * Writes a two byte parameter
+ *
+ * @param[in]	slave The slave number
+ * @param[in]	drive The drive on the slave
+ * @param[in]	idn The parameter
+ * @param[in]	value The value
+ * @return the working counter, 0 or less on failure
+ */
+static int ax5000_soe_write_u16(uint16 slave, uint8 drive, uint16 idn, uint16 value)
+{
+	uint16 data = htoes(value);
+	return ec_SoEwrite(slave, drive, EC_SOE_VALUE_B, idn, sizeof(data), &data, EC_TIMEOUTRXM);
+}
+
+/**
+ * Writes a list parameter
+ *
+ * Lists start with their current and their maximum length in bytes.
+ * @param[in]	slave The slave number
+ * @param[in]	drive The drive on the slave
+ * @param[in]	idn The parameter
+ * @param[in]	idns The elements
+ * @param[in]	n Number of elements, at most AX5000_SOE_MAX_LIST
+ * @return the working counter, 0 or less on failure
+ */
+static int ax5000_soe_write_list(uint16 slave, uint8 drive, uint16 idn, const uint16 *idns, int n)
+{
+	uint16 list[2 + AX5000_SOE_MAX_LIST];
+
+	list[0] = htoes(n * sizeof(uint16));
+	list[1] = htoes(n * sizeof(uint16));
+	for (int i=0; i<n; i++)
+		list[2 + i] = htoes(idns[i]);
+	return ec_SoEwrite(slave, drive, EC_SOE_VALUE_B, idn, (2 + n) * sizeof(uint16), list, EC_TIMEOUTRXM);
+}
+
+/**
+ * Configures the telegrams of every drive of a slave
+ *
+ * Called by SOEM on the way from pre-op to safe-op, before the process data is mapped.
+ * @param[in]	slave The slave number
+ * @return 1 on success, 0 on failure
+ */
+static int ax5000_soe_setup(uint16 slave)
+{
+	int drives = ax5000_soe_drives(slave);
+
+	for (uint8 drive=0; drive<drives; drive++) {
+		if (ax5000_soe_write_u16(slave, drive, AX5000_SOE_IDN_TELEGRAM, AX5000_SOE_TELEGRAM_CONFIGURABLE) <= 0 ||
+			ax5000_soe_write_u16(slave, drive, AX5000_SOE_IDN_NC_CYCLE, ax5000_soe_cycle_us) <= 0 ||
+			ax5000_soe_write_u16(slave, drive, AX5000_SOE_IDN_COMM_CYCLE, ax5000_soe_cycle_us) <= 0 ||
+			ax5000_soe_write_list(slave, drive, AX5000_SOE_IDN_MDT_LIST, ax5000_soe_mdt_list,
+				sizeof(ax5000_soe_mdt_list) / sizeof(ax5000_soe_mdt_list[0])) <= 0 ||
+			ax5000_soe_write_list(slave, drive, AX5000_SOE_IDN_AT_LIST, ax5000_soe_at_list,
+				sizeof(ax5000_soe_at_list) / sizeof(ax5000_soe_at_list[0])) <= 0) {
+			printf("AX5000: Could not configure the telegrams of slave %d drive %d\n", slave, drive);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Finds the drives and has their telegrams configured
+ *
+ * Must be called after ec_config_init() and before the process data is mapped.
+ * @param[in]	cycle_ns The cycle time
+ * @return the number of axes found
+ */
+int ax5000_soe_find(uint32_t cycle_ns)
+{
+	ax5000_soe_count = 0;
+	ax5000_soe_cycle_us = cycle_ns / 1000;
+
+	for (uint16 slave=1; slave<=ec_slavecount; slave++) {
+		int drives = ax5000_soe_drives(slave);
+		if (drives == 0)
+			continue;
+		ec_slave[slave].PO2SOconfig = ax5000_soe_setup;
+		for (uint8 drive=0; drive<drives && ax5000_soe_count<AX5000_NUM_AXES; drive++) {
+			ax5000_soe_axes[ax5000_soe_count].slave = slave;
+			ax5000_soe_axes[ax5000_soe_count].drive = drive;
+			ax5000_soe_count++;
+		}
+	}
+	return ax5000_soe_count;
+}
+
+/**
+ * Points the driver at the process data of every axis
+ *
+ * Must be called after the process data is mapped.
+ * @return the number of axes, AX5000_SOE_ERR_MAPPING if a drive's process data is not the size
+ * the telegrams were configured for
+ */
+int ax5000_soe_map(void)
+{
+	for (int axis=0; axis<ax5000_soe_count; axis++) {
+		uint16 slave = ax5000_soe_axes[axis].slave;
+		uint8 drive = ax5000_soe_axes[axis].drive;
+		int drives = ax5000_soe_drives(slave);
+
+		if (ec_slave[slave].Obytes != drives * sizeof(struct ax5000_mdt_t) ||
+			ec_slave[slave].Ibytes != drives * sizeof(struct ax5000_at_t)) {
+			printf("AX5000: Slave %d maps %d output and %d input bytes, expected %d and %d\n", slave,
+				ec_slave[slave].Obytes, ec_slave[slave].Ibytes,
+				(int) (drives * sizeof(struct ax5000_mdt_t)), (int) (drives * sizeof(struct ax5000_at_t)));
+			return AX5000_SOE_ERR_MAPPING;
+		}
+		ax5000_mdt[axis] = (struct ax5000_mdt_t *) (ec_slave[slave].outputs + drive * sizeof(struct ax5000_mdt_t));
+		ax5000_at[axis] = (struct ax5000_at_t *) (ec_slave[slave].inputs + drive * sizeof(struct ax5000_at_t));
+	}
+	ax5000_clear_fault = ax5000_soe_clear_fault;
+	return ax5000_soe_count;
+}
+
+/**
+ * Switches on SYNC0 for every drive
+ *
+ * Must be called in safe-op, before op is requested. SYNC0 comes a quarter of a cycle after the
+ * cycle starts so the frame carrying the setpoints has passed the drives by then.
+ * @param[in]	cycle_ns The cycle time
+ * @return 1 if the drives are synchronised and the ethercat thread must follow the distributed clock, 0 otherwise
+ */
+int ax5000_soe_sync(uint32_t cycle_ns)
+{
+	uint16 last = 0;
+
+	if (ax5000_soe_count == 0)
+		return 0;
+	if (!ec_configdc()) {
+		printf("AX5000: No distributed clocks, the drives are not synchronised\n");
+		return 0;
+	}
+	for (int axis=0; axis<ax5000_soe_count; axis++) {
+		if (ax5000_soe_axes[axis].slave == last)
+			continue;
+		last = ax5000_soe_axes[axis].slave;
+		ec_dcsync0(last, TRUE, cycle_ns, cycle_ns / 4);
+	}
+	return 1;
+}
+
+/**
+ * Clears a drive's class 1 diagnostic
+ *
+ * Runs the S-0-0099 procedure command over the mailbox, blocks for up to a few EC_TIMEOUTRXM.
+ * Installed as ax5000_clear_fault by ax5000_soe_map().
+ * @param[in]	axis The axis
+ * @return AX5000_SOE_ERR_SUCCESS on success, AX5000_SOE_ERR_AXIS if there is no such axis,
+ * AX5000_SOE_ERR_SOE if the drive did not take the command
+ */
+int ax5000_soe_clear_fault(int axis)
+{
+	uint16 slave;
+	uint8 drive;
+
+	if (axis < 0 || axis >= ax5000_soe_count)
+		return AX5000_SOE_ERR_AXIS;
+	slave = ax5000_soe_axes[axis].slave;
+	drive = ax5000_soe_axes[axis].drive;
+
+	if (ax5000_soe_write_u16(slave, drive, AX5000_SOE_IDN_RESET_C1D, AX5000_SOE_COMMAND_SET) <= 0)
+		return AX5000_SOE_ERR_SOE;
+	/* a procedure command has to be cancelled before it can be given again */
+	ax5000_soe_write_u16(slave, drive, AX5000_SOE_IDN_RESET_C1D, AX5000_SOE_COMMAND_CANCEL);
+	return AX5000_SOE_ERR_SUCCESS;
+}
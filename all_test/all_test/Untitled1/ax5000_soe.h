@@ -0,0 +1,38 @@
+/* ax5000_soe.h
+ * this file defines the SOEM side of the AX5000 driver: finding the drives on the bus, configuring
+ * their telegrams over SoE, pointing the driver at their process data and synchronising them to
+ * the distributed clock
+ * SOEM only, TwinCAT3 configures the drives from its own startup list
+ */
+
+#ifndef __AX5000_SOE_H__
+#define __AX5000_SOE_H__
+
+#include <stdint.h>
+
+#include "ethercattype.h"
+#include "ethercatmain.h"
+
+#define AX5000_SOE_IDN_NC_CYCLE 1 /* S-0-0001 NC cycle time, microseconds */
+#define AX5000_SOE_IDN_COMM_CYCLE 2 /* S-0-0002 communication cycle time, microseconds */
+#define AX5000_SOE_IDN_TELEGRAM 15 /* S-0-0015 telegram type */
+#define AX5000_SOE_IDN_AT_LIST 16 /* S-0-0016 configuration list of the AT */
+#define AX5000_SOE_IDN_MDT_LIST 24 /* S-0-0024 configuration list of the MDT */
+#define AX5000_SOE_IDN_RESET_C1D 99 /* S-0-0099 reset class 1 diagnostic */
+
+#define AX5000_SOE_TELEGRAM_CONFIGURABLE 7
+/* procedure command values */
+#define AX5000_SOE_COMMAND_CANCEL 0
+#define AX5000_SOE_COMMAND_SET 3
+
+#define AX5000_SOE_ERR_SUCCESS 0
+#define AX5000_SOE_ERR_SOE -1
+#define AX5000_SOE_ERR_MAPPING -2
+#define AX5000_SOE_ERR_AXIS -3
+
+int ax5000_soe_find(uint32_t cycle_ns);
+int ax5000_soe_map(void);
+int ax5000_soe_sync(uint32_t cycle_ns);
+int ax5000_soe_clear_fault(int axis);
+
+#endif /* __AX5000_SOE_H__ */
@@ -0,0 +1,287 @@
+/** \file
+ * \brief Polling of every slave's error counters
+ *
+ * Every ESC counts, per port, the frames it received with an invalid frame or a bad CRC, how many
+ * of those were already marked bad by a slave further up (forwarded errors) and how often the link
+ * went down. A faulty cable or connector shows as RX errors on the port it is plugged into without
+ * matching forwarded errors, so the port's rate only counts invalid frames, RX errors and lost
+ * links, forwarded errors are kept but belong to the port where they started.
+ *
+ * The ethercat thread reads one slave in every slot the slow group is due, with a single FPRD of
+ * the whole counter block. SOEM 1.3.0 cannot add a datagram to a process data frame, so the FPRD
+ * goes in a frame of its own, sent just before the slow group's and picked up after it, and the
+ * process data frames keep their size. The same frame carries a second datagram, an FPRD of the
+ * slave's DL status, which the supervisor compares the links of the redundant ring with instead of
+ * reading them itself. Nothing else sends from here and every slot sends the same 20 and 2 byte
+ * datagrams, so the time it adds to a slow slot is fixed.
+ * The counters saturate, once any of them gets to BUS_ERRORS_CLEAR_AT the slave's next slot writes
+ * the whole block to 0 instead of reading it, errors arriving between the read and the clear are
+ * lost.
+ * Each port's errors are summed over BUS_ERRORS_WINDOW_READS reads of its slave, a window with
+ * BUS_ERRORS_ALARM_RATE errors, a rate that keeps going up or any lost link raises the port's
+ * alarm. The alarm clears after a window without errors.
+ */
+
+#include <string.h>
+
+#include "ethercattype.h"
+#include "nicdrv.h"
+#include "ethercatbase.h"
+#include "ethercatmain.h"
+
+#include "bus_errors.h"
+#include "log.h"
+
+/* the counter block from BUS_ERRORS_REG_RX up to the lost link counters */
+struct __attribute__((__packed__)) bus_errors_registers_t {
+	struct {
+		uint8 invalid_frames;
+		uint8 rx_errors;
+	} rx[BUS_ERRORS_PORTS];
+	uint8 forwarded_errors[BUS_ERRORS_PORTS];
+	uint8 processing_errors;
+	uint8 pdi_errors;
+	uint8 reserved[2];
+	uint8 lost_links[BUS_ERRORS_PORTS];
+};
+
+struct bus_errors_slave_t bus_errors_slaves[EC_MAXSLAVE];
+struct bus_errors_stats_t bus_errors_stats;
+
+/* counter values after the last read, the difference to the next read is what is new */
+static struct bus_errors_registers_t bus_errors_last[EC_MAXSLAVE];
+static uint32_t bus_errors_window_reads[EC_MAXSLAVE];
+
+static int bus_errors_running = 0;
+/* the slave the next slot is for, and whether that slot clears its counters */
+static uint16 bus_errors_next = 1;
+static int bus_errors_clear = 0;
+/* the datagram of the current slot, -1 for none */
+static int bus_errors_idx = -1;
+static int bus_errors_clearing = 0;
+/* what an FPWR clears the counters with, and what an FPRD is sent with */
+static struct bus_errors_registers_t bus_errors_zero;
+static uint16 bus_errors_dl_zero;
+/* where the DL status datagram's data is in the frame */
+static int bus_errors_dl_offset;
+
+/**
+ * Works out how far a counter has moved
+ *
+ * @param[in]	now The value just read
+ * @param[in]	last The value read last time
+ * @return the new counts, now if the counter was cleared behind our back
+ */
+static uint32_t bus_errors_delta(uint8 now, uint8 last)
+{
+	return (now >= last) ? now - last : now;
+}
+
+/**
+ * Closes a port's window and decides on its alarm
+ *
+ * @param[in]	slave The slave number
+ * @param[in]	port The port
+ */
+static void bus_errors_close_window(uint16 slave, int port)
+{
+	struct bus_errors_port_t *p = &bus_errors_slaves[slave].ports[port];
+
+	if (p->window > p->rate)
+		p->rising++;
+	else
+		p->rising = 0;
+	p->rate = p->window;
+	p->window = 0;
+
+	if (!p->alarm && (p->rate >= BUS_ERRORS_ALARM_RATE || p->rising >= BUS_ERRORS_ALARM_RISING)) {
+		p->alarm = 1;
+		bus_errors_stats.alarms++;
+		log_write("EtherCAT: slave %d port %d is taking errors, %u in the last window (%u windows rising)\n",
+			slave, port, p->rate, p->rising);
+	} else if (p->alarm && p->rate == 0) {
+		p->alarm = 0;
+		bus_errors_stats.alarms--;
+		log_write("EtherCAT: slave %d port %d is clean again\n", slave, port);
+	}
+}
+
+/**
+ * Accounts for a slave's counters just read
+ *
+ * @param[in]	slave The slave number
+ * @param[in]	now The counter block
+ * @return 1 if the counters must be cleared, 0 otherwise
+ */
+static int bus_errors_count(uint16 slave, const struct bus_errors_registers_t *now)
+{
+	struct bus_errors_slave_t *s = &bus_errors_slaves[slave];
+	struct bus_errors_registers_t *last = &bus_errors_last[slave];
+	uint32_t invalid, rx, lost;
+	int clear = 0;
+
+	s->reads++;
+
+	for (int port=0; port<BUS_ERRORS_PORTS; port++) {
+		struct bus_errors_port_t *p = &s->ports[port];
+
+		invalid = bus_errors_delta(now->rx[port].invalid_frames, last->rx[port].invalid_frames);
+		rx = bus_errors_delta(now->rx[port].rx_errors, last->rx[port].rx_errors);
+		lost = bus_errors_delta(now->lost_links[port], last->lost_links[port]);
+		p->invalid_frames += invalid;
+		p->rx_errors += rx;
+		p->forwarded_errors += bus_errors_delta(now->forwarded_errors[port], last->forwarded_errors[port]);
+		p->lost_links += lost;
+		p->window += invalid + rx + lost;
+		bus_errors_stats.errors += invalid + rx + lost;
+
+		if (lost > 0 && !p->alarm) {
+			p->alarm = 1;
+			bus_errors_stats.alarms++;
+			log_write("EtherCAT: slave %d port %d lost its link\n", slave, port);
+		}
+
+		if (now->rx[port].invalid_frames >= BUS_ERRORS_CLEAR_AT || now->rx[port].rx_errors >= BUS_ERRORS_CLEAR_AT ||
+			now->forwarded_errors[port] >= BUS_ERRORS_CLEAR_AT || now->lost_links[port] >= BUS_ERRORS_CLEAR_AT)
+			clear = 1;
+	}
+	s->processing_errors += bus_errors_delta(now->processing_errors, last->processing_errors);
+	if (now->processing_errors >= BUS_ERRORS_CLEAR_AT)
+		clear = 1;
+
+	*last = *now;
+
+	if (++bus_errors_window_reads[slave] >= BUS_ERRORS_WINDOW_READS) {
+		bus_errors_window_reads[slave] = 0;
+		for (int port=0; port<BUS_ERRORS_PORTS; port++)
+			bus_errors_close_window(slave, port);
+	}
+	return clear;
+}
+
+/**
+ * Moves on to the next slave, round robin
+ */
+static void bus_errors_advance(void)
+{
+	if (++bus_errors_next > ec_slavecount) {
+		bus_errors_next = 1;
+		bus_errors_stats.passes++;
+	}
+}
+
+/**
+ * Sends this slot's datagram
+ *
+ * Called by the ethercat thread in every slot the slow group is due, just before the slow group's
+ * frame is sent. bus_errors_receive() must follow in the same cycle.
+ */
+void bus_errors_send(void)
+{
+	uint8 com;
+
+	if (!bus_errors_running || ec_slavecount == 0 || bus_errors_idx >= 0)
+		return;
+
+	com = bus_errors_clear ? EC_CMD_FPWR : EC_CMD_FPRD;
+	bus_errors_idx = ec_getindex();
+	bus_errors_clearing = bus_errors_clear;
+	ec_setupdatagram(&(ecx_port.txbuf[bus_errors_idx]), com, bus_errors_idx, ec_slave[bus_errors_next].configadr,
+		BUS_ERRORS_REG_RX, sizeof(bus_errors_zero), &bus_errors_zero);
+	bus_errors_dl_offset = ec_adddatagram(&(ecx_port.txbuf[bus_errors_idx]), EC_CMD_FPRD, bus_errors_idx, FALSE,
+		ec_slave[bus_errors_next].configadr, ECT_REG_DLSTAT, sizeof(bus_errors_dl_zero), &bus_errors_dl_zero);
+	ec_outframe_red(bus_errors_idx);
+	bus_errors_stats.slots++;
+}
+
+/**
+ * Picks up this slot's datagram and accounts for it
+ *
+ * Called by the ethercat thread after the slow group's frame is back, the datagram went out before
+ * it so it is normally back already.
+ * @param[in]	timeout Receive timeout in microseconds
+ */
+void bus_errors_receive(int timeout)
+{
+	uint16 slave = bus_errors_next;
+	struct bus_errors_registers_t now;
+	uint16 dl_status, dl_wkc;
+	int wkc;
+
+	if (bus_errors_idx < 0)
+		return;
+
+	/* the working counter returned is the first datagram's */
+	wkc = ec_waitinframe(bus_errors_idx, timeout);
+	if (wkc > 0 && !bus_errors_clearing)
+		memcpy(&now, &(ecx_port.rxbuf[bus_errors_idx][EC_HEADERSIZE]), sizeof(now));
+	if (wkc > 0) {
+		memcpy(&dl_status, &(ecx_port.rxbuf[bus_errors_idx][bus_errors_dl_offset]), sizeof(dl_status));
+		memcpy(&dl_wkc, &(ecx_port.rxbuf[bus_errors_idx][bus_errors_dl_offset + sizeof(dl_status)]), sizeof(dl_wkc));
+		if (etohs(dl_wkc) > 0) {
+			bus_errors_slaves[slave].dl_status = etohs(dl_status);
+			bus_errors_slaves[slave].dl_status_reads++;
+		}
+	}
+	ec_setbufstat(bus_errors_idx, EC_BUF_EMPTY);
+	bus_errors_idx = -1;
+
+	if (wkc <= 0) {
+		if (wkc < 0)
+			bus_errors_stats.late++;
+		bus_errors_slaves[slave].read_failures++;
+		bus_errors_clear = 0;
+		bus_errors_advance();
+		return;
+	}
+
+	if (bus_errors_clearing) {
+		/* errors between the read and the clear are lost, the next read starts from 0 */
+		memset(&bus_errors_last[slave], 0, sizeof(bus_errors_last[slave]));
+		bus_errors_slaves[slave].clears++;
+		bus_errors_clear = 0;
+		bus_errors_advance();
+		return;
+	}
+
+	/* the slave's next slot clears its counters, the one after reads the next slave */
+	bus_errors_clear = bus_errors_count(slave, &now);
+	if (!bus_errors_clear)
+		bus_errors_advance();
+}
+
+/**
+ * Starts polling the error counters
+ *
+ * Call once the bus is in op, from the ethercat thread before its loop. The counters are not
+ * cleared, what they hold already becomes the starting point.
+ */
+void bus_errors_start(void)
+{
+	memset(bus_errors_slaves, 0, sizeof(bus_errors_slaves));
+	memset(&bus_errors_stats, 0, sizeof(bus_errors_stats));
+	memset(bus_errors_window_reads, 0, sizeof(bus_errors_window_reads));
+	for (uint16 slave=1; slave<=ec_slavecount; slave++) {
+		if (ec_FPRD(ec_slave[slave].configadr, BUS_ERRORS_REG_RX, sizeof(bus_errors_last[slave]), &bus_errors_last[slave], EC_TIMEOUTRET) <= 0)
+			memset(&bus_errors_last[slave], 0, sizeof(bus_errors_last[slave]));
+	}
+
+	bus_errors_next = 1;
+	bus_errors_clear = 0;
+	bus_errors_idx = -1;
+	bus_errors_running = 1;
+}
+
+/**
+ * Stops polling the error counters
+ *
+ * Call from the ethercat thread, a datagram still out is let go.
+ */
+void bus_errors_stop(void)
+{
+	if (bus_errors_idx >= 0) {
+		ec_setbufstat(bus_errors_idx, EC_BUF_EMPTY);
+		bus_errors_idx = -1;
+	}
+	bus_errors_running = 0;
+}
@@ -0,0 +1,70 @@
+/* bus_errors.h
+ * this file defines the polling of every slave's error counters
+ * the ethercat thread reads the RX error, forwarded error and lost link counters of one slave in
+ * every slow slot, in a datagram of its own, and keeps per port totals and rates with an alarm when
+ * a port's errors are high or keep rising
+ * the same frame reads the slave's DL status, which the supervisor checks the redundant ring with
+ * SOEM only
+ */
+
+#ifndef __BUS_ERRORS_H__
+#define __BUS_ERRORS_H__
+
+#include <stdint.h>
+
+#include "ethercattype.h"
+#include "ethercatmain.h"
+
+#define BUS_ERRORS_PORTS 4
+/* the counters saturate at 255, they are cleared once any gets this high */
+#define BUS_ERRORS_CLEAR_AT 0x80
+/* a port's rate is the number of errors over this many reads of its slave */
+#define BUS_ERRORS_WINDOW_READS 100
+/* alarm when a window has this many errors ... */
+#define BUS_ERRORS_ALARM_RATE 10
+/* ... or the rate has gone up this many windows in a row */
+#define BUS_ERRORS_ALARM_RISING 3
+
+/* error counter registers */
+#define BUS_ERRORS_REG_RX 0x0300
+#define BUS_ERRORS_REG_LOST_LINK 0x0310
+
+struct bus_errors_port_t {
+	uint32_t invalid_frames;
+	uint32_t rx_errors;
+	uint32_t forwarded_errors; /* errors already seen by a slave further up */
+	uint32_t lost_links;
+	uint32_t window; /* errors so far in the current window */
+	uint32_t rate; /* errors in the last complete window */
+	uint32_t rising; /* windows in a row the rate went up */
+	int alarm;
+};
+
+struct bus_errors_slave_t {
+	struct bus_errors_port_t ports[BUS_ERRORS_PORTS];
+	uint32_t processing_errors;
+	uint32_t reads;
+	uint32_t read_failures;
+	uint32_t clears;
+	/* DL status, read in every slot of the slave, clears included (see supervisor_check_ring()) */
+	uint16_t dl_status;
+	uint32_t dl_status_reads;
+};
+
+struct bus_errors_stats_t {
+	uint32_t passes; /* times every slave has been read */
+	uint32_t slots; /* datagrams sent */
+	uint32_t late; /* datagrams not back by the end of their slot */
+	uint32_t errors; /* invalid frames, RX errors and lost links on every port */
+	uint32_t alarms; /* ports in alarm */
+};
+
+extern struct bus_errors_slave_t bus_errors_slaves[EC_MAXSLAVE];
+extern struct bus_errors_stats_t bus_errors_stats;
+
+void bus_errors_start(void);
+void bus_errors_stop(void);
+void bus_errors_send(void);
+void bus_errors_receive(int timeout);
+
+#endif /* __BUS_ERRORS_H__ */
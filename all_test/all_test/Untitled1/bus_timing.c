@@ -0,0 +1,279 @@
+/** \file
+ * \brief Bus timing analyser
+ *
+ * Answers how short the cycle time can be made on a given cell, instead of finding out by trial
+ * and error. Three things are put side by side:
+ * - the time the process data frames spend on the wire, worked out from the groups' sizes and the
+ *   propagation delay of every slave, which ec_configdc() measures from the DC port receive times
+ * - the time a cycle really takes, measured by running the normal cycle (ethercat_cycle()) at a
+ *   fixed period: the frame's round trip through the stack and the NIC, cycle_update() and the
+ *   slow group's frame where there is one
+ * - working counter errors and cycles that were not done before the next one was due
+ * The shortest safe cycle time is the longest cycle seen with BUS_TIMING_HEADROOM_PERCENT added.
+ * bus_timing_sweep() tries shorter and shorter cycle times until errors or overruns show up.
+ *
+ * Run by soem_main -a in place of the normal loop, so printing and sorting here cost nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ethercattype.h"
+#include "nicdrv.h"
+#include "ethercatbase.h"
+#include "ethercatmain.h"
+#include "ethercatdc.h"
+
+#include "bus_timing.h"
+#include "pd_groups.h"
+#include "wago_steppers.h"
+
+/* the DC datagram SOEM puts in the first frame of a group with DC slaves */
+#define BUS_TIMING_DC_DATAGRAM (BUS_TIMING_DATAGRAM_OVERHEAD + 8)
+
+static int64_t round_trips[BUS_TIMING_MAX_CYCLES];
+static int64_t busy[BUS_TIMING_MAX_CYCLES];
+
+/**
+ * Reads the monotonic clock, the one the samples are taken with
+ *
+ * @return the monotonic clock in nanoseconds
+ */
+static int64_t bus_timing_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Works out how many bytes a frame takes on the wire
+ *
+ * @param[in]	datagrams The datagrams in the frame, headers and working counters included
+ * @return the bytes, preamble and inter frame gap included
+ */
+static int bus_timing_frame_bytes(int datagrams)
+{
+	int payload = BUS_TIMING_ECAT_HEADER + datagrams;
+
+	if (payload < BUS_TIMING_MIN_PAYLOAD)
+		payload = BUS_TIMING_MIN_PAYLOAD;
+	return BUS_TIMING_FRAME_OVERHEAD + BUS_TIMING_ETH_HEADER + payload;
+}
+
+/**
+ * Works out how long a group's frames take to send
+ *
+ * SOEM sends one LRW per segment of the group's I/O map, or a LRD and a LWR when a slave in the
+ * group cannot do LRW.
+ * @param[in]	group The group
+ * @param[out]	frames If not NULL, set to the number of frames
+ * @return the time to put the frames on the wire in nanoseconds, 0 for a group with no slaves
+ */
+int64_t bus_timing_wire_ns(int group, int *frames)
+{
+	ec_groupt *g = &ec_group[group];
+	int dc = g->hasdc ? BUS_TIMING_DC_DATAGRAM : 0;
+	int64_t bytes = 0;
+	int n = 0;
+
+	if (pd_groups[group].slaves > 0) {
+		if (g->blockLRW) {
+			bytes += bus_timing_frame_bytes(BUS_TIMING_DATAGRAM_OVERHEAD + g->Ibytes + dc);
+			bytes += bus_timing_frame_bytes(BUS_TIMING_DATAGRAM_OVERHEAD + g->Obytes);
+			n = 2;
+		} else {
+			for (int i=0; i<g->nsegments; i++) {
+				bytes += bus_timing_frame_bytes(BUS_TIMING_DATAGRAM_OVERHEAD + g->IOsegment[i] + (i == 0 ? dc : 0));
+				n++;
+			}
+		}
+	}
+
+	if (frames)
+		*frames = n;
+	return bytes * BUS_TIMING_NS_PER_BYTE;
+}
+
+/**
+ * Works out how long the leading edge of a frame takes to go round every slave and back
+ *
+ * @return twice the propagation delay to the furthest slave in nanoseconds, 0 if there are no DC slaves to measure it with
+ */
+int64_t bus_timing_loop_ns(void)
+{
+	int32 pdelay = 0;
+
+	for (int i=1; i<=ec_slavecount; i++) {
+		if (ec_slave[i].hasdc && ec_slave[i].pdelay > pdelay)
+			pdelay = ec_slave[i].pdelay;
+	}
+	return 2 * (int64_t) pdelay;
+}
+
+/**
+ * Prints the topology with the propagation delays
+ *
+ * The delays are the ones ec_configdc() measured when the distributed clocks were set up at
+ * startup (ax5000_soe_sync()). It is only called here when that did not happen, it latches the DC
+ * port receive times and rewrites every slave's system time offset and delay, which must not be
+ * done to drives already running on SYNC0.
+ * @param[in]	dc_configured Nonzero if ec_configdc() has already been called
+ */
+void bus_timing_topology(int dc_configured)
+{
+	if (!dc_configured && !ec_configdc())
+		printf("No slaves with distributed clocks, propagation delays are unknown\n");
+
+	printf("slave name                 group parent ports  dc   delay(ns)  out  in\n");
+	for (int i=1; i<=ec_slavecount; i++) {
+		printf("%5d %-20.20s %5d %6d %5x %3s %11d %4d %3d\n",
+			i, ec_slave[i].name, ec_slave[i].group, ec_slave[i].parent, ec_slave[i].activeports,
+			ec_slave[i].hasdc ? "yes" : "no", ec_slave[i].hasdc ? ec_slave[i].pdelay : 0,
+			ec_slave[i].Obytes, ec_slave[i].Ibytes
+		);
+	}
+}
+
+/**
+ * Sorts nanoseconds
+ */
+static int bus_timing_compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a;
+	int64_t y = *(const int64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Runs the bus at a fixed period and measures every cycle
+ *
+ * The ethercat thread's normal loop must not be running.
+ * @param[in]	period_ns The cycle time
+ * @param[in]	cycles How many cycles to run, at most BUS_TIMING_MAX_CYCLES
+ * @param[in]	cycle Does one cycle
+ * @param[out]	result What was measured
+ * @return BUS_TIMING_ERR_SUCCESS on success, BUS_TIMING_ERR_CYCLES if cycles is 0 or too large
+ */
+int bus_timing_measure(int64_t period_ns, uint32_t cycles, bus_timing_cycle_t cycle, struct bus_timing_result_t *result)
+{
+	struct bus_timing_sample_t sample;
+	struct timespec next;
+	int64_t next_ns;
+	int64_t sum = 0;
+
+	if (cycles == 0 || cycles > BUS_TIMING_MAX_CYCLES)
+		return BUS_TIMING_ERR_CYCLES;
+
+	memset(result, 0, sizeof(*result));
+	result->period_ns = period_ns;
+	result->cycles = cycles;
+	result->round_trip_ns_min = INT64_MAX;
+
+	next_ns = bus_timing_now() + period_ns;
+	for (uint32_t i=0; i<cycles; i++) {
+		next.tv_sec = next_ns / 1000000000;
+		next.tv_nsec = next_ns % 1000000000;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		IO_LOCK;
+		cycle(&sample);
+		IO_UNLOCK;
+
+		round_trips[i] = sample.receive_ns - sample.send_ns;
+		busy[i] = sample.done_ns - sample.send_ns;
+		sum += round_trips[i];
+		if (round_trips[i] < result->round_trip_ns_min)
+			result->round_trip_ns_min = round_trips[i];
+		if (round_trips[i] > result->round_trip_ns_max)
+			result->round_trip_ns_max = round_trips[i];
+		if (busy[i] > result->busy_ns_max)
+			result->busy_ns_max = busy[i];
+		if (sample.compute_ns > result->compute_ns_max)
+			result->compute_ns_max = sample.compute_ns;
+		if (!sample.wkc_ok)
+			result->wkc_errors++;
+
+		next_ns += period_ns;
+		if (sample.done_ns > next_ns) {
+			result->overruns++;
+			/* start again from now rather than running the missed cycles back to back */
+			next_ns = sample.done_ns;
+		}
+	}
+
+	result->round_trip_ns_avg = sum / cycles;
+	qsort(round_trips, cycles, sizeof(round_trips[0]), bus_timing_compare);
+	qsort(busy, cycles, sizeof(busy[0]), bus_timing_compare);
+	result->round_trip_ns_p99 = round_trips[(cycles * 99) / 100];
+	result->busy_ns_p99 = busy[(cycles * 99) / 100];
+
+	return BUS_TIMING_ERR_SUCCESS;
+}
+
+/**
+ * Prints where the time of a cycle goes and the cycle time the bus can be run at
+ *
+ * @param[in]	result A measurement from bus_timing_measure()
+ * @param[in]	slow_divider The slow group is exchanged every this many cycles
+ */
+void bus_timing_report(const struct bus_timing_result_t *result, uint32_t slow_divider)
+{
+	int fast_frames;
+	int slow_frames;
+	int64_t fast_wire_ns = bus_timing_wire_ns(PD_GROUP_FAST, &fast_frames);
+	int64_t slow_wire_ns = bus_timing_wire_ns(PD_GROUP_SLOW, &slow_frames);
+	int64_t loop_ns = bus_timing_loop_ns();
+	int64_t wire_per_cycle_ns = fast_wire_ns + slow_wire_ns / slow_divider;
+	int64_t min_ns = result->busy_ns_max;
+	int64_t safe_ns = min_ns + (min_ns * BUS_TIMING_HEADROOM_PERCENT) / 100;
+
+	printf("Bus timing over %u cycles of %lld ns\n", result->cycles, (long long) result->period_ns);
+	printf("  fast group: %d frames, %lld ns on the wire\n", fast_frames, (long long) fast_wire_ns);
+	if (slow_frames > 0)
+		printf("  slow group: %d frames every %u cycles, %lld ns on the wire\n", slow_frames, slow_divider, (long long) slow_wire_ns);
+	printf("  round trip through every slave: %lld ns\n", (long long) loop_ns);
+	printf("  fast frame round trip: min %lld avg %lld p99 %lld max %lld ns\n",
+		(long long) result->round_trip_ns_min, (long long) result->round_trip_ns_avg,
+		(long long) result->round_trip_ns_p99, (long long) result->round_trip_ns_max);
+	printf("  of which the stack and the NIC: at least %lld ns\n",
+		(long long) (result->round_trip_ns_min - fast_wire_ns - loop_ns));
+	printf("  cycle_update(): max %lld ns\n", (long long) result->compute_ns_max);
+	printf("  whole cycle: p99 %lld max %lld ns\n", (long long) result->busy_ns_p99, (long long) result->busy_ns_max);
+	printf("  bus utilisation: %lld.%lld%%\n",
+		(long long) (wire_per_cycle_ns * 100 / result->period_ns),
+		(long long) ((wire_per_cycle_ns * 1000 / result->period_ns) % 10));
+	printf("  %u working counter errors, %u overruns\n", result->wkc_errors, result->overruns);
+	printf("  minimum cycle time %lld ns, with %d%% headroom %lld ns\n",
+		(long long) min_ns, BUS_TIMING_HEADROOM_PERCENT, (long long) safe_ns);
+}
+
+/**
+ * Shortens the cycle time until the bus cannot keep up
+ *
+ * Each step runs BUS_TIMING_SWEEP_CYCLES cycles and fails on any working counter error or overrun.
+ * @param[in]	start_ns The cycle time to start from
+ * @param[in]	cycle Does one cycle
+ * @return the shortest cycle time that ran without errors, 0 if even start_ns did not
+ */
+int64_t bus_timing_sweep(int64_t start_ns, bus_timing_cycle_t cycle)
+{
+	struct bus_timing_result_t result;
+	int64_t period_ns = start_ns;
+	int64_t clean_ns = 0;
+
+	printf("Sweeping the cycle time down from %lld ns\n", (long long) start_ns);
+	while (period_ns >= BUS_TIMING_SWEEP_MIN_NS) {
+		bus_timing_measure(period_ns, BUS_TIMING_SWEEP_CYCLES, cycle, &result);
+		printf("  %lld ns: %u working counter errors, %u overruns, longest cycle %lld ns\n",
+			(long long) period_ns, result.wkc_errors, result.overruns, (long long) result.busy_ns_max);
+		if (result.wkc_errors > 0 || result.overruns > 0)
+			break;
+		clean_ns = period_ns;
+		period_ns -= (period_ns * BUS_TIMING_SWEEP_STEP_PERCENT) / 100;
+	}
+
+	return clean_ns;
+}
@@ -0,0 +1,72 @@
+/* bus_timing.h
+ * this file defines the bus timing analyser
+ * it works out from the topology and the process data how long the frames spend on the wire,
+ * measures how long a cycle really takes and reports the shortest cycle time the bus can be run
+ * at, optionally by sweeping the cycle time down until frames or cycles are missed
+ * SOEM only
+ */
+
+#ifndef __BUS_TIMING_H__
+#define __BUS_TIMING_H__
+
+#include <stdint.h>
+
+#include "ethercattype.h"
+#include "ethercatmain.h"
+
+/* 100Mbit/s, 10ns a bit */
+#define BUS_TIMING_NS_PER_BYTE 80
+/* preamble, start of frame, FCS and the gap before the next frame */
+#define BUS_TIMING_FRAME_OVERHEAD (8 + 4 + 12)
+#define BUS_TIMING_ETH_HEADER 14
+#define BUS_TIMING_ECAT_HEADER 2
+/* datagram header and working counter */
+#define BUS_TIMING_DATAGRAM_OVERHEAD (10 + 2)
+#define BUS_TIMING_MIN_PAYLOAD 46
+
+#define BUS_TIMING_MAX_CYCLES 20000
+/* added to the longest cycle seen for the recommended cycle time */
+#define BUS_TIMING_HEADROOM_PERCENT 25
+/* the sweep shortens the cycle time by this much at each step */
+#define BUS_TIMING_SWEEP_STEP_PERCENT 10
+#define BUS_TIMING_SWEEP_CYCLES 5000
+#define BUS_TIMING_SWEEP_MIN_NS 10000
+
+#define BUS_TIMING_ERR_SUCCESS 0
+#define BUS_TIMING_ERR_CYCLES -1
+
+/* one cycle as seen by the ethercat thread */
+struct bus_timing_sample_t {
+	int64_t send_ns; /* the fast frame was handed to send() */
+	int64_t receive_ns; /* the fast frame was back */
+	int64_t compute_ns; /* time spent in cycle_update() */
+	int64_t done_ns; /* everything was done, the slow frame included */
+	int wkc_ok; /* every frame sent came back with the expected working counter */
+};
+
+/* does one cycle with the io lock held, see ethercat_cycle() */
+typedef void (*bus_timing_cycle_t)(struct bus_timing_sample_t *sample);
+
+struct bus_timing_result_t {
+	int64_t period_ns;
+	uint32_t cycles;
+	int64_t round_trip_ns_min;
+	int64_t round_trip_ns_avg;
+	int64_t round_trip_ns_p99;
+	int64_t round_trip_ns_max;
+	int64_t compute_ns_max;
+	int64_t busy_ns_p99; /* from sending the fast frame to the end of the cycle */
+	int64_t busy_ns_max;
+	uint32_t wkc_errors;
+	uint32_t overruns; /* cycles not done before the next one was due */
+};
+
+int64_t bus_timing_wire_ns(int group, int *frames);
+int64_t bus_timing_loop_ns(void);
+void bus_timing_topology(int dc_configured);
+
+int bus_timing_measure(int64_t period_ns, uint32_t cycles, bus_timing_cycle_t cycle, struct bus_timing_result_t *result);
+void bus_timing_report(const struct bus_timing_result_t *result, uint32_t slow_divider);
+int64_t bus_timing_sweep(int64_t start_ns, bus_timing_cycle_t cycle);
+
+#endif /* __BUS_TIMING_H__ */
@@ -0,0 +1,207 @@
+/** \file
+ * \brief Tracking of the conveyor the parts arrive on
+ *
+ * conveyor_update() runs every cycle. It extends the EL5101's 32 bit count so it never wraps,
+ * stamps it with the time the frame carrying it arrived (conveyor_mark_receive(), the nominal
+ * cycle time on from the last stamp where the platform code has none) and measures the belt
+ * speed over the last CONVEYOR_WINDOW cycles. The terminal latches the count on the photo eye's
+ * rising edge, each latch registers a part at the exact count it passed the eye at, the latch is
+ * acknowledged and re-armed by clearing and setting its enable bit.
+ *
+ * Everything in the cycle is integer. Planning reads a consistent copy with conveyor_state() from
+ * any thread and predicts the count at a later time with conveyor_predict(), the belt is taken to
+ * keep its speed.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include <string.h>
+
+#include "conveyor.h"
+#include "cycle.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CONVEYOR_BARRIER() _ReadWriteBarrier()
+#else
+#define CONVEYOR_BARRIER() __sync_synchronize()
+#endif /* _MSC_VER */
+
+struct conveyor_inputs_t *conveyor_inputs = NULL;
+struct conveyor_outputs_t *conveyor_outputs = NULL;
+uint32_t conveyor_cycle_ns = 100000;
+struct conveyor_stats_t conveyor_stats;
+
+/* the last CONVEYOR_WINDOW counts and when they were read */
+static int64_t window_count[CONVEYOR_WINDOW];
+static int64_t window_ns[CONVEYOR_WINDOW];
+static uint32_t window_next = 0;
+static uint32_t window_filled = 0;
+
+static int64_t receive_ns;
+static int marked = 0;
+static int64_t last_ns;
+static int32_t last_counter;
+static int64_t count;
+static int started = 0;
+static int latch_armed = 0;
+
+/* odd while the cycle is writing state */
+static volatile uint32_t sequence = 0;
+static struct conveyor_state_t state;
+
+static struct conveyor_part_t parts[CONVEYOR_MAX_PARTS];
+/* next part to register, written by the cycle */
+static volatile uint32_t parts_head = 0;
+/* next part to hand out, written by conveyor_next_part() */
+static volatile uint32_t parts_tail = 0;
+
+/**
+ * Records when the current frame's inputs arrived
+ *
+ * Called by the platform code straight after receiving the frame carrying the encoder.
+ * @param[in]	timestamp_ns Time the frame was received
+ */
+void conveyor_mark_receive(int64_t timestamp_ns)
+{
+	receive_ns = timestamp_ns;
+	marked = 1;
+}
+
+/**
+ * Copies out where the belt was at the last cycle
+ *
+ * Never blocks the cycle, may be called from any thread.
+ * @param[out]	copy Where the belt was
+ * @return CONVEYOR_ERR_SUCCESS on success, CONVEYOR_ERR_NO_ENCODER if there is no speed yet
+ */
+int conveyor_state(struct conveyor_state_t *copy)
+{
+	uint32_t before;
+
+	do {
+		before = sequence;
+		CONVEYOR_BARRIER();
+		memcpy(copy, &state, sizeof(*copy));
+		CONVEYOR_BARRIER();
+	} while ((before & 1) || before != sequence);
+
+	return copy->valid ? CONVEYOR_ERR_SUCCESS : CONVEYOR_ERR_NO_ENCODER;
+}
+
+/**
+ * Takes the next part registered by the photo eye
+ *
+ * Only call from one thread.
+ * @param[out]	part The part
+ * @return CONVEYOR_ERR_SUCCESS on success, CONVEYOR_ERR_EMPTY if no part is waiting
+ */
+int conveyor_next_part(struct conveyor_part_t *part)
+{
+	if (parts_tail == parts_head)
+		return CONVEYOR_ERR_EMPTY;
+	CONVEYOR_BARRIER();
+	*part = parts[parts_tail % CONVEYOR_MAX_PARTS];
+	CONVEYOR_BARRIER();
+	parts_tail++;
+	return CONVEYOR_ERR_SUCCESS;
+}
+
+/**
+ * Predicts the count at a time, assuming the belt keeps its speed
+ *
+ * @param[in]	from Where the belt was, from conveyor_state()
+ * @param[in]	timestamp_ns The time, same clock as the frame timestamps
+ * @return the count
+ */
+int64_t conveyor_predict(const struct conveyor_state_t *from, int64_t timestamp_ns)
+{
+	return from->count + from->velocity * (timestamp_ns - from->timestamp_ns) / 1000000000000LL;
+}
+
+/**
+ * Registers the part the terminal latched, and re-arms the latch
+ */
+static void conveyor_latch(void)
+{
+	struct conveyor_part_t *part;
+
+	if (conveyor_outputs == NULL)
+		return;
+
+	if (!(conveyor_inputs->status & CONVEYOR_STATUS_LATCH_EXTERN_VALID)) {
+		conveyor_outputs->control |= CONVEYOR_CONTROL_ENABLE_LATCH_EXTERN;
+		latch_armed = 1;
+		return;
+	}
+	/* the terminal holds the latch until the enable bit is cleared */
+	conveyor_outputs->control &= ~CONVEYOR_CONTROL_ENABLE_LATCH_EXTERN;
+	if (!latch_armed)
+		return;
+	latch_armed = 0;
+
+	conveyor_stats.parts++;
+	if (parts_head - parts_tail >= CONVEYOR_MAX_PARTS) {
+		conveyor_stats.dropped++;
+		return;
+	}
+	part = &parts[parts_head % CONVEYOR_MAX_PARTS];
+	part->id = conveyor_stats.parts;
+	/* relative to the counter read in the same frame, so it is extended the same way */
+	part->count = count + (int32_t) ((uint32_t) conveyor_inputs->latch - (uint32_t) conveyor_inputs->counter);
+	part->cycle = cycle_count;
+	CONVEYOR_BARRIER();
+	parts_head++;
+}
+
+/**
+ * Cyclic update of the belt position and speed
+ *
+ * Must be called once per cycle after the inputs are received, the caller must hold the io lock.
+ */
+void conveyor_update(void)
+{
+	int64_t now_ns;
+	uint32_t oldest;
+
+	if (conveyor_inputs == NULL)
+		return;
+
+	if (!started) {
+		last_counter = conveyor_inputs->counter;
+		last_ns = receive_ns - conveyor_cycle_ns;
+		started = 1;
+	}
+	count += (int32_t) ((uint32_t) conveyor_inputs->counter - (uint32_t) last_counter);
+	last_counter = conveyor_inputs->counter;
+
+	if (marked) {
+		now_ns = receive_ns;
+		marked = 0;
+	} else {
+		now_ns = last_ns + conveyor_cycle_ns;
+		conveyor_stats.missing_cycles++;
+	}
+	last_ns = now_ns;
+
+	window_count[window_next % CONVEYOR_WINDOW] = count;
+	window_ns[window_next % CONVEYOR_WINDOW] = now_ns;
+	window_next++;
+	if (window_filled < CONVEYOR_WINDOW)
+		window_filled++;
+	oldest = window_next % CONVEYOR_WINDOW;
+
+	sequence++;
+	CONVEYOR_BARRIER();
+	state.cycle = cycle_count;
+	state.count = count;
+	state.timestamp_ns = now_ns;
+	if (window_filled == CONVEYOR_WINDOW && now_ns > window_ns[oldest]) {
+		state.velocity = (count - window_count[oldest]) * 1000000000000LL / (now_ns - window_ns[oldest]);
+		state.valid = 1;
+	}
+	CONVEYOR_BARRIER();
+	sequence++;
+
+	conveyor_latch();
+}
@@ -0,0 +1,93 @@
+/* conveyor.h
+ * this file defines the tracking of the conveyor the parts arrive on
+ * the belt's encoder is read through an incremental encoder terminal (EL5101), every cycle its
+ * count is extended, timestamped and turned into a belt speed, and a photo eye on the terminal's
+ * latch input registers the count each part passed it at
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __CONVEYOR_H__
+#define __CONVEYOR_H__
+
+#include "wago_steppers.h"
+
+/* cycles the speed is measured over, must be a power of two */
+#define CONVEYOR_WINDOW 256
+/* parts registered and not taken yet, must be a power of two */
+#define CONVEYOR_MAX_PARTS 32
+
+/* EL5101 status (0x6000) and control (0x7000) bits
+ * FIXME: check the terminal is set up for the 32 bit counter PDOs (0x1A02 inputs, 0x1602 outputs)
+ * and the photo eye is wired to the latch input against Documentation/ElectricalConfiguration */
+#define CONVEYOR_STATUS_LATCH_C_VALID 0x0001
+#define CONVEYOR_STATUS_LATCH_EXTERN_VALID 0x0002
+#define CONVEYOR_CONTROL_ENABLE_LATCH_EXTERN 0x0002 /* positive edge */
+
+#define CONVEYOR_ERR_SUCCESS 0
+#define CONVEYOR_ERR_EMPTY -1
+#define CONVEYOR_ERR_NO_ENCODER -2
+
+#ifdef _MSC_VER
+__pragma( pack(push, 1) )
+struct conveyor_inputs_t {
+#else
+struct __attribute__((__packed__)) conveyor_inputs_t {
+#endif /* _MSC_VER */
+	uint16_t status;
+	int32_t counter;
+	int32_t latch;
+};
+
+#ifdef _MSC_VER
+struct conveyor_outputs_t {
+#else
+struct __attribute__((__packed__)) conveyor_outputs_t {
+#endif /* _MSC_VER */
+	uint16_t control;
+	int32_t set_counter;
+};
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+__pragma( pack(pop) )
+#endif /* _MSC_VER */
+
+/* where the belt was at a cycle, counts are extended past the terminal's 32 bits */
+struct conveyor_state_t {
+	uint32_t cycle; /* cycle_count of the cycle the count was read in */
+	int64_t count;
+	int64_t timestamp_ns; /* when the frame carrying the count arrived */
+	int64_t velocity; /* counts per 1000 s, over the last CONVEYOR_WINDOW cycles */
+	int valid; /* 0 until there is a full window */
+};
+
+/* a part that passed the photo eye */
+struct conveyor_part_t {
+	uint32_t id;
+	int64_t count; /* count the belt was at as it passed */
+	uint32_t cycle; /* cycle it was seen in */
+};
+
+struct conveyor_stats_t {
+	uint32_t parts; /* registered by the photo eye */
+	uint32_t dropped; /* registered while CONVEYOR_MAX_PARTS were waiting */
+	uint32_t missing_cycles; /* cycles without a timestamp, the cycle time was assumed */
+};
+
+/* point at the EL5101's process data, set up by the platform code, NULL for none */
+extern struct conveyor_inputs_t *conveyor_inputs;
+extern struct conveyor_outputs_t *conveyor_outputs;
+/* nominal cycle time, used where the platform code does not timestamp the frames */
+extern uint32_t conveyor_cycle_ns;
+extern struct conveyor_stats_t conveyor_stats;
+
+void conveyor_mark_receive(int64_t timestamp_ns);
+int conveyor_state(struct conveyor_state_t *state);
+int conveyor_next_part(struct conveyor_part_t *part);
+int64_t conveyor_predict(const struct conveyor_state_t *state, int64_t timestamp_ns);
+
+void conveyor_update(void);
+
+#endif /* __CONVEYOR_H__ */
@@ -0,0 +1,79 @@
+/** \file
+ * \brief Work done once per bus cycle
+ *
+ * Anything that has to react to the inputs within the same cycle lives here rather than in the
+ * state machine. The state machine runs much slower than the bus (every 500ms under SOEM) and
+ * should only queue work for this function, sequences that wait on the machine are motion
+ * scripts (script.h) resumed from here.
+ * Under SOEM this is called from ethercat_thread() with io_mutex held, under TwinCAT3 it is
+ * called from CModule1::CycleUpdate(). Nothing in here may block or print, use log_write().
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#ifdef TC_VER /* If a twincat 3 version is defined */
+#include "stdint.h"
+#include "support.h" /* state_machine.h needs CTcTrace */
+#else /* SOEM Includes */
+#include <stdint.h>
+#endif
+
+#include "cycle.h"
+#include "state_machine.h"
+#include "wago_steppers.h"
+#include "wago_move_queue.h"
+#include "wago_mailbox.h"
+#include "wago_velocity.h"
+#include "homing.h"
+#include "safety.h"
+#include "output_events.h"
+#include "ax5000.h"
+#include "following.h"
+#include "conveyor.h"
+#include "script.h"
+
+uint32_t cycle_count = 0;
+int64_t (*cycle_clock_ns)(void) = NULL;
+int cycle_slow_io = 1;
+
+/**
+ * Cyclic update
+ *
+ * Must be called once per cycle after the inputs are received and before the outputs are sent.
+ * The caller must hold the io lock.
+ * The steppers only run on cycles where their I/O is exchanged, otherwise they would see the same
+ * inputs several times and count their timeouts in the wrong cycles. The safety reaction runs every
+ * cycle, the scanner inputs are exchanged every cycle.
+ */
+void cycle_update(void)
+{
+	cycle_count++;
+
+	/* safety first, a stop written here goes out with the next frame carrying the steppers */
+	safety_update(wago_steppers);
+
+	if (cycle_slow_io) {
+		for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+			homing_update(wago_steppers, i);
+			/* the mailbox goes first so a move waiting on it can load in the same cycle */
+			wago_mbx_update(wago_steppers, i);
+			wago_queue_update(wago_steppers, i);
+			wago_velocity_update(wago_steppers, i);
+		}
+	}
+
+	/* the belt is tracked every cycle, picks on the move are timed against it */
+	conveyor_update();
+
+	/* the servos are in the fast group, they take a setpoint every cycle */
+	for (int i=0; i<AX5000_NUM_AXES; i++) {
+		ax5000_update(i);
+		following_update(i);
+	}
+
+	/* the scripts see this cycle's state, a move they queue is loaded next cycle */
+	script_update();
+
+	/* after the motion so events tied to a move starting this cycle are applied this cycle */
+	output_events_update();
+}
@@ -0,0 +1,30 @@
+/* cycle.h
+ * this file defines the work done once per bus cycle, between receiving the inputs and
+ * sending the outputs
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __CYCLE_H__
+#define __CYCLE_H__
+
+#ifdef TC_VER /* If a twincat 3 version is defined */
+#include "stdint.h"
+#else
+#include <stdint.h>
+#endif
+
+/* number of times cycle_update() has run */
+extern uint32_t cycle_count;
+/* monotonic clock in nanoseconds provided by the platform code, NULL if there is none */
+extern int64_t (*cycle_clock_ns)(void);
+/* 1 on cycles where the slow I/O (the WAGO coupler with the steppers) is exchanged, the platform
+ * code clears it on the cycles in between when the slow I/O has a lower rate than the bus */
+extern int cycle_slow_io;
+
+void cycle_update(void);
+
+#endif /* __CYCLE_H__ */
@@ -0,0 +1,296 @@
+/** \file
+ * \brief Kinematics and joint limits of the delta robot
+ *
+ * The base frame has its origin in the plane of the motor axes on the robot's centre line, z up, so
+ * the whole workspace has a negative z. Arm i sits at 120 * i degrees from the x axis, its joint
+ * angle is 0 with the upper arm horizontal and grows as the arm swings down.
+ *
+ * Each arm closes a loop: the lower arm of length lower_arm joins the elbow to the effector, so
+ *	|p + (effector_radius - base_radius) d - upper_arm (cos q d - sin q z)| = lower_arm
+ * with d the arm's radial direction. Solving that for q gives the inverse kinematics, intersecting
+ * the three spheres around the elbows gives the forward kinematics. Differentiating it gives
+ * dq/dp one row per arm, its inverse is the Jacobian dp/dq.
+ *
+ * The Jacobian is what makes the limits depend on the pose. Through it each joint carries a
+ * different share of the effector's mass and holds a different part of its weight, so the
+ * acceleration left over from the gearbox output torque changes across the workspace. The velocity
+ * limit is the motor's speed through the gearbox.
+ */
+
+#include <stddef.h>
+#include <math.h>
+
+#include "delta.h"
+
+/**
+ * Fills in the default robot
+ *
+ * @param[out]	robot The robot
+ */
+void delta_defaults(struct delta_robot_t *robot)
+{
+	robot->geometry.base_radius = DELTA_DEFAULT_BASE_RADIUS;
+	robot->geometry.effector_radius = DELTA_DEFAULT_EFFECTOR_RADIUS;
+	robot->geometry.upper_arm = DELTA_DEFAULT_UPPER_ARM;
+	robot->geometry.lower_arm = DELTA_DEFAULT_LOWER_ARM;
+
+	robot->drive.motor_speed_rpm = DELTA_DEFAULT_MOTOR_SPEED_RPM;
+	robot->drive.motor_peak_torque = DELTA_DEFAULT_MOTOR_PEAK_TORQUE;
+	robot->drive.motor_inertia = DELTA_DEFAULT_MOTOR_INERTIA;
+	robot->drive.gear_ratio = DELTA_DEFAULT_GEAR_RATIO;
+	robot->drive.gear_efficiency = DELTA_DEFAULT_GEAR_EFFICIENCY;
+	robot->drive.gear_peak_torque = DELTA_DEFAULT_GEAR_PEAK_TORQUE;
+	robot->drive.arm_inertia = DELTA_DEFAULT_ARM_INERTIA;
+	robot->drive.counts_per_rev = DELTA_DEFAULT_COUNTS_PER_REV;
+	robot->drive.zero_angle = 0.0;
+
+	robot->payload = 0.0;
+	robot->effector_mass = DELTA_DEFAULT_EFFECTOR_MASS;
+	robot->fixed_limits = NULL;
+}
+
+/**
+ * Works out an arm's radial direction
+ *
+ * @param[in]	arm The arm
+ * @param[out]	d Unit vector from the centre towards the arm's motor, in the xy plane
+ */
+static void delta_direction(int arm, double d[3])
+{
+	double angle = arm * 2.0 * M_PI / DELTA_NUM_JOINTS;
+
+	d[0] = cos(angle);
+	d[1] = sin(angle);
+	d[2] = 0.0;
+}
+
+/**
+ * Works out the vector from an arm's elbow to its effector joint
+ *
+ * @param[in]	robot The robot
+ * @param[in]	arm The arm
+ * @param[in]	p The effector position
+ * @param[in]	q The arm's joint angle
+ * @param[out]	s The lower arm, from the elbow to the effector
+ */
+static void delta_lower_arm(const struct delta_robot_t *robot, int arm, const double p[3], double q, double s[3])
+{
+	const struct delta_geometry_t *g = &robot->geometry;
+	double d[3];
+
+	delta_direction(arm, d);
+	for (int k=0; k<2; k++)
+		s[k] = p[k] + (g->effector_radius - g->base_radius - g->upper_arm * cos(q)) * d[k];
+	s[2] = p[2] + g->upper_arm * sin(q);
+}
+
+/**
+ * Works out the joint angles for an effector position
+ *
+ * Takes the solution with the elbows pointing out, the only one the robot can reach.
+ * @param[in]	robot The robot
+ * @param[in]	p The effector position, metres
+ * @param[out]	q The joint angles, radians
+ * @return DELTA_ERR_SUCCESS on success, DELTA_ERR_UNREACHABLE if an arm cannot reach p
+ */
+int delta_inverse(const struct delta_robot_t *robot, const double p[3], double q[DELTA_NUM_JOINTS])
+{
+	const struct delta_geometry_t *g = &robot->geometry;
+	double d[3], radial, tangential, z, k, rho, c;
+
+	for (int arm=0; arm<DELTA_NUM_JOINTS; arm++) {
+		delta_direction(arm, d);
+		/* p seen from the motor axis, split into the arm's plane and across it */
+		radial = p[0] * d[0] + p[1] * d[1] + g->effector_radius - g->base_radius;
+		tangential = -p[0] * d[1] + p[1] * d[0];
+		z = p[2];
+
+		/* radial cos q - z sin q = k / (2 upper_arm) */
+		k = radial * radial + tangential * tangential + z * z + g->upper_arm * g->upper_arm - g->lower_arm * g->lower_arm;
+		rho = sqrt(radial * radial + z * z);
+		if (rho < 1e-9)
+			return DELTA_ERR_UNREACHABLE;
+		c = k / (2.0 * g->upper_arm * rho);
+		if (c > 1.0 || c < -1.0)
+			return DELTA_ERR_UNREACHABLE;
+		q[arm] = -atan2(z, radial) - acos(c);
+		if (q[arm] > M_PI)
+			q[arm] -= 2.0 * M_PI;
+		else if (q[arm] <= -M_PI)
+			q[arm] += 2.0 * M_PI;
+	}
+	return DELTA_ERR_SUCCESS;
+}
+
+/**
+ * Works out the effector position for a set of joint angles
+ *
+ * The effector sits where the three spheres of radius lower_arm around the elbows (moved in by
+ * the effector radius) meet, below the base.
+ * @param[in]	robot The robot
+ * @param[in]	q The joint angles, radians
+ * @param[out]	p The effector position, metres
+ * @return DELTA_ERR_SUCCESS on success, DELTA_ERR_UNREACHABLE if the lower arms cannot meet
+ */
+int delta_forward(const struct delta_robot_t *robot, const double q[DELTA_NUM_JOINTS], double p[3])
+{
+	const struct delta_geometry_t *g = &robot->geometry;
+	double c[DELTA_NUM_JOINTS][3], d[3];
+	double ex[3], ey[3], ez[3], v[3];
+	double dist, i, j, x, y, z2, norm;
+
+	for (int arm=0; arm<DELTA_NUM_JOINTS; arm++) {
+		delta_direction(arm, d);
+		for (int k=0; k<2; k++)
+			c[arm][k] = (g->base_radius + g->upper_arm * cos(q[arm]) - g->effector_radius) * d[k];
+		c[arm][2] = -g->upper_arm * sin(q[arm]);
+	}
+
+	/* frame with sphere 0 at the origin, sphere 1 on ex and sphere 2 in the ex ey plane */
+	for (int k=0; k<3; k++)
+		ex[k] = c[1][k] - c[0][k];
+	dist = sqrt(ex[0] * ex[0] + ex[1] * ex[1] + ex[2] * ex[2]);
+	if (dist < 1e-9)
+		return DELTA_ERR_UNREACHABLE;
+	for (int k=0; k<3; k++) {
+		ex[k] /= dist;
+		v[k] = c[2][k] - c[0][k];
+	}
+	i = ex[0] * v[0] + ex[1] * v[1] + ex[2] * v[2];
+	for (int k=0; k<3; k++)
+		ey[k] = v[k] - i * ex[k];
+	norm = sqrt(ey[0] * ey[0] + ey[1] * ey[1] + ey[2] * ey[2]);
+	if (norm < 1e-9)
+		return DELTA_ERR_UNREACHABLE;
+	for (int k=0; k<3; k++)
+		ey[k] /= norm;
+	j = ey[0] * v[0] + ey[1] * v[1] + ey[2] * v[2];
+	ez[0] = ex[1] * ey[2] - ex[2] * ey[1];
+	ez[1] = ex[2] * ey[0] - ex[0] * ey[2];
+	ez[2] = ex[0] * ey[1] - ex[1] * ey[0];
+
+	/* all three spheres have the same radius */
+	x = dist / 2.0;
+	y = (i * i + j * j) / (2.0 * j) - i * x / j;
+	z2 = g->lower_arm * g->lower_arm - x * x - y * y;
+	if (z2 < 0.0)
+		return DELTA_ERR_UNREACHABLE;
+
+	for (int k=0; k<3; k++)
+		p[k] = c[0][k] + x * ex[k] + y * ey[k];
+	/* of the two intersections take the one below the base */
+	if (ez[2] > 0.0)
+		z2 = -sqrt(z2);
+	else
+		z2 = sqrt(z2);
+	for (int k=0; k<3; k++)
+		p[k] += z2 * ez[k];
+	return DELTA_ERR_SUCCESS;
+}
+
+/**
+ * Works out how fast each joint turns as the effector moves
+ *
+ * @param[in]	robot The robot
+ * @param[in]	p The effector position
+ * @param[in]	q The joint angles at p, from delta_inverse()
+ * @param[out]	dq_dp Row i is the gradient of joint i's angle, radians per metre
+ * @return DELTA_ERR_SUCCESS on success, DELTA_ERR_SINGULAR if an upper and lower arm are in line
+ */
+int delta_inverse_jacobian(const struct delta_robot_t *robot, const double p[3], const double q[DELTA_NUM_JOINTS], double dq_dp[DELTA_NUM_JOINTS][3])
+{
+	double s[3], d[3], along;
+
+	for (int arm=0; arm<DELTA_NUM_JOINTS; arm++) {
+		delta_lower_arm(robot, arm, p, q[arm], s);
+		delta_direction(arm, d);
+		/* how much the lower arm stretches as the joint turns */
+		along = robot->geometry.upper_arm * ((s[0] * d[0] + s[1] * d[1]) * sin(q[arm]) + s[2] * cos(q[arm]));
+		if (fabs(along) < 1e-9)
+			return DELTA_ERR_SINGULAR;
+		for (int k=0; k<3; k++)
+			dq_dp[arm][k] = -s[k] / along;
+	}
+	return DELTA_ERR_SUCCESS;
+}
+
+/**
+ * Works out what the joints can do at a pose
+ *
+ * Each joint gets the output torque of its gearbox, less what it takes to hold its share of the
+ * effector and payload against gravity, to accelerate the motor, the upper arm and its share of
+ * the moving mass. The shares come from the Jacobian.
+ * A robot with fixed_limits set gets those instead, wherever it is.
+ * @param[in]	robot The robot
+ * @param[in]	p The effector position
+ * @param[in]	q The joint angles at p, from delta_inverse()
+ * @param[out]	limits The joint velocity and acceleration limits
+ * @return DELTA_ERR_SUCCESS on success, DELTA_ERR_SINGULAR if the pose is singular
+ */
+int delta_limits(const struct delta_robot_t *robot, const double p[3], const double q[DELTA_NUM_JOINTS], struct delta_limits_t *limits)
+{
+	const struct delta_drive_t *drive = &robot->drive;
+	double m[DELTA_NUM_JOINTS][3], jacobian[3][DELTA_NUM_JOINTS];
+	double det, mass, torque, gravity, inertia;
+	int err;
+
+	err = delta_inverse_jacobian(robot, p, q, m);
+	if (err < 0)
+		return err;
+	if (robot->fixed_limits != NULL) {
+		*limits = *robot->fixed_limits;
+		return DELTA_ERR_SUCCESS;
+	}
+
+	/* dp/dq is the inverse of dq/dp, adjugate over determinant */
+	det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+		- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+		+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	if (fabs(det) < 1e-12)
+		return DELTA_ERR_SINGULAR;
+	for (int r=0; r<3; r++) {
+		for (int c=0; c<3; c++) {
+			int r1 = (c + 1) % 3, r2 = (c + 2) % 3, c1 = (r + 1) % 3, c2 = (r + 2) % 3;
+			jacobian[r][c] = (m[r1][c1] * m[r2][c2] - m[r1][c2] * m[r2][c1]) / det;
+		}
+	}
+
+	mass = robot->effector_mass + robot->payload;
+	torque = drive->motor_peak_torque * drive->gear_ratio * drive->gear_efficiency;
+	if (torque > drive->gear_peak_torque)
+		torque = drive->gear_peak_torque;
+
+	for (int i=0; i<DELTA_NUM_JOINTS; i++) {
+		limits->velocity[i] = drive->motor_speed_rpm * 2.0 * M_PI / 60.0 / drive->gear_ratio;
+
+		gravity = fabs(mass * DELTA_GRAVITY * jacobian[2][i]);
+		inertia = drive->motor_inertia * drive->gear_ratio * drive->gear_ratio + drive->arm_inertia
+			+ mass * (jacobian[0][i] * jacobian[0][i] + jacobian[1][i] * jacobian[1][i] + jacobian[2][i] * jacobian[2][i]);
+		limits->acceleration[i] = (torque > gravity) ? (torque - gravity) / inertia : 0.0;
+	}
+	return DELTA_ERR_SUCCESS;
+}
+
+/**
+ * Converts a joint angle to drive position units
+ *
+ * @param[in]	robot The robot
+ * @param[in]	q The joint angle, radians
+ * @return the position, drive position units
+ */
+int32_t delta_counts(const struct delta_robot_t *robot, double q)
+{
+	return (int32_t) lround((q - robot->drive.zero_angle) / (2.0 * M_PI) * robot->drive.gear_ratio * robot->drive.counts_per_rev);
+}
+
+/**
+ * Converts drive position units to a joint angle
+ *
+ * @param[in]	robot The robot
+ * @param[in]	counts The position, drive position units
+ * @return the joint angle, radians
+ */
+double delta_angle(const struct delta_robot_t *robot, int32_t counts)
+{
+	return robot->drive.zero_angle + counts / (robot->drive.gear_ratio * robot->drive.counts_per_rev) * 2.0 * M_PI;
+}
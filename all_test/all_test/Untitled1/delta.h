@@ -0,0 +1,83 @@
+/* delta.h
+ * this file defines the kinematics of the delta robot and the limits of its joints
+ * inverse and forward kinematics, the Jacobian, and the joint velocity and acceleration limits
+ * the motors and gearboxes allow at a given pose (the payload seen by each joint changes across
+ * the workspace)
+ * SOEM only
+ */
+
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include <stdint.h>
+
+#define DELTA_NUM_JOINTS 3
+#define DELTA_GRAVITY 9.81
+
+/* default geometry, metres: motor axes on a circle of base_radius, ball joints of the effector on
+ * a circle of effector_radius, upper arm from motor axis to elbow, lower arm from elbow to effector */
+#define DELTA_DEFAULT_BASE_RADIUS 0.100
+#define DELTA_DEFAULT_EFFECTOR_RADIUS 0.035
+#define DELTA_DEFAULT_UPPER_ARM 0.200
+#define DELTA_DEFAULT_LOWER_ARM 0.450
+
+/* AM3031 motor behind an RS718 gearbox, take these from the data sheets if either is changed */
+#define DELTA_DEFAULT_MOTOR_SPEED_RPM 6000.0
+#define DELTA_DEFAULT_MOTOR_PEAK_TORQUE 2.5 /* Nm */
+#define DELTA_DEFAULT_MOTOR_INERTIA 0.000022 /* kgm^2, rotor */
+#define DELTA_DEFAULT_GEAR_RATIO 10.0
+#define DELTA_DEFAULT_GEAR_EFFICIENCY 0.95
+#define DELTA_DEFAULT_GEAR_PEAK_TORQUE 40.0 /* Nm at the output, acceleration torque rating */
+/* upper arm about the motor axis and the moving mass carried by the effector */
+#define DELTA_DEFAULT_ARM_INERTIA 0.004 /* kgm^2 */
+#define DELTA_DEFAULT_EFFECTOR_MASS 0.4 /* kg, effector, lower arms' share and gripper */
+/* drive position units per motor revolution (S-0-0079) */
+#define DELTA_DEFAULT_COUNTS_PER_REV 1048576.0
+
+#define DELTA_ERR_SUCCESS 0
+#define DELTA_ERR_UNREACHABLE -1
+#define DELTA_ERR_SINGULAR -2
+
+struct delta_geometry_t {
+	double base_radius;
+	double effector_radius;
+	double upper_arm;
+	double lower_arm;
+};
+
+struct delta_drive_t {
+	double motor_speed_rpm;
+	double motor_peak_torque;
+	double motor_inertia;
+	double gear_ratio;
+	double gear_efficiency;
+	double gear_peak_torque;
+	double arm_inertia;
+	double counts_per_rev;
+	double zero_angle; /* joint angle at position 0 after homing, radians, 0 is a horizontal arm */
+};
+
+/* limits of one pose, joint space */
+struct delta_limits_t {
+	double velocity[DELTA_NUM_JOINTS]; /* rad/s */
+	double acceleration[DELTA_NUM_JOINTS]; /* rad/s^2, left over after holding the load against gravity */
+};
+
+struct delta_robot_t {
+	struct delta_geometry_t geometry;
+	struct delta_drive_t drive;
+	double payload; /* kg, added to the effector mass while carrying a part */
+	double effector_mass;
+	/* NULL normally, set to use the same limits in every pose */
+	const struct delta_limits_t *fixed_limits;
+};
+
+void delta_defaults(struct delta_robot_t *robot);
+int delta_inverse(const struct delta_robot_t *robot, const double p[3], double q[DELTA_NUM_JOINTS]);
+int delta_forward(const struct delta_robot_t *robot, const double q[DELTA_NUM_JOINTS], double p[3]);
+int delta_inverse_jacobian(const struct delta_robot_t *robot, const double p[3], const double q[DELTA_NUM_JOINTS], double dq_dp[DELTA_NUM_JOINTS][3]);
+int delta_limits(const struct delta_robot_t *robot, const double p[3], const double q[DELTA_NUM_JOINTS], struct delta_limits_t *limits);
+int32_t delta_counts(const struct delta_robot_t *robot, double q);
+double delta_angle(const struct delta_robot_t *robot, int32_t counts);
+
+#endif /* __DELTA_H__ */
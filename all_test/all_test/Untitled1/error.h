@@ -10,5 +10,9 @@
 #define ERR_STATE_MACHINE_STOPPED -5
 #define ERR_CONFIG_FAIL -6
 #define ERR_FAILED_PRE_OP -7
+#define ERR_NO_SAFETY_INPUT -8
+#define ERR_NO_MAGNET_OUTPUT -9
+#define ERR_NO_WAGO_COUPLER -10
+#define ERR_NO_CONVEYOR_ENCODER -11
 
 #endif
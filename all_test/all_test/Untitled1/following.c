@@ -0,0 +1,258 @@
+/** \file
+ * \brief Following error statistics of the servo axes
+ *
+ * The position a drive reports in a cycle is the result of a command written a few cycles before:
+ * the command goes out with the next frame, the drive takes it at SYNC0 and its feedback comes back
+ * a frame later. following_update() keeps the last FOLLOWING_MAX_DELAY commands and compares the
+ * feedback with the one written delay cycles ago, so an axis that follows perfectly shows no error
+ * rather than one cycle's worth of travel.
+ *
+ * Only cycles where the axis follows setpoints count, while it is disabled, halted or stopped by
+ * the safety fields the command tracks the actual position anyway and would only dilute the
+ * statistics. The trajectory source marks moves with following_move_begin() and
+ * following_move_end(), each move gets its own maximum, RMS and histogram, the last completed one
+ * is kept until the next ends.
+ * An axis over its limit for limit_cycles cycles in a row halts every axis, they stop on the drives'
+ * own ramps and hold until following_reset().
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include <string.h>
+
+#include "following.h"
+#include "safety.h"
+#include "log.h"
+
+struct following_axis_t following_axes[FOLLOWING_NUM_AXES];
+int following_tripped = 0;
+
+static int following_configured = 0;
+
+/**
+ * Sets the defaults on every axis that has not been configured yet
+ */
+static void following_defaults(void)
+{
+	if (following_configured)
+		return;
+	for (int i=0; i<FOLLOWING_NUM_AXES; i++) {
+		following_axes[i].limit = FOLLOWING_DEFAULT_LIMIT;
+		following_axes[i].limit_cycles = FOLLOWING_DEFAULT_LIMIT_CYCLES;
+		following_axes[i].bin_width = FOLLOWING_DEFAULT_BIN_WIDTH;
+		following_axes[i].delay = FOLLOWING_DEFAULT_DELAY;
+	}
+	following_configured = 1;
+}
+
+/**
+ * Sets an axis's limit and how its errors are binned
+ *
+ * Call before the axis is enabled, the statistics are cleared.
+ * @param[in]	axis The axis, should start from 0 and go to FOLLOWING_NUM_AXES-1
+ * @param[in]	limit The largest error allowed either way, drive position units, 0 for no limit
+ * @param[in]	limit_cycles Cycles in a row over the limit before the axes are stopped
+ * @param[in]	bin_width Width of each histogram bin, drive position units
+ * @param[in]	delay Cycles between writing a command and the feedback that answers it
+ * @return FOLLOWING_ERR_SUCCESS on success, FOLLOWING_ERR_DELAY if delay is not between 1 and
+ * FOLLOWING_MAX_DELAY-1 or bin_width is not positive
+ */
+int following_configure(int axis, int32_t limit, uint32_t limit_cycles, int32_t bin_width, uint32_t delay)
+{
+	struct following_axis_t *f = &following_axes[axis];
+
+	if (delay == 0 || delay >= FOLLOWING_MAX_DELAY || bin_width <= 0)
+		return FOLLOWING_ERR_DELAY;
+
+	following_defaults();
+	f->limit = limit;
+	f->limit_cycles = (limit_cycles > 0) ? limit_cycles : 1;
+	f->bin_width = bin_width;
+	f->delay = delay;
+	following_clear(axis);
+	return FOLLOWING_ERR_SUCCESS;
+}
+
+/**
+ * Marks the start of a move, taken by the next cycle
+ *
+ * @param[in]	axis The axis, should start from 0 and go to FOLLOWING_NUM_AXES-1
+ */
+void following_move_begin(int axis)
+{
+	following_axes[axis].move_begin = 1;
+}
+
+/**
+ * Marks the end of a move, taken by the next cycle
+ *
+ * @param[in]	axis The axis, should start from 0 and go to FOLLOWING_NUM_AXES-1
+ */
+void following_move_end(int axis)
+{
+	following_axes[axis].move_end = 1;
+}
+
+/**
+ * Clears an axis's statistics
+ *
+ * Only call while the axis is not moving, the cycle may be updating them.
+ * @param[in]	axis The axis, should start from 0 and go to FOLLOWING_NUM_AXES-1
+ */
+void following_clear(int axis)
+{
+	struct following_axis_t *f = &following_axes[axis];
+
+	memset(&f->total, 0, sizeof(f->total));
+	memset(&f->move, 0, sizeof(f->move));
+	memset(&f->last_move, 0, sizeof(f->last_move));
+	f->in_move = 0;
+	f->moves = 0;
+	f->trips = 0;
+}
+
+/**
+ * Releases the axes after the limit stopped them
+ *
+ * The axes pick up setpoints again from where they stand.
+ * @return FOLLOWING_ERR_SUCCESS
+ */
+int following_reset(void)
+{
+	if (!following_tripped)
+		return FOLLOWING_ERR_SUCCESS;
+	for (int i=0; i<FOLLOWING_NUM_AXES; i++) {
+		following_axes[i].over_limit = 0;
+		ax5000_halt(i, 0);
+	}
+	following_tripped = 0;
+	return FOLLOWING_ERR_SUCCESS;
+}
+
+/**
+ * Works out the RMS error of a set of statistics
+ *
+ * Integer square root, so it can run anywhere including the cycle.
+ * @param[in]	stats The statistics
+ * @return the RMS error, drive position units, 0 if there are no cycles
+ */
+int32_t following_rms(const struct following_stats_t *stats)
+{
+	uint64_t mean, root, next;
+
+	if (stats->cycles == 0)
+		return 0;
+	mean = (uint64_t) stats->sum_squares / stats->cycles;
+	if (mean < 2)
+		return (int32_t) mean;
+
+	/* Newton's method from above, stops once it no longer gets smaller */
+	root = mean;
+	next = (root + 1) / 2;
+	while (next < root) {
+		root = next;
+		next = (root + mean / root) / 2;
+	}
+	return (int32_t) root;
+}
+
+/**
+ * Adds one error to a set of statistics
+ *
+ * @param[in,out]	stats The statistics
+ * @param[in]		error The error
+ * @param[in]		bin_width Width of each histogram bin
+ */
+static void following_add(struct following_stats_t *stats, int32_t error, int32_t bin_width)
+{
+	int32_t size = (error < 0) ? -error : error;
+	int32_t bin = size / bin_width;
+
+	stats->cycles++;
+	stats->sum_squares += (int64_t) error * error;
+	if (size > stats->max)
+		stats->max = size;
+	if (bin >= FOLLOWING_HISTOGRAM_BINS)
+		bin = FOLLOWING_HISTOGRAM_BINS - 1;
+	stats->histogram[bin]++;
+}
+
+/**
+ * Halts every axis after one went over its limit
+ *
+ * @param[in]	axis The axis that went over
+ */
+static void following_trip(int axis)
+{
+	struct following_axis_t *f = &following_axes[axis];
+
+	f->trips++;
+	if (following_tripped)
+		return;
+	following_tripped = 1;
+	for (int i=0; i<FOLLOWING_NUM_AXES; i++)
+		ax5000_halt(i, 1);
+	log_write("following %d: error %d over the limit of %d for %u cycles, every axis halted\n",
+		axis, f->error, f->limit, f->over_limit);
+}
+
+/**
+ * Updates one axis's following error
+ *
+ * Must be called once per cycle after ax5000_update(), the io lock must already be held
+ * (see cycle_update()).
+ * @param[in]	axis The axis, should start from 0 and go to FOLLOWING_NUM_AXES-1
+ */
+void following_update(int axis)
+{
+	struct following_axis_t *f = &following_axes[axis];
+	struct ax5000_axis_t *a = &ax5000_axes[axis];
+	uint32_t then;
+	int following;
+
+	following_defaults();
+
+	if (f->move_begin) {
+		f->move_begin = 0;
+		memset(&f->move, 0, sizeof(f->move));
+		f->in_move = 1;
+	}
+
+	following = (a->state == AX5000_ENABLED && !a->halt && safety_state == SAFETY_RUN);
+	if (!following) {
+		/* the history no longer matches what the drive is doing */
+		f->commands_valid = 0;
+		f->error = 0;
+		f->over_limit = 0;
+	} else {
+		/* the command written delay cycles ago, the newest is just before next_command */
+		if (f->commands_valid >= f->delay) {
+			then = (f->next_command + FOLLOWING_MAX_DELAY - f->delay) % FOLLOWING_MAX_DELAY;
+			f->error = f->commands[then] - a->actual_position;
+
+			following_add(&f->total, f->error, f->bin_width);
+			if (f->in_move)
+				following_add(&f->move, f->error, f->bin_width);
+
+			if (f->limit > 0 && (f->error > f->limit || f->error < -f->limit)) {
+				if (++f->over_limit >= f->limit_cycles)
+					following_trip(axis);
+			} else {
+				f->over_limit = 0;
+			}
+		}
+		f->commands[f->next_command] = a->command;
+		f->next_command = (f->next_command + 1) % FOLLOWING_MAX_DELAY;
+		if (f->commands_valid < FOLLOWING_MAX_DELAY)
+			f->commands_valid++;
+	}
+
+	if (f->move_end) {
+		f->move_end = 0;
+		if (f->in_move) {
+			f->last_move = f->move;
+			f->moves++;
+		}
+		f->in_move = 0;
+	}
+}
@@ -0,0 +1,80 @@
+/* following.h
+ * this file defines the following error statistics of the servo axes
+ * every cycle the commanded position is compared with the position the drive reports back, the
+ * error is kept as running RMS and maximum, per move histograms, and a limit that stops every axis
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __FOLLOWING_H__
+#define __FOLLOWING_H__
+
+#include "ax5000.h"
+
+#define FOLLOWING_NUM_AXES AX5000_NUM_AXES
+/* cycles of commands remembered to line them up with the feedback */
+#define FOLLOWING_MAX_DELAY 8
+/* cycles from writing a command until the drive reports the position it reached with it:
+ * the frame out, SYNC0 and the frame back */
+#define FOLLOWING_DEFAULT_DELAY 2
+/* default error limit and histogram bin width, drive position units */
+#define FOLLOWING_DEFAULT_LIMIT 20000
+#define FOLLOWING_DEFAULT_BIN_WIDTH 500
+#define FOLLOWING_HISTOGRAM_BINS 16
+/* cycles in a row over the limit before the axes are stopped */
+#define FOLLOWING_DEFAULT_LIMIT_CYCLES 2
+
+#define FOLLOWING_ERR_SUCCESS 0
+#define FOLLOWING_ERR_DELAY -1
+
+struct following_stats_t {
+	uint32_t cycles;
+	int64_t sum_squares;
+	int32_t max; /* largest error either way */
+	/* errors by size, the last bin takes everything beyond it */
+	uint32_t histogram[FOLLOWING_HISTOGRAM_BINS];
+};
+
+struct following_axis_t {
+	/* configuration */
+	int32_t limit;
+	uint32_t limit_cycles;
+	int32_t bin_width;
+	uint32_t delay;
+
+	/* set by the trajectory source, taken by the cycle */
+	volatile int move_begin;
+	volatile int move_end;
+
+	/* updated every cycle */
+	int32_t error;
+	uint32_t over_limit; /* cycles in a row over the limit */
+	int32_t commands[FOLLOWING_MAX_DELAY];
+	uint32_t commands_valid;
+	uint32_t next_command;
+
+	struct following_stats_t total; /* since the last following_clear() */
+	struct following_stats_t move; /* move in progress */
+	struct following_stats_t last_move; /* last completed move */
+	int in_move;
+	uint32_t moves;
+	uint32_t trips;
+};
+
+extern struct following_axis_t following_axes[FOLLOWING_NUM_AXES];
+/* set when an axis went over its limit and every axis was stopped, cleared by following_reset() */
+extern int following_tripped;
+
+int following_configure(int axis, int32_t limit, uint32_t limit_cycles, int32_t bin_width, uint32_t delay);
+void following_move_begin(int axis);
+void following_move_end(int axis);
+void following_clear(int axis);
+int following_reset(void);
+int32_t following_rms(const struct following_stats_t *stats);
+
+void following_update(int axis);
+
+#endif /* __FOLLOWING_H__ */
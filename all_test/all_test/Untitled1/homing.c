@@ -0,0 +1,282 @@
+/** \file
+ * \brief Homing (reference run) of the wago steppers
+ *
+ * homing_start() marks an axis for homing, the cycle then takes every marked axis through
+ * reference mode at the same time: the current operating mode is dropped, m_reference is selected,
+ * start is raised until the terminal reports reference_ok and positioning mode is selected again.
+ * Each step has a timeout so a stuck axis fails instead of hanging the state machine.
+ *
+ * The terminal keeps its reference for as long as it is powered, so after a controller restart an
+ * axis that was homed before (according to the file written by homing_save()) and still reports
+ * reference_ok does not need to be homed again, see homing_restore().
+ * Under TwinCAT3 the results are not saved, persistent module data would be the place for them.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#ifndef TC_VER
+#include <stdio.h>
+#endif
+
+#include "homing.h"
+#include "safety.h"
+
+struct homing_axis_t homing_axes[WAGO_NUM_STEPPERS];
+uint16_t homing_velocity = HOMING_DEFAULT_VELOCITY;
+uint16_t homing_acceleration = HOMING_DEFAULT_ACCELERATION;
+
+/* axes recorded as homed by the last homing_save(), filled in by homing_load() */
+static int homing_persisted[WAGO_NUM_STEPPERS];
+
+/**
+ * Marks an axis to be homed
+ *
+ * The reference run itself is done by the cycle, poll homing_all_done() to see when it has finished.
+ * The axis must be in setup mode or an operating mode, and its move queue must be idle.
+ * @param[in]	device The wago stepper to home, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return HOMING_ERR_SUCCESS on success, HOMING_ERR_BUSY if the axis is already homing
+ */
+int homing_start(int device)
+{
+	int err;
+
+	IO_LOCK;
+	err = homing_start_locked(device);
+	IO_UNLOCK;
+	return err;
+}
+
+/**
+ * Marks an axis to be homed, with the io lock already held
+ *
+ * As homing_start(), for scripts (see script.h).
+ * @param[in]	device The wago stepper to home, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return HOMING_ERR_SUCCESS on success, HOMING_ERR_BUSY if the axis is already homing
+ */
+int homing_start_locked(int device)
+{
+	struct homing_axis_t *axis = &homing_axes[device];
+
+	if (homing_active(device))
+		return HOMING_ERR_BUSY;
+
+	axis->error = 0;
+	axis->restored = 0;
+	axis->state_cycles = 0;
+	axis->homing_cycles = 0;
+	axis->state = HOMING_LEAVE_MODE;
+
+	return HOMING_ERR_SUCCESS;
+}
+
+/**
+ * Checks whether an axis is part way through homing
+ *
+ * While this is true the axis's process image belongs to the homing routine.
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return 1 if the axis is homing, 0 otherwise
+ */
+int homing_active(int device)
+{
+	return (homing_axes[device].state != HOMING_IDLE) && (homing_axes[device].state != HOMING_DONE) && (homing_axes[device].state != HOMING_FAILED);
+}
+
+/**
+ * Checks whether every axis has either finished or failed homing
+ *
+ * @return 1 if no axis is homing, 0 otherwise
+ */
+int homing_all_done(void)
+{
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		if (homing_active(i))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Checks whether any axis failed homing
+ *
+ * @return 1 if an axis failed, 0 otherwise
+ */
+int homing_any_failed(void)
+{
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		if (homing_axes[i].state == HOMING_FAILED)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Reuses the reference from a previous run if the terminal still has it
+ *
+ * @param[in]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return 1 if the axis does not need homing, 0 if it does
+ */
+int homing_restore(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	if (!homing_persisted[device] || !wago_steppers[device][WAGO_INPUT_SPACE]->stat_cont2.status_bits.reference_ok)
+		return 0;
+
+	homing_axes[device].restored = 1;
+	homing_axes[device].state = HOMING_DONE;
+	return 1;
+}
+
+/**
+ * Moves an axis to a new homing state
+ *
+ * @param[in,out]	axis The axis
+ * @param[in]		state The state to move to
+ */
+static void homing_set_state(struct homing_axis_t *axis, enum homing_states state)
+{
+	axis->state = state;
+	axis->state_cycles = 0;
+}
+
+/**
+ * Services the homing of one axis
+ *
+ * Must be called once per cycle, the io lock must already be held (see cycle_update()).
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to service, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ */
+void homing_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	struct wago_stepper_t *out = wago_steppers[device][WAGO_OUTPUT_SPACE];
+	struct wago_stepper_t *in = wago_steppers[device][WAGO_INPUT_SPACE];
+	struct homing_axis_t *axis = &homing_axes[device];
+	uint32_t timeout = HOMING_MODE_TIMEOUT;
+
+	if (!homing_active(device))
+		return;
+
+	axis->state_cycles++;
+	axis->homing_cycles++;
+
+	if (safety_stopped()) {
+		out->stat_cont1.bit.m_reference = 0;
+		homing_set_state(axis, HOMING_FAILED);
+		return;
+	}
+
+	switch (axis->state) {
+	case HOMING_LEAVE_MODE:
+		out->stat_cont1.bit.start = 0;
+		out->stat_cont1.bit.m_positioning = 0;
+		out->stat_cont1.bit.m_program = 0;
+		out->stat_cont1.bit.m_reference = 0;
+		out->stat_cont1.bit.m_jog = 0;
+		out->stat_cont1.bit.m_drive_by_mbx = 0;
+		if (in->stat_cont1.bit.m_positioning || in->stat_cont1.bit.m_program || in->stat_cont1.bit.m_reference
+			|| in->stat_cont1.bit.m_jog || in->stat_cont1.bit.m_drive_by_mbx || in->stat_cont1.bit.start)
+			break;
+
+		out->message.positioning.velocity_lbyte = (uint8_t) ((homing_velocity>>0)&0xFF);
+		out->message.positioning.velocity_hbyte = (uint8_t) ((homing_velocity>>8)&0xFF);
+		out->message.positioning.acceleration_lbyte = (uint8_t) ((homing_acceleration>>0)&0xFF);
+		out->message.positioning.acceleration_hbyte = (uint8_t) ((homing_acceleration>>8)&0xFF);
+		out->stat_cont1.bit.m_reference = 1;
+		homing_set_state(axis, HOMING_ENTER_MODE);
+		break;
+	case HOMING_ENTER_MODE:
+		if (!in->stat_cont1.bit.m_reference)
+			break;
+		out->stat_cont1.bit.start = 1;
+		homing_set_state(axis, HOMING_RUNNING);
+		break;
+	case HOMING_RUNNING:
+		timeout = HOMING_RUN_TIMEOUT;
+		if (in->stat_cont2.status_bits.error) {
+			axis->error = 1;
+			out->stat_cont1.bit.start = 0;
+			out->stat_cont1.bit.m_reference = 0;
+			homing_set_state(axis, HOMING_FAILED);
+			break;
+		}
+		if (!in->stat_cont1.bit.start || !in->stat_cont2.status_bits.reference_ok)
+			break;
+		out->stat_cont1.bit.start = 0;
+		out->stat_cont1.bit.m_reference = 0;
+		homing_set_state(axis, HOMING_RESTORE_MODE);
+		break;
+	case HOMING_RESTORE_MODE:
+		if (in->stat_cont1.bit.m_positioning) {
+			homing_set_state(axis, HOMING_DONE);
+			break;
+		}
+		if (!in->stat_cont1.bit.m_reference && !in->stat_cont1.bit.start)
+			out->stat_cont1.bit.m_positioning = 1;
+		break;
+	default:
+		break;
+	}
+
+	if (homing_active(device) && axis->state_cycles > timeout) {
+		out->stat_cont1.bit.start = 0;
+		out->stat_cont1.bit.m_reference = 0;
+		homing_set_state(axis, HOMING_FAILED);
+	}
+}
+
+#ifndef TC_VER
+/**
+ * Saves which axes are homed
+ *
+ * The file has one line per axis holding the axis number and 1 if it is homed.
+ * @param[in]	path File to write
+ * @return HOMING_ERR_SUCCESS on success, HOMING_ERR_FILE if the file could not be written
+ */
+int homing_save(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL)
+		return HOMING_ERR_FILE;
+
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		homing_persisted[i] = (homing_axes[i].state == HOMING_DONE);
+		fprintf(fp, "%d %d\n", i, homing_persisted[i]);
+	}
+
+	if (fclose(fp) != 0)
+		return HOMING_ERR_FILE;
+	return HOMING_ERR_SUCCESS;
+}
+
+/**
+ * Loads which axes were homed on the previous run
+ *
+ * A missing file is not an error, every axis is then treated as not homed.
+ * @param[in]	path File written by homing_save()
+ * @return HOMING_ERR_SUCCESS on success, HOMING_ERR_FILE if the file could not be parsed
+ */
+int homing_load(const char *path)
+{
+	int axis;
+	int homed;
+	int ret = HOMING_ERR_SUCCESS;
+	FILE *fp;
+
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++)
+		homing_persisted[i] = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return HOMING_ERR_SUCCESS;
+
+	while (fscanf(fp, "%d %d", &axis, &homed) == 2) {
+		if (axis < 0 || axis >= WAGO_NUM_STEPPERS) {
+			ret = HOMING_ERR_FILE;
+			break;
+		}
+		homing_persisted[axis] = homed;
+	}
+
+	fclose(fp);
+	return ret;
+}
+#endif /* TC_VER */
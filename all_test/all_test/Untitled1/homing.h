@@ -0,0 +1,69 @@
+/* homing.h
+ * this file defines the homing (reference run) of the wago steppers
+ * every selected axis is referenced at the same time by the cycle
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __HOMING_H__
+#define __HOMING_H__
+
+#include "wago_steppers.h"
+
+#define HOMING_ERR_SUCCESS 0
+#define HOMING_ERR_BUSY -1
+#define HOMING_ERR_FILE -2
+
+/* cycles an axis may take to reach a state before homing is abandoned */
+#define HOMING_MODE_TIMEOUT 1000
+#define HOMING_RUN_TIMEOUT 300000
+
+#define HOMING_DEFAULT_VELOCITY 2000
+#define HOMING_DEFAULT_ACCELERATION 2000
+
+enum homing_states {
+	HOMING_IDLE = 0,	/* not homed this run */
+	HOMING_LEAVE_MODE,	/* current operating mode dropped, waiting for the terminal */
+	HOMING_ENTER_MODE,	/* m_reference set, waiting for the terminal */
+	HOMING_RUNNING,		/* start raised, waiting for reference_ok */
+	HOMING_RESTORE_MODE,	/* reference found, going back to positioning mode */
+	HOMING_DONE,
+	HOMING_FAILED
+};
+
+struct homing_axis_t {
+	enum homing_states state;
+	uint32_t state_cycles; /* cycles spent in the current state */
+	uint32_t homing_cycles; /* cycles the whole reference run took */
+	int error; /* set if the terminal reported an error while homing */
+	int restored; /* homed on a previous run and the terminal still holds the reference */
+};
+
+extern struct homing_axis_t homing_axes[WAGO_NUM_STEPPERS];
+extern uint16_t homing_velocity;
+extern uint16_t homing_acceleration;
+
+int homing_start(int device);
+int homing_start_locked(int device);
+int homing_active(int device);
+int homing_all_done(void);
+int homing_any_failed(void);
+int homing_restore(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+
+void homing_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+
+#ifndef TC_VER
+/* results are kept here so a restart after a crash does not have to home again, the simulation
+ * builds with a file of its own so it never marks the real axes as homed */
+#ifndef HOMING_FILE
+#define HOMING_FILE "homing_state.txt"
+#endif
+
+int homing_save(const char *path);
+int homing_load(const char *path);
+#endif
+
+#endif /* __HOMING_H__ */
@@ -0,0 +1,365 @@
+/** \file
+ * \brief Picking parts off the moving conveyor
+ *
+ * A pick on the move is planned as three pieces played back to back as one trajectory:
+ *	approach	from where the robot is to the part, a pick path in the belt's frame coupled to it
+ *			at the end (trajectory_drift()), so the effector comes down onto the part moving
+ *			with it
+ *	grip		moving along with the part for the grip time, the magnet is switched on as the
+ *			effector arrives
+ *	depart		up off the belt and across to the place point, coupled to the belt at the start
+ *			and carrying the payload, then at rest while the magnet lets go
+ * The pick has to start in a known cycle (trajectory->start_cycle), the part's position comes from
+ * the belt's count predicted for that time. How long the approach takes depends on where it ends
+ * and where it ends depends on how long it takes, so each leg is planned again from the last
+ * timing until it lands within INTERCEPT_TOLERANCE of its target. A part that would only reach the
+ * pick window later is waited for, one that would be past it is given up. A part far upstream, out
+ * of the robot's reach, is waited for before the first plan.
+ *
+ * A part lying still, on a tray or a table rather than the belt, is picked the same way with the
+ * belt's velocity left out (intercept_plan_static()), each leg then lands where it was planned to.
+ *
+ * Which robot picks which part is up to the scheduler (scheduler.h), the picking thread
+ * (picker.h) queues the picks.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "intercept.h"
+#include "output_events.h"
+
+/**
+ * Sets up the belt and the pick as they are on the drawings
+ *
+ * The belt runs along x through the eye at INTERCEPT_DEFAULT_EYE_X, parts are placed back on the
+ * far side of it.
+ * @param[out]	conveyor The belt
+ * @param[out]	pick The pick
+ */
+void intercept_defaults(struct intercept_conveyor_t *conveyor, struct intercept_pick_t *pick)
+{
+	memset(conveyor, 0, sizeof(*conveyor));
+	conveyor->eye[0] = INTERCEPT_DEFAULT_EYE_X;
+	conveyor->eye[1] = INTERCEPT_DEFAULT_BELT_Y;
+	conveyor->eye[2] = INTERCEPT_DEFAULT_BELT_Z;
+	conveyor->direction[0] = 1.0;
+	conveyor->metres_per_count = INTERCEPT_DEFAULT_METRES_PER_COUNT;
+	conveyor->window[0] = INTERCEPT_DEFAULT_WINDOW_START;
+	conveyor->window[1] = INTERCEPT_DEFAULT_WINDOW_END;
+
+	memset(pick, 0, sizeof(*pick));
+	pick->place[0] = 0.0;
+	pick->place[1] = 0.150;
+	pick->place[2] = INTERCEPT_DEFAULT_BELT_Z;
+	pick->lift = TRAJECTORY_DEFAULT_LIFT;
+	pick->grip = INTERCEPT_DEFAULT_GRIP;
+	pick->release = INTERCEPT_DEFAULT_RELEASE;
+}
+
+/**
+ * Works out the belt's velocity in the robot's frame
+ *
+ * @param[in]	conveyor The belt
+ * @param[in]	state Where the belt was, from conveyor_state()
+ * @param[out]	velocity The velocity, m/s
+ */
+void intercept_belt_velocity(const struct intercept_conveyor_t *conveyor, const struct conveyor_state_t *state, double velocity[3])
+{
+	double speed = state->velocity * 1e-3 * conveyor->metres_per_count;
+
+	for (int c=0; c<3; c++)
+		velocity[c] = conveyor->direction[c] * speed;
+}
+
+/**
+ * Works out where a part is at a count of the belt
+ *
+ * @param[in]	conveyor The belt
+ * @param[in]	part The part
+ * @param[in]	count The count
+ * @param[out]	p Where the part is, metres
+ */
+void intercept_part_position(const struct intercept_conveyor_t *conveyor, const struct conveyor_part_t *part, int64_t count, double p[3])
+{
+	double along = (count - part->count) * conveyor->metres_per_count;
+
+	for (int c=0; c<3; c++)
+		p[c] = conveyor->eye[c] + conveyor->direction[c] * along;
+}
+
+/**
+ * Plans a leg that has to end on a moving target
+ *
+ * The leg ends at target + target_velocity * duration, its own frame carries it drift times
+ * trajectory_drift() of the way there, so the path is aimed that much short.
+ * @param[in]	robot The robot
+ * @param[in]	from Where the leg starts
+ * @param[in]	target Where the target is as the leg starts
+ * @param[in]	target_velocity How the target moves, m/s
+ * @param[in]	drift Velocity of the leg's frame, m/s
+ * @param[in]	coupling Coupling to the frame at the start and at the end
+ * @param[in]	lift How far above from and the target the leg crosses over
+ * @param[in]	cycle_ns The cycle the setpoints are played at
+ * @param[out]	leg The leg
+ * @return INTERCEPT_ERR_SUCCESS on success, INTERCEPT_ERR_UNREACHABLE if it cannot be planned or
+ * does not settle on the target, INTERCEPT_ERR_MEMORY if there was no memory to plan in
+ */
+static int intercept_leg(const struct delta_robot_t *robot, const double from[3], const double target[3], const double target_velocity[3],
+	const double drift[3], const double coupling[2], double lift, uint32_t cycle_ns, struct trajectory_t *leg)
+{
+	struct trajectory_path_t path;
+	double to[3], carried, duration = 0.0, miss;
+	int err;
+
+	for (int i=0; i<INTERCEPT_ITERATIONS; i++) {
+		path.coupling[0] = coupling[0];
+		path.coupling[1] = coupling[1];
+		carried = trajectory_drift(&path, duration, duration, NULL);
+		for (int c=0; c<3; c++)
+			to[c] = target[c] + target_velocity[c] * duration - drift[c] * carried;
+
+		trajectory_pick_path(&path, from, to, lift);
+		memcpy(path.drift, drift, sizeof(path.drift));
+		path.coupling[0] = coupling[0];
+		path.coupling[1] = coupling[1];
+		err = trajectory_plan(robot, &path, TRAJECTORY_DEFAULT_STEP, cycle_ns, leg);
+		if (err == TRAJECTORY_ERR_MEMORY)
+			return INTERCEPT_ERR_MEMORY;
+		if (err < 0)
+			return INTERCEPT_ERR_UNREACHABLE;
+
+		/* where the effector gets to against where the target is by then */
+		carried = trajectory_drift(&path, leg->duration, leg->duration, NULL);
+		miss = 0.0;
+		for (int c=0; c<3; c++) {
+			double off = to[c] + drift[c] * carried - target[c] - target_velocity[c] * leg->duration;
+			miss += off * off;
+		}
+		if (sqrt(miss) < INTERCEPT_TOLERANCE)
+			return INTERCEPT_ERR_SUCCESS;
+		duration = leg->duration;
+		trajectory_free(leg);
+	}
+	return INTERCEPT_ERR_UNREACHABLE;
+}
+
+/**
+ * Works out the setpoint of the effector at a point, moving at a velocity
+ *
+ * @param[in]	robot The robot
+ * @param[in]	p The point
+ * @param[in]	velocity The velocity, m/s
+ * @param[out]	setpoint The setpoint
+ * @return INTERCEPT_ERR_SUCCESS on success, INTERCEPT_ERR_UNREACHABLE if the point is outside the workspace
+ */
+static int intercept_setpoint(const struct delta_robot_t *robot, const double p[3], const double velocity[3], struct trajectory_setpoint_t *setpoint)
+{
+	double counts_per_rad = robot->drive.gear_ratio * robot->drive.counts_per_rev / (2.0 * M_PI);
+	double q[DELTA_NUM_JOINTS], dq_dp[DELTA_NUM_JOINTS][3];
+
+	if (delta_inverse(robot, p, q) < 0 || delta_inverse_jacobian(robot, p, q, dq_dp) < 0)
+		return INTERCEPT_ERR_UNREACHABLE;
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		setpoint->position[j] = delta_counts(robot, q[j]);
+		setpoint->velocity[j] = (int32_t) lround((dq_dp[j][0] * velocity[0] + dq_dp[j][1] * velocity[1] + dq_dp[j][2] * velocity[2]) * counts_per_rad);
+	}
+	return INTERCEPT_ERR_SUCCESS;
+}
+
+/**
+ * Joins the legs of a pick into one trajectory
+ *
+ * The two magnet events are allocated behind the setpoints, as in a trajectory file, so
+ * trajectory_free() frees them with the setpoints.
+ * @param[in]	robot The robot
+ * @param[in]	approach Down onto the part
+ * @param[in]	depart Off the belt to the place point
+ * @param[in]	velocity The belt's velocity
+ * @param[in]	grip Cycles moving along with the part
+ * @param[in]	release Cycles at rest on the place point
+ * @param[out]	trajectory The pick
+ * @return INTERCEPT_ERR_SUCCESS on success, INTERCEPT_ERR_UNREACHABLE if the part is carried out
+ * of the workspace while gripped, INTERCEPT_ERR_MEMORY if there was no memory for the setpoints
+ */
+static int intercept_join(const struct delta_robot_t *robot, const struct trajectory_t *approach, const struct trajectory_t *depart,
+	const double velocity[3], uint32_t grip, uint32_t release, struct trajectory_t *trajectory)
+{
+	struct trajectory_setpoint_t *setpoints;
+	struct trajectory_event_t *events;
+	double cycle = approach->cycle_ns * 1e-9, p[3];
+	uint32_t n = 0, cycles = approach->cycles + grip + depart->cycles - 1 + release;
+
+	setpoints = malloc(cycles * sizeof(*setpoints) + 2 * sizeof(*events));
+	if (setpoints == NULL)
+		return INTERCEPT_ERR_MEMORY;
+	events = (struct trajectory_event_t *) (setpoints + cycles);
+
+	memcpy(&setpoints[n], approach->setpoints, approach->cycles * sizeof(*setpoints));
+	n += approach->cycles;
+	for (uint32_t k=1; k<=grip; k++) {
+		for (int c=0; c<3; c++)
+			p[c] = approach->end[c] + velocity[c] * k * cycle;
+		if (intercept_setpoint(robot, p, velocity, &setpoints[n++]) < 0) {
+			free(setpoints);
+			return INTERCEPT_ERR_UNREACHABLE;
+		}
+	}
+	/* the first setpoint of the depart leg is the last one of the grip */
+	memcpy(&setpoints[n], depart->setpoints + 1, (depart->cycles - 1) * sizeof(*setpoints));
+	n += depart->cycles - 1;
+	for (uint32_t k=0; k<release; k++, n++)
+		setpoints[n] = depart->setpoints[depart->cycles - 1];
+
+	memset(events, 0, 2 * sizeof(*events));
+	events[0].cycle = approach->cycles - 1;
+	events[0].mask = OUTPUT_MAGNET;
+	events[0].value = OUTPUT_MAGNET;
+	events[1].cycle = approach->cycles + grip + depart->cycles - 2;
+	events[1].mask = OUTPUT_MAGNET;
+	events[1].value = 0;
+
+	memset(trajectory, 0, sizeof(*trajectory));
+	trajectory->cycle_ns = approach->cycle_ns;
+	trajectory->cycles = cycles;
+	trajectory->setpoints = setpoints;
+	trajectory->events = events;
+	trajectory->event_count = 2;
+	trajectory->duration = cycles * cycle;
+	trajectory->length = approach->length + depart->length;
+	trajectory->points = approach->points + depart->points;
+	for (int j=0; j<DELTA_NUM_JOINTS; j++)
+		trajectory->peak_velocity[j] = (approach->peak_velocity[j] > depart->peak_velocity[j]) ? approach->peak_velocity[j] : depart->peak_velocity[j];
+	memcpy(trajectory->end, depart->end, sizeof(trajectory->end));
+	return INTERCEPT_ERR_SUCCESS;
+}
+
+/**
+ * Plans the pick of a part off the moving belt
+ *
+ * Blocks while it plans, several trajectory_plan()s worth. Allocates, the trajectory is queued with
+ * planner_submit_trajectory() or freed with trajectory_free().
+ * @param[in]	robot The robot
+ * @param[in]	conveyor The belt
+ * @param[in]	pick The pick, the place point and the gripper's timing
+ * @param[in]	state Where the belt was, from conveyor_state()
+ * @param[in]	part The part
+ * @param[in]	from Where the robot is at start_cycle, at rest
+ * @param[in]	start_cycle The earliest cycle the pick can start in
+ * @param[in]	cycle_ns The cycle the setpoints are played at
+ * @param[out]	trajectory The pick, its start_cycle set to start_cycle or later if the part has to
+ * be waited for
+ * @param[out]	pick_cycle The cycle the effector lands on the part, NULL if not needed
+ * @return INTERCEPT_ERR_SUCCESS on success, INTERCEPT_ERR_MISSED if the part would be past the pick
+ * window, INTERCEPT_ERR_UNREACHABLE if the pick cannot be planned, INTERCEPT_ERR_MEMORY if there
+ * was no memory to plan in
+ */
+int intercept_plan(const struct delta_robot_t *robot, const struct intercept_conveyor_t *conveyor, const struct intercept_pick_t *pick,
+	const struct conveyor_state_t *state, const struct conveyor_part_t *part, const double from[3], uint32_t start_cycle, uint32_t cycle_ns,
+	struct trajectory_t *trajectory, uint32_t *pick_cycle)
+{
+	struct delta_robot_t carrying = *robot;
+	struct trajectory_t approach, depart;
+	const double rest[3] = {0.0, 0.0, 0.0};
+	const double approach_coupling[2] = {0.0, 1.0}, depart_coupling[2] = {1.0, 0.0};
+	double velocity[3], target[3], grip_end[3], speed, along, cycle = cycle_ns * 1e-9;
+	uint32_t grip = (uint32_t) ceil(pick->grip / cycle), release = (uint32_t) ceil(pick->release / cycle);
+	int64_t start_ns;
+	int err;
+
+	intercept_belt_velocity(conveyor, state, velocity);
+	speed = sqrt(velocity[0] * velocity[0] + velocity[1] * velocity[1] + velocity[2] * velocity[2]);
+
+	/* most of the wait for a part far upstream is known without planning */
+	start_ns = state->timestamp_ns + (int64_t) (int32_t) (start_cycle - state->cycle) * cycle_ns;
+	along = (conveyor_predict(state, start_ns) - part->count) * conveyor->metres_per_count;
+	if (speed >= 1e-6 && along + speed * INTERCEPT_APPROACH_GUESS < conveyor->window[0])
+		start_cycle += (uint32_t) ceil((conveyor->window[0] - along - speed * INTERCEPT_APPROACH_GUESS) / speed / cycle);
+
+	for (int attempt=0; ; attempt++) {
+		start_ns = state->timestamp_ns + (int64_t) (int32_t) (start_cycle - state->cycle) * cycle_ns;
+		intercept_part_position(conveyor, part, conveyor_predict(state, start_ns), target);
+		err = intercept_leg(robot, from, target, velocity, velocity, approach_coupling, pick->lift, cycle_ns, &approach);
+		if (err < 0)
+			return err;
+
+		/* how far along the window the part is picked up and let go of */
+		along = (conveyor_predict(state, start_ns + (int64_t) (approach.duration * 1e9)) - part->count) * conveyor->metres_per_count;
+		if (along + speed * grip * cycle > conveyor->window[1]) {
+			trajectory_free(&approach);
+			return INTERCEPT_ERR_MISSED;
+		}
+		if (along >= conveyor->window[0])
+			break;
+		trajectory_free(&approach);
+		/* a stopped belt never brings the part any closer, a shorter approach from further on
+		 * takes back some of the wait */
+		if (speed < 1e-6 || attempt + 1 == INTERCEPT_ITERATIONS)
+			return INTERCEPT_ERR_MISSED;
+		start_cycle += (uint32_t) ceil((conveyor->window[0] - along) / speed / cycle);
+	}
+
+	for (int c=0; c<3; c++)
+		grip_end[c] = approach.end[c] + velocity[c] * grip * cycle;
+	carrying.payload = pick->payload;
+	err = intercept_leg(&carrying, grip_end, pick->place, rest, velocity, depart_coupling, pick->lift, cycle_ns, &depart);
+	if (err < 0) {
+		trajectory_free(&approach);
+		return err;
+	}
+
+	err = intercept_join(robot, &approach, &depart, velocity, grip, release, trajectory);
+	if (err == INTERCEPT_ERR_SUCCESS) {
+		/* 0 would mean untimed */
+		trajectory->start_cycle = (start_cycle != 0) ? start_cycle : 1;
+		if (pick_cycle != NULL)
+			*pick_cycle = trajectory->start_cycle + approach.cycles - 1;
+	}
+	trajectory_free(&approach);
+	trajectory_free(&depart);
+	return err;
+}
+
+/**
+ * Plans the pick of a part lying still
+ *
+ * Blocks while it plans, two trajectory_plan()s. Allocates, the trajectory is queued with
+ * planner_submit_trajectory() or freed with trajectory_free().
+ * @param[in]	robot The robot
+ * @param[in]	pick The pick, the place point, the payload and the gripper's timing
+ * @param[in]	part Where the part is
+ * @param[in]	from Where the robot is at start_cycle, at rest
+ * @param[in]	start_cycle The cycle the pick starts in
+ * @param[in]	cycle_ns The cycle the setpoints are played at
+ * @param[out]	trajectory The pick
+ * @return INTERCEPT_ERR_SUCCESS on success, INTERCEPT_ERR_UNREACHABLE if the pick cannot be planned,
+ * INTERCEPT_ERR_MEMORY if there was no memory to plan in
+ */
+int intercept_plan_static(const struct delta_robot_t *robot, const struct intercept_pick_t *pick, const double part[3], const double from[3],
+	uint32_t start_cycle, uint32_t cycle_ns, struct trajectory_t *trajectory)
+{
+	struct delta_robot_t carrying = *robot;
+	struct trajectory_t approach, depart;
+	const double rest[3] = {0.0, 0.0, 0.0}, coupling[2] = {0.0, 0.0};
+	double cycle = cycle_ns * 1e-9;
+	uint32_t grip = (uint32_t) ceil(pick->grip / cycle), release = (uint32_t) ceil(pick->release / cycle);
+	int err;
+
+	err = intercept_leg(robot, from, part, rest, rest, coupling, pick->lift, cycle_ns, &approach);
+	if (err < 0)
+		return err;
+	carrying.payload = pick->payload;
+	err = intercept_leg(&carrying, approach.end, pick->place, rest, rest, coupling, pick->lift, cycle_ns, &depart);
+	if (err < 0) {
+		trajectory_free(&approach);
+		return err;
+	}
+
+	err = intercept_join(robot, &approach, &depart, rest, grip, release, trajectory);
+	if (err == INTERCEPT_ERR_SUCCESS)
+		trajectory->start_cycle = (start_cycle != 0) ? start_cycle : 1;
+	trajectory_free(&approach);
+	trajectory_free(&depart);
+	return err;
+}
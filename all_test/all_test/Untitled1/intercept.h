@@ -0,0 +1,70 @@
+/* intercept.h
+ * this file defines picking parts off the moving conveyor
+ * where the belt runs through the robot's frame and its encoder scale turn a part registered by
+ * the photo eye (conveyor.h) into where it will be at any time, and a pick is planned to meet it
+ * there: down onto the part moving with the belt, along with it while the magnet takes hold, then
+ * up off the belt and across to the place point, or the same for a part lying still
+ * SOEM only
+ */
+
+#ifndef __INTERCEPT_H__
+#define __INTERCEPT_H__
+
+#include <stdint.h>
+
+#include "conveyor.h"
+#include "trajectory.h"
+
+/* FIXME: measure the belt against the robot once it is mounted, these are from the drawings */
+#define INTERCEPT_DEFAULT_METRES_PER_COUNT 0.00005
+#define INTERCEPT_DEFAULT_EYE_X -0.300
+#define INTERCEPT_DEFAULT_BELT_Y 0.0
+#define INTERCEPT_DEFAULT_BELT_Z -0.450 /* top of a part on the belt */
+/* stretch of belt downstream of the eye the robot picks on, metres */
+#define INTERCEPT_DEFAULT_WINDOW_START 0.180
+#define INTERCEPT_DEFAULT_WINDOW_END 0.420
+
+/* time moving along with the part while the magnet takes hold, s */
+#define INTERCEPT_DEFAULT_GRIP 0.030
+/* time at rest on the place point while the magnet lets go, s */
+#define INTERCEPT_DEFAULT_RELEASE 0.030
+/* time from deciding on a pick to its first setpoint, covers planning and queueing it, s */
+#define INTERCEPT_DEFAULT_LEAD 0.020
+/* a typical approach, a part still further upstream than this from the window is waited for before
+ * the first plan, s */
+#define INTERCEPT_APPROACH_GUESS 0.100
+/* plans of each leg to line it up with where the part will be */
+#define INTERCEPT_ITERATIONS 6
+/* how far off the part the pick may land, metres */
+#define INTERCEPT_TOLERANCE 0.0002
+
+#define INTERCEPT_ERR_SUCCESS 0
+#define INTERCEPT_ERR_MISSED -1
+#define INTERCEPT_ERR_UNREACHABLE -2
+#define INTERCEPT_ERR_MEMORY -3
+
+struct intercept_conveyor_t {
+	double eye[3]; /* where a part is as it passes the photo eye, robot frame, metres */
+	double direction[3]; /* the way the belt moves, unit length */
+	double metres_per_count;
+	double window[2]; /* picks are made this far downstream of the eye, metres */
+};
+
+struct intercept_pick_t {
+	double place[3];
+	double lift;
+	double payload; /* kg, carried from the pick to the place */
+	double grip;
+	double release;
+};
+
+void intercept_defaults(struct intercept_conveyor_t *conveyor, struct intercept_pick_t *pick);
+void intercept_belt_velocity(const struct intercept_conveyor_t *conveyor, const struct conveyor_state_t *state, double velocity[3]);
+void intercept_part_position(const struct intercept_conveyor_t *conveyor, const struct conveyor_part_t *part, int64_t count, double p[3]);
+int intercept_plan(const struct delta_robot_t *robot, const struct intercept_conveyor_t *conveyor, const struct intercept_pick_t *pick,
+	const struct conveyor_state_t *state, const struct conveyor_part_t *part, const double from[3], uint32_t start_cycle, uint32_t cycle_ns,
+	struct trajectory_t *trajectory, uint32_t *pick_cycle);
+int intercept_plan_static(const struct delta_robot_t *robot, const struct intercept_pick_t *pick, const double part[3], const double from[3],
+	uint32_t start_cycle, uint32_t cycle_ns, struct trajectory_t *trajectory);
+
+#endif /* __INTERCEPT_H__ */
@@ -0,0 +1,1007 @@
+/** \file
+ * \brief Binary log for the control paths
+ *
+ * printf() on the control paths costs far more than the work around it (see the FIXMEs in
+ * ethercat_thread()). log_write() instead stores the address of the format string and the raw
+ * arguments in a ring owned by the calling thread. It never blocks and never formats, if the ring
+ * is full the record is dropped and counted.
+ * log_flush() takes the records out of the rings and formats them. Identical messages in a row
+ * are folded into one, and each format is limited to LOG_RATE_LIMIT messages per
+ * LOG_RATE_WINDOW cycles. Under SOEM log_flush() runs in its own thread (log_start()), under
+ * TwinCAT3 there is no thread of our own so CModule1::CycleUpdate() formats LOG_FLUSH_PER_CYCLE
+ * records at the end of each cycle.
+ *
+ * The format must be a string literal, its address is what identifies the message. %s arguments
+ * are stored as pointers so they must also outlive the record, which in practice means literals.
+ * Widths and precisions given as * are not supported.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#ifdef TC_VER /* If a twincat 3 version is defined */
+#include "stdint.h"
+#include "support.h" //fake printf()
+#else /* SOEM Includes */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "log.h"
+#include "cycle.h"
+
+#ifdef TC_VER
+/* the cycle is the only writer and the only reader, there is nothing to order */
+#define LOG_BARRIER()
+#define LOG_TRACE_ARG CTcTrace &m_Trace,
+#define LOG_TRACE m_Trace,
+#define LOG_TRACE_ONLY_ARG CTcTrace &m_Trace
+#define LOG_TRACE_ONLY m_Trace
+#else
+#define LOG_BARRIER() __sync_synchronize()
+#define LOG_TRACE_ARG
+#define LOG_TRACE
+#define LOG_TRACE_ONLY_ARG void
+#define LOG_TRACE_ONLY
+/* how often the log thread formats what has been written */
+#define LOG_FLUSH_PERIOD_US 10000
+#endif
+
+#define LOG_LINE_LENGTH 256
+
+enum log_arg_types {
+	LOG_ARG_NONE = 0,
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_SIZE,
+	LOG_ARG_PTR,
+	LOG_ARG_DOUBLE
+};
+
+struct log_rate_t {
+	const char *fmt;
+	uint32_t window_start;
+	uint32_t count;
+	uint32_t suppressed;
+};
+
+union log_double_t {
+	double d;
+	int64_t i;
+};
+
+struct log_stats_t log_stats;
+
+static struct log_ring_t log_rings[LOG_MAX_THREADS];
+static uint32_t log_rings_dropped[LOG_MAX_THREADS];
+
+/* consumer side, only touched by log_flush() */
+static struct log_record_t log_last;
+static uint32_t log_last_cycle;
+static uint32_t log_repeats = 0;
+static struct log_rate_t log_rates[LOG_RATE_SLOTS];
+
+#ifndef TC_VER
+static volatile uint32_t log_rings_used = 0;
+static volatile uint32_t log_no_ring = 0; /* records from threads that did not get a ring */
+static __thread int log_ring_index = -1;
+static pthread_t log_thread_handle;
+static volatile int log_running = 0;
+#endif
+
+/**
+ * Finds the ring of the calling thread, handing one out on the first call
+ *
+ * @return the ring, or NULL if every ring has been handed out
+ */
+static struct log_ring_t *log_thread_ring(void)
+{
+#ifdef TC_VER
+	return &log_rings[0];
+#else
+	if (log_ring_index == -1)
+		log_ring_index = (int) __sync_fetch_and_add(&log_rings_used, 1);
+	if (log_ring_index >= LOG_MAX_THREADS) {
+		__sync_fetch_and_add(&log_no_ring, 1);
+		return NULL;
+	}
+	return &log_rings[log_ring_index];
+#endif
+}
+
+/**
+ * Works out the type of a printf conversion
+ *
+ * @param[in]	fmt The character after the '%'
+ * @param[out]	type The type of argument the conversion takes, LOG_ARG_NONE if it takes none
+ * @return the character after the conversion
+ */
+static const char *log_conversion(const char *fmt, int *type)
+{
+	int longs = 0;
+	int size = 0;
+
+	/* flags, width and precision */
+	while ((*fmt >= '0' && *fmt <= '9') || *fmt == '-' || *fmt == '+' || *fmt == ' ' || *fmt == '#' || *fmt == '.')
+		fmt++;
+	/* length */
+	while (*fmt == 'h' || *fmt == 'l' || *fmt == 'z') {
+		if (*fmt == 'l')
+			longs++;
+		else if (*fmt == 'z')
+			size = 1;
+		fmt++;
+	}
+
+	switch (*fmt) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		*type = size ? LOG_ARG_SIZE : (longs >= 2) ? LOG_ARG_LLONG : longs ? LOG_ARG_LONG : LOG_ARG_INT;
+		break;
+	case 's': case 'p':
+		*type = LOG_ARG_PTR;
+		break;
+	case 'f': case 'e': case 'g': case 'E': case 'G':
+		*type = LOG_ARG_DOUBLE;
+		break;
+	case '\0':
+		*type = LOG_ARG_NONE;
+		return fmt;
+	default: /* %% */
+		*type = LOG_ARG_NONE;
+		break;
+	}
+	return fmt + 1;
+}
+
+/**
+ * Logs a message without formatting it
+ *
+ * Safe to call from the cycle. Only the owning thread writes to a ring so no lock is needed.
+ * @param[in]	fmt printf style format, must be a string literal
+ * @param[in]	... arguments, at most LOG_MAX_ARGS, %s arguments must outlive the record
+ */
+void log_write(const char *fmt, ...)
+{
+	struct log_ring_t *ring = log_thread_ring();
+	struct log_record_t *record;
+	union log_double_t bits;
+	const char *p = fmt;
+	uint32_t head;
+	int type;
+	va_list args;
+
+	if (ring == NULL)
+		return;
+
+	head = ring->head;
+	if (head - ring->tail >= LOG_RING_LENGTH) {
+		ring->dropped++;
+		return;
+	}
+
+	record = &ring->records[head & (LOG_RING_LENGTH - 1)];
+	record->fmt = fmt;
+	record->cycle = cycle_count;
+	record->nargs = 0;
+
+	va_start(args, fmt);
+	while (*p && record->nargs < LOG_MAX_ARGS) {
+		if (*p++ != '%')
+			continue;
+		p = log_conversion(p, &type);
+
+		switch (type) {
+		case LOG_ARG_INT:
+			record->args[record->nargs++] = va_arg(args, int);
+			break;
+		case LOG_ARG_LONG:
+			record->args[record->nargs++] = va_arg(args, long);
+			break;
+		case LOG_ARG_LLONG:
+			record->args[record->nargs++] = va_arg(args, long long);
+			break;
+		case LOG_ARG_SIZE:
+			record->args[record->nargs++] = (int64_t) va_arg(args, size_t);
+			break;
+		case LOG_ARG_PTR:
+			record->args[record->nargs++] = (intptr_t) va_arg(args, const void *);
+			break;
+		case LOG_ARG_DOUBLE:
+			bits.d = va_arg(args, double);
+			record->args[record->nargs++] = bits.i;
+			break;
+		default:
+			break;
+		}
+	}
+	va_end(args);
+
+	/* the record must be complete before the reader can see it */
+	LOG_BARRIER();
+	ring->head = head + 1;
+}
+
+/* a conversion as taken apart by log_spec() */
+struct log_spec_t {
+	int left; /* - */
+	int zero; /* 0 */
+	int alt; /* # */
+	char sign; /* '+', ' ' or 0 */
+	int width;
+	int precision; /* -1 if none was given */
+	char conversion;
+};
+
+/* a formatted field before it is padded to its width */
+struct log_field_t {
+	char prefix[4]; /* sign, 0x */
+	char digits[LOG_LINE_LENGTH];
+	int length; /* of digits, or of text */
+	const char *text; /* %s, nan and inf, instead of digits */
+};
+
+/**
+ * Takes a conversion apart
+ *
+ * @param[in]	p The character after the '%'
+ * @param[in]	end The character after the conversion, see log_conversion()
+ * @param[out]	spec The conversion
+ */
+static void log_spec(const char *p, const char *end, struct log_spec_t *spec)
+{
+	spec->left = spec->zero = spec->alt = 0;
+	spec->sign = 0;
+	spec->width = 0;
+	spec->precision = -1;
+
+	for (;; p++) {
+		if (*p == '-')
+			spec->left = 1;
+		else if (*p == '0')
+			spec->zero = 1;
+		else if (*p == '#')
+			spec->alt = 1;
+		else if (*p == '+')
+			spec->sign = '+';
+		else if (*p == ' ' && spec->sign == 0)
+			spec->sign = ' ';
+		else
+			break;
+	}
+	while (*p >= '0' && *p <= '9')
+		spec->width = spec->width*10 + (*p++ - '0');
+	if (*p == '.') {
+		spec->precision = 0;
+		p++;
+		while (*p >= '0' && *p <= '9')
+			spec->precision = spec->precision*10 + (*p++ - '0');
+		/* room for the digits in struct log_field_t */
+		if (spec->precision > LOG_LINE_LENGTH - 32)
+			spec->precision = LOG_LINE_LENGTH - 32;
+	}
+	spec->conversion = end[-1];
+}
+
+/**
+ * Writes the digits of an unsigned number
+ *
+ * @param[out]	field The field, digits are added to its end
+ * @param[in]	value The number
+ * @param[in]	base 8, 10 or 16
+ * @param[in]	upper 1 for upper case hex digits
+ * @param[in]	min Minimum number of digits, padded with zeros
+ */
+static void log_digits(struct log_field_t *field, uint64_t value, unsigned int base, int upper, int min)
+{
+	const char *set = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char reversed[24];
+	int n = 0;
+
+	do {
+		reversed[n++] = set[value % base];
+		value /= base;
+	} while (value && n < (int) sizeof(reversed));
+	for (int i=n; i<min && field->length < (int) sizeof(field->digits) - 32; i++)
+		field->digits[field->length++] = '0';
+	while (n > 0)
+		field->digits[field->length++] = reversed[--n];
+}
+
+/**
+ * Formats an integer conversion, d i u x X o c
+ *
+ * @param[out]	field The field
+ * @param[in]	spec The conversion
+ * @param[in]	type Argument type from log_conversion()
+ * @param[in]	arg The raw argument
+ */
+static void log_integer(struct log_field_t *field, const struct log_spec_t *spec, int type, int64_t arg)
+{
+	unsigned int base = 10;
+	uint64_t value;
+	int negative = 0;
+	int n = 0;
+
+	if (spec->conversion == 'c') {
+		field->digits[field->length++] = (char) arg;
+		return;
+	}
+
+	if (spec->conversion == 'd' || spec->conversion == 'i') {
+		if (type == LOG_ARG_INT)
+			arg = (int) arg;
+		else if (type == LOG_ARG_LONG)
+			arg = (long) arg;
+		negative = arg < 0;
+		value = negative ? (uint64_t) 0 - (uint64_t) arg : (uint64_t) arg;
+		if (negative)
+			field->prefix[n++] = '-';
+		else if (spec->sign)
+			field->prefix[n++] = spec->sign;
+	} else {
+		if (type == LOG_ARG_INT)
+			value = (unsigned int) arg;
+		else if (type == LOG_ARG_LONG)
+			value = (unsigned long) arg;
+		else if (type == LOG_ARG_SIZE)
+			value = (size_t) arg;
+		else
+			value = (uint64_t) arg;
+		if (spec->conversion == 'o')
+			base = 8;
+		else if (spec->conversion == 'x' || spec->conversion == 'X')
+			base = 16;
+		if (spec->alt && base == 16 && value != 0) {
+			field->prefix[n++] = '0';
+			field->prefix[n++] = spec->conversion;
+		}
+	}
+	field->prefix[n] = '\0';
+
+	/* %.0d of 0 prints nothing */
+	if (spec->precision == 0 && value == 0) {
+		if (spec->alt && base == 8)
+			field->digits[field->length++] = '0';
+		return;
+	}
+	log_digits(field, value, base, spec->conversion == 'X', spec->precision);
+	if (spec->alt && base == 8 && field->digits[0] != '0') {
+		for (int i=field->length; i>0; i--)
+			field->digits[i] = field->digits[i-1];
+		field->digits[0] = '0';
+		field->length++;
+	}
+}
+
+/**
+ * Formats a double as digits.digits, without a sign
+ *
+ * Values the integer part of which does not fit in 64 bits are left to log_exponent() by the caller.
+ * @param[out]	field The field, digits are added to its end
+ * @param[in]	value The value, not negative
+ * @param[in]	precision Digits after the point, at most 17 are significant, as many as a double has
+ * @param[in]	point 1 to write the point even without digits after it
+ */
+static void log_fixed(struct log_field_t *field, double value, int precision, int point)
+{
+	uint64_t scale = 1;
+	uint64_t whole = (uint64_t) value;
+	uint64_t fraction;
+	double scaled;
+	int digits = precision > 17 ? 17 : precision;
+
+	for (int i=0; i<digits; i++)
+		scale *= 10;
+	/* halves go to the even digit, as printf() does */
+	scaled = (value - (double) whole) * (double) scale;
+	fraction = (uint64_t) scaled;
+	if (scaled - (double) fraction > 0.5 || (scaled - (double) fraction == 0.5 && ((digits ? fraction : whole) & 1)))
+		fraction++;
+	if (fraction >= scale) {
+		whole++;
+		fraction -= scale;
+	}
+
+	log_digits(field, whole, 10, 0, 1);
+	if (precision > 0 || point)
+		field->digits[field->length++] = '.';
+	if (digits > 0)
+		log_digits(field, fraction, 10, 0, digits);
+	for (int i=digits; i<precision && field->length < (int) sizeof(field->digits) - 32; i++)
+		field->digits[field->length++] = '0';
+}
+
+/**
+ * Rounds a double to a number of decimals, as %f does, and keeps the significant digits
+ *
+ * Used for %e where the decimals fit, the digits then do not suffer the error of dividing the value
+ * by a power of 10.
+ * @param[out]	field Takes the digits, without the point
+ * @param[in]	value The value, positive and below 2^64
+ * @param[in]	decimals Digits after the point, at most 17
+ * @return the number of digits
+ */
+static int log_significant(struct log_field_t *field, double value, int decimals)
+{
+	struct log_field_t fixed;
+	int n = 0;
+
+	fixed.length = 0;
+	log_fixed(&fixed, value, decimals, 0);
+	for (int i=0; i<fixed.length; i++) {
+		if (fixed.digits[i] == '.' || (n == 0 && fixed.digits[i] == '0'))
+			continue;
+		field->digits[n++] = fixed.digits[i];
+	}
+	field->length = n;
+	return n;
+}
+
+/**
+ * Brings a double into [1, 10)
+ *
+ * @param[in,out]	value The value, positive and finite
+ * @param[in]	precision Digits after the point it is going to be rounded to
+ * @return the power of 10 it was divided by, counting a carry from the rounding
+ */
+static int log_normalise(double *value, int precision)
+{
+	struct log_field_t rounded;
+	double power = 1.0;
+	double scaled = *value;
+	int exponent = 0;
+	int carry;
+
+	while (scaled >= 10.0) {
+		scaled /= 10.0;
+		exponent++;
+	}
+	while (scaled < 1.0) {
+		scaled *= 10.0;
+		exponent--;
+	}
+	/* one division by an exact power of 10 where there is one, rather than the error of each step */
+	if (exponent >= -22 && exponent <= 22) {
+		for (int i=0; i < (exponent < 0 ? -exponent : exponent); i++)
+			power *= 10.0;
+		scaled = (exponent < 0) ? *value * power : *value / power;
+	}
+
+	/* rounding may carry into the next power of 10 */
+	rounded.length = 0;
+	if (precision - exponent >= 0 && precision - exponent <= 17 && *value < 1.8e19) {
+		carry = log_significant(&rounded, *value, precision - exponent) > precision + 1;
+	} else {
+		log_fixed(&rounded, scaled, precision, 0);
+		carry = rounded.length > 1 && rounded.digits[0] == '1' && rounded.digits[1] == '0';
+	}
+	if (carry) {
+		scaled /= 10.0;
+		exponent++;
+	}
+	*value = scaled;
+	return exponent;
+}
+
+/**
+ * Formats a double as d.ddde+xx, without a sign
+ *
+ * @param[out]	field The field, digits are added to its end
+ * @param[in]	value The value, not negative
+ * @param[in]	precision Digits after the point
+ * @param[in]	point 1 to write the point even without digits after it
+ * @param[in]	upper 1 for E
+ */
+static void log_exponent(struct log_field_t *field, double value, int precision, int point, int upper)
+{
+	struct log_field_t significant;
+	double mantissa = value;
+	int exponent = 0;
+
+	if (value != 0.0)
+		exponent = log_normalise(&mantissa, precision);
+	if (value != 0.0 && precision - exponent >= 0 && precision - exponent <= 17 && value < 1.8e19) {
+		log_significant(&significant, value, precision - exponent);
+		field->digits[field->length++] = significant.digits[0];
+		if (precision > 0 || point)
+			field->digits[field->length++] = '.';
+		for (int i=1; i<=precision; i++)
+			field->digits[field->length++] = significant.digits[i];
+	} else {
+		log_fixed(field, mantissa, precision, point);
+	}
+	field->digits[field->length++] = upper ? 'E' : 'e';
+	field->digits[field->length++] = exponent < 0 ? '-' : '+';
+	log_digits(field, (uint64_t) (exponent < 0 ? -exponent : exponent), 10, 0, 2);
+}
+
+/**
+ * Drops the trailing zeros after the point, and the point if nothing is left after it, for %g
+ *
+ * @param[in,out]	field The field
+ */
+static void log_strip_zeros(struct log_field_t *field)
+{
+	int point = -1;
+	int end = field->length;
+	int cut;
+
+	for (int i=0; i<field->length; i++) {
+		if (field->digits[i] == '.')
+			point = i;
+		if (field->digits[i] == 'e' || field->digits[i] == 'E') {
+			end = i;
+			break;
+		}
+	}
+	if (point < 0)
+		return;
+
+	cut = end;
+	while (cut > point + 1 && field->digits[cut-1] == '0')
+		cut--;
+	if (cut == point + 1)
+		cut = point;
+	for (int i=end; i<field->length; i++)
+		field->digits[cut + i - end] = field->digits[i];
+	field->length -= end - cut;
+}
+
+/**
+ * Formats a floating point conversion, f e E g G
+ *
+ * @param[out]	field The field
+ * @param[in]	spec The conversion
+ * @param[in]	value The value
+ */
+static void log_double(struct log_field_t *field, const struct log_spec_t *spec, double value)
+{
+	int precision = spec->precision < 0 ? 6 : spec->precision;
+	int upper = spec->conversion == 'E' || spec->conversion == 'G';
+	double mantissa;
+	int exponent = 0;
+	int n = 0;
+
+	if (value < 0.0 || (value == 0.0 && 1.0 / value < 0.0)) {
+		field->prefix[n++] = '-';
+		value = -value;
+	} else if (spec->sign) {
+		field->prefix[n++] = spec->sign;
+	}
+	field->prefix[n] = '\0';
+
+	if (value != value) {
+		field->text = upper ? "NAN" : "nan";
+		field->length = 3;
+		return;
+	}
+	if (value > 1.7976931348623157e308) {
+		field->text = upper ? "INF" : "inf";
+		field->length = 3;
+		return;
+	}
+
+	switch (spec->conversion) {
+	case 'f':
+		if (value < 1.8e19)
+			log_fixed(field, value, precision, spec->alt);
+		else
+			log_exponent(field, value, precision, spec->alt, 0);
+		break;
+	case 'e': case 'E':
+		log_exponent(field, value, precision, spec->alt, upper);
+		break;
+	default: /* g G, the exponent %e would print decides between the two */
+		if (precision == 0)
+			precision = 1;
+		mantissa = value;
+		if (value != 0.0)
+			exponent = log_normalise(&mantissa, precision - 1);
+		if (exponent < -4 || exponent >= precision)
+			log_exponent(field, value, precision - 1, spec->alt, upper);
+		else
+			log_fixed(field, value, precision - 1 - exponent, spec->alt);
+		if (!spec->alt)
+			log_strip_zeros(field);
+		break;
+	}
+}
+
+/**
+ * Formats a pointer conversion, s p
+ *
+ * @param[out]	field The field
+ * @param[in]	spec The conversion
+ * @param[in]	arg The raw argument
+ */
+static void log_pointer(struct log_field_t *field, const struct log_spec_t *spec, int64_t arg)
+{
+	if (spec->conversion == 's') {
+		field->text = (arg == 0) ? "(null)" : (const char *) (intptr_t) arg;
+		while (field->text[field->length] && (spec->precision < 0 || field->length < spec->precision))
+			field->length++;
+		return;
+	}
+	if (arg == 0) {
+		field->text = "(nil)";
+		field->length = 5;
+		return;
+	}
+	field->prefix[0] = '0';
+	field->prefix[1] = 'x';
+	field->prefix[2] = '\0';
+	log_digits(field, (uint64_t) (uintptr_t) arg, 16, 0, 1);
+}
+
+/**
+ * Copies characters to a line, as far as they fit
+ *
+ * @param[in,out]	line Buffer of LOG_LINE_LENGTH bytes
+ * @param[in]	len Characters already in the line
+ * @param[in]	text The characters
+ * @param[in]	n Number of characters
+ * @return the new length of the line
+ */
+static int log_append(char *line, int len, const char *text, int n)
+{
+	for (int i=0; i<n && len < LOG_LINE_LENGTH - 1; i++)
+		line[len++] = text[i];
+	return len;
+}
+
+/**
+ * Copies a field to a line, padded to its width
+ *
+ * @param[in,out]	line Buffer of LOG_LINE_LENGTH bytes
+ * @param[in]	len Characters already in the line
+ * @param[in]	spec The conversion
+ * @param[in]	field The field
+ * @return the new length of the line
+ */
+static int log_emit(char *line, int len, const struct log_spec_t *spec, const struct log_field_t *field)
+{
+	int floating = spec->conversion == 'f' || spec->conversion == 'e' || spec->conversion == 'E' || spec->conversion == 'g' || spec->conversion == 'G';
+	int prefix = 0;
+	int pad;
+
+	while (field->prefix[prefix])
+		prefix++;
+	pad = spec->width - prefix - field->length;
+
+	/* the 0 flag pads between the sign and the digits, but not once a precision is given to an integer */
+	if (spec->zero && !spec->left && field->text == NULL && (floating || spec->precision < 0)) {
+		len = log_append(line, len, field->prefix, prefix);
+		for (; pad > 0; pad--)
+			len = log_append(line, len, "0", 1);
+	} else if (!spec->left) {
+		for (; pad > 0; pad--)
+			len = log_append(line, len, " ", 1);
+		len = log_append(line, len, field->prefix, prefix);
+	} else {
+		len = log_append(line, len, field->prefix, prefix);
+	}
+	len = log_append(line, len, field->text ? field->text : field->digits, field->length);
+	for (; pad > 0; pad--)
+		len = log_append(line, len, " ", 1);
+	return len;
+}
+
+/**
+ * Formats a record
+ *
+ * The conversions are done here rather than by snprintf(), a TwinCAT3 module cannot count on the
+ * C library, so both platforms format the same way. Everything log_conversion() knows is handled,
+ * %f of a value of 2^64 or more is written as %e.
+ * @param[out]	line Buffer of LOG_LINE_LENGTH bytes
+ * @param[in]	record The record
+ */
+static void log_format(char *line, const struct log_record_t *record)
+{
+	const char *p = record->fmt;
+	const char *start;
+	struct log_spec_t spec;
+	struct log_field_t field;
+	union log_double_t bits;
+	int len;
+	int arg = 0;
+	int type;
+
+	field.prefix[0] = '\0';
+	field.length = 0;
+	field.text = NULL;
+	log_digits(&field, record->cycle, 10, 0, 1);
+	len = log_append(line, 0, "[", 1);
+	len = log_append(line, len, field.digits, field.length);
+	len = log_append(line, len, "] ", 2);
+
+	while (*p && len < LOG_LINE_LENGTH - 1) {
+		if (*p != '%') {
+			line[len++] = *p++;
+			continue;
+		}
+
+		start = p + 1;
+		p = log_conversion(start, &type);
+		if (type == LOG_ARG_NONE) {
+			if (p[-1] == '%')
+				line[len++] = '%';
+			continue;
+		}
+		if (arg >= (int) record->nargs)
+			break;
+
+		log_spec(start, p, &spec);
+		field.prefix[0] = '\0';
+		field.length = 0;
+		field.text = NULL;
+		switch (type) {
+		case LOG_ARG_PTR:
+			log_pointer(&field, &spec, record->args[arg]);
+			break;
+		case LOG_ARG_DOUBLE:
+			bits.i = record->args[arg];
+			log_double(&field, &spec, bits.d);
+			break;
+		default:
+			log_integer(&field, &spec, type, record->args[arg]);
+			break;
+		}
+		arg++;
+		len = log_emit(line, len, &spec, &field);
+	}
+	line[len] = '\0';
+}
+
+/**
+ * Prints a formatted line
+ *
+ * @param[in]	m_Trace A reference to TwinCAT3's m_Trace object. This argument is not present under SOEM.
+ * @param[in]	line The line
+ */
+static void log_print(LOG_TRACE_ARG const char *line)
+{
+#ifdef TC_VER
+	printf("%s", line);
+#else
+	fputs(line, stdout);
+#endif
+	log_stats.printed++;
+}
+
+/**
+ * Formats and prints a message of the log's own
+ *
+ * @param[in]	m_Trace A reference to TwinCAT3's m_Trace object. This argument is not present under SOEM.
+ * @param[in]	cycle Cycle to print the message with
+ * @param[in]	fmt The message, with at most two conversions
+ * @param[in]	first First argument
+ * @param[in]	second Second argument
+ */
+static void log_note(LOG_TRACE_ARG uint32_t cycle, const char *fmt, int64_t first, int64_t second)
+{
+	char line[LOG_LINE_LENGTH];
+	struct log_record_t note;
+
+	note.fmt = fmt;
+	note.cycle = cycle;
+	note.nargs = 2;
+	note.args[0] = first;
+	note.args[1] = second;
+	log_format(line, &note);
+	log_print(LOG_TRACE line);
+}
+
+/**
+ * Prints how often the last message was repeated, if it was
+ *
+ * @param[in]	m_Trace A reference to TwinCAT3's m_Trace object. This argument is not present under SOEM.
+ */
+static void log_print_repeats(LOG_TRACE_ONLY_ARG)
+{
+	if (log_repeats == 0)
+		return;
+	log_note(LOG_TRACE log_last_cycle, "last message repeated %u times\n", log_repeats, 0);
+	log_repeats = 0;
+}
+
+/**
+ * Counts a record against its format's rate limit
+ *
+ * @param[in]	m_Trace A reference to TwinCAT3's m_Trace object. This argument is not present under SOEM.
+ * @param[in]	record The record
+ * @return 1 if the record should be printed, 0 if it is over the limit
+ */
+static int log_rate_allow(LOG_TRACE_ARG const struct log_record_t *record)
+{
+	struct log_rate_t *rate = NULL;
+	uint32_t slot = (uint32_t) (((uintptr_t) record->fmt >> 2) % LOG_RATE_SLOTS);
+
+	for (int i=0; i<LOG_RATE_SLOTS; i++) {
+		rate = &log_rates[(slot + i) % LOG_RATE_SLOTS];
+		if (rate->fmt == record->fmt)
+			break;
+		if (rate->fmt == NULL) {
+			rate->fmt = record->fmt;
+			rate->window_start = record->cycle;
+			rate->count = 0;
+			rate->suppressed = 0;
+			break;
+		}
+		rate = NULL;
+	}
+	/* every slot is taken, do not limit this format */
+	if (rate == NULL)
+		return 1;
+
+	if (record->cycle - rate->window_start >= LOG_RATE_WINDOW) {
+		if (rate->suppressed) {
+			log_note(LOG_TRACE record->cycle, "%u messages suppressed: %s", rate->suppressed, (intptr_t) rate->fmt);
+		}
+		rate->window_start = record->cycle;
+		rate->count = 0;
+		rate->suppressed = 0;
+	}
+
+	if (++rate->count > LOG_RATE_LIMIT) {
+		rate->suppressed++;
+		log_stats.suppressed++;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Prints anything that has been held back and is not going to be added to any more
+ *
+ * @param[in]	m_Trace A reference to TwinCAT3's m_Trace object. This argument is not present under SOEM.
+ * @param[in]	force Print everything that has been held back, regardless of its age
+ */
+static void log_idle(LOG_TRACE_ARG int force)
+{
+	struct log_rate_t *rate;
+
+	if (log_repeats && (force || cycle_count - log_last_cycle >= LOG_RATE_WINDOW))
+		log_print_repeats(LOG_TRACE_ONLY);
+
+	for (int i=0; i<LOG_RATE_SLOTS; i++) {
+		rate = &log_rates[i];
+		if (rate->fmt == NULL || rate->suppressed == 0)
+			continue;
+		if (!force && cycle_count - rate->window_start < LOG_RATE_WINDOW)
+			continue;
+		log_note(LOG_TRACE cycle_count, "%u messages suppressed: %s", rate->suppressed, (intptr_t) rate->fmt);
+		rate->suppressed = 0;
+	}
+}
+
+/**
+ * Formats and prints a record, folding repeats and applying the rate limit
+ *
+ * @param[in]	m_Trace A reference to TwinCAT3's m_Trace object. This argument is not present under SOEM.
+ * @param[in]	record The record
+ */
+static void log_record(LOG_TRACE_ARG const struct log_record_t *record)
+{
+	char line[LOG_LINE_LENGTH];
+	int same;
+
+	same = log_last.fmt == record->fmt && log_last.nargs == record->nargs;
+	for (uint32_t i=0; same && i<record->nargs; i++)
+		same = log_last.args[i] == record->args[i];
+	if (same) {
+		log_repeats++;
+		log_last_cycle = record->cycle;
+		log_stats.repeated++;
+		return;
+	}
+	log_print_repeats(LOG_TRACE_ONLY);
+
+	log_last = *record;
+	log_last_cycle = record->cycle;
+
+	if (!log_rate_allow(LOG_TRACE record))
+		return;
+
+	log_format(line, record);
+	log_print(LOG_TRACE line);
+}
+
+/**
+ * Formats and prints what has been logged
+ *
+ * Only one thread may call this at a time. Under SOEM the log thread does (see log_start()).
+ * @param[in]	m_Trace A reference to TwinCAT3's m_Trace object. This argument is not present under SOEM.
+ * @param[in]	max Maximum number of records to take out of the rings, 0 for no limit
+ * @return number of records taken out of the rings
+ */
+#ifdef TC_VER
+int log_flush(CTcTrace &m_Trace, int max)
+#else
+int log_flush(int max)
+#endif
+{
+	struct log_ring_t *ring;
+	uint32_t dropped;
+	uint32_t tail;
+	int done = 0;
+
+	for (int i=0; i<LOG_MAX_THREADS; i++) {
+		ring = &log_rings[i];
+
+		tail = ring->tail;
+		while (tail != ring->head && (max <= 0 || done < max)) {
+			/* do not read the record before seeing head move past it */
+			LOG_BARRIER();
+			log_record(LOG_TRACE &ring->records[tail & (LOG_RING_LENGTH - 1)]);
+			LOG_BARRIER();
+			ring->tail = ++tail;
+			log_stats.records++;
+			done++;
+		}
+
+		dropped = ring->dropped;
+		if (dropped != log_rings_dropped[i]) {
+			log_print_repeats(LOG_TRACE_ONLY);
+			log_note(LOG_TRACE cycle_count, "%u messages dropped, log ring %d was full\n", dropped - log_rings_dropped[i], i);
+			log_stats.dropped += dropped - log_rings_dropped[i];
+			log_rings_dropped[i] = dropped;
+		}
+	}
+
+	if (done == 0)
+		log_idle(LOG_TRACE 0);
+
+	return done;
+}
+
+#ifndef TC_VER
+/**
+ * Log thread, formats what has been logged every LOG_FLUSH_PERIOD_US
+ *
+ * @param[in]	ptr unused
+ */
+static void *log_thread(void *ptr)
+{
+	while (log_running) {
+		if (log_flush(0))
+			fflush(stdout);
+		usleep(LOG_FLUSH_PERIOD_US);
+	}
+	return NULL;
+}
+
+/**
+ * Starts the log thread
+ *
+ * @return LOG_ERR_SUCCESS on success, LOG_ERR_THREAD if the thread could not be created
+ */
+int log_start(void)
+{
+	log_running = 1;
+	if (pthread_create(&log_thread_handle, NULL, log_thread, NULL) != 0) {
+		log_running = 0;
+		return LOG_ERR_THREAD;
+	}
+	return LOG_ERR_SUCCESS;
+}
+
+/**
+ * Stops the log thread and prints whatever is left
+ */
+void log_stop(void)
+{
+	if (log_running) {
+		log_running = 0;
+		pthread_join(log_thread_handle, NULL);
+	}
+	log_flush(0);
+	log_idle(1);
+	if (log_no_ring)
+		printf("%u messages lost, more than %d threads logged\n", log_no_ring, LOG_MAX_THREADS);
+	fflush(stdout);
+}
+#endif
@@ -0,0 +1,78 @@
+/* log.h
+ * this file defines a binary log for the control paths
+ * log_write() only stores the format string's address and the raw arguments in a ring owned by the
+ * calling thread, the formatting is done later by log_flush() outside of the cycle
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#ifdef TC_VER /* If a twincat 3 version is defined */
+#include "stdint.h"
+#include "TcInterfaces.h"
+#else
+#include <stdint.h>
+#endif
+
+#define LOG_MAX_ARGS 8
+/* must be a power of 2 */
+#define LOG_RING_LENGTH 256
+/* under TwinCAT3 everything is logged from the cycle so one ring is enough */
+#ifdef TC_VER
+#define LOG_MAX_THREADS 1
+#else
+#define LOG_MAX_THREADS 4
+#endif
+
+/* a format is rate limited to LOG_RATE_LIMIT messages every LOG_RATE_WINDOW cycles */
+#define LOG_RATE_LIMIT 20
+#define LOG_RATE_WINDOW 10000
+#define LOG_RATE_SLOTS 64
+
+/* records formatted per call to log_flush() from the TwinCAT3 cycle */
+#define LOG_FLUSH_PER_CYCLE 1
+
+#define LOG_ERR_SUCCESS 0
+#define LOG_ERR_NO_RING -1
+#define LOG_ERR_THREAD -2
+
+struct log_record_t {
+	const char *fmt; /* the format string, its address identifies the message */
+	uint32_t cycle; /* cycle_count when the message was written */
+	uint32_t nargs;
+	int64_t args[LOG_MAX_ARGS]; /* raw arguments, doubles are stored as their bit pattern */
+};
+
+struct log_ring_t {
+	struct log_record_t records[LOG_RING_LENGTH];
+	volatile uint32_t head; /* only written by the thread owning the ring */
+	volatile uint32_t tail; /* only written by log_flush() */
+	volatile uint32_t dropped; /* records lost because the ring was full */
+};
+
+struct log_stats_t {
+	uint32_t records; /* records taken out of the rings */
+	uint32_t printed;
+	uint32_t repeated; /* identical to the message before and folded into it */
+	uint32_t suppressed; /* over the rate limit */
+	uint32_t dropped;
+};
+
+extern struct log_stats_t log_stats;
+
+void log_write(const char *fmt, ...);
+
+#ifdef TC_VER
+int log_flush(CTcTrace &m_Trace, int max);
+#else
+int log_flush(int max);
+int log_start(void);
+void log_stop(void);
+#endif
+
+#endif /* __LOG_H__ */
@@ -0,0 +1,211 @@
+/** \file
+ * \brief Compares the socket and packet ring frame paths
+ *
+ * Sends EtherCAT frames out of one interface and times how long they take to come back through a
+ * reflector on another, once with send()/recv() as SOEM does and once through the packet ring
+ * (packet_ring.c). The reflector always uses plain sockets so only the master side differs.
+ * Reports the round trip times and the CPU time the master thread spent per frame.
+ *
+ * The interfaces are normally a veth pair:
+ *	ip link add veth0 type veth peer name veth1
+ *	ip link set veth0 up
+ *	ip link set veth1 up
+ * Usage (as root): nic_bench veth0 veth1 [frames]
+ * Give it two cores, with one the master and the reflector have to take turns.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+
+#include "packet_ring.h"
+
+#define ETH_P_ECAT 0x88a4
+#define BENCH_FRAME_LENGTH 60
+#define BENCH_TIMEOUT_NS 100000000LL
+/* payload bytes, after the ethernet header */
+#define BENCH_REFLECTED 14
+#define BENCH_SEQUENCE 16
+
+static volatile int reflector_running = 1;
+/* with a single core the reflector only runs when the master gives way */
+static int bench_yield = 0;
+
+static int64_t bench_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Opens a raw EtherCAT socket on an interface, the same way SOEM does
+ *
+ * @param[in]	ifname The interface
+ * @return the socket, or -1 on failure
+ */
+static int bench_socket(const char *ifname)
+{
+	struct sockaddr_ll sll;
+	int sock = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ECAT));
+
+	if (sock < 0)
+		return -1;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = if_nametoindex(ifname);
+	sll.sll_protocol = htons(ETH_P_ECAT);
+	if (sll.sll_ifindex == 0 || bind(sock, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * Reflector thread, sends every frame it has not already reflected back marked as reflected
+ *
+ * @param[in]	ptr pointer to the reflector's socket
+ */
+static void *reflector(void *ptr)
+{
+	int sock = *(int *) ptr;
+	uint8_t frame[1518];
+	ssize_t len;
+
+	while (reflector_running) {
+		len = recv(sock, frame, sizeof(frame), MSG_DONTWAIT);
+		if (len < BENCH_FRAME_LENGTH || frame[BENCH_REFLECTED]) {
+			/* on a single core the master could not run otherwise */
+			sched_yield();
+			continue;
+		}
+		frame[BENCH_REFLECTED] = 1;
+		send(sock, frame, len, 0);
+	}
+	return NULL;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a;
+	int64_t y = *(const int64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Times round trips through the reflector
+ *
+ * @param[in]	name Name of the path, for the report
+ * @param[in]	sock The master's socket
+ * @param[in]	ring The socket's packet ring, NULL to use send()/recv()
+ * @param[in]	frames Number of round trips
+ * @return 0 on success, -1 if a frame did not come back
+ */
+static int bench_run(const char *name, int sock, struct packet_ring_t *ring, int frames)
+{
+	uint8_t frame[BENCH_FRAME_LENGTH];
+	uint8_t reply[1518];
+	int64_t *rtt = malloc(frames * sizeof(int64_t));
+	int64_t cpu, start, end;
+	int64_t total = 0;
+	ssize_t len;
+	uint32_t sequence;
+
+	memset(frame, 0, sizeof(frame));
+	memset(frame, 0xff, 6);
+	frame[12] = ETH_P_ECAT >> 8;
+	frame[13] = ETH_P_ECAT & 0xff;
+
+	cpu = bench_ns(CLOCK_THREAD_CPUTIME_ID);
+	for (int i=0; i<frames; i++) {
+		sequence = (uint32_t) i;
+		memcpy(&frame[BENCH_SEQUENCE], &sequence, sizeof(sequence));
+
+		start = bench_ns(CLOCK_MONOTONIC);
+		if (ring != NULL)
+			packet_ring_send(ring, frame, sizeof(frame));
+		else
+			send(sock, frame, sizeof(frame), 0);
+
+		/* busy poll like SOEM's receive loop, skipping our own outgoing frame */
+		while (1) {
+			if (ring != NULL)
+				len = packet_ring_recv(ring, reply, sizeof(reply), NULL);
+			else
+				len = recv(sock, reply, sizeof(reply), MSG_DONTWAIT);
+			if (len >= BENCH_FRAME_LENGTH && reply[BENCH_REFLECTED] && memcmp(&reply[BENCH_SEQUENCE], &sequence, sizeof(sequence)) == 0)
+				break;
+			if (bench_yield)
+				sched_yield();
+			if (bench_ns(CLOCK_MONOTONIC) - start > BENCH_TIMEOUT_NS) {
+				printf("%s: frame %d did not come back\n", name, i);
+				free(rtt);
+				return -1;
+			}
+		}
+		end = bench_ns(CLOCK_MONOTONIC);
+		rtt[i] = end - start;
+		total += rtt[i];
+	}
+	cpu = bench_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+
+	qsort(rtt, frames, sizeof(int64_t), compare_ns);
+	printf("%-8s round trip ns: min %lld median %lld p99 %lld max %lld mean %lld, cpu %lld ns per frame\n",
+		name, (long long) rtt[0], (long long) rtt[frames / 2], (long long) rtt[frames * 99 / 100],
+		(long long) rtt[frames - 1], (long long) (total / frames), (long long) (cpu / frames));
+
+	free(rtt);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = (argc > 3) ? atoi(argv[3]) : 100000;
+	int master, slave;
+	pthread_t reflector_handle;
+	struct packet_ring_t *ring;
+
+	if (argc < 3 || frames <= 0) {
+		printf("usage: %s <master interface> <reflector interface> [frames]\n", argv[0]);
+		return 1;
+	}
+
+	master = bench_socket(argv[1]);
+	slave = bench_socket(argv[2]);
+	if (master < 0 || slave < 0) {
+		printf("could not open %s and %s, are they up and are we root?\n", argv[1], argv[2]);
+		return 1;
+	}
+	bench_yield = sysconf(_SC_NPROCESSORS_ONLN) < 2;
+	if (bench_yield)
+		printf("only one cpu, polling loops yield to each other, times include the context switches\n");
+	pthread_create(&reflector_handle, NULL, reflector, &slave);
+
+	bench_run("socket", master, NULL, frames);
+
+	if (packet_ring_open(master) != PACKET_RING_ERR_SUCCESS) {
+		printf("could not set up the packet ring on %s\n", argv[1]);
+	} else {
+		ring = packet_ring_find(master);
+		bench_run("ring", master, ring, frames);
+		printf("ring: %u sent, %u received, %u transmit ring full\n", ring->tx_frames, ring->rx_frames, ring->tx_full);
+		packet_ring_close(master);
+	}
+
+	reflector_running = 0;
+	pthread_join(reflector_handle, NULL);
+	close(master);
+	close(slave);
+	return 0;
+}
@@ -0,0 +1,303 @@
+/** \file
+ * \brief Digital output changes scheduled against motion
+ *
+ * Output changes are registered ahead of time and applied by the cycle on the exact cycle they
+ * become due, so they go out in the same frame as the motion they belong to.
+ * Changes can be tied to a cycle, to a number of cycles after a queued move starts (see
+ * wago_queue_last()) or to an axis passing a position. Positions come from the mailbox feedback
+ * (wago_mbx_actual_position()) so position events are only as fine as that feedback, the age of
+ * the feedback at each switch is recorded.
+ *
+ * Every applied event is compared with what was asked for, see output_event_stats.
+ * Trajectories name the magnet of whichever gripper plays them (OUTPUT_MAGNET), output_gripper()
+ * turns that into the outputs configured for a gripper.
+ * A safety stop discards every scheduled event and leaves the outputs as they were, so a held part
+ * is not dropped.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include "output_events.h"
+#include "cycle.h"
+#include "wago_move_queue.h"
+#include "wago_mailbox.h"
+#include "safety.h"
+
+uint8_t *output_events_outputs = NULL;
+struct output_event_stats_t output_event_stats;
+
+static struct output_event_t output_events[OUTPUT_EVENTS_MAX];
+static uint8_t output_grippers[OUTPUT_MAX_GRIPPERS] = OUTPUT_DEFAULT_GRIPPERS;
+
+/**
+ * Finds an unused event
+ *
+ * The io lock must be held.
+ * @return the event, or NULL if every event is in use
+ */
+static struct output_event_t *output_event_alloc(void)
+{
+	for (int i=0; i<OUTPUT_EVENTS_MAX; i++) {
+		if (output_events[i].trigger == OUTPUT_EVENT_FREE)
+			return &output_events[i];
+	}
+	return NULL;
+}
+
+/**
+ * Schedules an output change for a given cycle
+ *
+ * @param[in]	cycle The value of cycle_count on which the outputs should change
+ * @param[in]	mask Outputs to change
+ * @param[in]	value Value to set the masked outputs to
+ * @return OUTPUT_EVENT_ERR_SUCCESS on success, OUTPUT_EVENT_ERR_FULL if there are no free events
+ */
+int output_event_at_cycle(uint32_t cycle, uint8_t mask, uint8_t value)
+{
+	int err;
+
+	IO_LOCK;
+	err = output_event_at_cycle_locked(cycle, mask, value);
+	IO_UNLOCK;
+	return err;
+}
+
+/**
+ * Schedules an output change for a given cycle, with the io lock already held
+ *
+ * As output_event_at_cycle(), for the cycle itself (see planner_play()).
+ * @param[in]	cycle The value of cycle_count on which the outputs should change
+ * @param[in]	mask Outputs to change
+ * @param[in]	value Value to set the masked outputs to
+ * @return OUTPUT_EVENT_ERR_SUCCESS on success, OUTPUT_EVENT_ERR_FULL if there are no free events
+ */
+int output_event_at_cycle_locked(uint32_t cycle, uint8_t mask, uint8_t value)
+{
+	struct output_event_t *event = output_event_alloc();
+
+	if (event == NULL)
+		return OUTPUT_EVENT_ERR_FULL;
+	event->mask = mask;
+	event->value = value;
+	event->cycle = cycle;
+	event->trigger = OUTPUT_EVENT_AT_CYCLE;
+	return OUTPUT_EVENT_ERR_SUCCESS;
+}
+
+/**
+ * Schedules an output change relative to the start of a queued move
+ *
+ * @param[in]	device The wago stepper the move is queued on
+ * @param[in]	move The move number, from wago_queue_last() straight after queuing it
+ * @param[in]	offset Cycles after the move starts
+ * @param[in]	mask Outputs to change
+ * @param[in]	value Value to set the masked outputs to
+ * @return OUTPUT_EVENT_ERR_SUCCESS on success, OUTPUT_EVENT_ERR_FULL if there are no free events
+ */
+int output_event_after_move(int device, unsigned int move, uint32_t offset, uint8_t mask, uint8_t value)
+{
+	int err;
+
+	IO_LOCK;
+	err = output_event_after_move_locked(device, move, offset, mask, value);
+	IO_UNLOCK;
+	return err;
+}
+
+/**
+ * Schedules an output change relative to the start of a queued move, with the io lock already held
+ *
+ * As output_event_after_move(), for scripts (see script.h).
+ * @param[in]	device The wago stepper the move is queued on
+ * @param[in]	move The move number, from wago_queue_last() straight after queuing it
+ * @param[in]	offset Cycles after the move starts
+ * @param[in]	mask Outputs to change
+ * @param[in]	value Value to set the masked outputs to
+ * @return OUTPUT_EVENT_ERR_SUCCESS on success, OUTPUT_EVENT_ERR_FULL if there are no free events
+ */
+int output_event_after_move_locked(int device, unsigned int move, uint32_t offset, uint8_t mask, uint8_t value)
+{
+	struct output_event_t *event = output_event_alloc();
+
+	if (event == NULL)
+		return OUTPUT_EVENT_ERR_FULL;
+	event->mask = mask;
+	event->value = value;
+	event->device = device;
+	event->move = move;
+	event->offset = offset;
+	event->anchored = 0;
+	event->trigger = OUTPUT_EVENT_AFTER_MOVE;
+	return OUTPUT_EVENT_ERR_SUCCESS;
+}
+
+/**
+ * Schedules an output change for when an axis passes a position
+ *
+ * @param[in]	device The wago stepper to watch
+ * @param[in]	position The position to pass
+ * @param[in]	direction 1 if the axis is moving up through the position, -1 if it is moving down
+ * @param[in]	mask Outputs to change
+ * @param[in]	value Value to set the masked outputs to
+ * @return OUTPUT_EVENT_ERR_SUCCESS on success, OUTPUT_EVENT_ERR_FULL if there are no free events
+ */
+int output_event_at_position(int device, int32_t position, int direction, uint8_t mask, uint8_t value)
+{
+	struct output_event_t *event;
+
+	IO_LOCK;
+	event = output_event_alloc();
+	if (event == NULL) {
+		IO_UNLOCK;
+		return OUTPUT_EVENT_ERR_FULL;
+	}
+	event->mask = mask;
+	event->value = value;
+	event->device = device;
+	event->position = position;
+	event->direction = direction;
+	event->trigger = OUTPUT_EVENT_AT_POSITION;
+	IO_UNLOCK;
+
+	return OUTPUT_EVENT_ERR_SUCCESS;
+}
+
+/**
+ * Counts the events that have not been applied yet
+ *
+ * @return number of scheduled events
+ */
+int output_events_pending(void)
+{
+	int pending = 0;
+	for (int i=0; i<OUTPUT_EVENTS_MAX; i++) {
+		if (output_events[i].trigger != OUTPUT_EVENT_FREE)
+			pending++;
+	}
+	return pending;
+}
+
+/**
+ * Discards every scheduled event
+ */
+void output_events_clear(void)
+{
+	IO_LOCK;
+	for (int i=0; i<OUTPUT_EVENTS_MAX; i++)
+		output_events[i].trigger = OUTPUT_EVENT_FREE;
+	IO_UNLOCK;
+}
+
+/**
+ * Sets the outputs a gripper's magnet is switched through
+ *
+ * Before anything is played on it, the table is not locked.
+ * @param[in]	gripper The gripper, the robot it is on
+ * @param[in]	magnet The outputs, 0 for a gripper with no magnet wired
+ * @return OUTPUT_EVENT_ERR_SUCCESS on success, OUTPUT_EVENT_ERR_GRIPPER if there is no such gripper
+ */
+int output_gripper_configure(int gripper, uint8_t magnet)
+{
+	if (gripper < 0 || gripper >= OUTPUT_MAX_GRIPPERS)
+		return OUTPUT_EVENT_ERR_GRIPPER;
+	output_grippers[gripper] = magnet;
+	return OUTPUT_EVENT_ERR_SUCCESS;
+}
+
+/**
+ * Turns a trajectory's outputs into those of the gripper playing it
+ *
+ * @param[in]	gripper The gripper
+ * @param[in]	bits Outputs as the trajectory names them, OUTPUT_MAGNET
+ * @return the gripper's outputs, none for a gripper out of range
+ */
+uint8_t output_gripper(int gripper, uint8_t bits)
+{
+	if (gripper < 0 || gripper >= OUTPUT_MAX_GRIPPERS || !(bits & OUTPUT_MAGNET))
+		return 0;
+	return output_grippers[gripper];
+}
+
+/**
+ * Works out whether an event is due this cycle
+ *
+ * @param[in,out]	event The event
+ * @return 1 if the event should be applied, 0 otherwise
+ */
+static int output_event_due(struct output_event_t *event)
+{
+	struct wago_move_queue_t *queue;
+	int32_t position;
+	uint32_t age;
+
+	switch (event->trigger) {
+	case OUTPUT_EVENT_AFTER_MOVE:
+		if (!event->anchored) {
+			queue = &wago_move_queues[event->device];
+			if (queue->moves_started == 0 || (int) (queue->running_move - event->move) < 0)
+				return 0;
+			/* if the move has already been and gone this falls due now and is counted as late */
+			event->cycle = ((queue->running_move == event->move) ? queue->running_since : cycle_count) + event->offset;
+			event->anchored = 1;
+		}
+		/* fall through */
+	case OUTPUT_EVENT_AT_CYCLE:
+		return (int32_t) (cycle_count - event->cycle) >= 0;
+	case OUTPUT_EVENT_AT_POSITION:
+		position = wago_mbx_actual_position(event->device, &age);
+		if ((event->direction >= 0) ? (position < event->position) : (position > event->position))
+			return 0;
+
+		output_event_stats.position_error_last = position - event->position;
+		if (output_event_stats.position_error_last < 0)
+			output_event_stats.position_error_last = -output_event_stats.position_error_last;
+		if (output_event_stats.position_error_last > output_event_stats.position_error_max)
+			output_event_stats.position_error_max = output_event_stats.position_error_last;
+		if (age > output_event_stats.position_age_max)
+			output_event_stats.position_age_max = age;
+		/* there is no requested cycle, record it as on time */
+		event->cycle = cycle_count;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Applies every event that is due
+ *
+ * Must be called once per cycle after the motion has been updated, the io lock must already be
+ * held (see cycle_update()).
+ */
+void output_events_update(void)
+{
+	struct output_event_t *event;
+	uint32_t late;
+
+	if (output_events_outputs == NULL)
+		return;
+
+	/* the moves the events belong to have been abandoned, leave the outputs as they are */
+	if (safety_stopped()) {
+		for (int i=0; i<OUTPUT_EVENTS_MAX; i++)
+			output_events[i].trigger = OUTPUT_EVENT_FREE;
+		return;
+	}
+
+	for (int i=0; i<OUTPUT_EVENTS_MAX; i++) {
+		event = &output_events[i];
+		if (event->trigger == OUTPUT_EVENT_FREE || !output_event_due(event))
+			continue;
+
+		*output_events_outputs = (uint8_t) ((*output_events_outputs & ~event->mask) | (event->value & event->mask));
+
+		output_event_stats.applied++;
+		late = cycle_count - event->cycle;
+		if (late) {
+			output_event_stats.late++;
+			if (late > output_event_stats.late_cycles_max)
+				output_event_stats.late_cycles_max = late;
+		}
+		event->trigger = OUTPUT_EVENT_FREE;
+	}
+}
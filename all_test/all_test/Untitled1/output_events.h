@@ -0,0 +1,80 @@
+/* output_events.h
+ * this file defines digital output changes scheduled against motion
+ * the electromagnet gripper is switched through the EL2008 digital outputs, changes can be tied to
+ * a cycle, to a time after a queued move starts, or to an axis passing a position
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __OUTPUT_EVENTS_H__
+#define __OUTPUT_EVENTS_H__
+
+#include "wago_steppers.h"
+
+#define OUTPUT_EVENTS_MAX 32
+
+#define OUTPUT_EVENT_ERR_SUCCESS 0
+#define OUTPUT_EVENT_ERR_FULL -1
+#define OUTPUT_EVENT_ERR_GRIPPER -2
+
+/* a gripper's magnet in the events of a trajectory (trajectory.h), whichever robot it is played on,
+ * output_gripper() turns it into the outputs of that robot's magnet */
+#define OUTPUT_MAGNET 0x01
+/* one gripper per output of the EL2008 at most */
+#define OUTPUT_MAX_GRIPPERS 8
+/* outputs each gripper's magnet is switched through unless configured otherwise
+ * (output_gripper_configure(), soem_main -o), gripper 0 first. The drawings
+ * (Documentation/ElectricalConfiguration) only show the steppers' magnets, not the EL2008 */
+#define OUTPUT_DEFAULT_GRIPPERS {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80}
+
+enum output_event_triggers {
+	OUTPUT_EVENT_FREE = 0,
+	OUTPUT_EVENT_AT_CYCLE,		/* when cycle_count reaches cycle */
+	OUTPUT_EVENT_AFTER_MOVE,	/* offset cycles after a queued move starts */
+	OUTPUT_EVENT_AT_POSITION	/* when an axis's actual position passes position */
+};
+
+struct output_event_t {
+	enum output_event_triggers trigger;
+	uint8_t mask; /* outputs changed by the event */
+	uint8_t value; /* value the masked outputs are set to */
+
+	int device;
+	uint32_t cycle; /* OUTPUT_EVENT_AT_CYCLE: the cycle, OUTPUT_EVENT_AFTER_MOVE: filled in once the move starts */
+	unsigned int move; /* OUTPUT_EVENT_AFTER_MOVE */
+	uint32_t offset; /* OUTPUT_EVENT_AFTER_MOVE */
+	int anchored; /* OUTPUT_EVENT_AFTER_MOVE: cycle has been worked out */
+	int32_t position; /* OUTPUT_EVENT_AT_POSITION */
+	int direction; /* OUTPUT_EVENT_AT_POSITION: 1 when position must be passed going up, -1 going down */
+};
+
+struct output_event_stats_t {
+	uint32_t applied;
+	uint32_t late; /* events applied after the cycle they asked for */
+	uint32_t late_cycles_max;
+	/* position events, difference between the requested position and the one reported at the switch */
+	int32_t position_error_last;
+	int32_t position_error_max;
+	uint32_t position_age_max; /* oldest position feedback an event was switched on, in cycles */
+};
+
+/* points at the digital output byte in the process image, set up by the platform code */
+extern uint8_t *output_events_outputs;
+extern struct output_event_stats_t output_event_stats;
+
+int output_event_at_cycle(uint32_t cycle, uint8_t mask, uint8_t value);
+int output_event_at_cycle_locked(uint32_t cycle, uint8_t mask, uint8_t value);
+int output_event_after_move(int device, unsigned int move, uint32_t offset, uint8_t mask, uint8_t value);
+int output_event_after_move_locked(int device, unsigned int move, uint32_t offset, uint8_t mask, uint8_t value);
+int output_event_at_position(int device, int32_t position, int direction, uint8_t mask, uint8_t value);
+int output_events_pending(void);
+void output_events_clear(void);
+int output_gripper_configure(int gripper, uint8_t magnet);
+uint8_t output_gripper(int gripper, uint8_t bits);
+
+void output_events_update(void);
+
+#endif /* __OUTPUT_EVENTS_H__ */
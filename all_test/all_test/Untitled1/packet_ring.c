@@ -0,0 +1,215 @@
+/** \file
+ * \brief Memory mapped packet ring for the socket SOEM talks to the slaves through
+ *
+ * The socket is given a receive and a transmit ring (PACKET_RX_RING/PACKET_TX_RING) that are
+ * mapped into our address space. Receiving a frame is a poll of the next slot's status, there is
+ * no system call at all, so SOEM's receive loop busy polls the ring until its timeout. Sending
+ * copies the frame into the next transmit slot and flushes it with one sendto(), bypassing the
+ * qdisc where the kernel allows it.
+ *
+ * TPACKET_V2 is used rather than V3: V3 only hands a block of frames over once it is full or its
+ * retire timer (at least a millisecond) has run out, which is far longer than a bus cycle.
+ *
+ * SOEM calls send() and recv() itself, packet_ring_wrap.c redirects the calls for sockets that
+ * have a ring.
+ *
+ * Receiving needs no lock of its own, SOEM holds its rx_mutex around every receive. Sending does:
+ * the ethercat thread sends the process data, and the supervisor (supervisor.c) sends frames of
+ * its own through SOEM at the same time, while SOEM 1.3.0 only holds tx_mutex around the
+ * redundant port. packet_ring_send() takes a spinlock from
+ * reserving the slot until it is handed to the kernel, the copy of one frame is all it waits for.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+
+#include "packet_ring.h"
+
+/* frames are read and written after the header */
+#define PACKET_RING_TX_DATA TPACKET_ALIGN(sizeof(struct tpacket2_hdr))
+
+static struct packet_ring_t packet_rings[PACKET_RING_MAX] = {
+	{ .sock = -1 },
+	{ .sock = -1 }
+};
+
+/**
+ * Finds the ring of a socket
+ *
+ * @param[in]	sock The socket
+ * @return the ring, or NULL if the socket has none
+ */
+struct packet_ring_t *packet_ring_find(int sock)
+{
+	for (int i=0; i<PACKET_RING_MAX; i++) {
+		if (packet_rings[i].sock == sock)
+			return &packet_rings[i];
+	}
+	return NULL;
+}
+
+/**
+ * Gives a bound packet socket a receive and a transmit ring
+ *
+ * Must be called before anything is sent on the socket, frames already queued on it are lost.
+ * @param[in]	sock The socket, as set up by ec_init()
+ * @return PACKET_RING_ERR_SUCCESS on success, PACKET_RING_ERR_TOO_MANY if every ring is in use,
+ * PACKET_RING_ERR_SETUP if the kernel refused the rings
+ */
+int packet_ring_open(int sock)
+{
+	struct packet_ring_t *ring = packet_ring_find(-1);
+	struct tpacket_req req;
+	int version = TPACKET_V2;
+	int bypass = 1;
+
+	if (ring == NULL)
+		return PACKET_RING_ERR_TOO_MANY;
+
+	if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+		return PACKET_RING_ERR_SETUP;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = PACKET_RING_BLOCK_SIZE;
+	req.tp_block_nr = PACKET_RING_BLOCKS;
+	req.tp_frame_size = PACKET_RING_FRAME_SIZE;
+	req.tp_frame_nr = PACKET_RING_FRAMES;
+	if (setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+		return PACKET_RING_ERR_SETUP;
+	if (setsockopt(sock, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+		return PACKET_RING_ERR_SETUP;
+	/* not every kernel has it, frames still go out through the qdisc without it */
+	setsockopt(sock, SOL_PACKET, PACKET_QDISC_BYPASS, &bypass, sizeof(bypass));
+
+	ring->map_size = 2 * PACKET_RING_BLOCK_SIZE * PACKET_RING_BLOCKS;
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, sock, 0);
+	if (ring->map == MAP_FAILED) {
+		/* MAP_LOCKED needs the memlock limit, the ring works without it */
+		ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+		if (ring->map == MAP_FAILED)
+			return PACKET_RING_ERR_SETUP;
+	}
+
+	/* the receive ring comes first in the mapping */
+	ring->rx = ring->map;
+	ring->tx = ring->map + PACKET_RING_BLOCK_SIZE * PACKET_RING_BLOCKS;
+	ring->rx_next = 0;
+	ring->tx_next = 0;
+	ring->rx_frames = 0;
+	ring->tx_frames = 0;
+	ring->rx_truncated = 0;
+	ring->tx_full = 0;
+	if (pthread_spin_init(&ring->tx_lock, PTHREAD_PROCESS_PRIVATE) != 0) {
+		munmap(ring->map, ring->map_size);
+		return PACKET_RING_ERR_SETUP;
+	}
+	ring->sock = sock;
+
+	return PACKET_RING_ERR_SUCCESS;
+}
+
+/**
+ * Unmaps the rings of a socket
+ *
+ * Call before the socket is closed (ec_close()).
+ * @param[in]	sock The socket
+ */
+void packet_ring_close(int sock)
+{
+	struct packet_ring_t *ring = packet_ring_find(sock);
+
+	if (ring == NULL)
+		return;
+	munmap(ring->map, ring->map_size);
+	pthread_spin_destroy(&ring->tx_lock);
+	ring->sock = -1;
+}
+
+/**
+ * Sends a frame through the transmit ring
+ *
+ * May be called from any thread, the ethercat thread and the supervisor both do. A frame sent
+ * while every slot is still waiting for the kernel is dropped and -1 returned, which SOEM counts
+ * as a failed send, this can happen under load.
+ * @param[in]	ring The ring
+ * @param[in]	buf The frame, starting with the ethernet header
+ * @param[in]	len Length of the frame
+ * @return len on success, -1 if the frame is too large, every transmit slot is still in use or
+ * the flush failed
+ */
+ssize_t packet_ring_send(struct packet_ring_t *ring, const void *buf, size_t len)
+{
+	struct tpacket2_hdr *hdr;
+
+	if (len > PACKET_RING_FRAME_SIZE - PACKET_RING_TX_DATA)
+		return -1;
+
+	pthread_spin_lock(&ring->tx_lock);
+	hdr = (struct tpacket2_hdr *) (ring->tx + ring->tx_next * PACKET_RING_FRAME_SIZE);
+	if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+		ring->tx_full++;
+		pthread_spin_unlock(&ring->tx_lock);
+		return -1;
+	}
+
+	memcpy((uint8_t *) hdr + PACKET_RING_TX_DATA, buf, len);
+	hdr->tp_len = len;
+	/* the frame must be in place before the kernel can see the slot */
+	__sync_synchronize();
+	hdr->tp_status = TP_STATUS_SEND_REQUEST;
+	ring->tx_next = (ring->tx_next + 1) % PACKET_RING_FRAMES;
+	ring->tx_frames++;
+	pthread_spin_unlock(&ring->tx_lock);
+
+	/* flushes every slot waiting, a frame queued by another thread meanwhile goes out too */
+	if (sendto(ring->sock, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0)
+		return -1;
+	return len;
+}
+
+/**
+ * Takes the next received frame out of the receive ring
+ *
+ * Never blocks.
+ * @param[in]	ring The ring
+ * @param[out]	buf Buffer for the frame, starting with the ethernet header
+ * @param[in]	len Size of the buffer
+ * @param[out]	stamps The kernel's stamp of the frame laid out like SO_TIMESTAMPING, software in [0]
+ * and hardware in [2]. NULL if not wanted
+ * @return the length of the frame, or 0 if no frame has arrived
+ */
+ssize_t packet_ring_recv(struct packet_ring_t *ring, void *buf, size_t len, struct timespec *stamps)
+{
+	struct tpacket2_hdr *hdr = (struct tpacket2_hdr *) (ring->rx + ring->rx_next * PACKET_RING_FRAME_SIZE);
+	size_t frame_len;
+	int i;
+
+	if (!(hdr->tp_status & TP_STATUS_USER))
+		return 0;
+	/* do not read the frame before seeing the status */
+	__sync_synchronize();
+
+	frame_len = hdr->tp_snaplen;
+	if (frame_len > len) {
+		frame_len = len;
+		ring->rx_truncated++;
+	}
+	memcpy(buf, (uint8_t *) hdr + hdr->tp_mac, frame_len);
+	if (stamps != NULL) {
+		memset(stamps, 0, 3 * sizeof(struct timespec));
+		i = (hdr->tp_status & TP_STATUS_TS_RAW_HARDWARE) ? 2 : 0;
+		stamps[i].tv_sec = hdr->tp_sec;
+		stamps[i].tv_nsec = hdr->tp_nsec;
+	}
+
+	__sync_synchronize();
+	hdr->tp_status = TP_STATUS_KERNEL;
+	ring->rx_next = (ring->rx_next + 1) % PACKET_RING_FRAMES;
+
+	ring->rx_frames++;
+	return frame_len;
+}
@@ -0,0 +1,52 @@
+/* packet_ring.h
+ * this file defines a memory mapped packet ring for the socket SOEM talks to the slaves through
+ * frames are received by polling a ring shared with the kernel instead of a recv() per frame, and
+ * sent through a transmit ring flushed with a single sendto()
+ * SOEM only
+ */
+
+#ifndef __PACKET_RING_H__
+#define __PACKET_RING_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* sizes must keep a whole number of frames in each block, blocks must be a multiple of the page size */
+#define PACKET_RING_BLOCK_SIZE 4096
+#define PACKET_RING_FRAME_SIZE 2048
+#define PACKET_RING_BLOCKS 32
+#define PACKET_RING_FRAMES (PACKET_RING_BLOCKS * (PACKET_RING_BLOCK_SIZE / PACKET_RING_FRAME_SIZE))
+/* the primary port and the redundant one */
+#define PACKET_RING_MAX 2
+
+#define PACKET_RING_ERR_SUCCESS 0
+#define PACKET_RING_ERR_SETUP -1
+#define PACKET_RING_ERR_TOO_MANY -2
+
+struct packet_ring_t {
+	int sock; /* -1 while unused */
+	uint8_t *map;
+	size_t map_size;
+	uint8_t *rx;
+	uint8_t *tx;
+	unsigned int rx_next;
+	unsigned int tx_next;
+	/* held while a transmit slot is reserved and filled, any thread may send */
+	pthread_spinlock_t tx_lock;
+
+	uint32_t rx_frames;
+	uint32_t tx_frames; /* frames put in the transmit ring */
+	uint32_t rx_truncated; /* frames larger than the buffer they were read into */
+	uint32_t tx_full; /* frames not sent because every transmit slot was still in use */
+};
+
+int packet_ring_open(int sock);
+void packet_ring_close(int sock);
+struct packet_ring_t *packet_ring_find(int sock);
+
+ssize_t packet_ring_send(struct packet_ring_t *ring, const void *buf, size_t len);
+ssize_t packet_ring_recv(struct packet_ring_t *ring, void *buf, size_t len, struct timespec *stamps);
+
+#endif /* __PACKET_RING_H__ */
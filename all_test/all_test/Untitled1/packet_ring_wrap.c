@@ -0,0 +1,48 @@
+/** \file
+ * \brief Redirects SOEM's send() and recv() to the packet ring
+ *
+ * SOEM's nicdrv calls send() and recv() on its socket directly. soem_main is linked with
+ * -Wl,--wrap=send -Wl,--wrap=recv so those calls land here instead. Sockets that have been given a
+ * ring (packet_ring_open()) use the ring, everything else goes to the real functions.
+ * Frames received on a socket that is being timestamped (timestamps_enable()) have their stamps
+ * passed on to timestamps.c.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "packet_ring.h"
+#include "timestamps.h"
+
+ssize_t __real_send(int sock, const void *buf, size_t len, int flags);
+ssize_t __real_recv(int sock, void *buf, size_t len, int flags);
+
+ssize_t __wrap_send(int sock, const void *buf, size_t len, int flags)
+{
+	struct packet_ring_t *ring = packet_ring_find(sock);
+
+	if (ring == NULL)
+		return __real_send(sock, buf, len, flags);
+	return packet_ring_send(ring, buf, len);
+}
+
+ssize_t __wrap_recv(int sock, void *buf, size_t len, int flags)
+{
+	struct packet_ring_t *ring = packet_ring_find(sock);
+	struct timespec stamps[3];
+	ssize_t ret;
+
+	if (!timestamps_enabled(sock)) {
+		if (ring == NULL)
+			return __real_recv(sock, buf, len, flags);
+		return packet_ring_recv(ring, buf, len, NULL);
+	}
+
+	if (ring == NULL)
+		return timestamps_recv(sock, buf, len, flags);
+	ret = packet_ring_recv(ring, buf, len, stamps);
+	if (ret > 0)
+		timestamps_frame_received((const uint8_t *) buf, ret, stamps);
+	return ret;
+}
@@ -0,0 +1,168 @@
+/** \file
+ * \brief Process data groups exchanged at different rates
+ *
+ * Slaves that only need updating every few cycles (the WAGO coupler with the steppers) are put in a
+ * group of their own with a frame of its own, the rest of the bus (the AX5000 servos, the EL2008
+ * and the EL1002 the safety scanners are wired to) stays in group 0 and is exchanged every cycle. Leaving the slow frame out of most cycles lowers the bus load and the time the fast
+ * frame spends on the wire, so the fast group can be run at a shorter period.
+ *
+ * Both groups are scheduled by the ethercat thread. On the cycles the slow group is due its frame
+ * is exchanged straight after the fast one and before cycle_update(), so the steppers act on
+ * inputs read in the same cycle, and the outputs cycle_update() writes go out with the group's
+ * next frame, the divider cycles later. A safety stop does not wait for that, the slow frame is
+ * sent again in the cycle the stop is written (see ethercat_cycle()). SOEM 1.3.0 keeps a single
+ * index stack for every frame in flight, so the slow frame is only sent once the fast one is back.
+ *
+ * The fast group's working counter is checked by supervisor_cycle(), the slow group's here. A
+ * short slow frame sets the group's docheckstate so the supervisor thread looks at its slaves.
+ * With a divider of 1 every slave stays in group 0 and the bus is run exactly as it was.
+ */
+
+#include <string.h>
+
+#include "ethercattype.h"
+#include "nicdrv.h"
+#include "ethercatbase.h"
+#include "ethercatmain.h"
+#include "ethercatconfig.h"
+
+#include "pd_groups.h"
+#include "wago_steppers.h"
+
+struct pd_group_t pd_groups[PD_GROUPS];
+
+/**
+ * Decides whether a slave belongs in the slow group
+ *
+ * @param[in]	slave The slave number
+ * @return 1 for the slow group, 0 for the fast one
+ */
+static int pd_groups_is_slow(uint16 slave)
+{
+	/* the safety scanner's EL1002 stays fast, a field violation is seen in the cycle it arrives */
+	if (ec_slave[slave].eep_man == WAGO_VENDOR_ID && ec_slave[slave].eep_id == WAGO_COUPLER_PRODUCT_CODE)
+		return 1;
+	return 0;
+}
+
+/**
+ * Puts every slave in its group
+ *
+ * Must be called after ec_config_init() and before pd_groups_map().
+ * @param[in]	divider The slow group is exchanged every divider cycles, 1 puts every slave in the fast group
+ * @return the number of slaves in the slow group, PD_GROUPS_ERR_DIVIDER if the divider is 0
+ */
+int pd_groups_assign(uint32_t divider)
+{
+	if (divider == 0)
+		return PD_GROUPS_ERR_DIVIDER;
+
+	memset(pd_groups, 0, sizeof(pd_groups));
+	pd_groups[PD_GROUP_FAST].divider = 1;
+	pd_groups[PD_GROUP_SLOW].divider = divider;
+
+	for (uint16 slave=1; slave<=ec_slavecount; slave++) {
+		ec_slave[slave].group = (divider > 1 && pd_groups_is_slow(slave)) ? PD_GROUP_SLOW : PD_GROUP_FAST;
+		pd_groups[ec_slave[slave].group].slaves++;
+	}
+	/* nothing left to run slowly, the slow I/O simply rides in the fast frame */
+	if (pd_groups[PD_GROUP_SLOW].slaves == 0)
+		pd_groups[PD_GROUP_SLOW].divider = 1;
+
+	return pd_groups[PD_GROUP_SLOW].slaves;
+}
+
+/**
+ * Maps every group into the I/O map
+ *
+ * Replaces ec_config_map(), the groups are mapped one after the other.
+ * @param[in]	iomap The I/O map
+ * @return the number of bytes of the I/O map used, PD_GROUPS_ERR_MAP if a group could not be mapped
+ */
+int pd_groups_map(uint8 *iomap)
+{
+	int used = 0;
+	int size;
+
+	for (int group=0; group<PD_GROUPS; group++) {
+		if (pd_groups[group].slaves == 0)
+			continue;
+		size = ec_config_map_group(iomap + used, group);
+		if (size <= 0)
+			return PD_GROUPS_ERR_MAP;
+		used += size;
+		pd_groups[group].wkc_expected = (ec_group[group].outputsWKC * 2) + ec_group[group].inputsWKC;
+	}
+	if (used == 0)
+		return PD_GROUPS_ERR_MAP;
+
+	return used;
+}
+
+/**
+ * Reports whether a group is exchanged on a cycle
+ *
+ * @param[in]	group The group
+ * @param[in]	cycle The cycle number
+ * @return 1 if the group is exchanged, 0 otherwise
+ */
+int pd_groups_due(int group, uint32_t cycle)
+{
+	return (cycle % pd_groups[group].divider) == 0;
+}
+
+/**
+ * Sends a group's frame
+ *
+ * @param[in]	group The group
+ */
+void pd_groups_send(int group)
+{
+	if (pd_groups[group].slaves == 0)
+		return;
+	ec_send_processdata_group(group);
+}
+
+/**
+ * Receives a group's frame and checks its working counter
+ *
+ * @param[in]	group The group
+ * @param[in]	timeout Receive timeout in microseconds
+ * @return the working counter
+ */
+int pd_groups_receive(int group, int timeout)
+{
+	struct pd_group_t *g = &pd_groups[group];
+	int wkc;
+
+	if (g->slaves == 0)
+		return 0;
+
+	wkc = ec_receive_processdata_group(group, timeout);
+	g->wkc_last = wkc;
+	g->exchanges++;
+	if (wkc >= g->wkc_expected)
+		return wkc;
+
+	if (wkc <= 0)
+		g->frames_lost++;
+	else
+		g->frames_short++;
+	/* the supervisor thread finds out which of the group's slaves has left op */
+	ec_group[group].docheckstate = TRUE;
+	return wkc;
+}
+
+/**
+ * Exchanges every group's frame once
+ *
+ * For the state changes, where every slave has to see process data whatever its rate.
+ * @param[in]	timeout Receive timeout in microseconds
+ */
+void pd_groups_exchange_all(int timeout)
+{
+	for (int group=0; group<PD_GROUPS; group++) {
+		pd_groups_send(group);
+		pd_groups_receive(group, timeout);
+	}
+}
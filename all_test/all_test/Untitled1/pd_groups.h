@@ -0,0 +1,45 @@
+/* pd_groups.h
+ * this file defines the process data groups and the rate each of them is exchanged at
+ * the servo drives, the fast outputs and the safety scanner input are exchanged every cycle, the
+ * WAGO steppers only every Nth cycle in a frame of their own
+ * SOEM only, TwinCAT3 runs the slow I/O in a task of its own
+ */
+
+#ifndef __PD_GROUPS_H__
+#define __PD_GROUPS_H__
+
+#include <stdint.h>
+
+#include "ethercattype.h"
+#include "ethercatmain.h"
+
+/* SOEM 1.3.0 only has two groups (EC_MAXGROUP) */
+#define PD_GROUP_FAST 0
+#define PD_GROUP_SLOW 1
+#define PD_GROUPS 2
+
+#define PD_GROUPS_ERR_SUCCESS 0
+#define PD_GROUPS_ERR_MAP -1
+#define PD_GROUPS_ERR_DIVIDER -2
+
+struct pd_group_t {
+	uint32_t divider; /* exchanged on every divider'th cycle */
+	int slaves;
+	int wkc_expected;
+	int wkc_last;
+	uint32_t exchanges;
+	uint32_t frames_lost; /* exchanges where no frame came back */
+	uint32_t frames_short; /* exchanges where the working counter was lower than expected */
+};
+
+extern struct pd_group_t pd_groups[PD_GROUPS];
+
+int pd_groups_assign(uint32_t divider);
+int pd_groups_map(uint8 *iomap);
+
+int pd_groups_due(int group, uint32_t cycle);
+void pd_groups_send(int group);
+int pd_groups_receive(int group, int timeout);
+void pd_groups_exchange_all(int timeout);
+
+#endif /* __PD_GROUPS_H__ */
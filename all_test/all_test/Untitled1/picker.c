@@ -0,0 +1,312 @@
+/** \file
+ * \brief Thread picking the parts off the conveyor
+ *
+ * picker_start() runs a thread that takes each part the photo eye registers, has the scheduler
+ * choose a robot for it and plan its pick (scheduler_assign()), and queues the pick with that
+ * robot's planner (planner_submit_trajectory()). It is then the only thread that may queue
+ * anything with the planner.
+ *
+ * A robot with PICKER_MAX_AHEAD picks queued is left out of the choice until it has played one, as
+ * is one whose axes would not play a pick (planner_ready()), stopped by the safety fields, halted
+ * or not enabled, so its parts go to the others or are missed. A robot with nothing queued starts its timeline again from where its servos say it is, which also
+ * picks it back up after a stop dropped its queue.
+ *
+ * Parts lying still in a robot's reach, on a tray or a table, are handed over as pick and place
+ * jobs (picker_add_job()) from any thread. The picking thread takes them into that robot's
+ * sequence (sequence.h) one at a time, each within SEQUENCE_DEFAULT_BUDGET_NS, and while no part
+ * is waiting on the belt queues the first job of the order on a robot with nothing queued, after
+ * another SEQUENCE_DEFAULT_BUDGET_NS improving it. The belt's parts will not wait and always come
+ * first, a job goes on the robot's timeline as their picks do.
+ *
+ * Without the thread picker_init() and picker_poll() do the same work for a caller that runs
+ * between cycles itself, as the simulation (sim_main.c) does.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "picker.h"
+#include "ax5000.h"
+#include "cycle.h"
+
+/* how often the thread looks for a part while there is none, us */
+#define PICKER_POLL_US 1000
+
+struct scheduler_t picker_scheduler;
+struct sequence_t picker_sequences[SCHEDULER_MAX_ROBOTS];
+
+static uint32_t picker_cycle_ns;
+static pthread_t picker_thread_handle;
+static volatile int picker_running = 0;
+
+/* jobs handed over, in the order they came */
+static pthread_mutex_t picker_jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sequence_job_t picker_jobs[PICKER_MAX_JOBS];
+static int picker_job_robots[PICKER_MAX_JOBS];
+static int picker_job_count = 0;
+
+/**
+ * Works out where a robot's effector is from its servos' feedback
+ *
+ * @param[in]	robot The robot
+ * @param[out]	p Where it is
+ * @return 0 on success, -1 if the feedback is not a pose of the robot
+ */
+static int picker_where(int robot, double p[3])
+{
+	const struct delta_robot_t *geometry = &picker_scheduler.robots[robot].robot;
+	double q[DELTA_NUM_JOINTS];
+
+	for (int j=0; j<DELTA_NUM_JOINTS; j++)
+		q[j] = delta_angle(geometry, ax5000_actual_position(PLANNER_AXIS(robot, j)));
+	return delta_forward(geometry, q, p);
+}
+
+/**
+ * Brings the robots' timelines up to date with their queues
+ */
+static void picker_refresh(void)
+{
+	for (int r=0; r<picker_scheduler.count; r++) {
+		struct scheduler_robot_t *s = &picker_scheduler.robots[r];
+		int pending = planner_pending(r);
+
+		s->available = pending < PICKER_MAX_AHEAD && planner_ready(r);
+		if (pending == 0) {
+			s->free_cycle = 0;
+			if (picker_where(r, s->free_at) < 0)
+				s->available = 0;
+		}
+	}
+}
+
+/**
+ * Takes the first job handed over whose robot has room for it into that robot's sequence
+ *
+ * @return 1 if a job was taken, 0 if none could be
+ */
+static int picker_take_job(void)
+{
+	struct sequence_job_t job;
+	int robot = -1;
+
+	pthread_mutex_lock(&picker_jobs_mutex);
+	for (int i=0; i<picker_job_count; i++) {
+		if (picker_sequences[picker_job_robots[i]].count >= SEQUENCE_MAX_JOBS)
+			continue;
+		robot = picker_job_robots[i];
+		job = picker_jobs[i];
+		picker_job_count--;
+		memmove(&picker_jobs[i], &picker_jobs[i + 1], (picker_job_count - i) * sizeof(picker_jobs[0]));
+		memmove(&picker_job_robots[i], &picker_job_robots[i + 1], (picker_job_count - i) * sizeof(picker_job_robots[0]));
+		break;
+	}
+	pthread_mutex_unlock(&picker_jobs_mutex);
+	if (robot < 0)
+		return 0;
+
+	/* one that cannot be planned is counted in the sequence's stats */
+	sequence_add(&picker_sequences[robot], &job, SEQUENCE_DEFAULT_BUDGET_NS);
+	return 1;
+}
+
+/**
+ * Queues the first job of the order on a robot with nothing queued
+ *
+ * @return 1 if a job was taken off a sequence, 0 if no robot was free for one
+ */
+static int picker_queue_job(void)
+{
+	uint32_t lead = (uint32_t) ceil(picker_scheduler.lead * 1e9 / picker_cycle_ns);
+	struct intercept_pick_t pick;
+	struct sequence_job_t job;
+	struct trajectory_t trajectory;
+
+	picker_refresh();
+	for (int r=0; r<picker_scheduler.count; r++) {
+		struct scheduler_robot_t *s = &picker_scheduler.robots[r];
+		struct sequence_t *sequence = &picker_sequences[r];
+
+		if (sequence->count == 0 || !s->available || s->free_cycle != 0)
+			continue;
+		/* a pick off the belt may have left it elsewhere */
+		sequence_move(sequence, s->free_at);
+		sequence_optimise(sequence, SEQUENCE_DEFAULT_BUDGET_NS);
+		sequence_next(sequence, &job);
+
+		pick = s->pick;
+		memcpy(pick.place, job.place, sizeof(pick.place));
+		pick.payload = job.payload;
+		if (intercept_plan_static(&s->robot, &pick, job.pick, s->free_at, cycle_count + lead, picker_cycle_ns, &trajectory) < 0) {
+			sequence->stats.unreachable++;
+			return 1;
+		}
+		if (planner_submit_trajectory(r, &trajectory, NULL) < 0) {
+			trajectory_free(&trajectory);
+			sequence->stats.unreachable++;
+			return 1;
+		}
+		scheduler_commit(&picker_scheduler, r, &trajectory);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Assigns the next part the photo eye registered and queues its pick
+ *
+ * What the picking thread does each time round, for a caller without the thread after
+ * picker_init(). Never waits for a part. With no part waiting it takes in a job handed over,
+ * or failing that queues one.
+ * @return 1 if a part or a job was taken, 0 if there was nothing to do
+ */
+int picker_poll(void)
+{
+	struct conveyor_part_t part;
+	struct conveyor_state_t state;
+	struct trajectory_t trajectory;
+	int robot, err;
+
+	if (conveyor_next_part(&part) < 0)
+		return picker_take_job() || picker_queue_job();
+	if (conveyor_state(&state) < 0) {
+		picker_scheduler.stats.parts++;
+		picker_scheduler.stats.missed++;
+		return 1;
+	}
+	picker_refresh();
+
+	err = scheduler_assign(&picker_scheduler, &state, &part, cycle_count, picker_cycle_ns, &trajectory, &robot);
+	if (err < 0)
+		return 1;
+	if (planner_submit_trajectory(robot, &trajectory, NULL) < 0) {
+		trajectory_free(&trajectory);
+		picker_scheduler.stats.unreachable++;
+		return 1;
+	}
+	scheduler_commit(&picker_scheduler, robot, &trajectory);
+	return 1;
+}
+
+/**
+ * Picking thread, assigns each part the photo eye registers and queues its pick
+ *
+ * @param[in]	ptr unused
+ */
+static void *picker_thread(void *ptr)
+{
+	while (picker_running) {
+		if (!picker_poll())
+			usleep(PICKER_POLL_US);
+	}
+	return NULL;
+}
+
+/**
+ * Sets up picking without starting the thread
+ *
+ * The caller runs picker_poll() itself. The planner must be started with the same robots.
+ * @param[in]	scheduler The robots and how to choose between them, copied
+ * @param[in]	cycle_ns The cycle the setpoints are played at
+ */
+void picker_init(const struct scheduler_t *scheduler, uint32_t cycle_ns)
+{
+	picker_scheduler = *scheduler;
+	memset(&picker_scheduler.stats, 0, sizeof(picker_scheduler.stats));
+	picker_cycle_ns = cycle_ns;
+	for (int r=0; r<picker_scheduler.count; r++) {
+		const struct scheduler_robot_t *s = &picker_scheduler.robots[r];
+		sequence_init(&picker_sequences[r], &s->robot, s->free_at, s->pick.lift);
+	}
+	pthread_mutex_lock(&picker_jobs_mutex);
+	picker_job_count = 0;
+	pthread_mutex_unlock(&picker_jobs_mutex);
+}
+
+/**
+ * Starts picking the parts off the belt
+ *
+ * The conveyor's encoder must be in the process image, the planner started with the same robots
+ * and the cycle running.
+ * @param[in]	scheduler The robots and how to choose between them, copied
+ * @param[in]	cycle_ns The cycle the setpoints are played at
+ * @param[in]	rt_cpu The core the ethercat thread is pinned to, the thread keeps off it, -1 if it is not pinned
+ * @return PICKER_ERR_SUCCESS on success, PICKER_ERR_THREAD if the thread could not be created
+ */
+int picker_start(const struct scheduler_t *scheduler, uint32_t cycle_ns, int rt_cpu)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	cpu_set_t cpus;
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	int err;
+
+	picker_init(scheduler, cycle_ns);
+
+	/* normal priority whatever the thread starting it runs at, as the planner threads */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	memset(&param, 0, sizeof(param));
+	pthread_attr_setschedparam(&attr, &param);
+	if (rt_cpu >= 0 && online > 1) {
+		CPU_ZERO(&cpus);
+		for (int cpu=0; cpu<online; cpu++) {
+			if (cpu != rt_cpu)
+				CPU_SET(cpu, &cpus);
+		}
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	picker_running = 1;
+	err = pthread_create(&picker_thread_handle, &attr, picker_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if (err != 0) {
+		picker_running = 0;
+		return PICKER_ERR_THREAD;
+	}
+	return PICKER_ERR_SUCCESS;
+}
+
+/**
+ * Hands over a part lying still in a robot's reach to be picked and placed
+ *
+ * Any thread may call it once picking has been set up. The job waits until the picking thread
+ * takes it into the robot's sequence, where it waits for the robot to be free of the belt's parts.
+ * @param[in]	robot The robot, its frame for the job's points
+ * @param[in]	job The job, copied
+ * @return PICKER_ERR_SUCCESS on success, PICKER_ERR_FULL if PICKER_MAX_JOBS are waiting to be
+ * taken already, PICKER_ERR_ROBOT if there is no such robot
+ */
+int picker_add_job(int robot, const struct sequence_job_t *job)
+{
+	int err = PICKER_ERR_SUCCESS;
+
+	if (robot < 0 || robot >= picker_scheduler.count)
+		return PICKER_ERR_ROBOT;
+	pthread_mutex_lock(&picker_jobs_mutex);
+	if (picker_job_count < PICKER_MAX_JOBS) {
+		picker_jobs[picker_job_count] = *job;
+		picker_job_robots[picker_job_count++] = robot;
+	} else {
+		err = PICKER_ERR_FULL;
+	}
+	pthread_mutex_unlock(&picker_jobs_mutex);
+	return err;
+}
+
+/**
+ * Stops picking, picks already queued are left to the planner
+ */
+void picker_stop(void)
+{
+	if (!picker_running)
+		return;
+	picker_running = 0;
+	pthread_join(picker_thread_handle, NULL);
+}
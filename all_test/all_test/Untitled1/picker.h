@@ -0,0 +1,42 @@
+/* picker.h
+ * this file defines the thread picking the parts off the conveyor
+ * each part the photo eye registers is given to one of the robots by the scheduler
+ * (scheduler.h) and its pick queued with that robot's planner
+ * parts lying still in a robot's reach are handed over as pick and place jobs, ordered by that
+ * robot's sequence (sequence.h) and picked whenever the robot has nothing else queued
+ * picker_init() and picker_poll() do the same work for a caller without the thread
+ * SOEM only
+ */
+
+#ifndef __PICKER_H__
+#define __PICKER_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+#include "sequence.h"
+
+/* picks queued on a robot and not played yet before it is left out, the belt may change speed meanwhile */
+#define PICKER_MAX_AHEAD 2
+/* jobs handed over and not taken into a sequence yet */
+#define PICKER_MAX_JOBS SEQUENCE_MAX_JOBS
+
+#define PICKER_ERR_SUCCESS 0
+#define PICKER_ERR_THREAD -1
+#define PICKER_ERR_FULL -2
+#define PICKER_ERR_ROBOT -3
+
+/* the robots and their timelines, only read once the thread has stopped */
+extern struct scheduler_t picker_scheduler;
+/* the jobs waiting for each robot, only read once the thread has stopped */
+extern struct sequence_t picker_sequences[SCHEDULER_MAX_ROBOTS];
+
+int picker_start(const struct scheduler_t *scheduler, uint32_t cycle_ns, int rt_cpu);
+void picker_stop(void);
+int picker_add_job(int robot, const struct sequence_job_t *job);
+
+/* without the thread */
+void picker_init(const struct scheduler_t *scheduler, uint32_t cycle_ns);
+int picker_poll(void);
+
+#endif /* __PICKER_H__ */
@@ -0,0 +1,519 @@
+/** \file
+ * \brief Planner threads and playback of their trajectories
+ *
+ * planner_submit() puts a pick in the next slot of a ring of jobs, numbered in the order they were
+ * queued. Idle workers take the oldest queued job, plan it (trajectory_plan()) and mark it ready.
+ * With several workers the next picks are planned at the same time and may finish out of order.
+ * Workers run at normal priority and are pinned off the ethercat thread's core, so planning never
+ * takes time from the cycle however many picks are queued.
+ *
+ * A finished job's setpoints are never written again. The cycle plays jobs strictly in order:
+ * once the next one is ready it takes a pointer to its setpoints and writes one per cycle to the
+ * servo axes, nothing is copied or locked. Played jobs are freed by the submitting thread the next
+ * time it queues a pick, so the cycle never calls free() either.
+ * Trajectories that are already finished, such as those mapped from a trajectory file
+ * (trajectory_file.h), are queued ready to play with planner_submit_trajectory(), and their output
+ * changes are scheduled with the output events for the cycle they belong to, on the outputs of
+ * the robot's own gripper (output_gripper()). One with a start cycle, a pick on the move
+ * timed against the conveyor (intercept.h), is held until that cycle and skipped if it comes too
+ * late, it would meet the part somewhere else.
+ * A job is only started with every axis following setpoints, one with a start cycle is skipped if
+ * they are not by then, as not ready rather than late. If an axis drops out, is halted or
+ * the safety fields stop it during a move, the move is abandoned and every pick queued before that
+ * is dropped rather than started from the wrong place.
+ *
+ * Each robot on the bus has a ring of its own, played to its own axes, so one robot stopping does
+ * not hold up the others. The workers are shared, they take the oldest queued pick of the robot
+ * after the one they last planned for, so one robot with a long queue cannot starve the rest.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "planner.h"
+#include "ax5000.h"
+#include "following.h"
+#include "safety.h"
+#include "output_events.h"
+#include "cycle.h"
+#include "log.h"
+
+struct planner_stats_t planner_stats;
+
+/* one per robot */
+struct planner_queue_t {
+	struct delta_robot_t robot;
+	struct planner_job_t jobs[PLANNER_MAX_JOBS];
+	/* next id to queue, written by the submitting thread under planner_mutex */
+	volatile uint32_t head;
+	/* next id for a worker, under planner_mutex */
+	uint32_t next_plan;
+	/* next id to play and the job being played, the cycle only */
+	volatile uint32_t next_play;
+	struct planner_job_t *playing;
+	uint32_t index;
+	uint32_t event;
+	/* picks queued before this id are dropped, the cycle only */
+	uint32_t drop_before;
+};
+
+static struct planner_queue_t planner_queues[PLANNER_MAX_ROBOTS];
+static int planner_robots = 1;
+static uint32_t planner_cycle_ns;
+
+static pthread_mutex_t planner_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t planner_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t planner_threads[PLANNER_MAX_WORKERS];
+static int planner_workers = 0;
+static volatile int planner_running = 0;
+
+/**
+ * Reads the monotonic clock
+ *
+ * @return the time, ns
+ */
+static int64_t planner_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Finds a robot with a pick waiting to be planned
+ *
+ * Call with planner_mutex held.
+ * @param[in]	after The robot planned for last, the search starts with the one after it
+ * @return the robot, -1 if nothing is waiting
+ */
+static int planner_waiting(int after)
+{
+	for (int i=1; i<=planner_robots; i++) {
+		int robot = (after + i) % planner_robots;
+		if (planner_queues[robot].next_plan != planner_queues[robot].head)
+			return robot;
+	}
+	return -1;
+}
+
+/**
+ * Worker thread, plans queued jobs oldest first
+ *
+ * @param[in]	ptr unused
+ */
+static void *planner_thread(void *ptr)
+{
+	struct delta_robot_t robot;
+	struct planner_queue_t *queue;
+	struct planner_job_t *job;
+	int64_t start;
+	int last = 0, next = 0;
+
+	while (1) {
+		pthread_mutex_lock(&planner_mutex);
+		while (planner_running && (next = planner_waiting(last)) < 0)
+			pthread_cond_wait(&planner_cond, &planner_mutex);
+		if (!planner_running) {
+			pthread_mutex_unlock(&planner_mutex);
+			break;
+		}
+		last = next;
+		queue = &planner_queues[next];
+		job = &queue->jobs[queue->next_plan % PLANNER_MAX_JOBS];
+		queue->next_plan++;
+		/* trajectories queued ready to play have nothing to plan */
+		if (job->state != PLANNER_QUEUED) {
+			pthread_mutex_unlock(&planner_mutex);
+			continue;
+		}
+		job->state = PLANNER_PLANNING;
+		robot = queue->robot;
+		pthread_mutex_unlock(&planner_mutex);
+
+		robot.payload = job->payload;
+		start = planner_now();
+		job->err = trajectory_plan(&robot, &job->path, TRAJECTORY_DEFAULT_STEP, planner_cycle_ns, &job->trajectory);
+		job->plan_ns = planner_now() - start;
+
+		pthread_mutex_lock(&planner_mutex);
+		if (job->err < 0) {
+			planner_stats.failed++;
+		} else {
+			planner_stats.planned++;
+			planner_stats.plan_ns_total += job->plan_ns;
+			if (job->plan_ns > planner_stats.plan_ns_max)
+				planner_stats.plan_ns_max = job->plan_ns;
+		}
+		pthread_mutex_unlock(&planner_mutex);
+
+		/* the setpoints are complete before the cycle can see the job is ready */
+		__sync_synchronize();
+		job->state = (job->err < 0) ? PLANNER_FAILED : PLANNER_READY;
+	}
+	return NULL;
+}
+
+/**
+ * Starts the planner threads
+ *
+ * Call once before anything is queued. Robot r drives axes PLANNER_AXIS(r, 0) to PLANNER_AXIS(r, 2).
+ * @param[in]	robots The robots, copied
+ * @param[in]	count Number of robots, 1 to PLANNER_MAX_ROBOTS
+ * @param[in]	cycle_ns The cycle the setpoints are played at
+ * @param[in]	workers Number of planner threads, 0 to PLANNER_MAX_WORKERS, with none only finished
+ * trajectories can be queued
+ * @param[in]	rt_cpu The core the ethercat thread is pinned to, the workers keep off it, -1 if it is not pinned
+ * @return PLANNER_ERR_SUCCESS on success, PLANNER_ERR_WORKERS if workers is out of range,
+ * PLANNER_ERR_ROBOT if count is, PLANNER_ERR_THREAD if a thread could not be created
+ */
+int planner_start(const struct delta_robot_t *robots, int count, uint32_t cycle_ns, int workers, int rt_cpu)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	cpu_set_t cpus;
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (workers < 0 || workers > PLANNER_MAX_WORKERS)
+		return PLANNER_ERR_WORKERS;
+
+	if (count < 1 || count > PLANNER_MAX_ROBOTS)
+		return PLANNER_ERR_ROBOT;
+
+	memset(planner_queues, 0, sizeof(planner_queues));
+	for (int i=0; i<count; i++)
+		planner_queues[i].robot = robots[i];
+	planner_robots = count;
+	planner_cycle_ns = cycle_ns;
+	memset(&planner_stats, 0, sizeof(planner_stats));
+
+	/* normal priority whatever the thread starting them runs at */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	memset(&param, 0, sizeof(param));
+	pthread_attr_setschedparam(&attr, &param);
+	if (rt_cpu >= 0 && online > 1) {
+		CPU_ZERO(&cpus);
+		for (int cpu=0; cpu<online; cpu++) {
+			if (cpu != rt_cpu)
+				CPU_SET(cpu, &cpus);
+		}
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	planner_running = (workers > 0);
+	for (planner_workers=0; planner_workers<workers; planner_workers++) {
+		if (pthread_create(&planner_threads[planner_workers], &attr, planner_thread, NULL) != 0) {
+			pthread_attr_destroy(&attr);
+			planner_stop();
+			return PLANNER_ERR_THREAD;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	planner_stats.workers = planner_workers;
+	return PLANNER_ERR_SUCCESS;
+}
+
+/**
+ * Stops the planner threads and frees every job
+ *
+ * Only call once the cycle has stopped.
+ */
+void planner_stop(void)
+{
+	pthread_mutex_lock(&planner_mutex);
+	planner_running = 0;
+	pthread_cond_broadcast(&planner_cond);
+	pthread_mutex_unlock(&planner_mutex);
+	for (int i=0; i<planner_workers; i++)
+		pthread_join(planner_threads[i], NULL);
+	planner_workers = 0;
+
+	for (int r=0; r<planner_robots; r++) {
+		for (int i=0; i<PLANNER_MAX_JOBS; i++) {
+			trajectory_free(&planner_queues[r].jobs[i].trajectory);
+			planner_queues[r].jobs[i].state = PLANNER_FREE;
+		}
+		planner_queues[r].playing = NULL;
+	}
+}
+
+/**
+ * Frees the jobs the cycle has played
+ *
+ * @param[in]	queue The robot's queue
+ */
+static void planner_reap(struct planner_queue_t *queue)
+{
+	for (int i=0; i<PLANNER_MAX_JOBS; i++) {
+		if (queue->jobs[i].state == PLANNER_PLAYED) {
+			trajectory_free(&queue->jobs[i].trajectory);
+			queue->jobs[i].state = PLANNER_FREE;
+		}
+	}
+}
+
+/**
+ * Queues a pick to be planned and played after the ones already queued
+ *
+ * The path has to start where the one queued before it ends. Frees the jobs the cycle has played.
+ * Only call from one thread for each robot.
+ * @param[in]	robot The robot, should start from 0 and go to the number of robots-1
+ * @param[in]	path The path
+ * @param[in]	payload Mass carried along the path, kg
+ * @param[out]	id The pick's number, NULL if not needed
+ * @return PLANNER_ERR_SUCCESS on success, PLANNER_ERR_FULL if PLANNER_MAX_JOBS picks are waiting
+ * already, PLANNER_ERR_THREAD if the planner is not running, PLANNER_ERR_ROBOT if there is no such robot
+ */
+int planner_submit(int robot, const struct trajectory_path_t *path, double payload, uint32_t *id)
+{
+	struct planner_queue_t *queue;
+	struct planner_job_t *job;
+
+	if (robot < 0 || robot >= planner_robots)
+		return PLANNER_ERR_ROBOT;
+	queue = &planner_queues[robot];
+	if (!planner_running)
+		return PLANNER_ERR_THREAD;
+
+	planner_reap(queue);
+
+	job = &queue->jobs[queue->head % PLANNER_MAX_JOBS];
+	if (job->state != PLANNER_FREE)
+		return PLANNER_ERR_FULL;
+	job->path = *path;
+	job->payload = payload;
+	job->id = queue->head;
+	job->err = PLANNER_ERR_SUCCESS;
+	if (id != NULL)
+		*id = queue->head;
+
+	pthread_mutex_lock(&planner_mutex);
+	job->state = PLANNER_QUEUED;
+	queue->head++;
+	planner_stats.submitted++;
+	pthread_cond_signal(&planner_cond);
+	pthread_mutex_unlock(&planner_mutex);
+	return PLANNER_ERR_SUCCESS;
+}
+
+/**
+ * Queues a finished trajectory to be played after the picks already queued
+ *
+ * Nothing is planned or copied, the trajectory's setpoints and events must stay where they are
+ * until it has been played. A mapped trajectory is left alone once played, anything else is freed.
+ * With trajectory->start_cycle set it starts in exactly that cycle or not at all.
+ * Only call from the thread that calls planner_submit() for the robot, works without planner threads.
+ * @param[in]	robot The robot, should start from 0 and go to the number of robots-1
+ * @param[in]	trajectory The trajectory
+ * @param[out]	id The trajectory's number, NULL if not needed
+ * @return PLANNER_ERR_SUCCESS on success, PLANNER_ERR_FULL if PLANNER_MAX_JOBS picks are waiting already,
+ * PLANNER_ERR_ROBOT if there is no such robot
+ */
+int planner_submit_trajectory(int robot, const struct trajectory_t *trajectory, uint32_t *id)
+{
+	struct planner_queue_t *queue;
+	struct planner_job_t *job;
+
+	if (robot < 0 || robot >= planner_robots)
+		return PLANNER_ERR_ROBOT;
+	queue = &planner_queues[robot];
+
+	planner_reap(queue);
+
+	job = &queue->jobs[queue->head % PLANNER_MAX_JOBS];
+	if (job->state != PLANNER_FREE)
+		return PLANNER_ERR_FULL;
+	memset(&job->path, 0, sizeof(job->path));
+	job->payload = 0.0;
+	job->trajectory = *trajectory;
+	job->id = queue->head;
+	job->err = PLANNER_ERR_SUCCESS;
+	job->plan_ns = 0;
+	if (id != NULL)
+		*id = queue->head;
+
+	pthread_mutex_lock(&planner_mutex);
+	__sync_synchronize();
+	job->state = PLANNER_READY;
+	queue->head++;
+	planner_stats.submitted++;
+	pthread_mutex_unlock(&planner_mutex);
+	return PLANNER_ERR_SUCCESS;
+}
+
+/**
+ * Counts the picks queued and not played to the end yet
+ *
+ * @param[in]	robot The robot, -1 for every robot
+ * @return the number of picks
+ */
+int planner_pending(int robot)
+{
+	int pending = 0;
+
+	if (robot >= 0)
+		return planner_queues[robot].head - planner_queues[robot].next_play;
+	for (int r=0; r<planner_robots; r++)
+		pending += planner_queues[r].head - planner_queues[r].next_play;
+	return pending;
+}
+
+/**
+ * Tells whether every queued pick has been played
+ *
+ * @param[in]	robot The robot, -1 for every robot
+ * @return 1 if nothing is left to play, 0 otherwise
+ */
+int planner_idle(int robot)
+{
+	return planner_pending(robot) == 0;
+}
+
+/**
+ * Tells whether an axis is following setpoints
+ *
+ * @param[in]	axis The axis
+ * @return 1 if it is, 0 if it is disabled, halted or stopped by the safety fields
+ */
+static int planner_axis_ready(int axis)
+{
+	return ax5000_state(axis) == AX5000_ENABLED && !ax5000_axes[axis].halt && safety_state == SAFETY_RUN;
+}
+
+/**
+ * Tells whether a robot's picks would be played
+ *
+ * Read outside of the cycle the answer may be a cycle old.
+ * @param[in]	robot The robot
+ * @return 1 if every one of its axes follows setpoints, 0 if one does not or the safety fields
+ * stopped them
+ */
+int planner_ready(int robot)
+{
+	for (int joint=0; joint<DELTA_NUM_JOINTS; joint++) {
+		if (!planner_axis_ready(PLANNER_AXIS(robot, joint)))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Finishes with the job being played
+ *
+ * @param[in]	robot The robot
+ * @param[in]	job The job
+ */
+static void planner_finish(int robot, struct planner_job_t *job)
+{
+	struct planner_queue_t *queue = &planner_queues[robot];
+
+	job->state = PLANNER_PLAYED;
+	queue->next_play++;
+	if (queue->playing == job) {
+		queue->playing = NULL;
+		for (int joint=0; joint<DELTA_NUM_JOINTS; joint++)
+			following_move_end(PLANNER_AXIS(robot, joint));
+	}
+}
+
+/**
+ * Plays the next setpoint of one robot
+ *
+ * @param[in]	robot The robot
+ */
+static void planner_play_robot(int robot)
+{
+	struct planner_queue_t *queue = &planner_queues[robot];
+	struct planner_job_t *job;
+	const struct trajectory_setpoint_t *setpoint;
+	int state, axis;
+
+	if (queue->playing == NULL) {
+		job = &queue->jobs[queue->next_play % PLANNER_MAX_JOBS];
+		state = job->state;
+		if (state == PLANNER_FREE || state == PLANNER_PLAYED || job->id != queue->next_play)
+			return;
+		if (state == PLANNER_QUEUED || state == PLANNER_PLANNING) {
+			if (job->id >= queue->drop_before)
+				planner_stats.starved++;
+			return;
+		}
+		__sync_synchronize();
+		if (state == PLANNER_FAILED || job->id < queue->drop_before) {
+			if (state == PLANNER_FAILED)
+				log_write("planner: robot %d pick %u could not be planned (%d), skipped\n", robot, job->id, job->err);
+			planner_finish(robot, job);
+			return;
+		}
+		/* cycle_count is still the last cycle's until cycle_update() */
+		int32_t early = job->trajectory.start_cycle != 0 ? (int32_t) (job->trajectory.start_cycle - (cycle_count + 1)) : 0;
+		if (early > 0)
+			return;
+		for (int joint=0; joint<DELTA_NUM_JOINTS; joint++) {
+			axis = PLANNER_AXIS(robot, joint);
+			if (!planner_axis_ready(axis)) {
+				/* one without a start cycle can wait, a timed one would meet the part somewhere else */
+				if (job->trajectory.start_cycle == 0)
+					return;
+				log_write("planner: axis %d not ready for robot %d pick %u, skipped\n", axis, robot, job->id);
+				planner_stats.not_ready++;
+				planner_finish(robot, job);
+				return;
+			}
+		}
+		if (early < 0) {
+			log_write("planner: robot %d %u is %d cycles late, skipped\n", robot, job->id, -early);
+			planner_stats.late++;
+			planner_finish(robot, job);
+			return;
+		}
+		job->state = PLANNER_PLAYING;
+		queue->playing = job;
+		queue->index = 0;
+		queue->event = 0;
+		for (int joint=0; joint<DELTA_NUM_JOINTS; joint++)
+			following_move_begin(PLANNER_AXIS(robot, joint));
+	}
+
+	job = queue->playing;
+	setpoint = &job->trajectory.setpoints[queue->index];
+	for (int joint=0; joint<DELTA_NUM_JOINTS; joint++) {
+		axis = PLANNER_AXIS(robot, joint);
+		if (!planner_axis_ready(axis) || ax5000_set_position(axis, setpoint->position[joint], setpoint->velocity[joint]) < 0) {
+			queue->drop_before = queue->head;
+			log_write("planner: axis %d stopped during robot %d pick %u, %u queued picks dropped\n",
+				axis, robot, job->id, queue->drop_before - queue->next_play - 1);
+			planner_finish(robot, job);
+			return;
+		}
+	}
+	while (queue->event < job->trajectory.event_count && job->trajectory.events[queue->event].cycle <= queue->index) {
+		const struct trajectory_event_t *event = &job->trajectory.events[queue->event++];
+		/* due in the cycle cycle_update() is about to count, the one this setpoint goes out in */
+		if (output_event_at_cycle_locked(cycle_count + 1, output_gripper(robot, event->mask), output_gripper(robot, event->value)) < 0)
+			log_write("planner: no free output event for robot %d pick %u, its gripper was not switched\n", robot, job->id);
+	}
+	if (++queue->index >= job->trajectory.cycles) {
+		planner_stats.played++;
+		planner_finish(robot, job);
+	}
+}
+
+/**
+ * Plays the next setpoint to the servo axes of every robot
+ *
+ * Must be called once per cycle before cycle_update(), with the io lock held. Never blocks or
+ * allocates.
+ */
+void planner_play(void)
+{
+	for (int robot=0; robot<planner_robots; robot++)
+		planner_play_robot(robot);
+}
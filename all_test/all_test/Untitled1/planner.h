@@ -0,0 +1,76 @@
+/* planner.h
+ * this file defines the pool of planner threads and the playback of what they plan
+ * picks are queued by the application, worker threads pinned to the cores the ethercat thread
+ * does not use plan several of them at once (trajectory.h), and the cycle plays the finished
+ * setpoints to the servo axes in the order the picks were queued
+ * each robot on the bus has its own queue and axes, the workers are shared between them
+ * SOEM only
+ */
+
+#ifndef __PLANNER_H__
+#define __PLANNER_H__
+
+#include <stdint.h>
+
+#include "ax5000.h"
+#include "trajectory.h"
+
+/* must be a power of two, picks queued and not yet played */
+#define PLANNER_MAX_JOBS 16
+#define PLANNER_MAX_WORKERS 8
+#define PLANNER_MAX_ROBOTS (AX5000_NUM_AXES / DELTA_NUM_JOINTS)
+/* the axis driving a joint of a robot, the drives are in bus order robot by robot */
+#define PLANNER_AXIS(robot, joint) ((robot) * DELTA_NUM_JOINTS + (joint))
+
+#define PLANNER_ERR_SUCCESS 0
+#define PLANNER_ERR_THREAD -1
+#define PLANNER_ERR_FULL -2
+#define PLANNER_ERR_WORKERS -3
+#define PLANNER_ERR_ROBOT -4
+
+enum planner_job_states {
+	PLANNER_FREE = 0,	/* slot unused */
+	PLANNER_QUEUED,		/* waiting for a worker */
+	PLANNER_PLANNING,	/* a worker is on it */
+	PLANNER_READY,		/* setpoints finished, no longer written by anyone */
+	PLANNER_FAILED,		/* could not be planned, skipped by the cycle */
+	PLANNER_PLAYING,	/* the cycle is playing the setpoints */
+	PLANNER_PLAYED		/* done with, the slot is freed by the next planner_submit() */
+};
+
+struct planner_job_t {
+	volatile int state; /* enum planner_job_states */
+	uint32_t id;
+	struct trajectory_path_t path;
+	double payload;
+	struct trajectory_t trajectory;
+	int err;
+	int64_t plan_ns;
+};
+
+struct planner_stats_t {
+	uint32_t submitted;
+	uint32_t planned;
+	uint32_t failed;
+	uint32_t played;
+	uint32_t starved; /* cycles the next pick was queued but not planned yet */
+	uint32_t late; /* trajectories skipped because their start cycle had passed */
+	uint32_t not_ready; /* trajectories skipped because an axis was not ready at their start cycle */
+	int64_t plan_ns_max;
+	int64_t plan_ns_total;
+	int workers;
+};
+
+extern struct planner_stats_t planner_stats;
+
+int planner_start(const struct delta_robot_t *robots, int count, uint32_t cycle_ns, int workers, int rt_cpu);
+void planner_stop(void);
+int planner_submit(int robot, const struct trajectory_path_t *path, double payload, uint32_t *id);
+int planner_submit_trajectory(int robot, const struct trajectory_t *trajectory, uint32_t *id);
+int planner_pending(int robot);
+int planner_idle(int robot);
+int planner_ready(int robot);
+
+void planner_play(void);
+
+#endif /* __PLANNER_H__ */
@@ -0,0 +1,160 @@
+/** \file
+ * \brief Reaction to the SICK V300 safety laser scanners
+ *
+ * safety_update() is the first thing cycle_update() does, so a field violation is acted on in the
+ * same cycle the frame carrying it arrives and the stop goes out with the very next frame.
+ * Either scanner's protective field drops stop2_n on every axis, axes streaming velocity included,
+ * so the terminals decelerate on their stop ramp and queued moves are discarded.
+ * The stop is latched and written again every cycle until safety_reset() is called with both
+ * fields clear, so nothing in the slower state machine can override it.
+ *
+ * The reaction is timed: from the frame arriving to the stop being in the outputs, from the frame
+ * arriving to the stop being sent, and in cycles until every axis reports the stop back.
+ * This is not a replacement for the scanner's own safety outputs, it is the controller's part of
+ * bringing the robot to a controlled stop.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include "safety.h"
+#include "cycle.h"
+#include "wago_move_queue.h"
+#include "wago_velocity.h"
+
+uint8_t *safety_inputs = NULL;
+enum safety_states safety_state = SAFETY_RUN;
+struct safety_stats_t safety_stats;
+
+/* timing of the reaction in progress */
+static int64_t receive_ns;
+static int64_t edge_receive_ns;
+static uint32_t edge_cycle;
+static int awaiting_send;
+static int awaiting_confirm;
+
+/**
+ * Records when the current frame's inputs arrived
+ *
+ * Called by the platform code straight after receiving process data.
+ * @param[in]	timestamp_ns Time the frame was received
+ */
+void safety_mark_receive(int64_t timestamp_ns)
+{
+	receive_ns = timestamp_ns;
+}
+
+/**
+ * Records when a frame was sent
+ *
+ * Called by the platform code straight after sending process data.
+ * @param[in]	timestamp_ns Time the frame was sent
+ */
+void safety_mark_send(int64_t timestamp_ns)
+{
+	if (!awaiting_send)
+		return;
+	awaiting_send = 0;
+
+	safety_stats.send_ns_last = timestamp_ns - edge_receive_ns;
+	if (safety_stats.send_ns_last > safety_stats.send_ns_max)
+		safety_stats.send_ns_max = safety_stats.send_ns_last;
+}
+
+/**
+ * Checks whether the axes are being held by the safety reaction
+ *
+ * @return 1 if stopped or held by a field violation, 0 otherwise
+ */
+int safety_stopped(void)
+{
+	return safety_state != SAFETY_RUN;
+}
+
+/**
+ * Releases the latched stop
+ *
+ * The axes are left with stop2_n low, they have to be taken through setup mode again.
+ * @return SAFETY_ERR_SUCCESS on success, SAFETY_ERR_FIELD_VIOLATED if a field is still violated
+ */
+int safety_reset(void)
+{
+	int ret = SAFETY_ERR_SUCCESS;
+
+	IO_LOCK;
+	if (safety_inputs && ((*safety_inputs & SAFETY_FIELDS) != SAFETY_FIELDS))
+		ret = SAFETY_ERR_FIELD_VIOLATED;
+	else
+		safety_state = SAFETY_RUN;
+	IO_UNLOCK;
+
+	return ret;
+}
+
+/**
+ * Writes the stop into the outputs of every axis
+ *
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ */
+static void safety_hold(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE])
+{
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		/* the io lock is already held so the queue is emptied directly rather than with wago_queue_clear() */
+		wago_move_queues[i].head = wago_move_queues[i].tail;
+		wago_velocity_stop(i);
+		wago_steppers[i][WAGO_OUTPUT_SPACE]->stat_cont1.bit.stop2_n = 0;
+		wago_steppers[i][WAGO_OUTPUT_SPACE]->stat_cont1.bit.start = 0;
+	}
+}
+
+/**
+ * Checks the scanner and stops the axes on a field violation
+ *
+ * Must be the first thing called each cycle, the io lock must already be held (see cycle_update()).
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ */
+void safety_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE])
+{
+	uint8_t fields;
+
+	if (safety_inputs == NULL)
+		return;
+	fields = *safety_inputs;
+
+	if (safety_state == SAFETY_RUN) {
+		if ((fields & SAFETY_FIELDS) == SAFETY_FIELDS)
+			return;
+		safety_state = SAFETY_STOPPED;
+		safety_hold(wago_steppers);
+
+		safety_stats.reactions++;
+		safety_stats.fields = fields;
+		edge_cycle = cycle_count;
+		edge_receive_ns = receive_ns;
+		if (cycle_clock_ns) {
+			safety_stats.react_ns_last = cycle_clock_ns() - receive_ns;
+			if (safety_stats.react_ns_last > safety_stats.react_ns_max)
+				safety_stats.react_ns_max = safety_stats.react_ns_last;
+			awaiting_send = 1;
+		}
+		awaiting_confirm = 1;
+		return;
+	}
+
+	/* latched, keep the axes held in case something else wrote to them */
+	safety_hold(wago_steppers);
+
+	if (awaiting_confirm) {
+		int confirmed = 1;
+		for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+			struct wago_stepper_t *in = wago_steppers[i][WAGO_INPUT_SPACE];
+			if (in->stat_cont1.bit.stop2_n)
+				confirmed = 0;
+		}
+		if (confirmed) {
+			awaiting_confirm = 0;
+			safety_stats.confirm_cycles_last = cycle_count - edge_cycle;
+			if (safety_stats.confirm_cycles_last > safety_stats.confirm_cycles_max)
+				safety_stats.confirm_cycles_max = safety_stats.confirm_cycles_last;
+		}
+	}
+}
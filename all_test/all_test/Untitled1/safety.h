@@ -0,0 +1,61 @@
+/* safety.h
+ * this file defines the reaction to the SICK V300 safety laser scanners
+ * there are two scanners, each one's OSSD1 is wired to a channel of the 2 channel digital input
+ * terminal (EL1002), see Documentation/ElectricalConfiguration/connections.docx
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __SAFETY_H__
+#define __SAFETY_H__
+
+#include "wago_steppers.h"
+
+/*
+ * input bits of the scanners, the outputs are OSSDs so a bit is high while the scanner's protective
+ * field is clear, neither scanner has its warning field wired
+ */
+#define SAFETY_SCANNER_RHS 0x01 /* EL1002 input 1, terminal point 1 */
+#define SAFETY_SCANNER_LHS 0x02 /* EL1002 input 2, terminal point 5 */
+#define SAFETY_FIELDS (SAFETY_SCANNER_RHS|SAFETY_SCANNER_LHS)
+
+#define SAFETY_ERR_SUCCESS 0
+#define SAFETY_ERR_FIELD_VIOLATED -1
+
+enum safety_states {
+	SAFETY_RUN = 0,		/* both fields clear */
+	SAFETY_STOPPED		/* a protective field violated, stop2_n dropped on every axis */
+};
+
+struct safety_stats_t {
+	uint32_t reactions; /* number of field violations reacted to */
+	uint8_t fields; /* the scanner bits at the last violation */
+
+	/* nanosecond figures need cycle_clock_ns, they stay at 0 without it */
+	/* time from the frame carrying the edge arriving to the stop being written into the outputs */
+	int64_t react_ns_last;
+	int64_t react_ns_max;
+	/* time from the frame carrying the edge arriving to the frame carrying the stop being sent */
+	int64_t send_ns_last;
+	int64_t send_ns_max;
+	/* cycles from the edge until every axis reports the stop back */
+	uint32_t confirm_cycles_last;
+	uint32_t confirm_cycles_max;
+};
+
+/* points at the scanner input byte in the process image, set up by the platform code */
+extern uint8_t *safety_inputs;
+extern enum safety_states safety_state;
+extern struct safety_stats_t safety_stats;
+
+void safety_mark_receive(int64_t timestamp_ns);
+void safety_mark_send(int64_t timestamp_ns);
+int safety_stopped(void);
+int safety_reset(void);
+
+void safety_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE]);
+
+#endif /* __SAFETY_H__ */
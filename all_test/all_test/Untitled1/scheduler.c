@@ -0,0 +1,212 @@
+/** \file
+ * \brief Sharing the parts on the conveyor between several delta robots
+ *
+ * Every robot keeps a timeline of the picks it has been given: the cycle it will be done with them
+ * and where it will be at rest then. A part is planned on a robot to start once that robot is
+ * free (or as soon as it can be queued, if that is later) from where it will be, so a pick
+ * always follows on from the one before on the same robot. Robots further down the belt see the
+ * part later, the pick is timed for their own stretch of it (intercept_plan() waits for the part).
+ *
+ * Which robot gets the part depends on the strategy:
+ *	first fit	the robot furthest upstream that can make the pick, one plan per part while
+ *			the first robot keeps up
+ *	last fit	the robot furthest downstream, so the robots upstream of it are free for
+ *			the parts that come after
+ *	earliest finish	planned on every robot, the one that is done with it soonest
+ * A robot the part would already be past by the time it is free is skipped without planning.
+ *
+ * Nothing here touches the bus or the planner, the picking thread (picker.h) feeds the parts in
+ * and queues the picks, scheduler_bench replays a stream of parts through the same calls.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "scheduler.h"
+
+/**
+ * Reads the monotonic clock
+ *
+ * @return the time, ns
+ */
+static int64_t scheduler_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Sets up robots standing one after the other along the belt as they are on the drawings
+ *
+ * Robot 0 is the furthest upstream, each robot after it stands spacing further down the belt.
+ * Every robot places the parts on the same spot in its own frame and starts at rest there.
+ * @param[out]	scheduler The scheduler
+ * @param[in]	robot The robots' geometry, copied to each one
+ * @param[in]	count Number of robots, 1 to SCHEDULER_MAX_ROBOTS
+ * @param[in]	spacing Distance between the robots along the belt, metres
+ * @return SCHEDULER_ERR_SUCCESS on success, SCHEDULER_ERR_ROBOT if count is out of range
+ */
+int scheduler_defaults(struct scheduler_t *scheduler, const struct delta_robot_t *robot, int count, double spacing)
+{
+	if (count < 1 || count > SCHEDULER_MAX_ROBOTS)
+		return SCHEDULER_ERR_ROBOT;
+
+	memset(scheduler, 0, sizeof(*scheduler));
+	scheduler->count = count;
+	scheduler->strategy = SCHEDULER_FIRST_FIT;
+	/* every robot may be planned for before the pick is queued */
+	scheduler->lead = INTERCEPT_DEFAULT_LEAD * count;
+	for (int r=0; r<count; r++) {
+		struct scheduler_robot_t *s = &scheduler->robots[r];
+		s->robot = *robot;
+		intercept_defaults(&s->conveyor, &s->pick);
+		/* the eye is further upstream of each robot down the belt, the window is the same
+		 * stretch of belt under the robot */
+		for (int c=0; c<3; c++)
+			s->conveyor.eye[c] -= s->conveyor.direction[c] * spacing * r;
+		s->conveyor.window[0] += spacing * r;
+		s->conveyor.window[1] += spacing * r;
+		s->available = 1;
+		memcpy(s->free_at, s->pick.place, sizeof(s->free_at));
+	}
+	return SCHEDULER_ERR_SUCCESS;
+}
+
+/**
+ * Tells whether a part will be past a robot's window before the robot can start on it
+ *
+ * @param[in]	robot The robot
+ * @param[in]	state Where the belt was, from conveyor_state()
+ * @param[in]	part The part
+ * @param[in]	start_cycle The cycle the robot can start in
+ * @param[in]	cycle_ns The cycle the setpoints are played at
+ * @return 1 if it will, 0 if it may not
+ */
+static int scheduler_past(const struct scheduler_robot_t *robot, const struct conveyor_state_t *state, const struct conveyor_part_t *part,
+	uint32_t start_cycle, uint32_t cycle_ns)
+{
+	int64_t start_ns = state->timestamp_ns + (int64_t) (int32_t) (start_cycle - state->cycle) * cycle_ns;
+
+	return (conveyor_predict(state, start_ns) - part->count) * robot->conveyor.metres_per_count > robot->conveyor.window[1];
+}
+
+/**
+ * Chooses the robot to pick a part and plans its pick
+ *
+ * Blocks while it plans, up to one intercept_plan() per robot. Nothing is changed until the pick
+ * has been queued and scheduler_commit() is called with it, a pick that is not queued is freed
+ * with trajectory_free().
+ * @param[in,out]	scheduler The scheduler
+ * @param[in]	state Where the belt was, from conveyor_state()
+ * @param[in]	part The part
+ * @param[in]	now_cycle The current cycle
+ * @param[in]	cycle_ns The cycle the setpoints are played at
+ * @param[out]	trajectory The pick, timed and in the chosen robot's frame
+ * @param[out]	robot The robot chosen
+ * @return SCHEDULER_ERR_SUCCESS on success, SCHEDULER_ERR_MISSED if no robot can get to the part
+ * before it is past, SCHEDULER_ERR_UNREACHABLE if it cannot be planned on any robot that could,
+ * SCHEDULER_ERR_MEMORY if there was no memory to plan in
+ */
+int scheduler_assign(struct scheduler_t *scheduler, const struct conveyor_state_t *state, const struct conveyor_part_t *part,
+	uint32_t now_cycle, uint32_t cycle_ns, struct trajectory_t *trajectory, int *robot)
+{
+	struct trajectory_t candidate;
+	uint32_t lead = (uint32_t) ceil(scheduler->lead * 1e9 / cycle_ns), start_cycle, end_cycle, best_end = 0;
+	int64_t start = scheduler_now(), plan_ns;
+	int err, result = SCHEDULER_ERR_MISSED, best = -1;
+
+	scheduler->stats.parts++;
+	for (int i=0; i<scheduler->count; i++) {
+		int r = (scheduler->strategy == SCHEDULER_LAST_FIT) ? scheduler->count - 1 - i : i;
+		const struct scheduler_robot_t *s = &scheduler->robots[r];
+
+		if (!s->available)
+			continue;
+		start_cycle = now_cycle + lead;
+		if ((int32_t) (s->free_cycle - start_cycle) > 0)
+			start_cycle = s->free_cycle;
+		if (scheduler_past(s, state, part, start_cycle, cycle_ns))
+			continue;
+
+		err = intercept_plan(&s->robot, &s->conveyor, &s->pick, state, part, s->free_at, start_cycle, cycle_ns, &candidate, NULL);
+		if (err == INTERCEPT_ERR_MEMORY) {
+			result = SCHEDULER_ERR_MEMORY;
+			continue;
+		}
+		if (err == INTERCEPT_ERR_UNREACHABLE) {
+			if (result == SCHEDULER_ERR_MISSED)
+				result = SCHEDULER_ERR_UNREACHABLE;
+			continue;
+		}
+		if (err < 0)
+			continue;
+		scheduler->stats.plans++;
+
+		end_cycle = candidate.start_cycle + candidate.cycles;
+		if (best < 0 || (int32_t) (end_cycle - best_end) < 0) {
+			if (best >= 0)
+				trajectory_free(trajectory);
+			*trajectory = candidate;
+			best = r;
+			best_end = end_cycle;
+		} else {
+			trajectory_free(&candidate);
+		}
+		if (scheduler->strategy != SCHEDULER_EARLIEST_FINISH)
+			break;
+	}
+
+	plan_ns = scheduler_now() - start;
+	if (plan_ns > scheduler->stats.plan_ns_max)
+		scheduler->stats.plan_ns_max = plan_ns;
+	if (best < 0) {
+		if (result == SCHEDULER_ERR_MISSED)
+			scheduler->stats.missed++;
+		else
+			scheduler->stats.unreachable++;
+		return result;
+	}
+	*robot = best;
+	return SCHEDULER_ERR_SUCCESS;
+}
+
+/**
+ * Adds a pick that has been queued to its robot's timeline
+ *
+ * @param[in,out]	scheduler The scheduler
+ * @param[in]	robot The robot it was queued for
+ * @param[in]	trajectory The pick, from scheduler_assign()
+ */
+void scheduler_commit(struct scheduler_t *scheduler, int robot, const struct trajectory_t *trajectory)
+{
+	struct scheduler_robot_t *s = &scheduler->robots[robot];
+
+	s->free_cycle = trajectory->start_cycle + trajectory->cycles;
+	memcpy(s->free_at, trajectory->end, sizeof(s->free_at));
+	s->picks++;
+	s->busy_cycles += trajectory->cycles;
+	scheduler->stats.picks++;
+}
+
+/**
+ * Names a strategy
+ *
+ * @param[in]	strategy The strategy, enum scheduler_strategies
+ * @return the name
+ */
+const char *scheduler_strategy_name(int strategy)
+{
+	switch (strategy) {
+	case SCHEDULER_FIRST_FIT:
+		return "first fit";
+	case SCHEDULER_LAST_FIT:
+		return "last fit";
+	case SCHEDULER_EARLIEST_FINISH:
+		return "earliest finish";
+	default:
+		return "unknown";
+	}
+}
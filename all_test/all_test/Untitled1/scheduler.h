@@ -0,0 +1,69 @@
+/* scheduler.h
+ * this file defines sharing the parts coming down the conveyor between several delta robots
+ * the robots stand one after the other along the belt, each with its own axes and pick queue
+ * (planner.h), and every part the photo eye registers is given to the robot that can best fit it
+ * in after the picks it has already been given (intercept.h)
+ * SOEM only
+ */
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+
+#include "intercept.h"
+#include "planner.h"
+
+#define SCHEDULER_MAX_ROBOTS PLANNER_MAX_ROBOTS
+/* FIXME: from the drawings, measure once the robots are mounted. Distance between the robots'
+ * bases along the belt, metres */
+#define SCHEDULER_DEFAULT_SPACING 0.600
+
+#define SCHEDULER_ERR_SUCCESS 0
+#define SCHEDULER_ERR_MISSED -1
+#define SCHEDULER_ERR_UNREACHABLE -2
+#define SCHEDULER_ERR_MEMORY -3
+#define SCHEDULER_ERR_ROBOT -4
+
+enum scheduler_strategies {
+	SCHEDULER_FIRST_FIT = 0,	/* the robot furthest upstream that can make the pick */
+	SCHEDULER_LAST_FIT,		/* the robot furthest downstream, the others are kept free for the parts after */
+	SCHEDULER_EARLIEST_FINISH,	/* planned on every robot, the one done with it soonest */
+	SCHEDULER_STRATEGIES
+};
+
+struct scheduler_robot_t {
+	struct delta_robot_t robot;
+	struct intercept_conveyor_t conveyor; /* the belt in this robot's frame */
+	struct intercept_pick_t pick;
+	int available; /* 0 to leave the robot out, it is stopped or has enough queued */
+	uint32_t free_cycle; /* the cycle the picks it has been given are done by */
+	double free_at[3]; /* where it is then, at rest */
+	uint32_t picks;
+	uint64_t busy_cycles; /* cycles of picks it has been given */
+};
+
+struct scheduler_stats_t {
+	uint32_t parts;
+	uint32_t picks;
+	uint32_t missed; /* no robot could get to them before they were past */
+	uint32_t unreachable; /* could not be planned on any robot */
+	uint32_t plans; /* picks planned to choose between */
+	int64_t plan_ns_max; /* longest time assigning one part took */
+};
+
+struct scheduler_t {
+	int count;
+	int strategy; /* enum scheduler_strategies */
+	double lead; /* time from assigning a part to the first setpoint of its pick, s */
+	struct scheduler_robot_t robots[SCHEDULER_MAX_ROBOTS];
+	struct scheduler_stats_t stats;
+};
+
+int scheduler_defaults(struct scheduler_t *scheduler, const struct delta_robot_t *robot, int count, double spacing);
+int scheduler_assign(struct scheduler_t *scheduler, const struct conveyor_state_t *state, const struct conveyor_part_t *part,
+	uint32_t now_cycle, uint32_t cycle_ns, struct trajectory_t *trajectory, int *robot);
+void scheduler_commit(struct scheduler_t *scheduler, int robot, const struct trajectory_t *trajectory);
+const char *scheduler_strategy_name(int strategy);
+
+#endif /* __SCHEDULER_H__ */
@@ -0,0 +1,188 @@
+/** \file
+ * \brief Replays a stream of parts down the conveyor through the scheduler
+ *
+ * Parts arrive at the photo eye at random (Poisson, with a shortest gap between two parts) on a
+ * belt running at a steady speed. Every part is assigned as the picking thread would, with the
+ * belt's state read exactly at the cycle the part passed the eye, and each strategy is run over
+ * the same stream with one robot up to SCHEDULER_MAX_ROBOTS. Reports the parts picked and missed,
+ * the picks per minute, how busy each robot was and how long assigning a part took, which has to
+ * fit in the scheduler's lead for the picks to start on time.
+ * Nothing is played, the picks are taken to run exactly as planned. As in the picking thread
+ * (picker.c) a robot is left out while PICKER_MAX_AHEAD of its picks are not done yet, and one
+ * with none left starts again from where it is.
+ * Usage: scheduler_bench [parts] [parts per minute] [belt speed in mm/s] [cycle in us]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "scheduler.h"
+#include "picker.h"
+
+/* the bench stands in for the cycle */
+uint32_t cycle_count = 0;
+
+/* closest two parts come down the belt, s */
+#define BENCH_MIN_GAP 0.050
+/* start the clock well clear of 0, a start cycle of 0 means untimed */
+#define BENCH_FIRST_CYCLE 10000
+
+struct bench_part_t {
+	int64_t arrival_ns;
+};
+
+/**
+ * Reads the monotonic clock
+ *
+ * @return the time, ns
+ */
+static int64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Draws the times the parts pass the eye
+ *
+ * @param[out]	parts The parts
+ * @param[in]	count Number of parts
+ * @param[in]	per_minute Average parts per minute
+ * @param[in]	cycle_ns The cycle, arrivals are in whole cycles
+ */
+static void bench_stream(struct bench_part_t *parts, int count, double per_minute, uint32_t cycle_ns)
+{
+	double t = 0.0, gap;
+
+	srand(1);
+	for (int i=0; i<count; i++) {
+		gap = -log((rand() + 1.0) / (RAND_MAX + 2.0)) * 60.0 / per_minute;
+		t += (gap > BENCH_MIN_GAP) ? gap : BENCH_MIN_GAP;
+		parts[i].arrival_ns = (int64_t) (t * 1e9 / cycle_ns) * cycle_ns;
+	}
+}
+
+/**
+ * Brings the robots' timelines up to date as picker_refresh() does
+ *
+ * @param[in,out]	scheduler The scheduler
+ * @param[in]	done The cycles each robot's last PICKER_MAX_AHEAD picks are done by
+ */
+static void bench_refresh(struct scheduler_t *scheduler, uint32_t done[][PICKER_MAX_AHEAD])
+{
+	for (int r=0; r<scheduler->count; r++) {
+		struct scheduler_robot_t *s = &scheduler->robots[r];
+		int pending = 0;
+
+		for (int i=0; i<PICKER_MAX_AHEAD; i++) {
+			if ((int32_t) (done[r][i] - cycle_count) > 0)
+				pending++;
+		}
+		s->available = pending < PICKER_MAX_AHEAD;
+		/* it is at rest where its last pick left it */
+		if (pending == 0)
+			s->free_cycle = 0;
+	}
+}
+
+/**
+ * Runs the stream through one strategy with a number of robots
+ *
+ * @param[in]	parts The parts
+ * @param[in]	count Number of parts
+ * @param[in]	robots Number of robots
+ * @param[in]	strategy The strategy
+ * @param[in]	speed Belt speed, m/s
+ * @param[in]	cycle_ns The cycle
+ */
+static void bench_run(const struct bench_part_t *parts, int count, int robots, int strategy, double speed, uint32_t cycle_ns)
+{
+	struct scheduler_t scheduler;
+	struct delta_robot_t robot;
+	struct conveyor_state_t state;
+	struct conveyor_part_t part;
+	struct trajectory_t trajectory;
+	double counts_per_ns, minutes, busy;
+	uint32_t done[SCHEDULER_MAX_ROBOTS][PICKER_MAX_AHEAD] = {{0}};
+	uint32_t last, busy_until = 0;
+	int64_t start, plan_ns = 0;
+	int chosen;
+
+	delta_defaults(&robot);
+	scheduler_defaults(&scheduler, &robot, robots, SCHEDULER_DEFAULT_SPACING);
+	scheduler.strategy = strategy;
+	counts_per_ns = speed / scheduler.robots[0].conveyor.metres_per_count * 1e-9;
+
+	for (int i=0; i<count; i++) {
+		cycle_count = BENCH_FIRST_CYCLE + (uint32_t) (parts[i].arrival_ns / cycle_ns);
+		part.id = i + 1;
+		part.count = (int64_t) (parts[i].arrival_ns * counts_per_ns);
+		part.cycle = cycle_count;
+		state.cycle = cycle_count;
+		state.count = part.count;
+		state.timestamp_ns = (int64_t) cycle_count * cycle_ns;
+		state.velocity = (int64_t) (counts_per_ns * 1e12);
+		state.valid = 1;
+
+		bench_refresh(&scheduler, done);
+		start = bench_now();
+		if (scheduler_assign(&scheduler, &state, &part, cycle_count, cycle_ns, &trajectory, &chosen) == SCHEDULER_ERR_SUCCESS) {
+			scheduler_commit(&scheduler, chosen, &trajectory);
+			done[chosen][scheduler.robots[chosen].picks % PICKER_MAX_AHEAD] = scheduler.robots[chosen].free_cycle;
+			if ((int32_t) (scheduler.robots[chosen].free_cycle - busy_until) > 0)
+				busy_until = scheduler.robots[chosen].free_cycle;
+			trajectory_free(&trajectory);
+		}
+		plan_ns += bench_now() - start;
+	}
+
+	/* until the last arrival or the last pick, whichever is later */
+	last = cycle_count;
+	if ((int32_t) (busy_until - last) > 0)
+		last = busy_until;
+	last -= BENCH_FIRST_CYCLE;
+	minutes = parts[count - 1].arrival_ns * 1e-9 / 60.0;
+	printf("%-15s %d robot%s: %4u picked %4u missed %3u unreachable, %6.1f picks per minute, %5.2f ms per part (max %5.2f ms), %4.2f plans per part, busy",
+		scheduler_strategy_name(strategy), robots, (robots > 1) ? "s" : " ", scheduler.stats.picks, scheduler.stats.missed, scheduler.stats.unreachable,
+		scheduler.stats.picks / minutes, plan_ns * 1e-6 / count, scheduler.stats.plan_ns_max * 1e-6, (double) scheduler.stats.plans / count);
+	for (int r=0; r<robots; r++) {
+		busy = (double) scheduler.robots[r].busy_cycles / last;
+		printf(" %3.0f%%", busy * 100.0);
+	}
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int count = (argc > 1) ? atoi(argv[1]) : 200;
+	double per_minute = (argc > 2) ? atof(argv[2]) : 400.0;
+	double speed = (argc > 3) ? atof(argv[3]) * 1e-3 : 0.200;
+	uint32_t cycle_ns = (argc > 4) ? atoi(argv[4]) * 1000 : 100000;
+	struct bench_part_t *parts;
+
+	if (count <= 1 || per_minute <= 0.0 || speed <= 0.0 || cycle_ns == 0) {
+		printf("usage: %s [parts] [parts per minute] [belt speed in mm/s] [cycle in us]\n", argv[0]);
+		return 1;
+	}
+	parts = malloc(count * sizeof(*parts));
+	if (parts == NULL)
+		return 1;
+	bench_stream(parts, count, per_minute, cycle_ns);
+	printf("%d parts, %.0f per minute on average, belt at %.0f mm/s, robots %.0f mm apart\n",
+		count, count / (parts[count - 1].arrival_ns * 1e-9 / 60.0), speed * 1e3, SCHEDULER_DEFAULT_SPACING * 1e3);
+
+	for (int strategy=0; strategy<SCHEDULER_STRATEGIES; strategy++) {
+		for (int robots=1; robots<=SCHEDULER_MAX_ROBOTS; robots++) {
+			/* the strategies only differ with more than one robot */
+			if (robots == 1 && strategy != SCHEDULER_FIRST_FIT)
+				continue;
+			bench_run(parts, count, robots, strategy, speed, cycle_ns);
+		}
+	}
+	free(parts);
+	return 0;
+}
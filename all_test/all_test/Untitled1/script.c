@@ -0,0 +1,212 @@
+/** \file
+ * \brief Motion scripts resumed by the cycle
+ *
+ * A script is a plain function whose body is wrapped in SCRIPT_BEGIN()/SCRIPT_END(). Each wait
+ * (SCRIPT_UNTIL(), SCRIPT_CYCLES(), SCRIPT_MOVE_TO(), ...) stores where it is in the script's
+ * frame and returns, the next time the script is resumed the switch in SCRIPT_BEGIN() jumps
+ * straight back to the wait. This is what a coroutine would do for us, written out by hand so it
+ * builds as c under SOEM as well as c++ under TwinCAT3.
+ *
+ * The frames are a fixed pool, script_start() takes one, the script keeps it until whoever
+ * started it has seen it end and calls script_free(). script_update() resumes every waiting
+ * script once per cycle, so a script costs one call up to its next wait per cycle whatever it
+ * is doing. A safety stop aborts every script, the moves they were waiting for have been
+ * abandoned.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include <string.h>
+
+#include "script.h"
+#include "safety.h"
+
+struct script_t script_frames[SCRIPT_MAX_FRAMES];
+struct script_stats_t script_stats;
+
+/**
+ * Starts a script
+ *
+ * It is first resumed by the next script_update(). A script starts another one with
+ * script_start_locked().
+ * @param[in]	function The script
+ * @param[in]	arg Handed to the script in its frame
+ * @return the frame the script runs in on success, SCRIPT_ERR_FULL if every frame is in use
+ */
+int script_start(script_function_t function, void *arg)
+{
+	int frame;
+
+	IO_LOCK;
+	frame = script_start_locked(function, arg);
+	IO_UNLOCK;
+	return frame;
+}
+
+/**
+ * Starts a script, with the io lock already held
+ *
+ * As script_start(). Called from a script the new one is first resumed later in the same
+ * script_update() if its frame comes after the caller's, otherwise in the next one.
+ * @param[in]	function The script
+ * @param[in]	arg Handed to the script in its frame
+ * @return the frame the script runs in on success, SCRIPT_ERR_FULL if every frame is in use
+ */
+int script_start_locked(script_function_t function, void *arg)
+{
+	struct script_t *frame;
+
+	for (int i=0; i<SCRIPT_MAX_FRAMES; i++) {
+		frame = &script_frames[i];
+		if (frame->state != SCRIPT_FREE)
+			continue;
+
+		memset(frame, 0, sizeof(*frame));
+		frame->function = function;
+		frame->arg = arg;
+		frame->started = cycle_count;
+		frame->state = SCRIPT_WAITING;
+		script_stats.started++;
+		return i;
+	}
+	script_stats.full++;
+	return SCRIPT_ERR_FULL;
+}
+
+/**
+ * Tells how a script is getting on
+ *
+ * @param[in]	frame The frame from script_start()
+ * @return SCRIPT_WAITING while it runs, SCRIPT_FINISHED or SCRIPT_ABORTED once it has ended,
+ * SCRIPT_FREE if the frame is not in use
+ */
+enum script_states script_state(int frame)
+{
+	if (frame < 0 || frame >= SCRIPT_MAX_FRAMES)
+		return SCRIPT_FREE;
+	return script_frames[frame].state;
+}
+
+/**
+ * Gives back the frame of a script that has ended
+ *
+ * @param[in]	frame The frame from script_start()
+ * @return how the script ended, SCRIPT_FINISHED or SCRIPT_ABORTED, SCRIPT_ERR_RUNNING if it has
+ * not ended yet, SCRIPT_ERR_FRAME if the frame is not in use
+ */
+int script_free(int frame)
+{
+	int state;
+
+	IO_LOCK;
+	state = script_free_locked(frame);
+	IO_UNLOCK;
+	return state;
+}
+
+/**
+ * Gives back the frame of a script that has ended, with the io lock already held
+ *
+ * As script_free(), for scripts (see SCRIPT_RUN()).
+ * @param[in]	frame The frame from script_start()
+ * @return how the script ended, SCRIPT_FINISHED or SCRIPT_ABORTED, SCRIPT_ERR_RUNNING if it has
+ * not ended yet, SCRIPT_ERR_FRAME if the frame is not in use
+ */
+int script_free_locked(int frame)
+{
+	int state;
+
+	if (frame < 0 || frame >= SCRIPT_MAX_FRAMES)
+		return SCRIPT_ERR_FRAME;
+
+	state = script_frames[frame].state;
+	if (state == SCRIPT_WAITING)
+		return SCRIPT_ERR_RUNNING;
+	if (state == SCRIPT_FREE)
+		return SCRIPT_ERR_FRAME;
+	script_frames[frame].state = SCRIPT_FREE;
+	return state;
+}
+
+/**
+ * Aborts a script where it is waiting
+ *
+ * Moves it has queued are not taken back. The frame still has to be given back with script_free().
+ * @param[in]	frame The frame from script_start()
+ * @return SCRIPT_ERR_SUCCESS on success, SCRIPT_ERR_FRAME if no script is running in the frame
+ */
+int script_stop(int frame)
+{
+	if (frame < 0 || frame >= SCRIPT_MAX_FRAMES)
+		return SCRIPT_ERR_FRAME;
+
+	IO_LOCK;
+	if (script_frames[frame].state != SCRIPT_WAITING) {
+		IO_UNLOCK;
+		return SCRIPT_ERR_FRAME;
+	}
+	script_frames[frame].state = SCRIPT_ABORTED;
+	script_stats.aborted++;
+	IO_UNLOCK;
+	return SCRIPT_ERR_SUCCESS;
+}
+
+/**
+ * Counts the scripts still running
+ *
+ * @return the number of scripts waiting to be resumed
+ */
+int script_running(void)
+{
+	int running = 0;
+
+	for (int i=0; i<SCRIPT_MAX_FRAMES; i++) {
+		if (script_frames[i].state == SCRIPT_WAITING)
+			running++;
+	}
+	return running;
+}
+
+/**
+ * Resumes every waiting script once
+ *
+ * Must be called once per cycle after the motion has been updated, so the scripts see this
+ * cycle's state, the io lock must already be held (see cycle_update()).
+ */
+void script_update(void)
+{
+	struct script_t *frame;
+	enum script_states state;
+	int stopped = safety_stopped();
+	int64_t start = 0;
+
+	if (cycle_clock_ns != NULL)
+		start = cycle_clock_ns();
+
+	for (int i=0; i<SCRIPT_MAX_FRAMES; i++) {
+		frame = &script_frames[i];
+		if (frame->state != SCRIPT_WAITING)
+			continue;
+
+		if (stopped) {
+			frame->state = SCRIPT_ABORTED;
+			script_stats.aborted++;
+			continue;
+		}
+		frame->resumes++;
+		state = frame->function(frame);
+		if (state == SCRIPT_WAITING)
+			continue;
+		frame->state = state;
+		if (state == SCRIPT_FINISHED)
+			script_stats.finished++;
+		else
+			script_stats.aborted++;
+	}
+
+	if (cycle_clock_ns != NULL) {
+		script_stats.update_ns_last = cycle_clock_ns() - start;
+		if (script_stats.update_ns_last > script_stats.update_ns_max)
+			script_stats.update_ns_max = script_stats.update_ns_last;
+	}
+}
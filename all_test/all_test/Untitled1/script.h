@@ -0,0 +1,163 @@
+/* script.h
+ * this file defines motion scripts, sequences written as straight line code that wait for the
+ * machine (a move to finish, a condition, a number of cycles) and are resumed by the cycle
+ * a script is a function that picks up where it last waited every time it is resumed, its frame
+ * comes from a fixed pool so nothing is allocated in the cycle
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __SCRIPT_H__
+#define __SCRIPT_H__
+
+#ifdef TC_VER /* If a twincat 3 version is defined */
+#include "stdint.h"
+#else
+#include <stdint.h>
+#endif
+
+#include "cycle.h"
+#include "wago_move_queue.h"
+
+#define SCRIPT_MAX_FRAMES 8
+/* room for a script's own variables, see SCRIPT_LOCALS() */
+#define SCRIPT_LOCALS_SIZE 128
+
+#define SCRIPT_ERR_SUCCESS 0
+#define SCRIPT_ERR_FULL -1
+#define SCRIPT_ERR_FRAME -2
+#define SCRIPT_ERR_RUNNING -3
+
+/* what a script returns each time it is resumed */
+enum script_states {
+	SCRIPT_FREE = 0,	/* frame not in use */
+	SCRIPT_WAITING,		/* to be resumed next cycle */
+	SCRIPT_FINISHED,	/* ran to SCRIPT_END() */
+	SCRIPT_ABORTED		/* left by SCRIPT_ABORT() or script_stop() */
+};
+
+struct script_t;
+typedef enum script_states (*script_function_t)(struct script_t *script);
+
+struct script_t {
+	script_function_t function;
+	void *arg; /* handed to script_start() */
+	enum script_states state;
+	int resume; /* where to pick up, 0 at the start */
+	uint32_t until; /* SCRIPT_CYCLES() */
+	int err; /* last error of a call made by a macro, SCRIPT_QUEUE_MOVE() */
+	int child; /* frame of the script SCRIPT_RUN() waits for */
+	uint32_t started; /* cycle_count when started */
+	uint32_t resumes;
+	/* the script's variables, ordinary locals do not keep their value across a wait */
+	union {
+		double align;
+		uint8_t bytes[SCRIPT_LOCALS_SIZE];
+	} locals;
+};
+
+struct script_stats_t {
+	uint32_t started;
+	uint32_t finished;
+	uint32_t aborted;
+	uint32_t full; /* script_start() found no free frame */
+	/* time spent resuming the scripts in one cycle, only measured if cycle_clock_ns is set */
+	int64_t update_ns_last;
+	int64_t update_ns_max;
+};
+
+extern struct script_t script_frames[SCRIPT_MAX_FRAMES];
+extern struct script_stats_t script_stats;
+
+/*
+ * Writing a script
+ *
+ *	struct pick_locals_t { int i; };
+ *
+ *	enum script_states pick(struct script_t *s)
+ *	{
+ *		struct pick_locals_t *l = SCRIPT_LOCALS(s, struct pick_locals_t);
+ *
+ *		SCRIPT_BEGIN(s);
+ *		for (l->i = 0; l->i < 3; l->i++) {
+ *			SCRIPT_MOVE_TO(s, l->i, 6400, 5000, 5000);
+ *		}
+ *		SCRIPT_CYCLES(s, 100);
+ *		SCRIPT_END(s);
+ *	}
+ *
+ * Every wait is several statements, it needs braces round it under an if or a loop. The waits
+ * are case labels of a switch over the whole body, so a script may not use a switch of
+ * its own around a wait, and (as it is built as c++ under TwinCAT3) may not declare a variable
+ * with an initialiser that a wait jumps over. Anything that has to last across a wait belongs in
+ * SCRIPT_LOCALS(). A script runs in the cycle with the io lock held: it must call the _locked
+ * variants of the queueing functions (wago_queue_move_locked(), output_event_after_move_locked(),
+ * ...), the lock is not recursive. It must not block, print or allocate, and should do little
+ * between waits.
+ */
+
+/* the script's variables as a struct, which must fit in SCRIPT_LOCALS_SIZE */
+#define SCRIPT_LOCALS(s, type) ((type *) (s)->locals.bytes)
+
+#define SCRIPT_BEGIN(s) switch ((s)->resume) { case 0:
+
+#define SCRIPT_END(s) } (s)->resume = -1; return SCRIPT_FINISHED
+
+#define SCRIPT_ABORT(s) do { (s)->resume = -1; return SCRIPT_ABORTED; } while (0)
+
+/* fall through marker for the waits, a comment does not survive the macro, so
+ * -Wimplicit-fallthrough needs the attribute */
+#if defined(__GNUC__) && (__GNUC__ >= 7 || defined(__clang__))
+#define SCRIPT_FALL_THROUGH __attribute__((fallthrough))
+#else
+#define SCRIPT_FALL_THROUGH ((void) 0)
+#endif
+
+/* waits until cond is true, cond is checked straight away and then once every cycle */
+#define SCRIPT_UNTIL(s, cond) SCRIPT_UNTIL_AT(s, cond, __COUNTER__ + 1)
+#define SCRIPT_UNTIL_AT(s, cond, n) \
+	(s)->resume = (n); SCRIPT_FALL_THROUGH; case (n): if (!(cond)) return SCRIPT_WAITING
+
+/* gives up the rest of the cycle */
+#define SCRIPT_YIELD(s) SCRIPT_YIELD_AT(s, __COUNTER__ + 1)
+#define SCRIPT_YIELD_AT(s, n) \
+	(s)->resume = (n); return SCRIPT_WAITING; SCRIPT_FALL_THROUGH; case (n):
+
+/* waits n cycles */
+#define SCRIPT_CYCLES(s, n) \
+	(s)->until = cycle_count + (uint32_t) (n); \
+	SCRIPT_UNTIL(s, (int32_t) (cycle_count - (s)->until) >= 0)
+
+/* queues a stepper move, waiting for room in the queue, and aborts if it cannot be queued at all */
+#define SCRIPT_QUEUE_MOVE(s, device, position, velocity, acceleration) \
+	SCRIPT_UNTIL(s, ((s)->err = wago_queue_move_locked((device), (position), (velocity), (acceleration))) != WAGO_ERR_QUEUE_FULL); \
+	if ((s)->err < 0) \
+		SCRIPT_ABORT(s)
+
+/* queues a stepper move and waits until the axis is done with every move queued */
+#define SCRIPT_MOVE_TO(s, device, position, velocity, acceleration) \
+	SCRIPT_QUEUE_MOVE(s, device, position, velocity, acceleration); \
+	SCRIPT_UNTIL(s, wago_queue_idle(device))
+
+/* runs another script in a frame of its own and waits for it, aborting too if it is aborted */
+#define SCRIPT_RUN(s, function, arg) \
+	SCRIPT_UNTIL(s, ((s)->child = script_start_locked((function), (arg))) >= 0); \
+	SCRIPT_UNTIL(s, script_state((s)->child) != SCRIPT_WAITING); \
+	if (script_free_locked((s)->child) == SCRIPT_ABORTED) \
+		SCRIPT_ABORT(s)
+
+int script_start(script_function_t function, void *arg);
+int script_start_locked(script_function_t function, void *arg);
+enum script_states script_state(int frame);
+int script_free(int frame);
+int script_free_locked(int frame);
+int script_stop(int frame);
+int script_running(void);
+
+/* called from the cycle */
+void script_update(void);
+
+#endif /* __SCRIPT_H__ */
@@ -0,0 +1,483 @@
+/** \file
+ * \brief Ordering the pick and place jobs waiting for a robot
+ *
+ * A job is a pick path from its pick to its place point carrying the payload. Getting to it is an
+ * empty pick path from wherever the robot let go of the part before. The job itself is timed with
+ * trajectory_duration() as it is added, which also tells whether it can be made at all. The empty
+ * moves to it from every job already waiting and back are only estimated from the length of
+ * their paths then (sequence_estimate()), so adding a job costs one model however many are
+ * waiting. The estimates are replaced by the model's times while the time budget lasts, the moves
+ * of the order as it stands first, and are scaled by what the model has come to so far. The model's
+ * times are those the planner will come to, the slow corners of the workspace included, the order
+ * is worked on from the table alone.
+ *
+ * An order is judged by the time of each job in it, those further down the order counting for
+ * less (sequence_score()). A new job goes in where that comes out lowest. sequence_optimise() then builds an order afresh by
+ * always going to the job that is quickest to get to and done (nearest neighbour), keeps whichever
+ * of the two is better, and improves it by moving one job elsewhere in the order, swapping two
+ * jobs or reversing a stretch of them, for as long as a change is better and the time budget
+ * lasts. The first job of the order is the one to queue next.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "sequence.h"
+
+/**
+ * Reads the monotonic clock
+ *
+ * @return the time, ns
+ */
+static int64_t sequence_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Times a pick path with the planner's model
+ *
+ * @param[in,out]	sequence The sequence, for the robot, the lift and the stats
+ * @param[in]	from Where the path starts
+ * @param[in]	to Where it ends
+ * @param[in]	payload Mass carried, kg
+ * @return the time, s, SEQUENCE_UNREACHABLE_TIME if the path cannot be planned
+ */
+static double sequence_model(struct sequence_t *sequence, const double from[3], const double to[3], double payload)
+{
+	struct delta_robot_t robot = sequence->robot;
+	struct trajectory_path_t path;
+	double duration;
+
+	robot.payload = payload;
+	trajectory_pick_path(&path, from, to, sequence->lift);
+	sequence->stats.models++;
+	if (trajectory_duration(&robot, &path, TRAJECTORY_MODEL_STEP, &duration) < 0)
+		return SEQUENCE_UNREACHABLE_TIME;
+	return duration;
+}
+
+/**
+ * Estimates an empty pick path from its length, unscaled
+ *
+ * @param[in]	sequence The sequence, for the lift
+ * @param[in]	from Where the path starts
+ * @param[in]	to Where it ends
+ * @return the time, s
+ */
+static double sequence_length_time(const struct sequence_t *sequence, const double from[3], const double to[3])
+{
+	double length = hypot(to[0] - from[0], to[1] - from[1]) + fabs(to[2] - from[2]) + 2.0 * sequence->lift;
+	double speed = SEQUENCE_ESTIMATE_SPEED, acceleration = SEQUENCE_ESTIMATE_ACCELERATION, time;
+
+	if (length < speed * speed / acceleration)
+		time = 2.0 * sqrt(length / acceleration);
+	else
+		time = length / speed + speed / acceleration;
+	return time + SEQUENCE_ESTIMATE_SETTLE;
+}
+
+/**
+ * Estimates an empty pick path until the model gets to it
+ *
+ * @param[in,out]	sequence The sequence, for the lift, the scale and the stats
+ * @param[in]	from Where the path starts
+ * @param[in]	to Where it ends
+ * @return the time, s
+ */
+static double sequence_estimate(struct sequence_t *sequence, const double from[3], const double to[3])
+{
+	double scale = (sequence->estimated > 0.0) ? sequence->modelled / sequence->estimated : 1.0;
+
+	sequence->stats.estimates++;
+	return sequence_length_time(sequence, from, to) * scale;
+}
+
+/**
+ * Times an estimated move with the model
+ *
+ * The model's time goes towards the scale of the estimates.
+ * @param[in,out]	sequence The sequence
+ * @param[in]	from The slot of the job the move starts from, -1 for where the robot is
+ * @param[in]	to The slot of the job it goes to
+ * @param[in]	deadline When to stop, monotonic ns
+ * @return 1 if it was timed, 0 if it was timed already or the time has run out
+ */
+static int sequence_refine(struct sequence_t *sequence, int from, int to, int64_t deadline)
+{
+	uint32_t *timed = (from < 0) ? &sequence->start_timed : &sequence->reach_timed[from];
+	double *time = (from < 0) ? &sequence->start[to] : &sequence->reach[from][to];
+	const double *p = (from < 0) ? sequence->at : sequence->jobs[from].place;
+
+	if ((*timed & (1u << to)) || sequence_now() > deadline)
+		return 0;
+	*time = sequence_model(sequence, p, sequence->jobs[to].pick, 0.0);
+	*timed |= 1u << to;
+	if (*time < SEQUENCE_UNREACHABLE_TIME) {
+		sequence->modelled += *time;
+		sequence->estimated += sequence_length_time(sequence, p, sequence->jobs[to].pick);
+	}
+	return 1;
+}
+
+/**
+ * Times the estimated moves of the order as it stands, front to back
+ *
+ * @param[in,out]	sequence The sequence
+ * @param[in]	deadline When to stop, monotonic ns
+ * @return the number of moves timed
+ */
+static int sequence_refine_order(struct sequence_t *sequence, int64_t deadline)
+{
+	int timed = 0;
+
+	for (int i=0; i<sequence->count; i++)
+		timed += sequence_refine(sequence, (i == 0) ? -1 : sequence->order[i - 1], sequence->order[i], deadline);
+	return timed;
+}
+
+/**
+ * Times the estimated moves between every other pair of jobs, from the front of the order
+ *
+ * @param[in,out]	sequence The sequence
+ * @param[in]	deadline When to stop, monotonic ns
+ * @return the number of moves timed
+ */
+static int sequence_refine_rest(struct sequence_t *sequence, int64_t deadline)
+{
+	int timed = 0;
+
+	for (int i=0; i<sequence->count; i++) {
+		timed += sequence_refine(sequence, -1, sequence->order[i], deadline);
+		for (int k=0; k<sequence->count; k++) {
+			if (k != i)
+				timed += sequence_refine(sequence, sequence->order[i], sequence->order[k], deadline);
+		}
+	}
+	return timed;
+}
+
+/**
+ * Works out how long an order of the jobs takes
+ *
+ * @param[in]	sequence The sequence
+ * @param[in]	order The slots in order, sequence->count of them
+ * @return the time, s
+ */
+static double sequence_cost(const struct sequence_t *sequence, const int *order)
+{
+	double cost = 0.0;
+
+	for (int i=0; i<sequence->count; i++)
+		cost += ((i == 0) ? sequence->start[order[0]] : sequence->reach[order[i - 1]][order[i]]) + sequence->carry[order[i]];
+	return cost;
+}
+
+/**
+ * Works out how good an order of the jobs is, lower is better
+ *
+ * New jobs keep coming while the ones waiting are taken, so the time to the last one is not
+ * what counts: an order that makes a poor start to save a little further on only loses out once
+ * a job arrives that fits in better. Each job's time is counted for SEQUENCE_DISCOUNT of the job
+ * before it, the moves at the front count for the most.
+ * @param[in]	sequence The sequence
+ * @param[in]	order The slots in order, sequence->count of them
+ * @return the discounted time, s
+ */
+static double sequence_score(const struct sequence_t *sequence, const int *order)
+{
+	double score = 0.0, weight = 1.0;
+
+	for (int i=0; i<sequence->count; i++) {
+		score += weight * (((i == 0) ? sequence->start[order[0]] : sequence->reach[order[i - 1]][order[i]]) + sequence->carry[order[i]]);
+		weight *= SEQUENCE_DISCOUNT;
+	}
+	return score;
+}
+
+/**
+ * Sets up an empty sequence
+ *
+ * @param[out]	sequence The sequence
+ * @param[in]	robot The robot, copied
+ * @param[in]	at Where the robot is
+ * @param[in]	lift How far above the points the paths cross over
+ */
+void sequence_init(struct sequence_t *sequence, const struct delta_robot_t *robot, const double at[3], double lift)
+{
+	memset(sequence, 0, sizeof(*sequence));
+	sequence->robot = *robot;
+	sequence->robot.fixed_limits = NULL;
+	sequence->lift = lift;
+	memcpy(sequence->at, at, sizeof(sequence->at));
+}
+
+/**
+ * Adds a job where it fits best in the order
+ *
+ * Blocks while it times the job itself, one trajectory_duration(), and then while it times the
+ * moves to and from it in the order, as far as the budget lasts. The rest are estimated.
+ * @param[in,out]	sequence The sequence
+ * @param[in]	job The job, copied
+ * @param[in]	budget_ns Time allowed, SEQUENCE_DEFAULT_BUDGET_NS normally
+ * @return SEQUENCE_ERR_SUCCESS on success, SEQUENCE_ERR_FULL if SEQUENCE_MAX_JOBS are waiting
+ * already, SEQUENCE_ERR_UNREACHABLE if the job cannot be planned
+ */
+int sequence_add(struct sequence_t *sequence, const struct sequence_job_t *job, int64_t budget_ns)
+{
+	int64_t deadline = sequence_now() + budget_ns;
+	int slot, best = 0, trial[SEQUENCE_MAX_JOBS];
+	double carry, score, least = 0.0;
+
+	if (sequence->count >= SEQUENCE_MAX_JOBS)
+		return SEQUENCE_ERR_FULL;
+	carry = sequence_model(sequence, job->pick, job->place, job->payload);
+	if (carry >= SEQUENCE_UNREACHABLE_TIME) {
+		sequence->stats.unreachable++;
+		return SEQUENCE_ERR_UNREACHABLE;
+	}
+	for (slot=0; sequence->used[slot]; slot++)
+		;
+
+	sequence->jobs[slot] = *job;
+	sequence->carry[slot] = carry;
+	sequence->start[slot] = sequence_estimate(sequence, sequence->at, job->pick);
+	sequence->start_timed &= ~(1u << slot);
+	sequence->reach_timed[slot] = 0;
+	for (int k=0; k<SEQUENCE_MAX_JOBS; k++) {
+		if (!sequence->used[k])
+			continue;
+		sequence->reach[k][slot] = sequence_estimate(sequence, sequence->jobs[k].place, job->pick);
+		sequence->reach_timed[k] &= ~(1u << slot);
+		sequence->reach[slot][k] = sequence_estimate(sequence, job->place, sequence->jobs[k].pick);
+	}
+	sequence->used[slot] = 1;
+
+	/* best place in the order, position i goes before the job at i */
+	sequence->count++;
+	for (int i=0; i<sequence->count; i++) {
+		memcpy(trial, sequence->order, i * sizeof(trial[0]));
+		trial[i] = slot;
+		memcpy(&trial[i + 1], &sequence->order[i], (sequence->count - 1 - i) * sizeof(trial[0]));
+		score = sequence_score(sequence, trial);
+		if (i == 0 || score < least) {
+			least = score;
+			best = i;
+		}
+	}
+	memmove(&sequence->order[best + 1], &sequence->order[best], (sequence->count - 1 - best) * sizeof(sequence->order[0]));
+	sequence->order[best] = slot;
+	sequence->stats.added++;
+	sequence_refine_order(sequence, deadline);
+	return SEQUENCE_ERR_SUCCESS;
+}
+
+/**
+ * Tells the sequence the robot is somewhere else than where the last job left it
+ *
+ * As after moves the sequence was not asked for. The moves from there to each job are estimated
+ * again, nothing is timed. Within SEQUENCE_MOVE_TOLERANCE the times stand.
+ * @param[in,out]	sequence The sequence
+ * @param[in]	at Where the robot is
+ */
+void sequence_move(struct sequence_t *sequence, const double at[3])
+{
+	double off = 0.0;
+
+	for (int c=0; c<3; c++)
+		off += (at[c] - sequence->at[c]) * (at[c] - sequence->at[c]);
+	if (off < SEQUENCE_MOVE_TOLERANCE * SEQUENCE_MOVE_TOLERANCE)
+		return;
+	memcpy(sequence->at, at, sizeof(sequence->at));
+	for (int k=0; k<SEQUENCE_MAX_JOBS; k++) {
+		if (sequence->used[k])
+			sequence->start[k] = sequence_estimate(sequence, at, sequence->jobs[k].pick);
+	}
+	sequence->start_timed = 0;
+}
+
+/**
+ * Orders the jobs by always going to the one quickest to get to
+ *
+ * @param[in]	sequence The sequence
+ * @param[out]	order The slots in order
+ */
+static void sequence_nearest(const struct sequence_t *sequence, int *order)
+{
+	int taken[SEQUENCE_MAX_JOBS] = {0};
+	int last = -1, next;
+	double time, quickest;
+
+	for (int i=0; i<sequence->count; i++) {
+		next = -1;
+		quickest = 0.0;
+		for (int k=0; k<sequence->count; k++) {
+			int slot = sequence->order[k];
+			if (taken[k])
+				continue;
+			time = ((last < 0) ? sequence->start[slot] : sequence->reach[last][slot]) + sequence->carry[slot];
+			if (next < 0 || time < quickest) {
+				next = k;
+				quickest = time;
+			}
+		}
+		taken[next] = 1;
+		order[i] = last = sequence->order[next];
+	}
+}
+
+/**
+ * Takes a changed order if it is better
+ *
+ * @param[in]	sequence The sequence
+ * @param[in,out]	order The slots in order
+ * @param[in]	trial The changed order
+ * @param[in,out]	cost The order's score
+ * @return 1 if the changed order was taken, 0 if not
+ */
+static int sequence_try(const struct sequence_t *sequence, int *order, const int *trial, double *cost)
+{
+	double time = sequence_score(sequence, trial);
+
+	if (time >= *cost - 1e-9)
+		return 0;
+	memcpy(order, trial, sequence->count * sizeof(trial[0]));
+	*cost = time;
+	return 1;
+}
+
+/**
+ * Makes the first change to an order that is better
+ *
+ * @param[in]	sequence The sequence
+ * @param[in,out]	order The slots in order
+ * @param[in,out]	cost The order's score
+ * @param[in]	deadline When to give up looking, monotonic ns
+ * @return 1 if the order was changed, 0 if no change is better, -1 if out of time
+ */
+static int sequence_improve(const struct sequence_t *sequence, int *order, double *cost, int64_t deadline)
+{
+	int n = sequence->count, trial[SEQUENCE_MAX_JOBS], moved;
+
+	for (int i=0; i<n; i++) {
+		if (sequence_now() > deadline)
+			return -1;
+		/* one job moved to j */
+		for (int j=0; j<n; j++) {
+			if (j == i)
+				continue;
+			memcpy(trial, order, n * sizeof(trial[0]));
+			moved = trial[i];
+			if (j > i)
+				memmove(&trial[i], &trial[i + 1], (j - i) * sizeof(trial[0]));
+			else
+				memmove(&trial[j + 1], &trial[j], (i - j) * sizeof(trial[0]));
+			trial[j] = moved;
+			if (sequence_try(sequence, order, trial, cost))
+				return 1;
+		}
+		/* two jobs swapped, the stretch between them reversed */
+		for (int j=i+1; j<n; j++) {
+			memcpy(trial, order, n * sizeof(trial[0]));
+			trial[i] = order[j];
+			trial[j] = order[i];
+			if (sequence_try(sequence, order, trial, cost))
+				return 1;
+			for (int k=0; k<=j-i; k++)
+				trial[i + k] = order[j - k];
+			if (sequence_try(sequence, order, trial, cost))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Improves the order of the jobs within a time budget
+ *
+ * The moves of the order are timed with the model before it is judged, so an order is never
+ * taken on an estimate alone. Once no change is better the other moves are timed with what is
+ * left of the budget, and the search goes on if that makes a change better after all.
+ * @param[in,out]	sequence The sequence
+ * @param[in]	budget_ns Time allowed, SEQUENCE_DEFAULT_BUDGET_NS normally
+ * @return the number of changes that took time off the order
+ */
+int sequence_optimise(struct sequence_t *sequence, int64_t budget_ns)
+{
+	int64_t deadline = sequence_now() + budget_ns;
+	int order[SEQUENCE_MAX_JOBS], improvements = 0, err;
+	double cost, nearest;
+
+	if (sequence->count < 2)
+		return 0;
+
+	cost = sequence_score(sequence, sequence->order);
+	sequence_nearest(sequence, order);
+	nearest = sequence_score(sequence, order);
+	if (nearest < cost) {
+		memcpy(sequence->order, order, sequence->count * sizeof(order[0]));
+		cost = nearest;
+	}
+
+	for (;;) {
+		if (sequence_refine_order(sequence, deadline) > 0)
+			cost = sequence_score(sequence, sequence->order);
+		err = sequence_improve(sequence, sequence->order, &cost, deadline);
+		if (err > 0) {
+			improvements++;
+			continue;
+		}
+		if (err < 0 || sequence_refine_rest(sequence, deadline) == 0)
+			break;
+	}
+	if (err < 0)
+		sequence->stats.out_of_time++;
+	sequence->stats.improvements += improvements;
+	return improvements;
+}
+
+/**
+ * Takes the next job in the order
+ *
+ * The robot is taken to be at the job's place point from then on, sequence_move() if it is not.
+ * @param[in,out]	sequence The sequence
+ * @param[out]	job The job
+ * @return SEQUENCE_ERR_SUCCESS on success, SEQUENCE_ERR_EMPTY if no job is waiting
+ */
+int sequence_next(struct sequence_t *sequence, struct sequence_job_t *job)
+{
+	int slot;
+
+	if (sequence->count == 0)
+		return SEQUENCE_ERR_EMPTY;
+	slot = sequence->order[0];
+	*job = sequence->jobs[slot];
+	sequence->used[slot] = 0;
+	sequence->count--;
+	memmove(&sequence->order[0], &sequence->order[1], sequence->count * sizeof(sequence->order[0]));
+
+	/* the moves from its place point are timed or estimated already */
+	memcpy(sequence->at, job->place, sizeof(sequence->at));
+	for (int k=0; k<SEQUENCE_MAX_JOBS; k++) {
+		if (sequence->used[k])
+			sequence->start[k] = sequence->reach[slot][k];
+	}
+	sequence->start_timed = sequence->reach_timed[slot];
+	sequence->stats.taken++;
+	return SEQUENCE_ERR_SUCCESS;
+}
+
+/**
+ * Works out how long the jobs waiting take in their current order
+ *
+ * @param[in]	sequence The sequence
+ * @return the time, s, by the planner's model where it has timed the moves
+ */
+double sequence_time(const struct sequence_t *sequence)
+{
+	return sequence_cost(sequence, sequence->order);
+}
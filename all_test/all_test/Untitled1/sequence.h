@@ -0,0 +1,85 @@
+/* sequence.h
+ * this file defines the ordering of the pick and place jobs waiting for a robot
+ * the time each move takes is estimated as the job arrives and replaced by the trajectory
+ * planner's model (trajectory_duration()) as time allows, jobs are put in as they arrive and the
+ * order is improved within a time budget so the robot spends as little time as it can getting
+ * from one job to the next
+ * SOEM only
+ */
+
+#ifndef __SEQUENCE_H__
+#define __SEQUENCE_H__
+
+#include <stdint.h>
+
+#include "trajectory.h"
+
+#define SEQUENCE_MAX_JOBS 32
+/* time of a move that cannot be planned, so it is never chosen, s */
+#define SEQUENCE_UNREACHABLE_TIME 1000.0
+/* how much each job in the order counts for against the one before, the jobs further on are
+ * taken as they stand once more have come in */
+#define SEQUENCE_DISCOUNT 0.9
+/* default time allowed for adding a job or improving the order each time, ns */
+#define SEQUENCE_DEFAULT_BUDGET_NS 1000000
+/* estimate of an empty pick path before the model has timed it: as fast as it can along the
+ * length of the path, then settling. Fitted to the model's times for delta_defaults() across the
+ * workspace, within 2% rms and 8% at worst, and scaled by what the model has come to since */
+#define SEQUENCE_ESTIMATE_SPEED 7.25 /* m/s */
+#define SEQUENCE_ESTIMATE_ACCELERATION 165.0 /* m/s^2 */
+#define SEQUENCE_ESTIMATE_SETTLE 0.015 /* s */
+/* the robot closer than this to where the sequence has it is taken to be there, metres */
+#define SEQUENCE_MOVE_TOLERANCE 0.001
+
+#define SEQUENCE_ERR_SUCCESS 0
+#define SEQUENCE_ERR_FULL -1
+#define SEQUENCE_ERR_EMPTY -2
+#define SEQUENCE_ERR_UNREACHABLE -3
+
+struct sequence_job_t {
+	uint32_t id;
+	double pick[3];
+	double place[3];
+	double payload; /* kg, carried from the pick to the place */
+};
+
+struct sequence_stats_t {
+	uint32_t added;
+	uint32_t unreachable; /* jobs that could not be planned and were not added */
+	uint32_t taken;
+	uint32_t models; /* moves timed with the planner's model */
+	uint32_t estimates; /* moves estimated until the model gets to them */
+	uint32_t improvements; /* changes that made the order better */
+	uint32_t out_of_time; /* times the budget ran out before the order could not be improved any more */
+};
+
+struct sequence_t {
+	struct delta_robot_t robot;
+	double lift;
+	double at[3]; /* where the robot is before the first job */
+	int count;
+	int order[SEQUENCE_MAX_JOBS]; /* slots of the jobs in the order they are to be taken */
+	int used[SEQUENCE_MAX_JOBS];
+	struct sequence_job_t jobs[SEQUENCE_MAX_JOBS];
+	/* modelled times, s: from the pick to the place of each job, empty from where the robot is to
+	 * its pick, and empty from the place of one job to the pick of another */
+	double carry[SEQUENCE_MAX_JOBS];
+	double start[SEQUENCE_MAX_JOBS];
+	double reach[SEQUENCE_MAX_JOBS][SEQUENCE_MAX_JOBS];
+	/* which of start and reach the model has timed, a bit for each slot, the rest are estimates */
+	uint32_t start_timed;
+	uint32_t reach_timed[SEQUENCE_MAX_JOBS];
+	/* the model's times against the estimates of the same moves, s */
+	double modelled;
+	double estimated;
+	struct sequence_stats_t stats;
+};
+
+void sequence_init(struct sequence_t *sequence, const struct delta_robot_t *robot, const double at[3], double lift);
+int sequence_add(struct sequence_t *sequence, const struct sequence_job_t *job, int64_t budget_ns);
+void sequence_move(struct sequence_t *sequence, const double at[3]);
+int sequence_optimise(struct sequence_t *sequence, int64_t budget_ns);
+int sequence_next(struct sequence_t *sequence, struct sequence_job_t *job);
+double sequence_time(const struct sequence_t *sequence);
+
+#endif /* __SEQUENCE_H__ */
@@ -0,0 +1,209 @@
+/** \file
+ * \brief Picks per minute with and without ordering the jobs
+ *
+ * Two synthetic streams of jobs. Sorting: parts lie at random on the pick side of the workspace
+ * and each goes to one of a few bins on the other side. Kitting: parts lie anywhere in the
+ * workspace and each goes to its own spot anywhere in it. A set number of parts are waiting at
+ * any time, each one picked is replaced by the next of the stream. The same stream is run taking the parts in the
+ * order they came (first in first out), in the order the sequence puts them in as they arrive
+ * with nearest neighbour on the estimates only (no time to time or improve anything), and with
+ * SEQUENCE_DEFAULT_BUDGET_NS to add each arrival and as much again for the local search. Every move is timed as planned
+ * (TRAJECTORY_DEFAULT_STEP), not with the model the order was chosen with, plus the gripper's
+ * dwell at each end.
+ * Usage: sequence_bench [picks] [dwell in ms] [payload in kg]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sequence.h"
+
+/* sorting, parts are picked from this rectangle, metres */
+#define BENCH_PICK_X 0.120
+#define BENCH_PICK_Y_MIN -0.150
+#define BENCH_PICK_Y_MAX 0.000
+#define BENCH_BINS 3
+/* kitting, parts are picked and placed anywhere in this circle */
+#define BENCH_RADIUS 0.140
+#define BENCH_Z -0.450
+/* parts waiting at once for each run */
+static const int bench_waiting[] = {1, 2, 4, 8, 16, SEQUENCE_MAX_JOBS};
+
+enum bench_modes {
+	BENCH_FIFO = 0,
+	BENCH_NEAREST,
+	BENCH_SEARCH,
+	BENCH_MODES
+};
+
+static const char *bench_mode_names[BENCH_MODES] = {"in order", "nearest", "searched"};
+
+/**
+ * Reads the monotonic clock
+ *
+ * @return the time, ns
+ */
+static int64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Picks a random point in the kitting circle
+ *
+ * @param[out]	p The point
+ */
+static void bench_point(double p[3])
+{
+	do {
+		p[0] = (2.0 * rand() / RAND_MAX - 1.0) * BENCH_RADIUS;
+		p[1] = (2.0 * rand() / RAND_MAX - 1.0) * BENCH_RADIUS;
+	} while (p[0] * p[0] + p[1] * p[1] > BENCH_RADIUS * BENCH_RADIUS);
+	p[2] = BENCH_Z;
+}
+
+/**
+ * Draws a stream of jobs
+ *
+ * @param[out]	jobs The jobs
+ * @param[in]	count Number of jobs
+ * @param[in]	payload Mass of a part, kg
+ * @param[in]	kitting 1 for the kitting stream, 0 for sorting
+ */
+static void bench_stream(struct sequence_job_t *jobs, int count, double payload, int kitting)
+{
+	srand(1);
+	for (int i=0; i<count; i++) {
+		int bin = rand() % BENCH_BINS;
+		jobs[i].id = i;
+		jobs[i].payload = payload;
+		if (kitting) {
+			bench_point(jobs[i].pick);
+			bench_point(jobs[i].place);
+			continue;
+		}
+		jobs[i].pick[0] = (2.0 * rand() / RAND_MAX - 1.0) * BENCH_PICK_X;
+		jobs[i].pick[1] = BENCH_PICK_Y_MIN + (BENCH_PICK_Y_MAX - BENCH_PICK_Y_MIN) * rand() / RAND_MAX;
+		jobs[i].pick[2] = BENCH_Z;
+		jobs[i].place[0] = (bin - (BENCH_BINS - 1) / 2.0) * 0.100;
+		jobs[i].place[1] = 0.120;
+		jobs[i].place[2] = BENCH_Z;
+	}
+}
+
+/**
+ * Times a move as it would be planned
+ *
+ * @param[in]	robot The robot
+ * @param[in]	from Where it starts
+ * @param[in]	to Where it ends
+ * @param[in]	payload Mass carried, kg
+ * @return the time, s
+ */
+static double bench_move(const struct delta_robot_t *robot, const double from[3], const double to[3], double payload)
+{
+	struct delta_robot_t carrying = *robot;
+	struct trajectory_path_t path;
+	double duration;
+
+	carrying.payload = payload;
+	trajectory_pick_path(&path, from, to, TRAJECTORY_DEFAULT_LIFT);
+	if (trajectory_duration(&carrying, &path, TRAJECTORY_DEFAULT_STEP, &duration) < 0)
+		return SEQUENCE_UNREACHABLE_TIME;
+	return duration;
+}
+
+/**
+ * Runs the stream
+ *
+ * @param[in]	robot The robot
+ * @param[in]	jobs The stream, picks + waiting jobs, every one reachable
+ * @param[in]	picks Number of parts to pick
+ * @param[in]	waiting Number of parts waiting at once
+ * @param[in]	mode How they are ordered, enum bench_modes
+ * @param[in]	dwell Time at each end for the gripper, s
+ * @param[out]	ordering_ns Time spent adding and ordering the jobs
+ * @return picks per minute
+ */
+static double bench_run(const struct delta_robot_t *robot, const struct sequence_job_t *jobs, int picks, int waiting, int mode,
+	double dwell, int64_t *ordering_ns)
+{
+	struct sequence_t sequence;
+	struct sequence_job_t fifo[SEQUENCE_MAX_JOBS], job;
+	double at[3] = {0.0, 0.120, BENCH_Z}, time = 0.0;
+	int next = 0, fifo_count = 0;
+	int64_t start, budget;
+
+	sequence_init(&sequence, robot, at, TRAJECTORY_DEFAULT_LIFT);
+	*ordering_ns = 0;
+	for (int i=0; i<picks; i++) {
+		/* the table is topped up to the parts waiting */
+		start = bench_now();
+		while ((mode == BENCH_FIFO ? fifo_count : sequence.count) < waiting) {
+			if (mode == BENCH_FIFO) {
+				fifo[fifo_count++] = jobs[next++];
+				continue;
+			}
+			budget = (mode == BENCH_SEARCH) ? SEQUENCE_DEFAULT_BUDGET_NS : 0;
+			if (sequence_add(&sequence, &jobs[next++], budget) < 0)
+				continue;
+			sequence_optimise(&sequence, budget);
+		}
+		if (mode == BENCH_FIFO) {
+			job = fifo[0];
+			memmove(&fifo[0], &fifo[1], --fifo_count * sizeof(fifo[0]));
+		} else {
+			sequence_next(&sequence, &job);
+		}
+		*ordering_ns += bench_now() - start;
+
+		time += bench_move(robot, at, job.pick, 0.0) + bench_move(robot, job.pick, job.place, job.payload) + 2.0 * dwell;
+		memcpy(at, job.place, sizeof(at));
+	}
+	return picks / time * 60.0;
+}
+
+int main(int argc, char *argv[])
+{
+	int picks = (argc > 1) ? atoi(argv[1]) : 300;
+	double dwell = (argc > 2) ? atof(argv[2]) * 1e-3 : 0.030;
+	double payload = (argc > 3) ? atof(argv[3]) : 0.0;
+	struct delta_robot_t robot;
+	struct sequence_job_t *jobs;
+	double rate[BENCH_MODES];
+	int64_t ordering_ns[BENCH_MODES];
+
+	if (picks <= 0 || dwell < 0.0) {
+		printf("usage: %s [picks] [dwell in ms] [payload in kg]\n", argv[0]);
+		return 1;
+	}
+	jobs = malloc((picks + SEQUENCE_MAX_JOBS) * sizeof(*jobs));
+	if (jobs == NULL)
+		return 1;
+	delta_defaults(&robot);
+	printf("%d picks, %.0f ms dwell, %.2f kg\n", picks, dwell * 1e3, payload);
+
+	for (int kitting=0; kitting<2; kitting++) {
+		bench_stream(jobs, picks + SEQUENCE_MAX_JOBS, payload, kitting);
+		if (kitting)
+			printf("kitting, anywhere to anywhere\n");
+		else
+			printf("sorting into %d bins\n", BENCH_BINS);
+		for (unsigned int w=0; w<sizeof(bench_waiting)/sizeof(bench_waiting[0]); w++) {
+			for (int mode=0; mode<BENCH_MODES; mode++)
+				rate[mode] = bench_run(&robot, jobs, picks, bench_waiting[w], mode, dwell, &ordering_ns[mode]);
+			printf("%2d waiting:", bench_waiting[w]);
+			for (int mode=0; mode<BENCH_MODES; mode++)
+				printf(" %s %5.1f", bench_mode_names[mode], rate[mode]);
+			printf(" picks per minute, %+5.1f%% searched over in order, ordering %.2f ms per pick (nearest %.2f ms)\n",
+				(rate[BENCH_SEARCH] / rate[BENCH_FIFO] - 1.0) * 100.0, ordering_ns[BENCH_SEARCH] * 1e-6 / picks, ordering_ns[BENCH_NEAREST] * 1e-6 / picks);
+		}
+	}
+	free(jobs);
+	return 0;
+}
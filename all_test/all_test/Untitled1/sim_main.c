@@ -0,0 +1,514 @@
+/** \file
+ * \brief Runs the cell against a model of the machine, faster than real time
+ *
+ * The controller is the same code soem_main runs: the cycle (cycle_update()), the planner playing
+ * the picks, the picker assigning the parts, the startup script and the state machine. The bus is
+ * replaced by the plant model (sim_plant.c) and the ethercat thread's timer by a virtual clock that
+ * moves on a cycle as soon as the last one is done, so an hour of production runs in however long
+ * the controller's work takes.
+ *
+ * Everything runs on this thread in the order the threads would have run it: the plant exchange,
+ * then the cycle with the io lock held, then the picker (picker_poll()) between cycles, and the
+ * state machine every SIM_STATE_MACHINE_NS of virtual time. Picking and planning take no virtual
+ * time, a pick is planned as if the picker thread never fell behind, the scheduler's lead is
+ * still kept. The virtual time is what the belt and the conveyor tracking see, the controller's
+ * own timing figures (safety reaction, script time) stay on the real clock as they measure the
+ * code.
+ *
+ * Reports the parts taken off the belt and placed, the picks per minute over the run and from the
+ * end of the startup on, when the cell is running as it would in production, the peak joint
+ * velocities and accelerations against what the robots can do, and every cycle a robot went over
+ * them. Exits with 1 if one did, a plan that goes over is a fault of the planner. Every position
+ * the steppers' mailbox reads is compared with the plant, and once the startup has finished it has
+ * to report each stepper on the target of its last move, or the run exits with 1 as well.
+ *
+ * With -j, parts are also laid still in robot 0's reach, picked on one side of the belt and placed
+ * anywhere on the other, and handed to the picker as jobs (picker_add_job()) as it has room for
+ * them, so the robot orders them (sequence.h) and picks them between the belt's parts.
+ * Usage: sim [-t seconds] [-c cycle in us] [-p parts per minute] [-v belt speed in mm/s]
+ * [-n robots] [-x strategy] [-l payload in kg] [-b place x,y,z in mm] [-s protective stop at seconds] [-r seed]
+ * [-j parts laid still]
+ *
+ * The time planner_play() and cycle_update() take and the scripts' share of it are kept as
+ * histograms as well as their worst cases. The worst cases are of a process that is not real time
+ * and may be held up by the machine it runs on, on any line of the cycle; the 99.99th percentile
+ * and the cycles over the cycle time are what the code itself takes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "sim_plant.h"
+#include "state_machine.h"
+#include "wago_move_queue.h"
+#include "wago_mailbox.h"
+#include "homing.h"
+#include "safety.h"
+#include "script.h"
+#include "cycle.h"
+#include "ax5000.h"
+#include "following.h"
+#include "conveyor.h"
+#include "planner.h"
+#include "picker.h"
+#include "log.h"
+
+/* how often the state machine runs, as in soem_main, ns */
+#define SIM_STATE_MACHINE_NS 500000000LL
+/* cycle AX5000_DEFAULT_MAX_STEP is meant for, soem_main's TICK_RATE, ns */
+#define SIM_MAX_STEP_CYCLE_NS 100000
+/* parts laid still are picked from and placed anywhere across this on either side of the belt,
+ * robot 0's frame, metres */
+#define SIM_TABLE_X 0.100
+#define SIM_TABLE_Y_MIN 0.060
+#define SIM_TABLE_Y_MAX 0.140
+#define SIM_TABLE_Z -0.450
+/* the timing histograms' bins, 1 us each, the last one takes everything longer */
+#define SIM_TIMING_BINS 1000
+
+static double sim_seconds = 60.0;
+static uint32_t sim_cycle_ns = 100000;
+static double sim_parts_per_minute = 400.0;
+static double sim_belt_speed = 0.200;
+static int sim_robots = 1;
+static int sim_strategy = SCHEDULER_FIRST_FIT;
+static double sim_payload = 0.0;
+static double sim_place_mm[3];
+static int sim_place_set = 0;
+static double sim_stop_seconds = -1.0;
+static unsigned int sim_seed = 1;
+static int sim_jobs = 0;
+static int sim_jobs_handed = 0;
+static unsigned int sim_job_seed;
+
+/* the steppers' mailbox position feedback against where the plant has them */
+struct sim_feedback_t {
+	uint32_t updates; /* position_updates when last looked at */
+	uint32_t checked; /* readings compared */
+	int32_t error_max; /* steps */
+	int32_t peak; /* furthest from the switch a reading was, steps */
+};
+static struct sim_feedback_t sim_feedback[WAGO_NUM_STEPPERS];
+
+/* how long a piece of the cycle took, one count per cycle */
+struct sim_timing_t {
+	uint32_t bins[SIM_TIMING_BINS];
+	uint32_t count;
+};
+static struct sim_timing_t sim_cycle_timing;
+static struct sim_timing_t sim_script_timing;
+
+/**
+ * Reads the monotonic clock
+ *
+ * Used for timing measurements (see cycle_clock_ns), the cycle runs on the virtual clock.
+ * @return the time, ns
+ */
+static int64_t sim_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Counts one time in a histogram
+ *
+ * @param[in,out]	timing The histogram
+ * @param[in]	ns The time
+ */
+static void sim_timing_add(struct sim_timing_t *timing, int64_t ns)
+{
+	int64_t bin = ns / 1000;
+
+	timing->bins[(bin < SIM_TIMING_BINS - 1) ? bin : SIM_TIMING_BINS - 1]++;
+	timing->count++;
+}
+
+/**
+ * Finds the time a share of the counts were within
+ *
+ * @param[in]	timing The histogram
+ * @param[in]	share Between 0 and 1
+ * @return the upper end of the bin it falls in, us, SIM_TIMING_BINS if past the last
+ */
+static int sim_timing_within(const struct sim_timing_t *timing, double share)
+{
+	uint64_t below = 0;
+
+	for (int bin=0; bin<SIM_TIMING_BINS; bin++) {
+		below += timing->bins[bin];
+		if (below >= share * timing->count)
+			return bin + 1;
+	}
+	return SIM_TIMING_BINS;
+}
+
+/**
+ * Counts the times over a limit
+ *
+ * @param[in]	timing The histogram
+ * @param[in]	ns The limit
+ * @return how many were, to the nearest us
+ */
+static uint32_t sim_timing_over(const struct sim_timing_t *timing, int64_t ns)
+{
+	uint32_t over = 0;
+
+	for (int bin=(int) (ns / 1000); bin<SIM_TIMING_BINS; bin++)
+		over += timing->bins[bin];
+	return over;
+}
+
+/**
+ * Prints the usage and exits
+ */
+static void sim_help(void)
+{
+	printf("usage: sim [-t seconds] [-c cycle in us] [-p parts per minute] [-v belt speed in mm/s]\n"
+		"\t[-n robots] [-x strategy] [-l payload in kg] [-b place x,y,z in mm] [-s protective stop at seconds] [-r seed]\n"
+		"\t[-j parts laid still]\n"
+		"strategies: %d %s, %d %s, %d %s\n",
+		SCHEDULER_FIRST_FIT, scheduler_strategy_name(SCHEDULER_FIRST_FIT),
+		SCHEDULER_LAST_FIT, scheduler_strategy_name(SCHEDULER_LAST_FIT),
+		SCHEDULER_EARLIEST_FINISH, scheduler_strategy_name(SCHEDULER_EARLIEST_FINISH));
+	exit(1);
+}
+
+/**
+ * Reads the command line
+ *
+ * @param[in]	argc commandline argument count
+ * @param[in]	argv commandline arguments
+ */
+static void sim_options(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "b:c:j:l:n:p:r:s:t:v:x:")) != -1) {
+		switch (c) {
+		case 't':
+			sim_seconds = atof(optarg);
+			break;
+		case 'c':
+			sim_cycle_ns = (uint32_t) atoi(optarg) * 1000;
+			break;
+		case 'p':
+			sim_parts_per_minute = atof(optarg);
+			break;
+		case 'v':
+			sim_belt_speed = atof(optarg) * 1e-3;
+			break;
+		case 'n':
+			sim_robots = atoi(optarg);
+			break;
+		case 'x':
+			sim_strategy = atoi(optarg);
+			break;
+		case 'l':
+			sim_payload = atof(optarg);
+			break;
+		case 'b':
+			if (sscanf(optarg, "%lf,%lf,%lf", &sim_place_mm[0], &sim_place_mm[1], &sim_place_mm[2]) != 3)
+				sim_help();
+			sim_place_set = 1;
+			break;
+		case 's':
+			sim_stop_seconds = atof(optarg);
+			break;
+		case 'r':
+			sim_seed = (unsigned int) atoi(optarg);
+			break;
+		case 'j':
+			sim_jobs = atoi(optarg);
+			break;
+		default:
+			sim_help();
+		}
+	}
+	if (sim_seconds <= 0.0 || sim_cycle_ns == 0 || sim_parts_per_minute < 0.0 || sim_belt_speed <= 0.0 || sim_jobs < 0
+		|| sim_robots < 1 || sim_robots > PLANNER_MAX_ROBOTS || sim_strategy < 0 || sim_strategy >= SCHEDULER_STRATEGIES)
+		sim_help();
+}
+
+/**
+ * Draws a point across the table on one side of the belt
+ *
+ * @param[out]	p The point
+ * @param[in]	side -1 for the side the parts are picked from, 1 for the one they are placed on
+ */
+static void sim_table_point(double p[3], double side)
+{
+	p[0] = (2.0 * rand_r(&sim_job_seed) / RAND_MAX - 1.0) * SIM_TABLE_X;
+	p[1] = side * (SIM_TABLE_Y_MIN + (SIM_TABLE_Y_MAX - SIM_TABLE_Y_MIN) * rand_r(&sim_job_seed) / RAND_MAX);
+	p[2] = SIM_TABLE_Z;
+}
+
+/**
+ * Lays the parts still and hands them to the picker as it has room for them
+ *
+ * A part is only laid once the picker has its job, so the picker never plans for a part that is
+ * not there.
+ * @param[in]	payload Mass of a part, kg
+ */
+static void sim_hand_over(double payload)
+{
+	static struct sequence_job_t job;
+	static int drawn = 0;
+
+	while (sim_jobs_handed < sim_jobs) {
+		if (!drawn) {
+			memset(&job, 0, sizeof(job));
+			job.id = sim_jobs_handed;
+			sim_table_point(job.pick, -1.0);
+			sim_table_point(job.place, 1.0);
+			job.payload = payload;
+			drawn = 1;
+		}
+		if (picker_add_job(0, &job) < 0)
+			return;
+		if (sim_plant_add_part(0, job.pick, job.place, job.payload) < 0)
+			printf("Sim: No room for part %d, it will be missing when it is picked\n", sim_jobs_handed);
+		drawn = 0;
+		sim_jobs_handed++;
+	}
+}
+
+/**
+ * Compares each new mailbox position reading with the plant
+ *
+ * Called after every cycle. The plant answers a poll with where the stepper is in the cycle it
+ * sees it, and the cycle takes the answer in the same cycle, so a reading has to match exactly.
+ */
+static void sim_check_feedback(void)
+{
+	struct sim_feedback_t *f;
+	int32_t position, error;
+
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		f = &sim_feedback[i];
+		if (wago_mailboxes[i].position_updates == f->updates)
+			continue;
+		f->updates = wago_mailboxes[i].position_updates;
+		position = wago_mbx_actual_position(i, NULL);
+		error = position - sim_plant_stepper_position(i);
+		if (error < 0)
+			error = -error;
+		if (error > f->error_max)
+			f->error_max = error;
+		if (abs(position) > f->peak)
+			f->peak = abs(position);
+		f->checked++;
+	}
+}
+
+/**
+ * Checks that the mailbox reports each stepper on the target of the last move queued
+ *
+ * Only meaningful once the startup script has finished and every queue is idle.
+ * @return 1 if every stepper's feedback is right, 0 otherwise
+ */
+static int sim_feedback_ok(void)
+{
+	struct wago_move_queue_t *queue;
+	int32_t target;
+	int ok = 1;
+
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		queue = &wago_move_queues[i];
+		if (sim_feedback[i].checked == 0 || sim_feedback[i].error_max != 0)
+			ok = 0;
+		if (queue->head == 0)
+			continue;
+		/* 24 bit two's complement, as wago_queue_move() takes it */
+		target = (int32_t) (queue->moves[(queue->head - 1) & (WAGO_MOVE_QUEUE_LENGTH-1)].position << 8) >> 8;
+		if (!wago_queue_idle(i) || wago_mbx_actual_position(i, NULL) != target)
+			ok = 0;
+	}
+	return ok;
+}
+
+/**
+ * Prints what happened
+ *
+ * @param[in]	cycles Cycles run
+ * @param[in]	real_ns Time the run took
+ * @param[in]	cycle_ns_max Longest cycle, planner_play() and cycle_update()
+ * @param[in]	picking_ns Time spent in picker_poll()
+ * @param[in]	script_ended_ns Virtual time the startup script ended at, -1 if it did not
+ * @param[in]	placed_at_end Parts placed by the time the startup script ended
+ * @param[in]	feedback_ok Result of sim_feedback_ok()
+ */
+static void sim_report(uint32_t cycles, int64_t real_ns, int64_t cycle_ns_max, int64_t picking_ns, int64_t script_ended_ns,
+	uint32_t placed_at_end, int feedback_ok)
+{
+	const struct sim_plant_stats_t *s = &sim_plant_stats;
+	const struct scheduler_stats_t *picker = &picker_scheduler.stats;
+	double seconds = cycles * (sim_cycle_ns * 1e-9);
+	uint32_t limited = 0;
+
+	printf("simulated %.1f s (%u cycles of %u us) in %.2f s, %.1f times real time\n",
+		seconds, cycles, sim_cycle_ns / 1000, real_ns * 1e-9, seconds / (real_ns * 1e-9));
+	printf("belt: %u parts at %.0f mm/s, %u passed the eye unseen, %u went past every robot\n",
+		s->parts, sim_belt_speed * 1e3, s->unseen, s->passed);
+	printf("picker (%s, %d robot%s): %u parts, %u picks queued, %u missed, %u unreachable, %.2f ms per part\n",
+		scheduler_strategy_name(picker_scheduler.strategy), picker_scheduler.count, (picker_scheduler.count > 1) ? "s" : "",
+		picker->parts, picker->picks, picker->missed, picker->unreachable, picker->parts ? picking_ns * 1e-6 / picker->parts : 0.0);
+	if (sim_jobs > 0) {
+		const struct sequence_stats_t *jobs = &picker_sequences[0].stats;
+		printf("jobs: %d laid still, %d handed over, %u ordered, %u queued, %u unreachable, %u moves timed and %u estimated, %u times out of time\n",
+			sim_jobs, sim_jobs_handed, jobs->added, jobs->taken, jobs->unreachable, jobs->models, jobs->estimates, jobs->out_of_time);
+	}
+	printf("planner: %u played, %u late, %u not ready, %u cycles starved\n", planner_stats.played, planner_stats.late,
+		planner_stats.not_ready, planner_stats.starved);
+	printf("grippers: %u parts gripped, %u placed, %u dropped elsewhere, %u grips with no part, %.1f picks per minute\n",
+		s->gripped, s->placed, s->dropped, s->empty_grips, s->placed / (seconds / 60.0));
+	if (script_ended_ns >= 0 && script_stats.finished && seconds > script_ended_ns * 1e-9)
+		printf("grippers: %u placed in the %.1f s after the startup, %.1f picks per minute\n", s->placed - placed_at_end,
+			seconds - script_ended_ns * 1e-9, (s->placed - placed_at_end) / ((seconds - script_ended_ns * 1e-9) / 60.0));
+
+	for (int r=0; r<sim_robots; r++) {
+		for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+			const struct sim_joint_stats_t *joint = &s->joints[r][j];
+			printf("robot %d joint %d: velocity peak %6.2f rad/s (%3.0f%% of the limit), acceleration peak %7.1f rad/s^2 (%3.0f%%)\n",
+				r, j, joint->velocity_peak, joint->velocity_ratio * 100.0, joint->acceleration_peak, joint->acceleration_ratio * 100.0);
+			limited += ax5000_axes[PLANNER_AXIS(r, j)].limited_cycles;
+		}
+	}
+	printf("limits: %u cycles over a velocity limit, %u over an acceleration limit (%.0f%% allowed), %u off the workspace, %u setpoints cut to max_step\n",
+		s->velocity_over, s->acceleration_over, SIM_LIMIT_TOLERANCE * 100.0, s->workspace_over, limited);
+	if (s->first_over_ns >= 0)
+		printf("limits: first gone over at %.4f s, robot %d joint %d\n", s->first_over_ns * 1e-9, s->first_over_robot, s->first_over_joint);
+
+	if (script_ended_ns >= 0)
+		printf("startup: %s at %.2f s\n", script_stats.finished ? "finished" : "aborted", script_ended_ns * 1e-9);
+	else
+		printf("startup: still running\n");
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		printf("stepper %d: %u reference run%s, %u moves (%u handed off), peak %.0f steps/s, at %d steps, "
+			"mailbox reads %d (%u readings, furthest %d, worst %d steps off)\n",
+			i, s->stepper_references[i], (s->stepper_references[i] == 1) ? "" : "s", wago_move_queues[i].moves_completed,
+			wago_move_queues[i].precalc_handoffs, s->stepper_velocity_peak[i], sim_plant_stepper_position(i),
+			wago_mbx_actual_position(i, NULL), sim_feedback[i].checked, sim_feedback[i].peak, sim_feedback[i].error_max);
+	}
+	if (!feedback_ok)
+		printf("steppers: the mailbox position feedback does not match the plant or the last target\n");
+	if (safety_stats.reactions)
+		printf("safety: %u reactions, confirmed after %u cycles\n", safety_stats.reactions, safety_stats.confirm_cycles_max);
+	printf("cycle: %.2f us mean with the plant, %.2f us worst for planner_play() and cycle_update(), scripts %.2f us worst\n",
+		cycles ? (real_ns - picking_ns) * 1e-3 / cycles : 0.0, cycle_ns_max * 1e-3, script_stats.update_ns_max * 1e-3);
+	printf("cycle: 99.99%% of planner_play() and cycle_update() within %d us and of the scripts within %d us, %u cycles over %u us\n",
+		sim_timing_within(&sim_cycle_timing, 0.9999), sim_timing_within(&sim_script_timing, 0.9999),
+		sim_timing_over(&sim_cycle_timing, sim_cycle_ns), sim_cycle_ns / 1000);
+}
+
+int main(int argc, char *argv[])
+{
+	struct delta_robot_t robots[PLANNER_MAX_ROBOTS];
+	struct scheduler_t scheduler;
+	uint32_t cycles, cycle;
+	int64_t now_ns = 0, next_state_ns = SIM_STATE_MACHINE_NS, stop_ns, script_ended_ns = -1;
+	int64_t start_ns, begin_ns, cycle_ns, cycle_ns_max = 0, picking_ns = 0;
+	uint32_t placed_at_end = 0;
+	int err, stopped = 0, feedback_ok = 1;
+
+	sim_options(argc, argv);
+	cycles = (uint32_t) (sim_seconds * 1e9 / sim_cycle_ns);
+	stop_ns = (sim_stop_seconds >= 0.0) ? (int64_t) (sim_stop_seconds * 1e9) : -1;
+
+	if (log_start() < 0)
+		printf("Log: Could not start the log thread, messages will be printed on exit\n");
+
+	for (int r=0; r<sim_robots; r++)
+		delta_defaults(&robots[r]);
+	scheduler_defaults(&scheduler, &robots[0], sim_robots, SCHEDULER_DEFAULT_SPACING);
+	scheduler.strategy = sim_strategy;
+	for (int r=0; r<sim_robots; r++) {
+		scheduler.robots[r].pick.payload = sim_payload;
+		if (!sim_place_set)
+			continue;
+		for (int c=0; c<3; c++)
+			scheduler.robots[r].pick.place[c] = sim_place_mm[c] / 1000.0;
+		memcpy(scheduler.robots[r].free_at, scheduler.robots[r].pick.place, sizeof(scheduler.robots[r].free_at));
+	}
+
+	err = sim_plant_init(&scheduler, sim_cycle_ns, sim_belt_speed, sim_parts_per_minute, sim_seed);
+	if (err < 0) {
+		printf("Sim: Could not set up the plant (%d)\n", err);
+		log_stop();
+		return 1;
+	}
+	conveyor_cycle_ns = sim_cycle_ns;
+	cycle_clock_ns = sim_clock_ns;
+	/* the picks are planned by the picker itself, the planner only plays them */
+	if (planner_start(robots, sim_robots, sim_cycle_ns, 0, -1) < 0) {
+		printf("Planner: Could not start\n");
+		log_stop();
+		return 1;
+	}
+	picker_init(&scheduler, sim_cycle_ns);
+	sim_job_seed = sim_seed;
+	for (int axis=0; axis<sim_robots * DELTA_NUM_JOINTS; axis++) {
+		/* max_step is per cycle, a longer cycle moves further in one */
+		ax5000_axes[axis].max_step = (int32_t) ((int64_t) AX5000_DEFAULT_MAX_STEP * sim_cycle_ns / SIM_MAX_STEP_CYCLE_NS);
+		/* the plant answers sooner than the bus, a cycle of motion would show as following error */
+		following_configure(axis, FOLLOWING_DEFAULT_LIMIT, FOLLOWING_DEFAULT_LIMIT_CYCLES, FOLLOWING_DEFAULT_BIN_WIDTH, SIM_SERVO_DELAY);
+		ax5000_enable(axis);
+	}
+	printf("simulating %.1f s: %.0f parts per minute, belt at %.0f mm/s, %d robot%s, %s, %.2f kg, %d parts laid still\n",
+		sim_seconds, sim_parts_per_minute, sim_belt_speed * 1e3, sim_robots, (sim_robots > 1) ? "s" : "",
+		scheduler_strategy_name(sim_strategy), sim_payload, sim_jobs);
+
+	begin_ns = sim_clock_ns();
+	for (cycle=0; cycle<cycles; cycle++) {
+		now_ns += sim_cycle_ns;
+		if (stop_ns >= 0 && now_ns >= stop_ns)
+			sim_plant_fields(SAFETY_SCANNER_LHS);
+		sim_plant_update(now_ns);
+
+		start_ns = sim_clock_ns();
+		IO_LOCK;
+		safety_mark_receive(start_ns);
+		conveyor_mark_receive(now_ns);
+		planner_play();
+		cycle_update();
+		IO_UNLOCK;
+		safety_mark_send(sim_clock_ns());
+		cycle_ns = sim_clock_ns() - start_ns;
+		if (cycle_ns > cycle_ns_max)
+			cycle_ns_max = cycle_ns;
+		sim_timing_add(&sim_cycle_timing, cycle_ns);
+		sim_timing_add(&sim_script_timing, script_stats.update_ns_last);
+		sim_check_feedback();
+
+		start_ns = sim_clock_ns();
+		sim_hand_over(sim_payload);
+		while (picker_poll())
+			;
+		picking_ns += sim_clock_ns() - start_ns;
+
+		if (!stopped && now_ns >= next_state_ns) {
+			next_state_ns += SIM_STATE_MACHINE_NS;
+			if (state_machine() == ERR_STATE_MACHINE_STOPPED) {
+				stopped = 1;
+				script_ended_ns = now_ns;
+				placed_at_end = sim_plant_stats.placed;
+			}
+		}
+	}
+	cycle_ns = sim_clock_ns() - begin_ns;
+
+	/* a startup cut short by a stop or the end of the run leaves the steppers anywhere */
+	if (script_ended_ns >= 0 && script_stats.finished)
+		feedback_ok = sim_feedback_ok();
+
+	planner_stop();
+	log_stop();
+	sim_report(cycles, cycle_ns, cycle_ns_max, picking_ns, script_ended_ns, placed_at_end, feedback_ok);
+	return (sim_plant_stats.first_over_ns >= 0 || !feedback_ok) ? 1 : 0;
+}
@@ -0,0 +1,742 @@
+/** \file
+ * \brief Model of the machine for running the cell without the bus
+ *
+ * sim_plant_init() points the controller's process image pointers (wago_steppers, ax5000_mdt and
+ * ax5000_at, conveyor_inputs and conveyor_outputs, safety_inputs, output_events_outputs) at
+ * images of its own. Each sim_plant_update() stands for one exchange on the bus: the devices take
+ * the outputs the controller wrote last cycle, move on by a cycle and write the inputs the
+ * controller reads next.
+ *
+ * The servo drives come on SIM_SERVO_ENABLE_CYCLES after drive on and track their setpoint
+ * exactly, a cycle behind, there is no following error. The stepper terminals echo the control
+ * bits, run a trapezoid to each move's target with pre-calculation of the next move and on the
+ * fly setpoints, report their position, run the reference to a switch at 0 and answer the mailbox. The belt runs at a steady speed, parts pass
+ * the eye at random (a Poisson stream with at least SIM_PART_SPACING between them) and are latched
+ * by the encoder terminal if it is armed.
+ *
+ * The robots are watched from the feedback every cycle: each joint's velocity and acceleration
+ * over SIM_LIMIT_WINDOW_NS against what delta_limits() allows at the pose, carrying a part's
+ * payload once its magnet has held one for the whole of the windows, and a feedback that is not
+ * a pose of the robot. A magnet
+ * coming on takes the part under it off the belt, one going off has to be over the place point.
+ * Parts can also be laid still in a robot's reach with a place point and payload of their own
+ * (sim_plant_add_part()), only that robot's magnet takes them.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_plant.h"
+#include "state_machine.h"
+#include "wago_mailbox.h"
+#include "ax5000.h"
+#include "conveyor.h"
+#include "safety.h"
+#include "output_events.h"
+
+/* longest window the joints are measured over, cycles */
+#define SIM_MAX_WINDOW 64
+
+struct sim_stepper_t {
+	struct wago_stepper_t image[WAGO_LENGTH_SPACE];
+	double position; /* steps from the reference switch */
+	double velocity; /* steps/s */
+	double target;
+	double max_velocity;
+	double acceleration;
+	int moving;
+	int referencing;
+	int reference_ok;
+	int error;
+	/* the next move, taken on the start edge */
+	int primed;
+	int precalc_ack;
+	double next_target;
+	double next_velocity;
+	double next_acceleration;
+	uint8_t last_start;
+};
+
+struct sim_servo_t {
+	struct ax5000_mdt_t mdt;
+	struct ax5000_at_t at;
+	uint32_t on_cycles;
+};
+
+struct sim_part_t {
+	int used;
+	double count; /* where the belt was as it passed the eye */
+	int held; /* robot holding it + 1, 0 while it is on the belt */
+	/* a part laid still, in the robot's frame */
+	int still; /* robot it lies in reach of + 1, 0 for a part on the belt */
+	double at[3];
+	double place[3];
+	double payload; /* kg */
+};
+
+struct sim_robot_t {
+	struct delta_robot_t robot;
+	struct intercept_conveyor_t conveyor;
+	struct intercept_pick_t pick;
+	int held; /* part held + 1, 0 for none */
+	uint32_t held_samples; /* samples taken since the part was gripped */
+	uint32_t samples;
+	double history[2 * SIM_MAX_WINDOW + 1][DELTA_NUM_JOINTS]; /* joint angles, rad */
+};
+
+struct sim_plant_stats_t sim_plant_stats;
+
+static struct sim_stepper_t sim_steppers[WAGO_NUM_STEPPERS];
+static struct sim_servo_t sim_servos[AX5000_NUM_AXES];
+static struct sim_robot_t sim_robots[SCHEDULER_MAX_ROBOTS];
+static int sim_robot_count;
+static struct sim_part_t sim_parts[SIM_MAX_PARTS];
+
+static struct conveyor_inputs_t sim_conveyor_inputs;
+static struct conveyor_outputs_t sim_conveyor_outputs;
+static uint8_t sim_safety_inputs;
+static uint8_t sim_outputs;
+static uint8_t sim_last_outputs;
+
+static uint32_t sim_cycle_ns;
+static double sim_dt;
+static int sim_window;
+static int64_t sim_now_ns;
+/* the belt */
+static double sim_count;
+static double sim_counts_per_cycle;
+static double sim_belt_end; /* past every robot, metres downstream of the eye */
+static double sim_mean_gap; /* s, 0 for no parts */
+static double sim_min_gap;
+static int64_t sim_next_part_ns;
+static int sim_latch_armed;
+static uint16_t sim_last_control;
+
+/**
+ * Draws the time to the next part
+ *
+ * @return the gap, ns
+ */
+static int64_t sim_part_gap(void)
+{
+	double gap = -log((rand() + 1.0) / (RAND_MAX + 2.0)) * sim_mean_gap;
+
+	return (int64_t) (((gap > sim_min_gap) ? gap : sim_min_gap) * 1e9);
+}
+
+/**
+ * Sets up the plant and points the controller's process image at it
+ *
+ * The servos start with each robot at rest on its place point, the steppers
+ * SIM_STEPPER_START_POSITION from their switch and not referenced.
+ * @param[in]	scheduler The robots and the belt in each robot's frame, as the picker is given them
+ * @param[in]	cycle_ns The cycle
+ * @param[in]	belt_speed m/s
+ * @param[in]	parts_per_minute Parts put on the belt on average, 0 for none
+ * @param[in]	seed For the part stream, the same seed gives the same stream
+ * @return SIM_ERR_SUCCESS on success, SIM_ERR_ROBOT if there are too many robots for the drives,
+ * SIM_ERR_POSE if a place point cannot be reached
+ */
+int sim_plant_init(const struct scheduler_t *scheduler, uint32_t cycle_ns, double belt_speed, double parts_per_minute, unsigned int seed)
+{
+	double q[DELTA_NUM_JOINTS];
+
+	if (scheduler->count < 1 || scheduler->count > PLANNER_MAX_ROBOTS)
+		return SIM_ERR_ROBOT;
+
+	memset(&sim_plant_stats, 0, sizeof(sim_plant_stats));
+	sim_plant_stats.first_over_ns = -1;
+	memset(sim_steppers, 0, sizeof(sim_steppers));
+	memset(sim_servos, 0, sizeof(sim_servos));
+	memset(sim_robots, 0, sizeof(sim_robots));
+	memset(sim_parts, 0, sizeof(sim_parts));
+	sim_cycle_ns = cycle_ns;
+	sim_dt = cycle_ns * 1e-9;
+	sim_window = (int) (SIM_LIMIT_WINDOW_NS / cycle_ns);
+	if (sim_window < 1)
+		sim_window = 1;
+	if (sim_window > SIM_MAX_WINDOW)
+		sim_window = SIM_MAX_WINDOW;
+	sim_now_ns = 0;
+
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		sim_steppers[i].position = SIM_STEPPER_START_POSITION;
+		for (int space=0; space<WAGO_LENGTH_SPACE; space++)
+			wago_steppers[i][space] = &sim_steppers[i].image[space];
+	}
+
+	sim_robot_count = scheduler->count;
+	sim_belt_end = 0.0;
+	for (int r=0; r<sim_robot_count; r++) {
+		const struct scheduler_robot_t *s = &scheduler->robots[r];
+		struct sim_robot_t *w = &sim_robots[r];
+
+		w->robot = s->robot;
+		w->conveyor = s->conveyor;
+		w->pick = s->pick;
+		if (w->conveyor.window[1] > sim_belt_end)
+			sim_belt_end = w->conveyor.window[1];
+		if (delta_inverse(&w->robot, s->free_at, q) < 0)
+			return SIM_ERR_POSE;
+		for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+			struct sim_servo_t *servo = &sim_servos[PLANNER_AXIS(r, j)];
+			servo->at.position = delta_counts(&w->robot, q[j]);
+			servo->mdt.position = servo->at.position;
+			servo->at.status = AX5000_STATUS_LOGIC_READY;
+		}
+	}
+	for (int axis=0; axis<AX5000_NUM_AXES; axis++) {
+		int used = (axis < sim_robot_count * DELTA_NUM_JOINTS);
+		ax5000_mdt[axis] = used ? &sim_servos[axis].mdt : NULL;
+		ax5000_at[axis] = used ? &sim_servos[axis].at : NULL;
+	}
+	sim_belt_end += SIM_PART_SPACING;
+
+	memset(&sim_conveyor_inputs, 0, sizeof(sim_conveyor_inputs));
+	memset(&sim_conveyor_outputs, 0, sizeof(sim_conveyor_outputs));
+	conveyor_inputs = &sim_conveyor_inputs;
+	conveyor_outputs = &sim_conveyor_outputs;
+	sim_count = 0.0;
+	sim_counts_per_cycle = belt_speed * sim_dt / scheduler->robots[0].conveyor.metres_per_count;
+	sim_latch_armed = 0;
+	sim_last_control = 0;
+	srand(seed);
+	sim_mean_gap = (parts_per_minute > 0.0) ? 60.0 / parts_per_minute : 0.0;
+	sim_min_gap = (belt_speed > 0.0) ? SIM_PART_SPACING / belt_speed : 0.0;
+	sim_next_part_ns = sim_part_gap();
+
+	sim_safety_inputs = SAFETY_FIELDS;
+	safety_inputs = &sim_safety_inputs;
+	sim_outputs = 0;
+	sim_last_outputs = 0;
+	output_events_outputs = &sim_outputs;
+	return SIM_ERR_SUCCESS;
+}
+
+/**
+ * Lays a part still in a robot's reach
+ *
+ * @param[in]	robot The robot, the only one whose magnet takes it
+ * @param[in]	at Where it lies, in the robot's frame
+ * @param[in]	place Where it is to be let go of
+ * @param[in]	payload Its mass, kg
+ * @return SIM_ERR_SUCCESS on success, SIM_ERR_ROBOT if there is no such robot, SIM_ERR_FULL if
+ * SIM_MAX_PARTS are kept track of already
+ */
+int sim_plant_add_part(int robot, const double at[3], const double place[3], double payload)
+{
+	struct sim_part_t *part;
+
+	if (robot < 0 || robot >= sim_robot_count)
+		return SIM_ERR_ROBOT;
+	for (part=sim_parts; part<sim_parts+SIM_MAX_PARTS && part->used; part++)
+		;
+	if (part == sim_parts + SIM_MAX_PARTS)
+		return SIM_ERR_FULL;
+	memset(part, 0, sizeof(*part));
+	part->used = 1;
+	part->still = robot + 1;
+	memcpy(part->at, at, sizeof(part->at));
+	memcpy(part->place, place, sizeof(part->place));
+	part->payload = payload;
+	return SIM_ERR_SUCCESS;
+}
+
+/**
+ * Sets the safety scanner's outputs
+ *
+ * @param[in]	fields The scanner bits, SAFETY_SCANNER_RHS and SAFETY_SCANNER_LHS, high while clear
+ */
+void sim_plant_fields(uint8_t fields)
+{
+	sim_safety_inputs = fields;
+}
+
+/**
+ * Tells where a stepper really is
+ *
+ * @param[in]	device The wago stepper
+ * @return steps from its reference switch
+ */
+int32_t sim_plant_stepper_position(int device)
+{
+	return (int32_t) lround(sim_steppers[device].position);
+}
+
+/**
+ * Reads a positioning move out of the stepper's outputs
+ *
+ * @param[in]	out The outputs
+ * @param[out]	target Position, steps
+ * @param[out]	velocity steps/s
+ * @param[out]	acceleration steps/s^2
+ */
+static void sim_stepper_setpoint(const struct wago_stepper_t *out, double *target, double *velocity, double *acceleration)
+{
+	uint32_t raw = out->message.positioning.position_lbyte | (out->message.positioning.position_mbyte << 8)
+		| ((uint32_t) out->message.positioning.position_hbyte << 16);
+
+	/* 24 bit two's complement */
+	*target = (double) ((int32_t) (raw << 8) >> 8);
+	*velocity = (out->message.positioning.velocity_lbyte | (out->message.positioning.velocity_hbyte << 8)) * SIM_STEPPER_STEPS_PER_VELOCITY;
+	*acceleration = (out->message.positioning.acceleration_lbyte | (out->message.positioning.acceleration_hbyte << 8)) * SIM_STEPPER_STEPS_PER_ACCELERATION;
+}
+
+/**
+ * Moves a stepper on by a cycle towards its target, accelerating or braking to stop on it
+ *
+ * A target taken on the fly behind the stepper, or a lower speed, is reached by braking first.
+ * @param[in,out]	s The stepper
+ * @return 1 once it is on its target, 0 while it is on its way
+ */
+static int sim_stepper_move(struct sim_stepper_t *s)
+{
+	double remaining = s->target - s->position;
+	double direction = (remaining < 0.0) ? -1.0 : 1.0;
+	double speed = s->velocity * direction;
+
+	/* a move without a speed never gets anywhere, the terminal reports it */
+	if (s->max_velocity <= 0.0 || s->acceleration <= 0.0) {
+		s->error = 1;
+		s->velocity = 0.0;
+		return 1;
+	}
+	if (speed < 0.0) {
+		/* still moving away from the target */
+		speed += s->acceleration * sim_dt;
+		if (speed > 0.0)
+			speed = 0.0;
+		s->position += direction * speed * sim_dt;
+		s->velocity = direction * speed;
+		return 0;
+	}
+	if (speed > s->max_velocity) {
+		speed -= s->acceleration * sim_dt;
+		if (speed < s->max_velocity)
+			speed = s->max_velocity;
+	} else if (speed > 0.0 && speed * speed / (2.0 * s->acceleration) >= fabs(remaining)) {
+		speed -= s->acceleration * sim_dt;
+	} else {
+		speed += s->acceleration * sim_dt;
+		if (speed > s->max_velocity)
+			speed = s->max_velocity;
+	}
+	if (speed <= 0.0 || speed * sim_dt >= fabs(remaining)) {
+		s->position = s->target;
+		s->velocity = 0.0;
+		return 1;
+	}
+	s->position += direction * speed * sim_dt;
+	s->velocity = direction * speed;
+	return 0;
+}
+
+/**
+ * Answers the mailbox, the request is taken as soon as its toggle changes, only the measured
+ * position is known, anything else is answered with return code 0 and no data
+ *
+ * @param[in,out]	s The stepper
+ */
+static void sim_stepper_mailbox(struct sim_stepper_t *s)
+{
+	struct wago_stepper_t *out = &s->image[WAGO_OUTPUT_SPACE];
+	struct wago_stepper_t *in = &s->image[WAGO_INPUT_SPACE];
+	uint32_t raw = (uint32_t) (int32_t) lround(s->position);
+
+	if ((out->message.mailbox.control & WAGO_MBX_TOGGLE) == (in->message.mailbox.control & WAGO_MBX_TOGGLE))
+		return;
+	in->message.mailbox.opcode = out->message.mailbox.opcode;
+	memset(in->message.mailbox.mail, 0, sizeof(in->message.mailbox.mail));
+	if (out->message.mailbox.opcode == WAGO_MBX_OP_DIAG_RD_VAR && out->message.mailbox.mail[0] == WAGO_MBX_VAR_ACTUAL_POSITION) {
+		for (int i=0; i<4; i++)
+			in->message.mailbox.mail[i] = (uint8_t) ((raw >> (8 * i)) & 0xff);
+	}
+	/* status 0, done */
+	in->message.mailbox.control = out->message.mailbox.control & WAGO_MBX_TOGGLE;
+}
+
+/**
+ * Runs a stepper terminal for a cycle
+ *
+ * @param[in]	device The wago stepper
+ */
+static void sim_stepper_update(int device)
+{
+	struct sim_stepper_t *s = &sim_steppers[device];
+	struct wago_stepper_t *out = &s->image[WAGO_OUTPUT_SPACE];
+	struct wago_stepper_t *in = &s->image[WAGO_INPUT_SPACE];
+	int start = out->stat_cont1.bit.start;
+	int edge = start && !s->last_start;
+	int mbx = out->stat_cont0.bit.mbx_mode;
+
+	s->last_start = (uint8_t) start;
+	/* the mode and control bits are taken as they are written */
+	in->stat_cont1.value = out->stat_cont1.value;
+	in->stat_cont0.bit.mbx_mode = (uint8_t) mbx;
+	if (out->stat_cont2.control_bits.error_quit)
+		s->error = 0;
+
+	if (!out->stat_cont1.bit.enable || !out->stat_cont1.bit.stop2_n) {
+		/* stop2_n is a quick stop, taken as stopping on the spot */
+		s->moving = 0;
+		s->referencing = 0;
+		s->primed = 0;
+		s->precalc_ack = 0;
+		s->velocity = 0.0;
+	} else if (out->stat_cont1.bit.m_reference) {
+		if (edge && !mbx) {
+			double unused;
+			sim_stepper_setpoint(out, &unused, &s->max_velocity, &s->acceleration);
+			s->target = 0.0;
+			s->referencing = 1;
+			s->moving = 1;
+			sim_plant_stats.stepper_references[device]++;
+		} else if (!start) {
+			s->referencing = 0;
+			s->moving = 0;
+			s->velocity = 0.0;
+		}
+	} else if (out->stat_cont1.bit.m_positioning) {
+		/* the next move is read while the current one runs, a running move is never changed */
+		if (!out->stat_cont2.control_bits.pre_calc) {
+			s->precalc_ack = 0;
+		} else if (!s->precalc_ack && !mbx) {
+			sim_stepper_setpoint(out, &s->next_target, &s->next_velocity, &s->next_acceleration);
+			s->primed = 1;
+			s->precalc_ack = 1;
+		}
+		if (edge && (s->primed || !mbx)) {
+			if (s->primed) {
+				s->target = s->next_target;
+				s->max_velocity = s->next_velocity;
+				s->acceleration = s->next_acceleration;
+				s->primed = 0;
+			} else {
+				sim_stepper_setpoint(out, &s->target, &s->max_velocity, &s->acceleration);
+			}
+			s->moving = 1;
+			sim_plant_stats.stepper_moves[device]++;
+		}
+	} else {
+		s->moving = 0;
+		s->velocity = 0.0;
+	}
+
+	if (s->moving && sim_stepper_move(s)) {
+		s->moving = 0;
+		if (s->referencing) {
+			s->referencing = 0;
+			s->reference_ok = 1;
+		}
+	}
+	if (fabs(s->velocity) > sim_plant_stats.stepper_velocity_peak[device])
+		sim_plant_stats.stepper_velocity_peak[device] = fabs(s->velocity);
+	if (mbx) {
+		sim_stepper_mailbox(s);
+	} else {
+		/* the positioning image reports the actual velocity and position */
+		int32_t velocity = (int32_t) lround(fabs(s->velocity) / SIM_STEPPER_STEPS_PER_VELOCITY);
+		uint32_t position = (uint32_t) (int32_t) lround(s->position);
+
+		in->message.positioning.velocity_lbyte = (uint8_t) (velocity & 0xff);
+		in->message.positioning.velocity_hbyte = (uint8_t) ((velocity >> 8) & 0xff);
+		in->message.positioning.acceleration_lbyte = 0;
+		in->message.positioning.acceleration_hbyte = 0;
+		in->message.positioning.position_lbyte = (uint8_t) (position & 0xff);
+		in->message.positioning.position_mbyte = (uint8_t) ((position >> 8) & 0xff);
+		in->message.positioning.position_hbyte = (uint8_t) ((position >> 16) & 0xff);
+	}
+
+	in->stat_cont2.value = 0;
+	in->stat_cont2.status_bits.on_target = !s->moving;
+	in->stat_cont2.status_bits.busy = (uint8_t) s->moving;
+	in->stat_cont2.status_bits.standstill = (s->velocity == 0.0);
+	in->stat_cont2.status_bits.on_speed = s->moving && (fabs(s->velocity) >= s->max_velocity);
+	in->stat_cont2.status_bits.direction = (s->velocity < 0.0);
+	in->stat_cont2.status_bits.reference_ok = (uint8_t) s->reference_ok;
+	in->stat_cont2.status_bits.precalc_ack = (uint8_t) s->precalc_ack;
+	in->stat_cont2.status_bits.error = (uint8_t) s->error;
+	in->stat_cont0.bit.error = (uint8_t) s->error;
+}
+
+/**
+ * Runs a servo drive for a cycle
+ *
+ * @param[in,out]	s The drive
+ */
+static void sim_servo_update(struct sim_servo_t *s)
+{
+	const uint16_t on = AX5000_CONTROL_DRIVE_ON | AX5000_CONTROL_ENABLE;
+	int32_t last = s->at.position;
+
+	if ((s->mdt.control & on) == on) {
+		if (s->on_cycles < SIM_SERVO_ENABLE_CYCLES)
+			s->on_cycles++;
+	} else {
+		s->on_cycles = 0;
+	}
+	if (s->on_cycles >= SIM_SERVO_ENABLE_CYCLES)
+		s->at.status = AX5000_STATUS_OPERATING;
+	else
+		s->at.status = s->on_cycles ? AX5000_STATUS_POWER_READY : AX5000_STATUS_LOGIC_READY;
+
+	/* holds its position until it is operating and told to follow */
+	if (s->at.status == AX5000_STATUS_OPERATING && (s->mdt.control & AX5000_CONTROL_RESTART))
+		s->at.position = s->mdt.position;
+	s->at.velocity = (int32_t) lround((s->at.position - last) / sim_dt);
+}
+
+/**
+ * Works out where a part on the belt is
+ *
+ * @param[in]	w The robot, for its frame
+ * @param[in]	part The part
+ * @param[out]	p Where it is in the robot's frame
+ */
+static void sim_part_position(const struct sim_robot_t *w, const struct sim_part_t *part, double p[3])
+{
+	double along = (sim_count - part->count) * w->conveyor.metres_per_count;
+
+	if (part->still) {
+		memcpy(p, part->at, sizeof(part->at));
+		return;
+	}
+	for (int c=0; c<3; c++)
+		p[c] = w->conveyor.eye[c] + w->conveyor.direction[c] * along;
+}
+
+/**
+ * Runs the belt and the encoder terminal for a cycle
+ *
+ * The latch is armed by a rising edge of its enable and held until the enable is cleared, a part
+ * passing the eye in between is not registered.
+ */
+static void sim_belt_update(void)
+{
+	uint16_t control = sim_conveyor_outputs.control;
+	struct sim_part_t *part;
+
+	if (!(control & CONVEYOR_CONTROL_ENABLE_LATCH_EXTERN)) {
+		sim_conveyor_inputs.status &= ~CONVEYOR_STATUS_LATCH_EXTERN_VALID;
+		sim_latch_armed = 0;
+	} else if (!(sim_last_control & CONVEYOR_CONTROL_ENABLE_LATCH_EXTERN)) {
+		sim_latch_armed = 1;
+	}
+	sim_last_control = control;
+
+	sim_count += sim_counts_per_cycle;
+	while (sim_mean_gap > 0.0 && sim_next_part_ns <= sim_now_ns) {
+		/* where the belt was as it passed, within this cycle */
+		double count = sim_count - sim_counts_per_cycle * (double) (sim_now_ns - sim_next_part_ns) / sim_cycle_ns;
+
+		sim_next_part_ns += sim_part_gap();
+		sim_plant_stats.parts++;
+		if (sim_latch_armed) {
+			sim_conveyor_inputs.latch = (int32_t) (int64_t) floor(count);
+			sim_conveyor_inputs.status |= CONVEYOR_STATUS_LATCH_EXTERN_VALID;
+			sim_latch_armed = 0;
+		} else {
+			sim_plant_stats.unseen++;
+		}
+		for (part=sim_parts; part<sim_parts+SIM_MAX_PARTS && part->used; part++)
+			;
+		if (part == sim_parts + SIM_MAX_PARTS) {
+			/* more on the belt than can be kept track of, it goes unpicked */
+			sim_plant_stats.passed++;
+			continue;
+		}
+		memset(part, 0, sizeof(*part));
+		part->used = 1;
+		part->count = count;
+	}
+	sim_conveyor_inputs.counter = (int32_t) (int64_t) floor(sim_count);
+
+	for (int i=0; i<SIM_MAX_PARTS; i++) {
+		part = &sim_parts[i];
+		if (!part->used || part->held || part->still)
+			continue;
+		if ((sim_count - part->count) * sim_robots[0].conveyor.metres_per_count > sim_belt_end) {
+			part->used = 0;
+			sim_plant_stats.passed++;
+		}
+	}
+}
+
+/**
+ * Works out where a robot's effector is from the servo feedback
+ *
+ * @param[in]	r The robot
+ * @param[out]	q The joint angles
+ * @param[out]	p The effector position
+ * @return 0 on success, -1 if the feedback is not a pose of the robot
+ */
+static int sim_effector(int r, double q[DELTA_NUM_JOINTS], double p[3])
+{
+	const struct sim_robot_t *w = &sim_robots[r];
+
+	for (int j=0; j<DELTA_NUM_JOINTS; j++)
+		q[j] = delta_angle(&w->robot, sim_servos[PLANNER_AXIS(r, j)].at.position);
+	return delta_forward(&w->robot, q, p);
+}
+
+/**
+ * Applies the magnets, a part is taken or let go of where the effector is
+ */
+static void sim_grippers_update(void)
+{
+	uint8_t changed = sim_outputs ^ sim_last_outputs;
+	double q[DELTA_NUM_JOINTS], p[3], at[3], distance, nearest;
+	const double *place;
+	int found;
+
+	sim_last_outputs = sim_outputs;
+	for (int r=0; r<sim_robot_count; r++) {
+		struct sim_robot_t *w = &sim_robots[r];
+		uint8_t bit = output_gripper(r, OUTPUT_MAGNET);
+
+		if (!(changed & bit) || sim_effector(r, q, p) < 0)
+			continue;
+
+		if (!(sim_outputs & bit)) {
+			if (!w->held)
+				continue;
+			place = sim_parts[w->held - 1].still ? sim_parts[w->held - 1].place : w->pick.place;
+			distance = sqrt((p[0] - place[0]) * (p[0] - place[0]) + (p[1] - place[1]) * (p[1] - place[1]) + (p[2] - place[2]) * (p[2] - place[2]));
+			if (distance <= SIM_GRIP_DISTANCE)
+				sim_plant_stats.placed++;
+			else
+				sim_plant_stats.dropped++;
+			sim_parts[w->held - 1].used = 0;
+			w->held = 0;
+			continue;
+		}
+
+		found = -1;
+		nearest = SIM_GRIP_DISTANCE;
+		for (int i=0; i<SIM_MAX_PARTS; i++) {
+			if (!sim_parts[i].used || sim_parts[i].held || (sim_parts[i].still && sim_parts[i].still != r + 1))
+				continue;
+			sim_part_position(w, &sim_parts[i], at);
+			distance = sqrt((p[0] - at[0]) * (p[0] - at[0]) + (p[1] - at[1]) * (p[1] - at[1]) + (p[2] - at[2]) * (p[2] - at[2]));
+			if (distance <= nearest) {
+				nearest = distance;
+				found = i;
+			}
+		}
+		if (found < 0 || w->held) {
+			sim_plant_stats.empty_grips++;
+			continue;
+		}
+		sim_parts[found].held = r + 1;
+		w->held = found + 1;
+		w->held_samples = 0;
+		sim_plant_stats.gripped++;
+	}
+}
+
+/**
+ * Counts a cycle a robot went over a limit
+ *
+ * @param[in,out]	count The count for the limit
+ * @param[in]	r The robot
+ * @param[in]	joint The joint, -1 for the whole robot
+ */
+static void sim_over(uint32_t *count, int r, int joint)
+{
+	(*count)++;
+	if (sim_plant_stats.first_over_ns >= 0)
+		return;
+	sim_plant_stats.first_over_ns = sim_now_ns;
+	sim_plant_stats.first_over_robot = r;
+	sim_plant_stats.first_over_joint = joint;
+}
+
+/**
+ * Checks a robot's joints against what it can do where it is
+ *
+ * The velocity is the mean over the last window, the acceleration the change between the
+ * last two windows, less what the feedback's rounding to counts can account for, as
+ * trajectory_check() does. Only while the robot follows its setpoints, a drive holding its
+ * position stops the joint as hard as the drive can.
+ * @param[in]	r The robot
+ */
+static void sim_robot_watch(int r)
+{
+	struct sim_robot_t *w = &sim_robots[r];
+	struct delta_robot_t robot = w->robot;
+	struct delta_limits_t limits;
+	double q[DELTA_NUM_JOINTS], p[3], span = sim_window * sim_dt, velocity, acceleration;
+	double count = delta_angle(&robot, 1) - delta_angle(&robot, 0);
+	const double *mid, *old;
+	int n = 2 * sim_window + 1, velocity_over = 0, acceleration_over = 0;
+
+	if (sim_effector(r, q, p) < 0) {
+		sim_over(&sim_plant_stats.workspace_over, r, -1);
+		return;
+	}
+	/* a stop is the drive's own, the watch starts again once every joint follows its setpoint */
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		if (!(sim_servos[PLANNER_AXIS(r, j)].mdt.control & AX5000_CONTROL_RESTART)) {
+			w->samples = 0;
+			return;
+		}
+	}
+	memcpy(w->history[w->samples % n], q, sizeof(q));
+	w->samples++;
+	if (w->samples < (uint32_t) n)
+		return;
+	mid = w->history[(w->samples - 1 - sim_window) % n];
+	old = w->history[(w->samples - 1 - 2 * sim_window) % n];
+
+	/* a window the part was gripped in still has the move onto it, without the part */
+	if (w->held)
+		w->held_samples++;
+	robot.payload = 0.0;
+	if (w->held && w->held_samples >= (uint32_t) n)
+		robot.payload = sim_parts[w->held - 1].still ? sim_parts[w->held - 1].payload : w->pick.payload;
+	if (delta_limits(&robot, p, q, &limits) < 0)
+		return;
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		struct sim_joint_stats_t *stats = &sim_plant_stats.joints[r][j];
+
+		velocity = fmax(fabs(q[j] - mid[j]) - count, 0.0) / span;
+		acceleration = fmax(fabs(q[j] - 2.0 * mid[j] + old[j]) - 2.0 * count, 0.0) / (span * span);
+		if (velocity > stats->velocity_peak)
+			stats->velocity_peak = velocity;
+		if (velocity / limits.velocity[j] > stats->velocity_ratio)
+			stats->velocity_ratio = velocity / limits.velocity[j];
+		if (acceleration > stats->acceleration_peak)
+			stats->acceleration_peak = acceleration;
+		if (acceleration / limits.acceleration[j] > stats->acceleration_ratio)
+			stats->acceleration_ratio = acceleration / limits.acceleration[j];
+
+		if (!velocity_over && velocity > limits.velocity[j] * (1.0 + SIM_LIMIT_TOLERANCE)) {
+			sim_over(&sim_plant_stats.velocity_over, r, j);
+			velocity_over = 1;
+		}
+		if (!acceleration_over && acceleration > limits.acceleration[j] * (1.0 + SIM_LIMIT_TOLERANCE)) {
+			sim_over(&sim_plant_stats.acceleration_over, r, j);
+			acceleration_over = 1;
+		}
+	}
+}
+
+/**
+ * Runs the plant for a cycle
+ *
+ * Takes the outputs the controller wrote in the cycle before and writes the inputs for this one.
+ * @param[in]	now_ns The time of the cycle, from 0 at the start
+ */
+void sim_plant_update(int64_t now_ns)
+{
+	sim_now_ns = now_ns;
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++)
+		sim_stepper_update(i);
+	for (int axis=0; axis<sim_robot_count * DELTA_NUM_JOINTS; axis++)
+		sim_servo_update(&sim_servos[axis]);
+	sim_belt_update();
+	sim_grippers_update();
+	for (int r=0; r<sim_robot_count; r++)
+		sim_robot_watch(r);
+}
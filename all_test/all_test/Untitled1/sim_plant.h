@@ -0,0 +1,91 @@
+/* sim_plant.h
+ * this file defines a model of the machine the controller drives, for running the cell without
+ * the bus (sim_main.c)
+ * the plant owns a process image of its own in place of SOEM's: the servo drives follow their
+ * setpoints, the wago stepper terminals answer the mode, move queue, reference run and mailbox
+ * handshakes, and the belt carries parts past the photo eye at random
+ * the robots are watched the whole time: the joint velocities and accelerations against
+ * what they can do at each pose (delta_limits()), the grips against where the parts really are
+ * SOEM only
+ */
+
+#ifndef __SIM_PLANT_H__
+#define __SIM_PLANT_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+#include "wago_steppers.h"
+
+/* parts on the belt and laid still at once */
+#define SIM_MAX_PARTS 256
+/* cycles from drive on until the drive reports it is operating */
+#define SIM_SERVO_ENABLE_CYCLES 20
+/* cycles from writing a command until the servo reports the position it reached with it, the
+ * plant takes the outputs of the cycle before */
+#define SIM_SERVO_DELAY 1
+/* where the steppers are at power up, steps from their reference switch */
+#define SIM_STEPPER_START_POSITION 3200
+/* FIXME: the 750-673's velocity and acceleration units depend on its frequency and acceleration
+ * ranges (freq_range_sel, acc_range_sel), check them against the manual, taken as steps/s and
+ * steps/s^2 here */
+#define SIM_STEPPER_STEPS_PER_VELOCITY 1.0
+#define SIM_STEPPER_STEPS_PER_ACCELERATION 1.0
+/* closest the parts come down the belt after each other, metres */
+#define SIM_PART_SPACING 0.040
+/* how close the effector has to be to a part when its magnet comes on to take it, and to the
+ * place point when it goes off, metres */
+#define SIM_GRIP_DISTANCE 0.002
+/* the joint velocities and accelerations are measured over this, ns */
+#define SIM_LIMIT_WINDOW_NS 1000000
+/* how far over a limit a joint may go before it counts, a fraction of the limit, what
+ * trajectory_check() allows a planned trajectory */
+#define SIM_LIMIT_TOLERANCE TRAJECTORY_CHECK_TOLERANCE
+
+#define SIM_ERR_SUCCESS 0
+#define SIM_ERR_ROBOT -1
+#define SIM_ERR_POSE -2
+#define SIM_ERR_FULL -3
+
+struct sim_joint_stats_t {
+	double velocity_peak; /* rad/s */
+	double velocity_ratio; /* highest fraction of the limit at the pose */
+	double acceleration_peak; /* rad/s^2 */
+	double acceleration_ratio;
+};
+
+struct sim_plant_stats_t {
+	/* the belt */
+	uint32_t parts; /* put on the belt */
+	uint32_t unseen; /* passed the eye while it was not armed */
+	uint32_t passed; /* went past every robot without being picked */
+	/* the grippers */
+	uint32_t gripped; /* a magnet came on over a part */
+	uint32_t empty_grips; /* a magnet came on with no part under it */
+	uint32_t placed; /* let go of on the place point */
+	uint32_t dropped; /* let go of anywhere else */
+	/* the robots, in cycles */
+	uint32_t velocity_over;
+	uint32_t acceleration_over;
+	uint32_t workspace_over; /* the feedback was not a pose of the robot */
+	int64_t first_over_ns; /* -1 if no limit was ever gone over */
+	int first_over_robot;
+	int first_over_joint;
+	struct sim_joint_stats_t joints[SCHEDULER_MAX_ROBOTS][DELTA_NUM_JOINTS];
+	/* the steppers */
+	uint32_t stepper_moves[WAGO_NUM_STEPPERS]; /* moves started */
+	uint32_t stepper_references[WAGO_NUM_STEPPERS];
+	double stepper_velocity_peak[WAGO_NUM_STEPPERS]; /* steps/s */
+};
+
+extern struct sim_plant_stats_t sim_plant_stats;
+
+int sim_plant_init(const struct scheduler_t *scheduler, uint32_t cycle_ns, double belt_speed, double parts_per_minute, unsigned int seed);
+void sim_plant_fields(uint8_t fields);
+int sim_plant_add_part(int robot, const double at[3], const double place[3], double payload);
+int32_t sim_plant_stepper_position(int device);
+
+/* called once per cycle before the controller, with the time of the cycle */
+void sim_plant_update(int64_t now_ns);
+
+#endif /* __SIM_PLANT_H__ */
@@ -4,6 +4,7 @@
  * This program is used to connect to and control a delta robot 
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -26,12 +27,31 @@
 
 #include "wago_steppers.h"
 #include "state_machine.h"
+#include "cycle.h"
+#include "safety.h"
+#include "output_events.h"
+#include "telemetry.h"
+#include "log.h"
+#include "supervisor.h"
+#include "packet_ring.h"
+#include "timestamps.h"
+#include "pd_groups.h"
+#include "bus_timing.h"
+#include "ax5000_soe.h"
+#include "bus_errors.h"
+#include "planner.h"
+#include "trajectory_file.h"
+#include "conveyor.h"
+#include "picker.h"
 #include "error.h"
 
 #define NSEC_PER_SEC 1000000000
 #define TICK_RATE 100000
 #define EtherCAT_TIMEOUT EC_TIMEOUTRET
 
+/* working counter of a frame that reached every slave, worked out when the IOmap is configured */
+int expected_wkc = 0;
+
 struct input_msg_t {
 	int quit;
 };
@@ -61,14 +81,39 @@ char IOmap[4096];
 
 /* commandline args */
 char *eth_dev = "eth0";
+char *eth_dev_redundant = NULL;
+int use_packet_ring = 0;
+int use_timestamps = 0;
+uint32 slow_divider = 1;
+int analyse_bus = 0;
+/* the ethercat thread follows the distributed clock, set when the servo drives are synchronised to it */
+int dc_sync = 0;
+int sweep_cycle_time = 0;
+/* the group whose frame carries the stop the safety scanners cause, the steppers' group */
+int safety_group = PD_GROUP_FAST;
+/* planner threads, none unless asked for, and the core the ethercat thread is kept on */
+int planner_workers = 0;
+/* delta robots on the segment, three servo axes each in bus order */
+int robot_count = 1;
+int rt_cpu = -1;
+/* precomputed trajectory played once the servos are ready, none unless asked for */
+char *trajectory_name = NULL;
+struct trajectory_file_t trajectory_file;
+/* parts are picked off the conveyor and placed here, only when asked for */
+int conveyor_picking = 0;
+double place_mm[3];
+/* parts lying still to pick and place, one job a line, none unless asked for */
+char *jobs_name = NULL;
 uint32 cycle_time = 1000;
 uint32 move_coord = 0;
  
 /* wago device configuration */
 const int WAGO_DEVICE_OFFSETS_MOSI[] = {0x0005, 0x0011, 0x001d};
 const int WAGO_DEVICE_OFFSETS_MISO[] = {0x0030, 0x003c, 0x0048};
-
-uint32_t cycle_count = 0;
+/* the same, relative to the 750-354's own process data. The stepper modules are the first modules
+ * on the coupler, which is where the offsets above put them with every slave in one group */
+const int WAGO_COUPLER_OFFSETS_MOSI[] = {0x0000, 0x000c, 0x0018};
+const int WAGO_COUPLER_OFFSETS_MISO[] = {0x0000, 0x000c, 0x0018};
 
 /**
  * Function for testing writing of an SoE parameter.
@@ -167,6 +212,101 @@ void add_timespec(struct timespec *ts, int64 addtime)
 #define TIMESPEC_LESS -1
 #define TIMESPEC_GREATER 1
 #define TIMESPEC_EQUAL 0
+/**
+ * Reads the monotonic clock
+ *
+ * Used for timing measurements (see cycle_clock_ns), not for scheduling the cycle.
+ * @return the monotonic clock in nanoseconds
+ */
+int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * Finds the slave the safety laser scanner is wired to
+ *
+ * The SICK V300 field outputs go to an EL1002, its input byte is handed to the safety reaction.
+ * @return ERR_SUCCESS on success, ERR_NO_SAFETY_INPUT if there is no EL1002 on the bus
+ */
+int ethercat_find_safety_inputs(void)
+{
+	for (int i=1; i<=ec_slavecount; i++) {
+		if (strcmp(ec_slave[i].name, "EL1002") == 0) {
+			safety_inputs = ec_slave[i].inputs;
+			return ERR_SUCCESS;
+		}
+	}
+	return ERR_NO_SAFETY_INPUT;
+}
+
+/**
+ * Points the stepper structures at the WAGO coupler's process data
+ *
+ * With every slave in one group the steppers are at fixed offsets in the I/O map, with the coupler
+ * in the slow group they are found relative to the coupler.
+ * @return ERR_SUCCESS on success, ERR_NO_WAGO_COUPLER if the steppers are in a group of their own
+ * and there is no 750-354 on the bus
+ */
+int ethercat_find_wago_steppers(void)
+{
+	if (pd_groups[PD_GROUP_SLOW].slaves == 0) {
+		for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+			wago_steppers[i][WAGO_OUTPUT_SPACE] = (struct wago_stepper_t *) &IOmap[WAGO_DEVICE_OFFSETS_MOSI[i]];
+			wago_steppers[i][WAGO_INPUT_SPACE] = (struct wago_stepper_t *) &IOmap[WAGO_DEVICE_OFFSETS_MISO[i]];
+		}
+		return ERR_SUCCESS;
+	}
+
+	for (int i=1; i<=ec_slavecount; i++) {
+		if (ec_slave[i].eep_man == WAGO_VENDOR_ID && ec_slave[i].eep_id == WAGO_COUPLER_PRODUCT_CODE) {
+			for (int j=0; j<WAGO_NUM_STEPPERS; j++) {
+				wago_steppers[j][WAGO_OUTPUT_SPACE] = (struct wago_stepper_t *) &ec_slave[i].outputs[WAGO_COUPLER_OFFSETS_MOSI[j]];
+				wago_steppers[j][WAGO_INPUT_SPACE] = (struct wago_stepper_t *) &ec_slave[i].inputs[WAGO_COUPLER_OFFSETS_MISO[j]];
+			}
+			safety_group = ec_slave[i].group;
+			return ERR_SUCCESS;
+		}
+	}
+	return ERR_NO_WAGO_COUPLER;
+}
+
+/**
+ * Finds the digital output terminal the gripper magnet is wired to
+ *
+ * The EL2008 output byte is handed to the output event scheduler.
+ * @return ERR_SUCCESS on success, ERR_NO_MAGNET_OUTPUT if there is no EL2008 on the bus
+ */
+int ethercat_find_magnet_outputs(void)
+{
+	for (int i=1; i<=ec_slavecount; i++) {
+		if (strcmp(ec_slave[i].name, "EL2008") == 0) {
+			output_events_outputs = ec_slave[i].outputs;
+			return ERR_SUCCESS;
+		}
+	}
+	return ERR_NO_MAGNET_OUTPUT;
+}
+
+/**
+ * Points the conveyor tracking at the belt encoder's process data
+ *
+ * @return ERR_SUCCESS on success, ERR_NO_CONVEYOR_ENCODER if there is no EL5101 on the bus
+ */
+int ethercat_find_conveyor_encoder(void)
+{
+	for (int i=1; i<=ec_slavecount; i++) {
+		if (strcmp(ec_slave[i].name, "EL5101") == 0) {
+			conveyor_inputs = (struct conveyor_inputs_t *) ec_slave[i].inputs;
+			conveyor_outputs = (struct conveyor_outputs_t *) ec_slave[i].outputs;
+			return ERR_SUCCESS;
+		}
+	}
+	return ERR_NO_CONVEYOR_ENCODER;
+}
+
 /**
  * Compares timespecs for greater than, less than and equality
  *
@@ -239,11 +379,21 @@ void ec_sync(int64 reftime, int64 cycletime, int64 *offsettime)
 /**
  * Initialises the Ethernet connectioon to use for EtherCAT communications
  *
+ * With a second interface the bus is run as a redundant ring, the last slave's out port must be
+ * cabled back to it. SOEM then sends every frame both ways round the ring.
  * @param[in]	ifname The interface name to use, ie. eth0
+ * @param[in]	if2name The interface the end of the ring is connected to, NULL for no redundancy
  * @return ERR_SUCCESS on success, ERR_ETH_DEV_FAIL on failure.
  */
-int ethercat_init_device(char *ifname) {
+int ethercat_init_device(char *ifname, char *if2name) {
 	/* open the ethernet device */
+	if (if2name != NULL) {
+		if (ec_init_redundant(ifname, if2name) <= 0) {
+			printf("EtherCAT: Could not initialise devices %s and %s\n", ifname, if2name);
+			return ERR_ETH_DEV_FAIL;
+		}
+		return ERR_SUCCESS;
+	}
 	if (ec_init(ifname) < 0) {
 		printf("EtherCAT: Could not initialise device %s\n", ifname);
 		return ERR_ETH_DEV_FAIL;
@@ -286,13 +436,19 @@ int ethercat_init_to_pre_op()
  * Bring slaves into safe-op
  *
  * Give SOEM access to the I/O map and bring devices into safe-op
+ * The slaves are split into process data groups first (see pd_groups.c), each mapped on its own.
  * @return ERR_SUCCESS on success, ERR_EC_NO_SLAVES on failure to map slaves into io map (this error name should probably change...), ERR_FAILED_SAFE_OP if all slaves could not be brought into safe-op state.
  */
 int ethercat_pre_op_to_safe_op()
 {
 
+	if (ax5000_soe_find(TICK_RATE) > 0)
+		printf("EtherCAT: Configuring the telegrams of the AX5000 drives\n");
+	if (pd_groups_assign(slow_divider) > 0)
+		printf("EtherCAT: %d slaves exchanged every %u cycles\n", pd_groups[PD_GROUP_SLOW].slaves, slow_divider);
+
 	/* find slaves and automatically configure */
-	if (ec_config_map(&IOmap) <= 0 ) {
+	if (pd_groups_map((uint8 *) IOmap) < 0) {
 		printf("EtherCAT: Failed to map IOmap\n");
 		ec_close();
 		return ERR_EC_NO_SLAVES;
@@ -300,10 +456,17 @@ int ethercat_pre_op_to_safe_op()
 
 	while(EcatError) printf("%s", ec_elist2string());
 
+	if (ax5000_soe_map() < 0) {
+		ec_close();
+		return ERR_EC_NO_SLAVES;
+	}
+
 	printf("%d slaves found and configured\n", ec_slavecount);
 
-	int expectedWKC = (ec_group[0].outputsWKC * 2) + ec_group[0].inputsWKC;
-	printf("Calculated workcounter %d\n", expectedWKC);
+	expected_wkc = pd_groups[PD_GROUP_FAST].wkc_expected;
+	printf("Calculated workcounter %d\n", expected_wkc);
+	if (pd_groups[PD_GROUP_SLOW].slaves > 0)
+		printf("Calculated workcounter %d for the slow group\n", pd_groups[PD_GROUP_SLOW].wkc_expected);
 
 	/* wait for all slaves to reach SAFE_OP state */
 	ec_statecheck(0, EC_STATE_SAFE_OP, EC_TIMEOUTSTATE * 3);
@@ -345,9 +508,7 @@ int ethercat_safe_op_to_op()
 {
 	ec_slave[0].state = EC_STATE_OPERATIONAL;		
 	
-	ec_send_processdata();
-	int wkc = ec_receive_processdata(EtherCAT_TIMEOUT);
-//	printf("got wkc of: %d\n", wkc);
+	pd_groups_exchange_all(EtherCAT_TIMEOUT);
 
 	ec_writestate(0);
 //	printf("lowest state: %d\n", ec_readstate());
@@ -390,13 +551,146 @@ int ethercat_op_to_safe_op(){
 		add_timespec(&next_run, TICK_RATE); /* add ns to current time */
 
 		/* timer is sorted, lets go!!! */
-		ec_send_processdata();
-		ec_receive_processdata(EtherCAT_TIMEOUT);
+		pd_groups_exchange_all(EtherCAT_TIMEOUT);
 	}
 
 	return ERR_SUCCESS;
 }
 
+/**
+ * Exchanges the slow group's process data within a cycle
+ *
+ * @param[out]	sample Cleared of wkc_ok if the frame came back short
+ */
+static void ethercat_exchange_slow(struct bus_timing_sample_t *sample)
+{
+	int wkc;
+
+	if (pd_groups[PD_GROUP_SLOW].slaves == 0)
+		return;
+	pd_groups_send(PD_GROUP_SLOW);
+	if (safety_group == PD_GROUP_SLOW)
+		safety_mark_send(monotonic_ns());
+	wkc = pd_groups_receive(PD_GROUP_SLOW, EtherCAT_TIMEOUT);
+	if (wkc < pd_groups[PD_GROUP_SLOW].wkc_expected)
+		sample->wkc_ok = 0;
+}
+
+/**
+ * One bus cycle
+ *
+ * Exchanges the fast group's process data, and the slow group's where it is due, then runs
+ * cycle_update(). Must be called with io_mutex held.
+ * @param[out]	sample When the frames went and came back and how long the cycle's work took
+ */
+void ethercat_cycle(struct bus_timing_sample_t *sample)
+{
+	int64_t compute_start_ns;
+	uint32_t reactions;
+	int wkc;
+
+	timestamps_mark_send();
+	sample->send_ns = monotonic_ns();
+	ec_send_processdata();
+	if (safety_group == PD_GROUP_FAST)
+		safety_mark_send(monotonic_ns());
+	wkc = ec_receive_processdata(EtherCAT_TIMEOUT);
+	sample->receive_ns = monotonic_ns();
+	timestamps_mark_receive();
+	/* the scanners' EL1002 is always in the fast group */
+	safety_mark_receive(sample->receive_ns);
+	conveyor_mark_receive(sample->receive_ns);
+	supervisor_cycle(wkc);
+	sample->wkc_ok = (wkc >= expected_wkc);
+	cycle_slow_io = pd_groups_due(PD_GROUP_SLOW, cycle_count);
+	/* the steppers act on inputs read this cycle, their outputs go out the next time they are due */
+	if (cycle_slow_io) {
+		/* one slave's error counters per slot, its frame travels alongside the slow group's */
+		bus_errors_send();
+		ethercat_exchange_slow(sample);
+		bus_errors_receive(EtherCAT_TIMEOUT);
+	}
+	compute_start_ns = monotonic_ns();
+	reactions = safety_stats.reactions;
+	/* the next setpoint of the pick being played, taken up by the servos in cycle_update() */
+	planner_play();
+	/* react to the new inputs, outputs written here go out with the next frame */
+	cycle_update();
+	sample->compute_ns = monotonic_ns() - compute_start_ns;
+	/* a safety stop does not wait for the slow group to be due again */
+	if (safety_stats.reactions != reactions)
+		ethercat_exchange_slow(sample);
+	sample->done_ns = monotonic_ns();
+	/* reads the transmit stamps back, kept out of the time to react to the inputs */
+	timestamps_update();
+}
+
+/**
+ * Measures the bus instead of running it
+ *
+ * Prints the topology, where the time of a cycle goes and the cycle time the bus can be run at,
+ * see bus_timing.c.
+ */
+void ethercat_analyse(void)
+{
+	struct bus_timing_result_t result;
+	int64_t shortest_ns;
+
+	/* the delays measured when the drives were synchronised are reused, see bus_timing_topology() */
+	bus_timing_topology(dc_sync);
+	bus_timing_measure(TICK_RATE, BUS_TIMING_MAX_CYCLES, ethercat_cycle, &result);
+	bus_timing_report(&result, pd_groups[PD_GROUP_SLOW].divider);
+
+	if (!sweep_cycle_time)
+		return;
+	shortest_ns = bus_timing_sweep(TICK_RATE, ethercat_cycle);
+	if (shortest_ns == 0)
+		printf("The bus could not keep up even at %d ns\n", TICK_RATE);
+	else
+		printf("Shortest clean cycle time %lld ns, with %d%% headroom %lld ns\n", (long long) shortest_ns,
+			BUS_TIMING_HEADROOM_PERCENT, (long long) (shortest_ns + (shortest_ns * BUS_TIMING_HEADROOM_PERCENT) / 100));
+}
+
+/**
+ * Hands the jobs in a file over to the picker
+ *
+ * One job a line: the robot, the pick and the place point in its frame in mm and optionally the
+ * payload in kg, "0 -50,-80,-450 0,150,-450 0.1". Lines that do not read as a job are skipped.
+ * The picker takes PICKER_MAX_JOBS at once, the cycle is not running yet to pick any of them, the
+ * rest are left out.
+ * @param[in]	name The file
+ * @return the number of jobs handed over, -1 if the file could not be opened
+ */
+int read_jobs(const char *name)
+{
+	FILE *file = fopen(name, "r");
+	struct sequence_job_t job;
+	char line[256];
+	int robot, count = 0, fields;
+
+	if (file == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		memset(&job, 0, sizeof(job));
+		fields = sscanf(line, "%d %lf,%lf,%lf %lf,%lf,%lf %lf", &robot, &job.pick[0], &job.pick[1], &job.pick[2],
+			&job.place[0], &job.place[1], &job.place[2], &job.payload);
+		if (fields < 7)
+			continue;
+		for (int c=0; c<3; c++) {
+			job.pick[c] /= 1000.0;
+			job.place[c] /= 1000.0;
+		}
+		job.id = count;
+		if (picker_add_job(robot, &job) < 0) {
+			printf("Picker: Could not hand over job %d of %s, only the ones before it will be picked\n", count, name);
+			break;
+		}
+		count++;
+	}
+	fclose(file);
+	return count;
+}
+
 /**
  * Ethercat update thread
  *
@@ -410,9 +704,35 @@ void ethercat_thread(void * ptr)
 	printf("Starting input_test\n");
 
 	struct input_msg_t *input_msg = (struct input_msg_t *) ptr;
+	cpu_set_t cpus;
+
+	/* the planner threads keep off this core */
+	if (rt_cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(rt_cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+			printf("EtherCAT: Could not pin the ethercat thread to cpu %d\n", rt_cpu);
+			rt_cpu = -1;
+		}
+	}
 
-	if (ethercat_init_device(eth_dev) < 0) return;
+	if (ethercat_init_device(eth_dev, eth_dev_redundant) < 0) return;
 	printf("EtherCAT: Initialised device: %s\n", eth_dev);
+	if (eth_dev_redundant != NULL)
+		printf("EtherCAT: Redundant ring closed on: %s\n", eth_dev_redundant);
+	if (use_packet_ring) {
+		/* before anything is sent, SOEM's send() and recv() go through the rings from here on */
+		if (packet_ring_open(ecx_context.port->sockhandle) < 0)
+			printf("EtherCAT: Could not set up the packet ring on %s, using the socket\n", eth_dev);
+		if (eth_dev_redundant != NULL && packet_ring_open(ecx_context.port->redport->sockhandle) < 0)
+			printf("EtherCAT: Could not set up the packet ring on %s, using the socket\n", eth_dev_redundant);
+	}
+	if (use_timestamps) {
+		if (timestamps_enable(ecx_context.port->sockhandle, eth_dev) < 0)
+			printf("EtherCAT: Could not timestamp frames on %s\n", eth_dev);
+		else
+			printf("EtherCAT: Timestamping frames on %s in %s\n", eth_dev, timestamps_stats.hardware ? "hardware" : "software");
+	}
 
 	if (ethercat_init_to_pre_op() < 0) return;
 	printf("EtherCAT: Slaves are in pre-op.\n");
@@ -420,9 +740,10 @@ void ethercat_thread(void * ptr)
 	if (ethercat_pre_op_to_safe_op() < 0) return;
 	printf("EtherCAT: Slaves are in safe-op\n");
 
-	/* FIXME: use distributed clocks */
-	/* I've read distributed clocks are required to use the AX5000 */
-//	ec_configdc();
+	/* the AX5000 needs distributed clocks to take a position setpoint every cycle */
+	dc_sync = ax5000_soe_sync(TICK_RATE);
+	if (dc_sync)
+		printf("EtherCAT: Servo drives synchronised to the distributed clock\n");
 
 	if (ethercat_safe_op_to_op() < 0) return;
 	printf("EtherCAT: Slaves are in op\n");
@@ -434,41 +755,97 @@ void ethercat_thread(void * ptr)
 	struct timespec current_time;
 	struct timespec result;
 
-	/* FIXME: this should be updated to be detected automatically, theres no reason other than laziness to do it this way */
-	for (int i=0; i<3; i++)
-	{
-		wago_steppers[i][WAGO_OUTPUT_SPACE] = (struct wago_stepper_t *) &IOmap[WAGO_DEVICE_OFFSETS_MOSI[i]];
-		wago_steppers[i][WAGO_INPUT_SPACE] = (struct wago_stepper_t *) &IOmap[WAGO_DEVICE_OFFSETS_MISO[i]];
+	if (ethercat_find_wago_steppers() < 0) {
+		printf("EtherCAT: No 750-354 found for the steppers\n");
+		return;
 	}
 
+	if (ethercat_find_safety_inputs() < 0)
+		printf("EtherCAT: No EL1002 found, the safety scanner will not stop the axes!\n");
+	if (ethercat_find_magnet_outputs() < 0)
+		printf("EtherCAT: No EL2008 found, output events will not be applied\n");
+	conveyor_cycle_ns = TICK_RATE;
+	if (ethercat_find_conveyor_encoder() < 0 && conveyor_picking) {
+		printf("EtherCAT: No EL5101 found, parts cannot be picked off the conveyor\n");
+		conveyor_picking = 0;
+	}
+	cycle_clock_ns = monotonic_ns;
+	if (telemetry_open() < 0)
+		printf("Telemetry: Could not create %s, running without it\n", TELEMETRY_SHM_NAME);
+	if (supervisor_start(expected_wkc, eth_dev_redundant != NULL) < 0)
+		printf("EtherCAT: Could not start the supervisor, slaves that drop out will not be brought back\n");
+	bus_errors_start();
+	struct delta_robot_t robots[PLANNER_MAX_ROBOTS];
+	for (int r=0; r<robot_count; r++)
+		delta_defaults(&robots[r]);
+	if (planner_start(robots, robot_count, TICK_RATE, planner_workers, rt_cpu) < 0)
+		printf("Planner: Could not start %d planner threads, picks cannot be queued\n", planner_workers);
+	if (trajectory_name != NULL) {
+		/* mapped and checked here, the cycle only ever reads it */
+		int err = trajectory_file_map(trajectory_name, &trajectory_file);
+		if (err < 0)
+			printf("Planner: Could not map %s (%d), it will not be played\n", trajectory_name, err);
+		else if (trajectory_file.trajectory.cycle_ns != TICK_RATE)
+			printf("Planner: %s was planned for %u ns cycles, not %d, it will not be played\n", trajectory_name, trajectory_file.trajectory.cycle_ns, TICK_RATE);
+		else if (planner_submit_trajectory(0, &trajectory_file.trajectory, NULL) < 0)
+			printf("Planner: Could not queue %s\n", trajectory_name);
+		else if (!trajectory_file.locked)
+			printf("Planner: Could not lock %s in memory, the cycle may wait for it to be paged back in\n", trajectory_name);
+	}
+	if (conveyor_picking || jobs_name != NULL) {
+		struct scheduler_t scheduler;
+		scheduler_defaults(&scheduler, &robots[0], robot_count, SCHEDULER_DEFAULT_SPACING);
+		for (int r=0; r<robot_count && conveyor_picking; r++) {
+			for (int c=0; c<3; c++)
+				scheduler.robots[r].pick.place[c] = place_mm[c] / 1000.0;
+		}
+		if (picker_start(&scheduler, TICK_RATE, rt_cpu) < 0)
+			printf("Conveyor: Could not start picking\n");
+		else if (jobs_name != NULL && read_jobs(jobs_name) < 0)
+			printf("Picker: Could not open %s, its jobs will not be picked\n", jobs_name);
+	}
+
+	int64_t last_receive_ns = monotonic_ns();
+	struct bus_timing_sample_t sample;
+	int64 toff = 0;
+
 	/* FIXME: this shouldn't be needed as structure is zeroed in main, remove it and check it still works */
 	input_msg->quit = 0;
 
+	if (analyse_bus) {
+		ethercat_analyse();
+		input_msg->quit = 1;
+	}
+
 	while (input_msg->quit == 0) {
 		/* FIXME: this timing should probably be changed to use pthread_cond_timedwait like the SOEM ebox example does. pthread_cond_timedwait has the advantage of built in timing error detection */
 		/* check if timer has not elapsed */
 		clock_gettime(CLOCK_REALTIME, &current_time);
-		/* FIXME I think print statements significantly slow this down? should test at some point */	   
 		if ( compare_timespec(current_time, next_run) == -1 ){
 			/* FIXME: should there be a usleep here to avoid starvation of other thread? */
 			continue;
 		}
 
-		/* XXX: the following prints out whether timing has been met. The printf() call will very likely cause delay. I would avoid using this, the output probably isn't even reliable */
+		/* XXX: the following prints out whether timing has been met. log_write() is cheap but this still logs every cycle, expect the rate limit to hide most of it */
 #ifdef SHOW_TPS
 		int valid = subtract_timespec(current_time, next_run, &result);
-		printf("valid? %d. difference is %d sec and %ld nsec\n", valid, result.tv_sec, result.tv_nsec);
+		log_write("valid? %d. difference is %d sec and %ld nsec\n", valid, (int) result.tv_sec, result.tv_nsec);
 #endif /* SHOW_TPS */
 
 		/* timer has elapsed update expiration time */
 		memcpy(&next_run, &current_time, sizeof(struct timespec));
-		add_timespec(&next_run, TICK_RATE); /* add ns to current time */
+		add_timespec(&next_run, TICK_RATE + toff); /* add ns to current time */
 
 		/* timer is sorted, lets go!!! */
 		// the following should not be needed as it is now done in the ethercat thread 
 		pthread_mutex_lock(&io_mutex);
-		ec_send_processdata();
-		ec_receive_processdata(EtherCAT_TIMEOUT);
+		ethercat_cycle(&sample);
+		/* pull the start of the next cycle towards the distributed clock */
+		if (dc_sync)
+			ec_sync(ec_DCtime, TICK_RATE, &toff);
+		/* readers copy this out of shared memory themselves, nothing here waits for them */
+		telemetry_publish(sample.receive_ns, sample.receive_ns - last_receive_ns, sample.compute_ns, TICK_RATE);
+		last_receive_ns = sample.receive_ns;
 		pthread_mutex_unlock(&io_mutex);
 
 		/* FIXME: this is dangerous for time constraints but otherwise can't get other thread to get access :S This is possibly a good candidate for pthread_yield(), I don't know whether pthread_yield has less overhead than usleep though */
@@ -479,6 +856,15 @@ void ethercat_thread(void * ptr)
 //	ethercat_op_to_safe_op();
 //	ethercat_safe_op_to_pre_op();
 
+	picker_stop();
+	planner_stop();
+	trajectory_file_unmap(&trajectory_file);
+	bus_errors_stop();
+	supervisor_stop();
+	telemetry_close();
+	packet_ring_close(ecx_context.port->sockhandle);
+	if (eth_dev_redundant != NULL)
+		packet_ring_close(ecx_context.port->redport->sockhandle);
 	ec_close();	
 }
 
@@ -490,6 +876,19 @@ void help(void)
 	printf("Welcome to the SOEM based Delta robot controller\n");
 	printf("-c = cycle time (us), int\n");
 	printf("-d = device, string\n");
+	printf("-r = second device the end of the ring is connected to, string\n");
+	printf("-p = poll a memory mapped packet ring instead of calling recv() for every frame\n");
+	printf("-t = timestamp process data frames, see the telemetry for the figures\n");
+	printf("-a = measure the bus timing and report the shortest cycle time instead of running\n");
+	printf("-s = with -a, also shorten the cycle time until the bus cannot keep up\n");
+	printf("-g = exchange the WAGO steppers and the safety scanner input only every this many cycles\n");
+	printf("-w = number of threads planning the queued picks\n");
+	printf("-f = precomputed trajectory file (trajectory_gen) to play\n");
+	printf("-b = pick the parts off the conveyor and place them at x,y,z (mm)\n");
+	printf("-j = file of parts lying still to pick and place, one job a line: robot x,y,z x,y,z (mm) [payload kg]\n");
+	printf("-n = number of delta robots along the conveyor, three servo axes each\n");
+	printf("-o = EL2008 outputs switching each robot's magnet, a mask per robot in order, e.g. 0x01,0x02\n");
+	printf("-k = cpu to keep the ethercat thread on, the planner threads use the others\n");
 	printf("-m = coordinate to move all wago stepper motors to\n");
 }
 
@@ -501,8 +900,8 @@ void help(void)
  */
 void process_cmd_opts(int argc, char *argv[])
 {	
-	int c;
-	while ( (c=getopt(argc, argv, "c:d:m:")) != -1) {
+	int c, gripper = 0;
+	while ( (c=getopt(argc, argv, "ab:c:d:f:g:j:k:m:n:o:r:pstw:")) != -1) {
 		switch (c) {
 		case 'c':
 			cycle_time = atoi(optarg);
@@ -512,6 +911,74 @@ void process_cmd_opts(int argc, char *argv[])
 			eth_dev = optarg;
 			printf("setting ethernet device to %s\n", eth_dev);
 			break;
+		case 'r':
+			eth_dev_redundant = optarg;
+			printf("setting redundant ethernet device to %s\n", eth_dev_redundant);
+			break;
+		case 'p':
+			use_packet_ring = 1;
+			printf("using the packet ring\n");
+			break;
+		case 'a':
+			analyse_bus = 1;
+			printf("analysing the bus timing\n");
+			break;
+		case 's':
+			sweep_cycle_time = 1;
+			break;
+		case 'g':
+			slow_divider = atoi(optarg);
+			if (slow_divider < 1)
+				slow_divider = 1;
+			printf("exchanging the slow I/O every %u cycles\n", slow_divider);
+			break;
+		case 't':
+			use_timestamps = 1;
+			printf("timestamping frames\n");
+			break;
+		case 'w':
+			planner_workers = atoi(optarg);
+			if (planner_workers > PLANNER_MAX_WORKERS)
+				planner_workers = PLANNER_MAX_WORKERS;
+			printf("planning picks on %d threads\n", planner_workers);
+			break;
+		case 'b':
+			if (sscanf(optarg, "%lf,%lf,%lf", &place_mm[0], &place_mm[1], &place_mm[2]) == 3) {
+				conveyor_picking = 1;
+				printf("picking parts off the conveyor, placing them at %.1f %.1f %.1f\n", place_mm[0], place_mm[1], place_mm[2]);
+			} else {
+				help();
+			}
+			break;
+		case 'n':
+			robot_count = atoi(optarg);
+			if (robot_count < 1)
+				robot_count = 1;
+			if (robot_count > PLANNER_MAX_ROBOTS)
+				robot_count = PLANNER_MAX_ROBOTS;
+			printf("sharing the conveyor between %d robots\n", robot_count);
+			break;
+		case 'o':
+			for (char *mask = strtok(optarg, ","); mask != NULL; mask = strtok(NULL, ","), gripper++) {
+				if (output_gripper_configure(gripper, (uint8_t) strtoul(mask, NULL, 0)) < 0) {
+					help();
+					break;
+				}
+				printf("switching robot %d's magnet through outputs 0x%02x\n", gripper, output_gripper(gripper, OUTPUT_MAGNET));
+			}
+			break;
+		case 'f':
+			trajectory_name = optarg;
+			printf("playing trajectory file %s\n", trajectory_name);
+			break;
+		case 'j':
+			jobs_name = optarg;
+			printf("picking the jobs in %s\n", jobs_name);
+			break;
+		case 'k':
+			rt_cpu = atoi(optarg);
+			printf("keeping the ethercat thread on cpu %d\n", rt_cpu);
+			break;
 		case 'm':
 			move_coord = atoi(optarg);
 			printf("Moving wago steppers to: %d\n", move_coord);
@@ -547,6 +1014,10 @@ int main(int argc, char *argv[])
 
 	printf("SOEM (Simple Open EtherCAT Master)\nInput Test\n");
 
+	/* messages from the state machine and the ethercat thread are printed by the log thread */
+	if (log_start() < 0)
+		printf("Log: Could not start the log thread, messages will be printed on exit\n");
+
 	process_cmd_opts(argc, argv);
 
 	/* increase thread priority and set to fifo mode */
@@ -583,6 +1054,7 @@ int main(int argc, char *argv[])
 	schedp.sched_priority = 0;
 	sched_setscheduler(0, SCHED_OTHER, &schedp);
 
+	log_stop();
 	printf("End Program\n");
 
 	return 0;
@@ -1,6 +1,8 @@
 /** \file
  * \brief State machine used for controlling the system
  *
+ * The startup sequence is a motion script (script.h) run by the cycle, the state machine starts it
+ * and waits for it to end.
  * \warning Building this file in visual studio requires setting the /TP build option 
  * (Project->Properties->c/c++->commandline->additional options)
  * This forces this file to be compiled as c++ as otherwise a beckhoff header gets pulled in
@@ -20,17 +22,132 @@
 #include "error.h"
 #include "state_machine.h"
 #include "wago_steppers.h"
+#include "wago_move_queue.h"
+#include "wago_mailbox.h"
+#include "homing.h"
+#include "safety.h"
+#include "output_events.h"
+#include "log.h"
+#include "script.h"
 
 struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE];
 
+/* set by the startup script once homing is over, the result is only saved then */
+static int state_machine_homed = 0;
+
+/* the startup script's variables, see SCRIPT_LOCALS() */
+struct state_machine_locals_t {
+	int i;
+};
+
+/**
+ * Checks that every stepper has confirmed a mode
+ *
+ * @param[in]	confirm One of the wago_confirm_*_mode() functions
+ * @return 1 if all of them have, 0 otherwise
+ */
+static int state_machine_confirmed(int (*confirm)(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device))
+{
+	for (int i=0; i<3; i++) {
+		if (confirm(wago_steppers, i) < 0)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Checks that every stepper is done with its queued moves
+ *
+ * @return 1 if they all are, 0 otherwise
+ */
+static int state_machine_idle(void)
+{
+	for (int i=0; i<3; i++) {
+		if (!wago_queue_idle(i))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Startup sequence, brings the steppers into positioning mode, homes them and runs the test move
+ *
+ * Resumed by the cycle, see script.h. Aborted by a safety stop.
+ * @param[in,out]	s The script's frame
+ * @return SCRIPT_WAITING until it is done, SCRIPT_FINISHED once the test move is back,
+ * SCRIPT_ABORTED if homing failed or a move could not be queued
+ */
+static enum script_states state_machine_script(struct script_t *s)
+{
+	struct state_machine_locals_t *l = SCRIPT_LOCALS(s, struct state_machine_locals_t);
+	uint32_t move_coord = 64*5*200; /* 64 microsteps * 5:1 gear ratio * 360degrees/1.8degreesperstep = 1 full rotation */
+
+	SCRIPT_BEGIN(s);
+	log_write("terminating existing\n");
+	for (int i=0; i<3; i++)
+		wago_terminate_mode_locked(wago_steppers, i);
+	log_write("Terminate Operating Mode\n");
+	SCRIPT_UNTIL(s, state_machine_confirmed(wago_confirm_terminate_mode_locked));
+
+	log_write("set setup mode\n");
+	for (int i=0; i<3; i++)
+		wago_set_setup_mode_locked(wago_steppers, i);
+	log_write("Confirm Setup Mode\n");
+	SCRIPT_UNTIL(s, state_machine_confirmed(wago_confirm_setup_mode_locked));
+
+	/* every axis that needs it is homed at the same time by the cycle */
+	log_write("start homing\n");
+	for (int i=0; i<3; i++) {
+		if (homing_restore(wago_steppers, i))
+			log_write("%d: still referenced, not homing\n", i);
+		else
+			homing_start_locked(i);
+	}
+	log_write("confirm homing\n");
+	SCRIPT_UNTIL(s, homing_all_done());
+	state_machine_homed = 1;
+	for (int i=0; i<3; i++) {
+		log_write("%d: homing %s after %u cycles\n", i, 
+			(homing_axes[i].state == HOMING_DONE) ? "done" : "failed", 
+			homing_axes[i].homing_cycles
+		);
+	}
+	if (homing_any_failed())
+		SCRIPT_ABORT(s);
+
+	log_write("set positioning mode\n");
+	for (int i=0; i<3; i++)
+		wago_set_positioning_mode_locked(wago_steppers, i);
+	log_write("confirm positioning mode\n");
+	SCRIPT_UNTIL(s, state_machine_confirmed(wago_confirm_positioning_mode));
+
+	log_write("set position\n");
+	for (l->i = 0; l->i < 3; l->i++) {
+		log_write("m_positioning? %d\n", wago_steppers[l->i][1]->stat_cont1.bit.m_positioning);
+
+		/* the return move is pre-calculated by the terminal while the first move runs */
+		SCRIPT_QUEUE_MOVE(s, l->i, move_coord, (uint16_t) 5000, (uint16_t) 5000);
+		SCRIPT_QUEUE_MOVE(s, l->i, 0, (uint16_t) 5000, (uint16_t) 5000);
+	}
+	/* pick up on the way out, release as soon as the return move starts */
+	output_event_after_move_locked(0, wago_queue_last(0)-1, 0, OUTPUT_MAGNET, OUTPUT_MAGNET);
+	output_event_after_move_locked(0, wago_queue_last(0), 0, OUTPUT_MAGNET, 0);
+
+	log_write("check position\n");
+	SCRIPT_UNTIL(s, state_machine_idle());
+	log_write("Reached destination! %u moves handed off without stopping\n", wago_move_queues[0].precalc_handoffs);
+	for (int i=0; i<3; i++)
+		log_write("%d: actual position %d (%u updates)\n", i, wago_mbx_actual_position(i, NULL), wago_mailboxes[i].position_updates);
+	log_write("output events: %u applied, %u late (worst %u cycles)\n", output_event_stats.applied, output_event_stats.late, output_event_stats.late_cycles_max);
+	SCRIPT_END(s);
+}
+
 /**
  * State machine
  *
- * The state machine currently only runs the wago stepper motors, it appears to run correctly in TwinCAT3
- * It definately runs correctly in soem. 
- * It would probably be a nice solution to create a queue on which to register these instructions instead.
- * This would significantly simplify the code.
- * Currently debug messages are printed whenever the state changes
+ * Starts the startup sequence (state_machine_script()) as a script on the first call and reports
+ * once it has ended. The sequence itself is run by the cycle, this only does what may not be done
+ * there: under SOEM reading and writing the homing file.
  * @param[in]     m_Trace A reference to TwinCAT3's m_Trace object, needed for printf() in TwinCAT3. This argument is not present under SOEM.
  * @return Returns ERR_SUCCESS if the state machine is still executing and ERR_STATE_MACHINE_STOPPED once execution is complete.
  */
@@ -39,181 +156,42 @@ int state_machine(CTcTrace &m_Trace) {
 #else
 int state_machine() {
 #endif
-	enum states {
-		set_terminate_operating_mode = 0,
-		confirm_terminate_operating_mode,
-		set_setup_mode,
-		confirm_setup_mode,
-		set_positioning_mode,
-		confirm_positioning_mode,
-		set_position,
-		check_position,
-		stop
-	};
-	
-	static enum states current_state = set_terminate_operating_mode;
-	static enum states last_state = stop;
-	uint32_t move_coord = 64*5*200; /* 64 microsteps * 5:1 gear ratio * 360degrees/1.8degreesperstep = 1 full rotation */
-	int confirmed;
-
-	switch (current_state) {
-	case set_terminate_operating_mode:
-		printf("terminating existing\n");
-
-		for (int i=0; i<3; i++){
-			wago_terminate_mode(wago_steppers, i);
-			/*wago_steppers[i][0]->stat_cont1.bit.enable = 0;
-			wago_steppers[i][0]->stat_cont1.bit.stop2_n = 0;
-			wago_steppers[i][0]->stat_cont1.bit.start = 0;*/
-		}
-
-		last_state = set_terminate_operating_mode;
-		current_state = confirm_terminate_operating_mode;
-		break;
-	case confirm_terminate_operating_mode:
-		printf("Terminate Operating Mode\n");
-		/*confirmed = 1;
-		for (int i=0; i<3; i++) {
-			if (wago_steppers[i][1]->stat_cont1.bit.enable != 0) {
-				printf("%d: Enable not yet reset!\n", i);
-				confirmed = 0;
-			}
-			if (wago_steppers[i][1]->stat_cont1.bit.stop2_n != 0) {
-				printf("%d: Stop not yet reset!\n", i);
-				confirmed = 0;
-			}
-			if (wago_steppers[i][1]->stat_cont1.bit.start != 0) {
-				printf("%d: start not yet reset!\n", i);
-				confirmed = 0;
-			}
-	
-		}*/
-		confirmed = 1;
-		for (int i=0; i<3; i++) {
-				if (wago_confirm_terminate_mode(wago_steppers, i) < 0) {
-					confirmed = 0;
-					break;
-				}
-		}
+	static int frame = SCRIPT_ERR_FRAME;
+	static int stopped = 0;
+	int state;
 
-		last_state = confirm_terminate_operating_mode;
-		if (confirmed) 
-			current_state=set_setup_mode;
-		break;
-	case set_setup_mode:
-		printf("set setup mode\n");
-		for (int i=0; i<3; i++) {
-			wago_set_setup_mode(wago_steppers, i);
-		}
-
-		last_state = set_setup_mode;
-		current_state = confirm_setup_mode;
-		break;
-	case confirm_setup_mode:
-		if (last_state != current_state)
-			printf("Confirm Setup Mode\n");
-		
-		confirmed = 1;
-		for (int i=0; i<3; i++) {
-			if (wago_confirm_setup_mode(wago_steppers, i) < 0) {
-				confirmed = 0;
-				break;
-			}
-/*			if (wago_steppers[i][WAGO_INPUT_SPACE]->stat_cont1.bit.enable != 1) {
-				printf("%d: Trying to set enable to: %d Enable is: %d!\n", 
-					i, 
-					wago_steppers[i][WAGO_OUTPUT_SPACE]->stat_cont1.bit.enable, 
-					wago_steppers[WAGO_INPUT_SPACE][1]->stat_cont1.bit.enable
-				);
-				confirmed = 0;
-			}
-			if (wago_steppers[i][WAGO_INPUT_SPACE]->stat_cont1.bit.stop2_n != 1) {
-				printf("%d: Trying to set stop to: %d Stop is: %d!\n", 
-					i, 
-					wago_steppers[i][WAGO_OUTPUT_SPACE]->stat_cont1.bit.stop2_n, 
-					wago_steppers[i][WAGO_INPUT_SPACE]->stat_cont1.bit.stop2_n
-				);
-				confirmed = 0;
-			}
-			if (wago_steppers[i][WAGO_INPUT_SPACE]->stat_cont1.bit.start != 0) {
-				printf("%d: Trying to set start to: %d Start is: %d!\n", 
-					i, 
-					wago_steppers[i][WAGO_OUTPUT_SPACE]->stat_cont1.bit.start, 
-					wago_steppers[i][WAGO_INPUT_SPACE]->stat_cont1.bit.start
-				);
-				confirmed = 0;
-			}*/
-		}
-		last_state = confirm_setup_mode;
-		if (confirmed)
-			current_state=set_positioning_mode;
-		break;
-	case set_positioning_mode:
-		printf("set positioning mode\n");
-		for (int i=0; i<3; i++) {
-			wago_set_positioning_mode(wago_steppers, i);
-		}
+	if (stopped)
+		return ERR_STATE_MACHINE_STOPPED;
 
-		last_state = set_positioning_mode;
-		current_state = confirm_positioning_mode;
-		break;
-	case confirm_positioning_mode:
-		if (last_state != current_state)
-			printf("confirm positioning mode\n");
-		confirmed = 1;
-		for (int i=0; i<3; i++) {
-			if (wago_confirm_positioning_mode(wago_steppers, i) < 0) {
-				confirmed = 0;
-				break;
-			}
-		}
-		/*printf("positioning mode active? s1:%s s2:%s s3:%s\n",
-			(wago_steppers[0][1]->stat_cont1.bit.m_positioning)?"y":"n",
-			(wago_steppers[1][1]->stat_cont1.bit.m_positioning)?"y":"n",	
-			(wago_steppers[2][1]->stat_cont1.bit.m_positioning)?"y":"n"
-		);*/
-		
-		last_state = confirm_positioning_mode;
-		if (confirmed)	
-			current_state = set_position;
-		break;
-	case set_position:
-		if (last_state != current_state)
-			printf("set position\n");
-		for (int i=0; i<3; i++) {
-			printf("m_positioning? %d\n", wago_steppers[i][1]->stat_cont1.bit.m_positioning);
-			
-			wago_set_acceleration_limit(wago_steppers, i, (uint16_t) 5000);
-
-			wago_set_velocity_limit(wago_steppers, i, (uint16_t) 5000);
-			
-			wago_set_position(wago_steppers, i, (uint32_t) move_coord);
-
-			wago_enable_motor(wago_steppers, i);
-		}
-		last_state = set_position;
-		current_state = check_position;
-		break;
-	case check_position:
-		if (last_state != current_state)
-			printf("check position\n");
-		if (wago_steppers[0][1]->stat_cont2.status_bits.on_target){
-			printf("Reached destination!\n");
-			current_state = stop;
+	if (frame < 0) {
+#ifndef TC_VER
+		if (homing_load(HOMING_FILE) != HOMING_ERR_SUCCESS)
+			log_write("could not read %s, homing every axis\n", HOMING_FILE);
+#endif
+		frame = script_start(state_machine_script, NULL);
+		if (frame < 0) {
+			log_write("ERROR: no frame for the startup script\n");
+			stopped = 1;
+			return ERR_STATE_MACHINE_STOPPED;
 		}
-		last_state = check_position;
-		break;
+		return ERR_SUCCESS;
+	}
 
-	case stop:
-		if (last_state != current_state)
-			printf("positioning mode: %d\n", wago_steppers[0][1]->stat_cont1.bit.m_positioning);
+	if (script_state(frame) == SCRIPT_WAITING)
+		return ERR_SUCCESS;
+	state = script_free(frame);
+	stopped = 1;
 
-		last_state = stop;
-		return ERR_STATE_MACHINE_STOPPED;
-		break;
-	default:
-		printf("ERROR: should not be in this state\n");
-		break;
+#ifndef TC_VER
+	if (state_machine_homed && homing_save(HOMING_FILE) != HOMING_ERR_SUCCESS)
+		log_write("could not write %s\n", HOMING_FILE);
+#endif
+	if (state == SCRIPT_ABORTED && safety_stopped()) {
+		log_write("Safety scanner stopped the axes! scanners 0x%02x, reaction %ldns (max %ldns), sent after %ldns, confirmed after %u cycles\n",
+			safety_stats.fields, (long) safety_stats.react_ns_last, (long) safety_stats.react_ns_max,
+			(long) safety_stats.send_ns_last, safety_stats.confirm_cycles_last
+		);
 	}
-	return ERR_SUCCESS;
+	log_write("positioning mode: %d\n", wago_steppers[0][1]->stat_cont1.bit.m_positioning);
+	return ERR_STATE_MACHINE_STOPPED;
 }
@@ -0,0 +1,295 @@
+/** \file
+ * \brief Supervision of the EtherCAT bus once it is in op
+ *
+ * supervisor_cycle() is called by the ethercat thread with the working counter of every frame. It
+ * only counts: a lost frame (no working counter) or a short one (lower than expected) marks the
+ * bus as degraded. It never blocks.
+ * While the bus is degraded the supervisor thread reads the slave states and brings back the
+ * slaves that have left op, one at a time, the same way the SOEM examples do: errors in safe-op
+ * are acknowledged, slaves in safe-op are asked for op, slaves in a lower state are configured
+ * again and slaves that have disappeared are recovered once they come back. None of this holds
+ * io_mutex so the cycle keeps running for the rest of the bus.
+ * The cycle does not know which slave a short frame belongs to, the process data of a slave that
+ * is out of op is simply not updated until it is back.
+ * The slow process data group (see pd_groups.c) checks its own frames and asks for its slaves to be
+ * looked at through the group's docheckstate.
+ *
+ * When the bus is opened on two ports (ec_init_redundant()) SOEM sends every frame both ways round
+ * the ring and merges what comes back, so a single break does not lose the process data. The
+ * break does not show in the working counter, so the supervisor thread also compares the link bits
+ * of every slave's DL status with the ones found at start up. The DL status is read by the ethercat
+ * thread, one slave in every slow slot alongside the error counters (bus_errors.c), so checking the
+ * ring adds no frames to the bus. The frames that
+ * were lost or short between the last check with the ring closed and the check that found it
+ * broken are the cost of the failover.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "supervisor.h"
+#include "bus_errors.h"
+#include "cycle.h"
+#include "log.h"
+
+struct supervisor_stats_t supervisor_stats;
+struct supervisor_slave_t supervisor_slaves[EC_MAXSLAVE];
+
+static volatile int supervisor_is_degraded = 0;
+static uint32_t supervisor_degraded_since = 0;
+static volatile int supervisor_running = 0;
+static pthread_t supervisor_thread_handle;
+
+/* links found at start up, only used when the ring is redundant */
+static uint16 supervisor_links[EC_MAXSLAVE];
+static uint32_t supervisor_frames_at_check = 0;
+
+/**
+ * Reads which ports of a slave have a physical link
+ *
+ * Only used at start up, before the cycle runs, supervisor_check_ring() takes the DL status the
+ * error counter slot read last.
+ * @param[in]	slave The slave number
+ * @param[out]	links The link bits of the DL status register
+ * @return 1 if the register could be read, 0 otherwise
+ */
+static int supervisor_read_links(uint16 slave, uint16 *links)
+{
+	uint16 dlstat = 0;
+
+	if (ec_FPRD(ec_slave[slave].configadr, ECT_REG_DLSTAT, sizeof(dlstat), &dlstat, EC_TIMEOUTRET) <= 0)
+		return 0;
+	*links = etohs(dlstat) & SUPERVISOR_DLSTAT_LINKS;
+	return 1;
+}
+
+/**
+ * Compares every slave's links with the ones found at start up
+ *
+ * A slave can only be reached from one side while the ring is broken, that is what the redundancy
+ * is for, so slaves that cannot be read at all are left to supervisor_check(). Each slave's DL
+ * status is the one its last error counter slot read, up to a pass of the slots old.
+ */
+static void supervisor_check_ring(void)
+{
+	uint32_t frames = supervisor_stats.frames_lost + supervisor_stats.frames_short;
+	uint16 links;
+	int broken_slave = 0;
+	int broken_port = 0;
+
+	for (uint16 slave=1; slave<=ec_slavecount && !broken_slave; slave++) {
+		if (bus_errors_slaves[slave].dl_status_reads == 0)
+			continue;
+		links = bus_errors_slaves[slave].dl_status & SUPERVISOR_DLSTAT_LINKS;
+		for (int port=0; port<4; port++) {
+			if ((supervisor_links[slave] & ~links) & (0x10 << port)) {
+				broken_slave = slave;
+				broken_port = port;
+				break;
+			}
+		}
+	}
+
+	if (broken_slave && !supervisor_stats.ring_broken) {
+		supervisor_stats.ring_broken = 1;
+		supervisor_stats.ring_breaks++;
+		supervisor_stats.ring_broken_since = cycle_count;
+		supervisor_stats.failover_frames_last = frames - supervisor_frames_at_check;
+		if (supervisor_stats.failover_frames_last > supervisor_stats.failover_frames_max)
+			supervisor_stats.failover_frames_max = supervisor_stats.failover_frames_last;
+		log_write("EtherCAT: ring broken at slave %d port %d, %u frames lost or short during the failover\n",
+			broken_slave, broken_port, supervisor_stats.failover_frames_last);
+	} else if (!broken_slave && supervisor_stats.ring_broken) {
+		supervisor_stats.ring_broken = 0;
+		supervisor_stats.ring_repairs++;
+		log_write("EtherCAT: ring closed again after %u cycles\n", cycle_count - supervisor_stats.ring_broken_since);
+	}
+
+	if (!supervisor_stats.ring_broken)
+		supervisor_frames_at_check = frames;
+}
+
+/**
+ * Brings one slave that has left op back
+ *
+ * Blocks for up to a few EC_TIMEOUTMON, so it must not be called from the ethercat thread.
+ * @param[in]	slave The slave number
+ */
+static void supervisor_recover_slave(uint16 slave)
+{
+	ec_slavet *s = &ec_slave[slave];
+
+	if (s->state == (EC_STATE_SAFE_OP + EC_STATE_ERROR)) {
+		log_write("EtherCAT: slave %d is in safe-op with error %x (%s), acknowledging\n",
+			slave, s->ALstatuscode, ec_ALstatuscode2string(s->ALstatuscode));
+		s->state = EC_STATE_SAFE_OP + EC_STATE_ACK;
+		ec_writestate(slave);
+		supervisor_slaves[slave].errors_acked++;
+	} else if (s->state == EC_STATE_SAFE_OP) {
+		log_write("EtherCAT: slave %d is in safe-op, requesting op\n", slave);
+		s->state = EC_STATE_OPERATIONAL;
+		ec_writestate(slave);
+	} else if (s->state > EC_STATE_NONE) {
+		if (ec_reconfig_slave(slave, EC_TIMEOUTMON)) {
+			s->islost = FALSE;
+			supervisor_slaves[slave].reconfigs++;
+			log_write("EtherCAT: slave %d reconfigured\n", slave);
+		}
+	} else if (!s->islost) {
+		/* make sure the slave really is gone */
+		ec_statecheck(slave, EC_STATE_OPERATIONAL, EC_TIMEOUTRET);
+		if (s->state == EC_STATE_NONE) {
+			s->islost = TRUE;
+			supervisor_slaves[slave].losses++;
+			log_write("EtherCAT: slave %d lost\n", slave);
+		}
+	}
+
+	if (s->islost) {
+		if (s->state == EC_STATE_NONE) {
+			if (ec_recover_slave(slave, EC_TIMEOUTMON)) {
+				s->islost = FALSE;
+				log_write("EtherCAT: slave %d recovered\n", slave);
+			}
+		} else {
+			s->islost = FALSE;
+			log_write("EtherCAT: slave %d found\n", slave);
+		}
+	}
+}
+
+/**
+ * Checks every slave and brings back the ones that have left op
+ */
+static void supervisor_check(void)
+{
+	for (int group=0; group<EC_MAXGROUP; group++)
+		ec_group[group].docheckstate = FALSE;
+	ec_readstate();
+
+	for (uint16 slave=1; slave<=ec_slavecount; slave++) {
+		if (ec_slave[slave].state != EC_STATE_OPERATIONAL) {
+			ec_group[ec_slave[slave].group].docheckstate = TRUE;
+			supervisor_recover_slave(slave);
+			if (ec_slave[slave].state == EC_STATE_OPERATIONAL)
+				supervisor_slaves[slave].recoveries++;
+		}
+	}
+}
+
+/**
+ * Reports whether any group has asked for its slaves to be checked
+ *
+ * @return 1 if a check is pending, 0 otherwise
+ */
+static int supervisor_check_pending(void)
+{
+	for (int group=0; group<EC_MAXGROUP; group++) {
+		if (ec_group[group].docheckstate)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Supervisor thread, looks at the slaves while the bus is degraded
+ *
+ * @param[in]	ptr unused
+ */
+static void *supervisor_thread(void *ptr)
+{
+	while (supervisor_running) {
+		if (supervisor_is_degraded || supervisor_check_pending())
+			supervisor_check();
+		if (supervisor_stats.redundant)
+			supervisor_check_ring();
+		usleep(SUPERVISOR_PERIOD_US);
+	}
+	return NULL;
+}
+
+/**
+ * Starts supervising the bus
+ *
+ * Call once every slave is in op, with the ring closed.
+ * @param[in]	wkc_expected The working counter of a frame that reached every slave
+ * @param[in]	redundant 1 if the bus was opened on two ports with ec_init_redundant()
+ * @return SUPERVISOR_ERR_SUCCESS on success, SUPERVISOR_ERR_THREAD if the thread could not be created
+ */
+int supervisor_start(int wkc_expected, int redundant)
+{
+	supervisor_stats.wkc_expected = wkc_expected;
+	supervisor_stats.redundant = redundant;
+	if (redundant) {
+		for (uint16 slave=1; slave<=ec_slavecount; slave++) {
+			if (!supervisor_read_links(slave, &supervisor_links[slave]))
+				supervisor_links[slave] = 0;
+		}
+	}
+	supervisor_running = 1;
+	if (pthread_create(&supervisor_thread_handle, NULL, supervisor_thread, NULL) != 0) {
+		supervisor_running = 0;
+		return SUPERVISOR_ERR_THREAD;
+	}
+	return SUPERVISOR_ERR_SUCCESS;
+}
+
+/**
+ * Stops supervising the bus
+ */
+void supervisor_stop(void)
+{
+	if (!supervisor_running)
+		return;
+	supervisor_running = 0;
+	pthread_join(supervisor_thread_handle, NULL);
+}
+
+/**
+ * Reports whether the last frames have come back with a low working counter
+ *
+ * @return 1 if the bus is degraded, 0 otherwise
+ */
+int supervisor_degraded(void)
+{
+	return supervisor_is_degraded;
+}
+
+/**
+ * Checks the working counter of this cycle's frame
+ *
+ * Must be called from the ethercat thread once per cycle, after ec_receive_processdata().
+ * @param[in]	wkc The working counter returned by ec_receive_processdata()
+ */
+void supervisor_cycle(int wkc)
+{
+	uint32_t cycles;
+
+	supervisor_stats.wkc_last = wkc;
+
+	if (wkc >= supervisor_stats.wkc_expected) {
+		if (supervisor_is_degraded) {
+			cycles = cycle_count - supervisor_degraded_since;
+			supervisor_stats.recover_cycles_last = cycles;
+			if (cycles > supervisor_stats.recover_cycles_max)
+				supervisor_stats.recover_cycles_max = cycles;
+			supervisor_is_degraded = 0;
+			log_write("EtherCAT: working counter back to %d after %u cycles\n", wkc, cycles);
+		}
+		return;
+	}
+
+	if (wkc <= 0)
+		supervisor_stats.frames_lost++;
+	else
+		supervisor_stats.frames_short++;
+	supervisor_stats.degraded_cycles++;
+
+	if (!supervisor_is_degraded) {
+		supervisor_is_degraded = 1;
+		supervisor_degraded_since = cycle_count;
+		supervisor_stats.degradations++;
+		log_write("EtherCAT: working counter %d, expected %d\n", wkc, supervisor_stats.wkc_expected);
+	}
+}
@@ -0,0 +1,64 @@
+/* supervisor.h
+ * this file defines the supervision of the EtherCAT bus once it is in op
+ * the working counter is checked every cycle, slaves that drop out of op are brought back by a
+ * separate thread while the cycle keeps running the rest of the bus
+ * with a second network port the bus is run as a redundant ring and breaks in the ring are detected
+ * SOEM only, TwinCAT3 does this in its own I/O system
+ */
+
+#ifndef __SUPERVISOR_H__
+#define __SUPERVISOR_H__
+
+#include <stdint.h>
+
+#include "ethercattype.h"
+#include "ethercatmain.h"
+
+/* how often the supervisor thread looks at the slaves while the bus is degraded */
+#define SUPERVISOR_PERIOD_US 10000
+
+#define SUPERVISOR_ERR_SUCCESS 0
+#define SUPERVISOR_ERR_THREAD -1
+
+/* DL status register, bit 4 + n is set while port n has a physical link */
+#define SUPERVISOR_DLSTAT_LINKS 0x00f0
+
+struct supervisor_stats_t {
+	int wkc_expected;
+	int wkc_last;
+	uint32_t frames_lost; /* cycles where no frame came back */
+	uint32_t frames_short; /* cycles where the working counter was lower than expected */
+	uint32_t degradations; /* times the bus went from healthy to degraded */
+	uint32_t degraded_cycles;
+	/* cycles from the working counter dropping until it was back to the expected value */
+	uint32_t recover_cycles_last;
+	uint32_t recover_cycles_max;
+
+	/* redundant ring, only used when the bus was opened on two ports */
+	int redundant;
+	int ring_broken;
+	uint32_t ring_breaks;
+	uint32_t ring_repairs;
+	/* lost and short frames between the last check that found the ring closed and the one that found it broken */
+	uint32_t failover_frames_last;
+	uint32_t failover_frames_max;
+	uint32_t ring_broken_since;
+};
+
+struct supervisor_slave_t {
+	uint32_t errors_acked; /* times the slave was in safe-op with an error and was acknowledged */
+	uint32_t reconfigs; /* times the slave had to be configured again */
+	uint32_t losses; /* times the slave disappeared from the bus */
+	uint32_t recoveries; /* times the slave was brought back into op */
+};
+
+extern struct supervisor_stats_t supervisor_stats;
+extern struct supervisor_slave_t supervisor_slaves[EC_MAXSLAVE];
+
+int supervisor_start(int wkc_expected, int redundant);
+void supervisor_stop(void);
+int supervisor_degraded(void);
+
+void supervisor_cycle(int wkc);
+
+#endif /* __SUPERVISOR_H__ */
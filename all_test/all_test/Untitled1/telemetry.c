@@ -0,0 +1,224 @@
+/** \file
+ * \brief Live process image and telemetry in POSIX shared memory
+ *
+ * The ethercat thread calls telemetry_publish() once per cycle. The snapshot is protected by a
+ * seqlock: the writer makes the sequence odd, updates the snapshot and makes it even again. It never
+ * waits for readers, so it makes no difference to the cycle how many readers there are or how slow
+ * they are. A reader copies the snapshot and keeps it only if the sequence was the same even
+ * number before and after the copy (telemetry_read() in telemetry_reader.c).
+ *
+ * The segment is versioned, readers must check magic and version before using it.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "telemetry.h"
+#include "cycle.h"
+#include "wago_move_queue.h"
+#include "wago_mailbox.h"
+#include "wago_velocity.h"
+#include "homing.h"
+#include "safety.h"
+#include "output_events.h"
+#include "state_machine.h"
+#include "supervisor.h"
+#include "pd_groups.h"
+#include "bus_errors.h"
+#include "timestamps.h"
+#include "following.h"
+#include "planner.h"
+
+static struct telemetry_t *telemetry = NULL;
+
+/**
+ * Creates the shared memory segment
+ *
+ * @return TELEMETRY_ERR_SUCCESS on success, TELEMETRY_ERR_SHM if the segment could not be created
+ */
+int telemetry_open(void)
+{
+	int fd = shm_open(TELEMETRY_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		return TELEMETRY_ERR_SHM;
+
+	if (ftruncate(fd, sizeof(struct telemetry_t)) < 0) {
+		close(fd);
+		return TELEMETRY_ERR_SHM;
+	}
+
+	telemetry = mmap(NULL, sizeof(struct telemetry_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (telemetry == MAP_FAILED) {
+		telemetry = NULL;
+		return TELEMETRY_ERR_SHM;
+	}
+
+	memset(telemetry, 0, sizeof(struct telemetry_t));
+	telemetry->cycle.period_ns_min = INT64_MAX;
+	telemetry->size = sizeof(struct telemetry_t);
+	telemetry->version = TELEMETRY_VERSION;
+	/* magic last so a reader never sees a half initialised segment as valid */
+	__sync_synchronize();
+	telemetry->magic = TELEMETRY_MAGIC;
+
+	return TELEMETRY_ERR_SUCCESS;
+}
+
+/**
+ * Removes the shared memory segment
+ *
+ * Readers that are attached keep their mapping, new readers will not find it.
+ */
+void telemetry_close(void)
+{
+	if (telemetry == NULL)
+		return;
+	munmap(telemetry, sizeof(struct telemetry_t));
+	shm_unlink(TELEMETRY_SHM_NAME);
+	telemetry = NULL;
+}
+
+/**
+ * Appends a group's process image to the snapshot's
+ *
+ * @param[out]	image The snapshot's outputs or inputs
+ * @param[in]	used Bytes of image already filled
+ * @param[in]	group The group's outputs or inputs
+ * @param[in]	bytes Size of the group's image
+ * @return the number of bytes copied
+ */
+static uint32_t telemetry_copy(uint8_t *image, uint32_t used, const uint8_t *group, uint32_t bytes)
+{
+	if (bytes > TELEMETRY_IO_SIZE - used)
+		bytes = TELEMETRY_IO_SIZE - used;
+	memcpy(image + used, group, bytes);
+	return bytes;
+}
+
+/**
+ * Publishes a snapshot of the current cycle
+ *
+ * Must be called from the ethercat thread after cycle_update(), with the io lock held.
+ * Does nothing if telemetry_open() was not called or failed. The process image of every group is
+ * copied, what does not fit in TELEMETRY_IO_SIZE is left out.
+ * @param[in]	timestamp_ns Time the inputs were received
+ * @param[in]	period_ns Time since the previous cycle
+ * @param[in]	compute_ns Time spent in cycle_update()
+ * @param[in]	nominal_period_ns The cycle period asked for
+ */
+void telemetry_publish(int64_t timestamp_ns, int64_t period_ns, int64_t compute_ns, int64_t nominal_period_ns)
+{
+	struct telemetry_t *t = telemetry;
+
+	if (t == NULL)
+		return;
+
+	t->sequence++;
+	__sync_synchronize();
+
+	t->cycle_count = cycle_count;
+	t->timestamp_ns = timestamp_ns;
+
+	t->output_bytes = 0;
+	t->input_bytes = 0;
+	for (int group=0; group<PD_GROUPS; group++) {
+		if (group == PD_GROUP_SLOW) {
+			t->slow_output_offset = t->output_bytes;
+			t->slow_input_offset = t->input_bytes;
+		}
+		if (pd_groups[group].slaves == 0)
+			continue;
+		t->output_bytes += telemetry_copy(t->outputs, t->output_bytes, ec_group[group].outputs, ec_group[group].Obytes);
+		t->input_bytes += telemetry_copy(t->inputs, t->input_bytes, ec_group[group].inputs, ec_group[group].Ibytes);
+	}
+
+	for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+		struct telemetry_axis_t *axis = &t->axes[i];
+		if (wago_steppers[i][WAGO_OUTPUT_SPACE] == NULL)
+			continue;
+		axis->outputs = *wago_steppers[i][WAGO_OUTPUT_SPACE];
+		axis->inputs = *wago_steppers[i][WAGO_INPUT_SPACE];
+		axis->queue_state = wago_move_queues[i].state;
+		axis->queue_pending = wago_queue_pending(i);
+		axis->moves_completed = wago_move_queues[i].moves_completed;
+		axis->precalc_handoffs = wago_move_queues[i].precalc_handoffs;
+		axis->actual_position = wago_mbx_actual_position(i, &axis->position_age);
+		axis->mailbox_timeouts = wago_mailboxes[i].timeouts;
+		axis->velocity_command = wago_velocity_streams[i].command;
+		axis->homing_state = homing_axes[i].state;
+	}
+
+	for (int i=0; i<FOLLOWING_NUM_AXES; i++) {
+		const struct following_axis_t *f = &following_axes[i];
+		struct telemetry_servo_t *servo = &t->servos[i];
+		servo->state = ax5000_axes[i].state;
+		servo->command = ax5000_axes[i].command;
+		servo->actual_position = ax5000_axes[i].actual_position;
+		servo->following_error = f->error;
+		servo->following_max = f->total.max;
+		servo->following_rms = following_rms(&f->total);
+		servo->move_max = f->last_move.max;
+		servo->move_rms = following_rms(&f->last_move);
+		servo->moves = f->moves;
+		servo->trips = f->trips;
+		memcpy(servo->move_histogram, f->last_move.histogram, sizeof(servo->move_histogram));
+	}
+	t->following_bin_width = following_axes[0].bin_width;
+	t->following_tripped = following_tripped;
+	t->planner_workers = planner_stats.workers;
+	t->planner_pending = planner_pending(-1);
+	t->planner_played = planner_stats.played;
+	t->planner_failed = planner_stats.failed;
+	t->planner_starved = planner_stats.starved;
+	t->planner_plan_ns_max = planner_stats.plan_ns_max;
+
+	t->cycle.period_ns_last = period_ns;
+	if (period_ns < t->cycle.period_ns_min)
+		t->cycle.period_ns_min = period_ns;
+	if (period_ns > t->cycle.period_ns_max)
+		t->cycle.period_ns_max = period_ns;
+	if (period_ns > 2 * nominal_period_ns)
+		t->cycle.overruns++;
+	t->cycle.compute_ns_last = compute_ns;
+	if (compute_ns > t->cycle.compute_ns_max)
+		t->cycle.compute_ns_max = compute_ns;
+	t->cycle.tx_stack_ns = timestamps_stats.tx_stack_ns_last;
+	t->cycle.wire_ns = timestamps_stats.wire_ns_last;
+	t->cycle.rx_stack_ns = timestamps_stats.rx_stack_ns_last;
+	t->cycle.app_ns = timestamps_stats.app_ns_last;
+	t->cycle.wire_hardware = timestamps_stats.wire_hardware;
+
+	t->safety_state = safety_state;
+	t->safety_reactions = safety_stats.reactions;
+	t->output_events_late = output_event_stats.late;
+	t->wkc_last = supervisor_stats.wkc_last;
+	t->wkc_expected = supervisor_stats.wkc_expected;
+	t->frames_lost = supervisor_stats.frames_lost;
+	t->frames_short = supervisor_stats.frames_short;
+	t->slow_divider = pd_groups[PD_GROUP_SLOW].divider;
+	t->slow_wkc_last = pd_groups[PD_GROUP_SLOW].wkc_last;
+	t->slow_wkc_expected = pd_groups[PD_GROUP_SLOW].wkc_expected;
+	t->slow_frames_lost = pd_groups[PD_GROUP_SLOW].frames_lost;
+	t->slow_frames_short = pd_groups[PD_GROUP_SLOW].frames_short;
+
+	t->bus_errors = bus_errors_stats.errors;
+	t->bus_error_alarms = bus_errors_stats.alarms;
+	t->port_slaves = (ec_slavecount < TELEMETRY_MAX_SLAVES) ? ec_slavecount : TELEMETRY_MAX_SLAVES;
+	for (uint32_t i=0; i<t->port_slaves; i++) {
+		for (int port=0; port<TELEMETRY_PORTS; port++) {
+			const struct bus_errors_port_t *p = &bus_errors_slaves[i + 1].ports[port];
+			struct telemetry_port_t *out = &t->ports[i][port];
+			out->errors = p->invalid_frames + p->rx_errors + p->lost_links;
+			out->forwarded_errors = p->forwarded_errors;
+			out->lost_links = p->lost_links;
+			out->rate = p->rate;
+			out->alarm = p->alarm;
+		}
+	}
+
+	__sync_synchronize();
+	t->sequence++;
+}
@@ -0,0 +1,146 @@
+/* telemetry.h
+ * this file defines the live process image and telemetry published to POSIX shared memory
+ * the ethercat thread writes a snapshot every cycle, any number of local readers (HMI, dashboards,
+ * telemetry_dump) copy it out at their own rate without touching the ethercat thread
+ * SOEM only
+ */
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stdint.h>
+
+#include "wago_steppers.h"
+#include "following.h"
+
+#define TELEMETRY_SHM_NAME "/delta_robot_telemetry"
+#define TELEMETRY_MAGIC 0x44524f42 /* "DROB" */
+/* bump whenever struct telemetry_t changes, readers must check it */
+#define TELEMETRY_VERSION 9
+
+#define TELEMETRY_IO_SIZE 1024
+/* slaves whose error counters are published, and the ports of each */
+#define TELEMETRY_MAX_SLAVES 16
+#define TELEMETRY_PORTS 4
+
+#define TELEMETRY_ERR_SUCCESS 0
+#define TELEMETRY_ERR_SHM -1
+#define TELEMETRY_ERR_VERSION -2
+#define TELEMETRY_ERR_BUSY -3
+
+struct telemetry_axis_t {
+	struct wago_stepper_t outputs;
+	struct wago_stepper_t inputs;
+	int32_t queue_state;
+	int32_t queue_pending;
+	uint32_t moves_completed;
+	uint32_t precalc_handoffs;
+	int32_t actual_position;
+	uint32_t position_age;
+	uint32_t mailbox_timeouts;
+	int32_t velocity_command;
+	int32_t homing_state;
+};
+
+struct telemetry_cycle_t {
+	int64_t period_ns_last;
+	int64_t period_ns_min;
+	int64_t period_ns_max;
+	int64_t compute_ns_last; /* time spent in cycle_update() */
+	int64_t compute_ns_max;
+	uint32_t overruns; /* cycles whose period was more than twice the nominal one */
+	/* split of the frame's round trip, only filled in with timestamping on (see timestamps.h) */
+	int64_t tx_stack_ns;
+	int64_t wire_ns;
+	int64_t rx_stack_ns;
+	int64_t app_ns;
+	int32_t wire_hardware;
+};
+
+/* one servo axis and its following error (see following.h) */
+struct telemetry_servo_t {
+	int32_t state;
+	int32_t command;
+	int32_t actual_position;
+	int32_t following_error;
+	int32_t following_max;
+	int32_t following_rms;
+	int32_t move_max; /* last completed move */
+	int32_t move_rms;
+	uint32_t moves;
+	uint32_t trips;
+	uint32_t move_histogram[FOLLOWING_HISTOGRAM_BINS];
+};
+
+/* error counters of one port of a slave (see bus_errors.h) */
+struct telemetry_port_t {
+	uint32_t errors; /* invalid frames, RX errors and lost links */
+	uint32_t forwarded_errors;
+	uint32_t lost_links;
+	uint32_t rate; /* errors in the last window */
+	int32_t alarm;
+};
+
+struct telemetry_t {
+	/* header, fixed for every version */
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; /* sizeof(struct telemetry_t) of the writer */
+	volatile uint32_t sequence; /* seqlock, odd while the writer is updating */
+
+	uint32_t cycle_count;
+	int64_t timestamp_ns;
+
+	/* process image, every group's bytes one after the other, the fast group's first */
+	uint32_t output_bytes;
+	uint32_t input_bytes;
+	/* where the slow group's bytes start, output_bytes and input_bytes when there is no slow group */
+	uint32_t slow_output_offset;
+	uint32_t slow_input_offset;
+	uint8_t outputs[TELEMETRY_IO_SIZE];
+	uint8_t inputs[TELEMETRY_IO_SIZE];
+
+	struct telemetry_axis_t axes[WAGO_NUM_STEPPERS];
+	struct telemetry_cycle_t cycle;
+	struct telemetry_servo_t servos[FOLLOWING_NUM_AXES];
+	int32_t following_bin_width; /* of axis 0, for reading the histograms */
+	int32_t following_tripped;
+
+	/* planner threads (see planner.h) */
+	int32_t planner_workers;
+	int32_t planner_pending; /* picks queued and not played */
+	uint32_t planner_played;
+	uint32_t planner_failed;
+	uint32_t planner_starved; /* cycles the next pick was not planned in time */
+	int64_t planner_plan_ns_max;
+
+	/* error counters */
+	int32_t safety_state;
+	uint32_t safety_reactions;
+	uint32_t output_events_late;
+	int32_t wkc_last;
+	int32_t wkc_expected;
+	uint32_t frames_lost;
+	uint32_t frames_short;
+	/* slow process data group (see pd_groups.h), a divider of 1 when there is none */
+	uint32_t slow_divider;
+	int32_t slow_wkc_last;
+	int32_t slow_wkc_expected;
+	uint32_t slow_frames_lost;
+	uint32_t slow_frames_short;
+
+	/* bus error counters, slave 1 is ports[0] */
+	uint32_t bus_errors;
+	uint32_t bus_error_alarms;
+	uint32_t port_slaves; /* slaves in ports[] */
+	struct telemetry_port_t ports[TELEMETRY_MAX_SLAVES][TELEMETRY_PORTS];
+};
+
+int telemetry_open(void);
+void telemetry_close(void);
+void telemetry_publish(int64_t timestamp_ns, int64_t period_ns, int64_t compute_ns, int64_t nominal_period_ns);
+
+const struct telemetry_t *telemetry_attach(void);
+int telemetry_read(const struct telemetry_t *shared, struct telemetry_t *copy);
+
+#endif /* __TELEMETRY_H__ */
@@ -0,0 +1,92 @@
+/** \file
+ * \brief Prints the controller's shared memory telemetry
+ *
+ * Example reader for the telemetry published by soem_main (see telemetry.h). It only maps the
+ * segment read only and never affects the controller.
+ * Usage: telemetry_dump [period in ms]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+int main(int argc, char *argv[])
+{
+	int period_ms = (argc > 1) ? atoi(argv[1]) : 500;
+	const struct telemetry_t *shared;
+	struct telemetry_t snapshot;
+
+	shared = telemetry_attach();
+	if (shared == NULL) {
+		printf("No telemetry found (%s), is soem_main running? Expected version %d\n", TELEMETRY_SHM_NAME, TELEMETRY_VERSION);
+		return 1;
+	}
+
+	while (1) {
+		if (telemetry_read(shared, &snapshot) != TELEMETRY_ERR_SUCCESS) {
+			printf("could not get a consistent snapshot\n");
+		} else {
+			printf("cycle %u: period %lld ns (min %lld max %lld, %u overruns) compute %lld ns (max %lld)\n",
+				snapshot.cycle_count,
+				(long long) snapshot.cycle.period_ns_last, (long long) snapshot.cycle.period_ns_min,
+				(long long) snapshot.cycle.period_ns_max, snapshot.cycle.overruns,
+				(long long) snapshot.cycle.compute_ns_last, (long long) snapshot.cycle.compute_ns_max
+			);
+			printf("  frame: tx stack %lld ns, wire %lld ns (%s), rx stack %lld ns, application %lld ns\n",
+				(long long) snapshot.cycle.tx_stack_ns, (long long) snapshot.cycle.wire_ns,
+				snapshot.cycle.wire_hardware ? "hardware" : "software",
+				(long long) snapshot.cycle.rx_stack_ns, (long long) snapshot.cycle.app_ns
+			);
+			for (int i=0; i<WAGO_NUM_STEPPERS; i++) {
+				printf("  axis %d: status %02x/%02x queue %d (%d pending, %u done) position %d (%u cycles old) homing %d\n",
+					i, snapshot.axes[i].inputs.stat_cont1.value, snapshot.axes[i].inputs.stat_cont2.value,
+					snapshot.axes[i].queue_state, snapshot.axes[i].queue_pending, snapshot.axes[i].moves_completed,
+					snapshot.axes[i].actual_position, snapshot.axes[i].position_age, snapshot.axes[i].homing_state
+				);
+			}
+			for (int i=0; i<FOLLOWING_NUM_AXES; i++) {
+				const struct telemetry_servo_t *s = &snapshot.servos[i];
+				printf("  servo %d: state %d command %d position %d following error %d (max %d rms %d, %u trips)\n",
+					i, s->state, s->command, s->actual_position, s->following_error, s->following_max,
+					s->following_rms, s->trips
+				);
+				if (s->moves == 0)
+					continue;
+				printf("    move %u: max %d rms %d, errors per %d:", s->moves, s->move_max, s->move_rms,
+					snapshot.following_bin_width);
+				for (int bin=0; bin<FOLLOWING_HISTOGRAM_BINS; bin++)
+					printf(" %u", s->move_histogram[bin]);
+				printf("\n");
+			}
+			if (snapshot.following_tripped)
+				printf("  following error limit tripped, servos halted\n");
+			if (snapshot.planner_workers > 0)
+				printf("  planner: %d threads, %d picks pending, %u played, %u failed, starved %u cycles, slowest plan %lld us\n",
+					snapshot.planner_workers, snapshot.planner_pending, snapshot.planner_played, snapshot.planner_failed,
+					snapshot.planner_starved, (long long) snapshot.planner_plan_ns_max / 1000);
+			printf("  safety state %d, %u reactions, %u late output events\n",
+				snapshot.safety_state, snapshot.safety_reactions, snapshot.output_events_late);
+			printf("  working counter %d of %d, %u frames lost, %u short\n",
+				snapshot.wkc_last, snapshot.wkc_expected, snapshot.frames_lost, snapshot.frames_short);
+			if (snapshot.slow_divider > 1)
+				printf("  slow group every %u cycles: working counter %d of %d, %u frames lost, %u short\n",
+					snapshot.slow_divider, snapshot.slow_wkc_last, snapshot.slow_wkc_expected,
+					snapshot.slow_frames_lost, snapshot.slow_frames_short);
+			printf("  bus errors %u, %u ports in alarm\n", snapshot.bus_errors, snapshot.bus_error_alarms);
+			for (uint32_t i=0; i<snapshot.port_slaves; i++) {
+				for (int port=0; port<TELEMETRY_PORTS; port++) {
+					const struct telemetry_port_t *p = &snapshot.ports[i][port];
+					if (p->errors == 0 && p->forwarded_errors == 0)
+						continue;
+					printf("    slave %u port %d: %u errors (%u lost links, %u forwarded), %u in the last window%s\n",
+						i + 1, port, p->errors, p->lost_links, p->forwarded_errors, p->rate, p->alarm ? " ALARM" : "");
+				}
+			}
+		}
+		usleep(period_ms * 1000);
+	}
+
+	return 0;
+}
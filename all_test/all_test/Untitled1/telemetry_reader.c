@@ -0,0 +1,68 @@
+/** \file
+ * \brief Reader side of the shared memory telemetry
+ *
+ * Kept apart from telemetry.c so readers can be built without the rest of the controller.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "telemetry.h"
+
+/* attempts telemetry_read() makes before giving up on a writer that keeps updating */
+#define TELEMETRY_READ_RETRIES 100
+
+/**
+ * Maps the shared memory segment read only
+ *
+ * Used by readers, not by the controller.
+ * @return the segment, or NULL if it does not exist or is not a version this reader understands
+ */
+const struct telemetry_t *telemetry_attach(void)
+{
+	const struct telemetry_t *shared;
+	int fd = shm_open(TELEMETRY_SHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	shared = mmap(NULL, sizeof(struct telemetry_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shared == MAP_FAILED)
+		return NULL;
+
+	if (shared->magic != TELEMETRY_MAGIC || shared->version != TELEMETRY_VERSION || shared->size != sizeof(struct telemetry_t)) {
+		munmap((void *) shared, sizeof(struct telemetry_t));
+		return NULL;
+	}
+	return shared;
+}
+
+/**
+ * Takes a consistent copy of the snapshot
+ *
+ * @param[in]	shared The segment returned by telemetry_attach()
+ * @param[out]	copy Where to copy the snapshot to
+ * @return TELEMETRY_ERR_SUCCESS on success, TELEMETRY_ERR_BUSY if no consistent copy could be made
+ */
+int telemetry_read(const struct telemetry_t *shared, struct telemetry_t *copy)
+{
+	uint32_t before;
+	uint32_t after;
+
+	for (int i=0; i<TELEMETRY_READ_RETRIES; i++) {
+		before = shared->sequence;
+		__sync_synchronize();
+		if (before & 1)
+			continue;
+
+		memcpy(copy, (const void *) shared, sizeof(struct telemetry_t));
+
+		__sync_synchronize();
+		after = shared->sequence;
+		if (before == after)
+			return TELEMETRY_ERR_SUCCESS;
+	}
+	return TELEMETRY_ERR_BUSY;
+}
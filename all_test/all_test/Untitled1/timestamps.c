@@ -0,0 +1,300 @@
+/** \file
+ * \brief Kernel timestamping of process data frames
+ *
+ * The socket SOEM uses is asked for SO_TIMESTAMPING transmit and receive stamps, hardware ones as
+ * well if the NIC accepts SIOCSHWTSTAMP. Together with our own clock readings around
+ * ec_send_processdata() and ec_receive_processdata() each cycle is split into:
+ *	- transmit stack: send() until the kernel stamps the frame on its way to the NIC
+ *	- wire: transmit stamp until receive stamp, the NIC, the cable and the slaves
+ *	- receive stack: receive stamp until recv() hands the frame to SOEM
+ *	- application: our own time from receiving the frame until the next one is sent
+ * Only process data frames (LRD, LWR, LRW) are used, mailbox traffic from other threads shares the
+ * socket and is ignored.
+ *
+ * Receive stamps come with the frame, packet_ring_wrap.c reads them with timestamps_recv() or out
+ * of the packet ring. Transmit stamps are read from the socket's error queue by
+ * timestamps_update() once the frame is back. Kernel stamps are CLOCK_REALTIME so our own
+ * readings here are too.
+ */
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <linux/if_packet.h>
+
+#include "ethercattype.h"
+#include "timestamps.h"
+
+/* offset of the first datagram's command, after the ethernet and EtherCAT headers */
+#define TIMESTAMPS_CMD_OFFSET 16
+/* transmit stamps read from the error queue per cycle */
+#define TIMESTAMPS_ERRQUEUE_MAX 8
+
+struct timestamps_stats_t timestamps_stats;
+
+static int timestamps_sock = -1;
+
+/* our own readings */
+static int64_t timestamps_app_send_ns = 0;
+static int64_t timestamps_app_receive_ns = 0;
+static int64_t timestamps_rx_app_ns = 0; /* when recv() returned the process data frame */
+
+/* kernel stamps of this cycle's process data frame, software in [0] and hardware in [2] */
+static struct timespec timestamps_tx[3];
+static struct timespec timestamps_rx[3];
+static int timestamps_tx_valid = 0;
+static int timestamps_rx_valid = 0;
+
+static int64_t timestamps_ns(const struct timespec *ts)
+{
+	return (int64_t) ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static int64_t timestamps_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return timestamps_ns(&ts);
+}
+
+/**
+ * Works out whether a frame carries process data
+ *
+ * @param[in]	frame The frame, starting with the ethernet header
+ * @param[in]	len Length of the frame
+ * @return 1 if the first datagram is a logical read, write or read/write, 0 otherwise
+ */
+static int timestamps_process_data(const uint8_t *frame, size_t len)
+{
+	uint8_t cmd;
+
+	if (len <= TIMESTAMPS_CMD_OFFSET)
+		return 0;
+	if (frame[12] != (ETH_P_ECAT >> 8) || frame[13] != (ETH_P_ECAT & 0xff))
+		return 0;
+	cmd = frame[TIMESTAMPS_CMD_OFFSET];
+	return cmd == EC_CMD_LRD || cmd == EC_CMD_LWR || cmd == EC_CMD_LRW;
+}
+
+/**
+ * Pulls the stamps out of a message's control data
+ *
+ * @param[in]	msg The message
+ * @param[out]	stamps Software stamp in [0], hardware stamp in [2], zeroed if there are none
+ * @return 1 if the message had stamps, 0 otherwise
+ */
+static int timestamps_from_msg(struct msghdr *msg, struct timespec stamps[3])
+{
+	struct cmsghdr *cmsg;
+
+	memset(stamps, 0, 3 * sizeof(struct timespec));
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+			memcpy(stamps, CMSG_DATA(cmsg), 3 * sizeof(struct timespec));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Turns on timestamping for a socket
+ *
+ * Hardware stamps are asked for as well, the socket falls back to software stamps if the NIC or
+ * its driver does not do them.
+ * @param[in]	sock The socket, as set up by ec_init()
+ * @param[in]	ifname The interface the socket is bound to
+ * @return TIMESTAMPS_ERR_SUCCESS on success, TIMESTAMPS_ERR_SOCKET if the socket refused
+ */
+int timestamps_enable(int sock, const char *ifname)
+{
+	struct hwtstamp_config config;
+	struct ifreq ifr;
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	int ring_flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	memset(&config, 0, sizeof(config));
+	config.tx_type = HWTSTAMP_TX_ON;
+	config.rx_filter = HWTSTAMP_FILTER_ALL;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+	ifr.ifr_data = (char *) &config;
+	timestamps_stats.hardware = ioctl(sock, SIOCSHWTSTAMP, &ifr) == 0;
+	if (timestamps_stats.hardware)
+		flags |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+		return TIMESTAMPS_ERR_SOCKET;
+	/* only matters with the packet ring, it then stamps frames in hardware where it can */
+	if (timestamps_stats.hardware)
+		setsockopt(sock, SOL_PACKET, PACKET_TIMESTAMP, &ring_flags, sizeof(ring_flags));
+
+	timestamps_stats.wire_ns_min = INT64_MAX;
+	timestamps_sock = sock;
+	return TIMESTAMPS_ERR_SUCCESS;
+}
+
+/**
+ * Reports whether a socket is being timestamped
+ *
+ * @param[in]	sock The socket
+ * @return 1 if it is, 0 otherwise
+ */
+int timestamps_enabled(int sock)
+{
+	return sock == timestamps_sock;
+}
+
+/**
+ * Records when we hand this cycle's process data to SOEM
+ *
+ * Call straight before ec_send_processdata().
+ */
+void timestamps_mark_send(void)
+{
+	int64_t now = timestamps_now_ns();
+
+	if (timestamps_sock < 0)
+		return;
+
+	if (timestamps_app_receive_ns) {
+		timestamps_stats.app_ns_last = now - timestamps_app_receive_ns;
+		if (timestamps_stats.app_ns_last > timestamps_stats.app_ns_max)
+			timestamps_stats.app_ns_max = timestamps_stats.app_ns_last;
+	}
+	timestamps_app_send_ns = now;
+	memset(timestamps_tx, 0, sizeof(timestamps_tx));
+	timestamps_tx_valid = 0;
+	timestamps_rx_valid = 0;
+}
+
+/**
+ * Records when SOEM handed us this cycle's process data
+ *
+ * Call straight after ec_receive_processdata().
+ */
+void timestamps_mark_receive(void)
+{
+	if (timestamps_sock < 0)
+		return;
+	timestamps_app_receive_ns = timestamps_now_ns();
+}
+
+/**
+ * Keeps the receive stamps of the first process data frame of the cycle
+ *
+ * @param[in]	frame The frame, starting with the ethernet header
+ * @param[in]	len Length of the frame
+ * @param[in]	stamps Software stamp in [0], hardware stamp in [2]
+ */
+void timestamps_frame_received(const uint8_t *frame, size_t len, const struct timespec stamps[3])
+{
+	if (timestamps_rx_valid || !timestamps_process_data(frame, len))
+		return;
+	memcpy(timestamps_rx, stamps, sizeof(timestamps_rx));
+	timestamps_rx_app_ns = timestamps_now_ns();
+	timestamps_rx_valid = 1;
+}
+
+/**
+ * recv() that also reads the frame's receive stamps
+ *
+ * @param[in]	sock The socket
+ * @param[out]	buf Buffer for the frame
+ * @param[in]	len Size of the buffer
+ * @param[in]	flags As for recv()
+ * @return as for recv()
+ */
+ssize_t timestamps_recv(int sock, void *buf, size_t len, int flags)
+{
+	char control[CMSG_SPACE(3 * sizeof(struct timespec)) + 64];
+	struct timespec stamps[3];
+	struct iovec iov;
+	struct msghdr msg;
+	ssize_t ret;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ret = recvmsg(sock, &msg, flags);
+	if (ret > 0 && timestamps_from_msg(&msg, stamps))
+		timestamps_frame_received((const uint8_t *) buf, ret, stamps);
+	return ret;
+}
+
+/**
+ * Collects the transmit stamps and works out this cycle's figures
+ *
+ * Call once per cycle after ec_receive_processdata(), from the ethercat thread.
+ */
+void timestamps_update(void)
+{
+	char control[CMSG_SPACE(3 * sizeof(struct timespec)) + 64];
+	uint8_t frame[64]; /* only the headers are needed */
+	struct timespec stamps[3];
+	struct iovec iov;
+	struct msghdr msg;
+	ssize_t ret;
+	int64_t tx_ns, rx_ns;
+
+	if (timestamps_sock < 0)
+		return;
+
+	for (int i=0; i<TIMESTAMPS_ERRQUEUE_MAX; i++) {
+		iov.iov_base = frame;
+		iov.iov_len = sizeof(frame);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ret = recvmsg(timestamps_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+		if (ret < 0)
+			break;
+		if (timestamps_process_data(frame, ret) && timestamps_from_msg(&msg, stamps)) {
+			/* software and hardware stamps can come back as separate messages */
+			if (stamps[0].tv_sec || stamps[0].tv_nsec)
+				timestamps_tx[0] = stamps[0];
+			if (stamps[2].tv_sec || stamps[2].tv_nsec)
+				timestamps_tx[2] = stamps[2];
+			timestamps_tx_valid = 1;
+		}
+	}
+
+	timestamps_stats.cycles++;
+	if (!timestamps_tx_valid || !timestamps_rx_valid) {
+		timestamps_stats.missing++;
+		return;
+	}
+
+	tx_ns = timestamps_ns(&timestamps_tx[0]);
+	rx_ns = timestamps_ns(&timestamps_rx[0]);
+
+	timestamps_stats.tx_stack_ns_last = tx_ns - timestamps_app_send_ns;
+	if (timestamps_stats.tx_stack_ns_last > timestamps_stats.tx_stack_ns_max)
+		timestamps_stats.tx_stack_ns_max = timestamps_stats.tx_stack_ns_last;
+
+	timestamps_stats.rx_stack_ns_last = timestamps_rx_app_ns - rx_ns;
+	if (timestamps_stats.rx_stack_ns_last > timestamps_stats.rx_stack_ns_max)
+		timestamps_stats.rx_stack_ns_max = timestamps_stats.rx_stack_ns_last;
+
+	/* hardware stamps leave the driver and the NIC's queues out of the wire time */
+	timestamps_stats.wire_hardware = timestamps_ns(&timestamps_tx[2]) && timestamps_ns(&timestamps_rx[2]);
+	if (timestamps_stats.wire_hardware)
+		timestamps_stats.wire_ns_last = timestamps_ns(&timestamps_rx[2]) - timestamps_ns(&timestamps_tx[2]);
+	else
+		timestamps_stats.wire_ns_last = rx_ns - tx_ns;
+	if (timestamps_stats.wire_ns_last < timestamps_stats.wire_ns_min)
+		timestamps_stats.wire_ns_min = timestamps_stats.wire_ns_last;
+	if (timestamps_stats.wire_ns_last > timestamps_stats.wire_ns_max)
+		timestamps_stats.wire_ns_max = timestamps_stats.wire_ns_last;
+}
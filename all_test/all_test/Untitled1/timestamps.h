@@ -0,0 +1,53 @@
+/* timestamps.h
+ * this file defines the kernel timestamping of process data frames
+ * each cycle is split into the time spent in the transmit stack, on the wire (NIC, cable and
+ * slaves), in the receive stack and in our own code
+ * SOEM only
+ */
+
+#ifndef __TIMESTAMPS_H__
+#define __TIMESTAMPS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define TIMESTAMPS_ERR_SUCCESS 0
+#define TIMESTAMPS_ERR_SOCKET -1
+
+struct timestamps_stats_t {
+	int hardware; /* 1 if the NIC accepted hardware timestamping */
+
+	/* from handing the frame to send() until the kernel stamped it on its way out */
+	int64_t tx_stack_ns_last;
+	int64_t tx_stack_ns_max;
+	/* from the transmit stamp to the receive stamp, hardware stamps when both ends have them */
+	int64_t wire_ns_last;
+	int64_t wire_ns_min;
+	int64_t wire_ns_max;
+	int wire_hardware; /* the last wire time came from hardware stamps */
+	/* from the receive stamp until recv() handed the frame to SOEM */
+	int64_t rx_stack_ns_last;
+	int64_t rx_stack_ns_max;
+	/* from receiving the frame until the next one was sent, our own time */
+	int64_t app_ns_last;
+	int64_t app_ns_max;
+
+	uint32_t cycles;
+	uint32_t missing; /* cycles where a stamp was not available */
+};
+
+extern struct timestamps_stats_t timestamps_stats;
+
+int timestamps_enable(int sock, const char *ifname);
+int timestamps_enabled(int sock);
+
+void timestamps_mark_send(void);
+void timestamps_mark_receive(void);
+void timestamps_frame_received(const uint8_t *frame, size_t len, const struct timespec stamps[3]);
+ssize_t timestamps_recv(int sock, void *buf, size_t len, int flags);
+
+void timestamps_update(void);
+
+#endif /* __TIMESTAMPS_H__ */
@@ -0,0 +1,854 @@
+/** \file
+ * \brief Time optimal trajectory planner
+ *
+ * The path is fixed, only the speed along it is planned. It is sampled every step metres and each
+ * point gets its joint angles, their first and second derivatives along the path (q' and q'') and
+ * the joint limits of that pose (delta_limits()). Moving along the path at speed v = ds/dt with
+ * acceleration a, joint j turns at q'_j v and accelerates at q''_j v^2 + q'_j a, so with u = v^2
+ *	u <= (velocity_j / q'_j)^2
+ *	-acceleration_j <= q''_j u + q'_j a <= acceleration_j
+ * For each point the largest u where some a satisfies every joint is found first. A forward pass
+ * then accelerates as hard as the joints allow from rest at the start, a backward pass does the
+ * same from rest at the end, and the lower of the two is the fastest the path can be taken at
+ * each point. Between points the acceleration is constant, which gives the time of each step.
+ *
+ * The timed path is then sampled once per cycle into joint setpoints. Planning allocates and uses
+ * floating point, it runs outside the cycle, the setpoints are what the cycle plays back.
+ *
+ * A path can be given in a moving frame, a conveyor belt carrying the part to be picked. The
+ * effector is then at p(s(t)) + drift D(t), where D'(t) blends smoothstep fashion from the coupling
+ * at the start to the one at the end (trajectory_drift()), so a pick path coupled at the end
+ * arrives moving with the belt, one coupled at the start leaves with it, and neither jumps in
+ * speed. The joints' share of the frame's speed comes off their velocity limits, the share of its
+ * change in speed off their acceleration limits, so the path is timed with what is left. Where
+ * the frame takes the effector depends on the timing, the path is timed once with the frame
+ * standing still and again with the poses and the headroom that timing gives.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "trajectory.h"
+
+/* where the derivatives are too small to limit anything */
+#define TRAJECTORY_EPSILON 1e-9
+/* halvings used to find the largest feasible u of a point */
+#define TRAJECTORY_BISECTIONS 40
+/* backward passes trajectory_time() runs before giving up on a path it cannot keep within limits */
+#define TRAJECTORY_TIME_PASSES 8
+/* how much closer than the step the points of a rounded corner are */
+#define TRAJECTORY_CORNER_DIVISIONS 2
+/* most a rounded corner turns from one point to the next, rad, for corners short next to the step */
+#define TRAJECTORY_CORNER_TURN 0.05
+/* timings of a path in a moving frame after the first, each with the poses of the one before */
+#define TRAJECTORY_DRIFT_PASSES 2
+
+struct trajectory_point_t {
+	double p[3];
+	double q[DELTA_NUM_JOINTS];
+	double dq[DELTA_NUM_JOINTS]; /* dq/ds */
+	double ddq[DELTA_NUM_JOINTS]; /* d2q/ds2 */
+	struct delta_limits_t limits;
+	double ds; /* to the next point */
+	double u_max;
+	double u; /* planned (ds/dt)^2 */
+	double t; /* time the point is reached */
+};
+
+struct trajectory_points_t {
+	struct trajectory_point_t *points;
+	uint32_t count;
+	uint32_t allocated;
+};
+
+/**
+ * Builds the path of a pick: straight up, across and straight down
+ *
+ * @param[out]	path The path
+ * @param[in]	from Where the move starts, metres
+ * @param[in]	to Where the move ends, metres
+ * @param[in]	lift How far above the higher of from and to the path crosses over, 0 to go straight there
+ */
+void trajectory_pick_path(struct trajectory_path_t *path, const double from[3], const double to[3], double lift)
+{
+	/* level, a crossing that climbs on to the top of a short descent turns back on itself there */
+	double top = ((from[2] > to[2]) ? from[2] : to[2]) + lift;
+	int n = 0;
+
+	memcpy(path->points[n++], from, sizeof(path->points[0]));
+	if (lift > 0.0) {
+		memcpy(path->points[n], from, sizeof(path->points[0]));
+		path->points[n++][2] = top;
+		memcpy(path->points[n], to, sizeof(path->points[0]));
+		path->points[n++][2] = top;
+	}
+	memcpy(path->points[n++], to, sizeof(path->points[0]));
+	path->waypoints = n;
+	path->blend = TRAJECTORY_DEFAULT_BLEND;
+	memset(path->drift, 0, sizeof(path->drift));
+	path->coupling[0] = path->coupling[1] = 0.0;
+}
+
+/**
+ * Works out how far a path in a moving frame has been carried by it
+ *
+ * The coupling goes from path->coupling[0] to path->coupling[1] over the move as 3x^2 - 2x^3 of
+ * x = t / duration and stays at the end value after it.
+ * @param[in]	path The path
+ * @param[in]	duration How long the move takes, s
+ * @param[in]	t Time into the move, s
+ * @param[out]	rate The coupling at t, the effector moves with path->drift times this, NULL if not needed
+ * @return how far the frame has carried the effector by t, in seconds of path->drift
+ */
+double trajectory_drift(const struct trajectory_path_t *path, double duration, double t, double *rate)
+{
+	double c0 = path->coupling[0], c1 = path->coupling[1], x, after = 0.0;
+
+	if (duration <= 0.0) {
+		if (rate != NULL)
+			*rate = c0;
+		return c0 * t;
+	}
+	if (t > duration) {
+		after = t - duration;
+		t = duration;
+	}
+	if (t < 0.0)
+		t = 0.0;
+	x = t / duration;
+	if (rate != NULL)
+		*rate = (after > 0.0) ? c1 : c0 + (c1 - c0) * (3.0 * x * x - 2.0 * x * x * x);
+	return duration * (c0 * x + (c1 - c0) * (x * x * x - 0.5 * x * x * x * x)) + c1 * after;
+}
+
+/**
+ * Tells whether a path is in a moving frame
+ *
+ * @param[in]	path The path
+ * @return 1 if it is, 0 if it stands still
+ */
+static int trajectory_drifting(const struct trajectory_path_t *path)
+{
+	return (path->drift[0] != 0.0 || path->drift[1] != 0.0 || path->drift[2] != 0.0)
+		&& (path->coupling[0] != 0.0 || path->coupling[1] != 0.0);
+}
+
+/**
+ * Adds a point to the sampled path
+ *
+ * Points on top of the previous one are dropped.
+ * @param[in,out]	points The sampled path
+ * @param[in]		p The point
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_MEMORY if the path could not grow
+ */
+static int trajectory_add_point(struct trajectory_points_t *points, const double p[3])
+{
+	struct trajectory_point_t *last, *grown;
+	double d;
+
+	if (points->count > 0) {
+		last = &points->points[points->count - 1];
+		d = sqrt((p[0] - last->p[0]) * (p[0] - last->p[0]) + (p[1] - last->p[1]) * (p[1] - last->p[1]) + (p[2] - last->p[2]) * (p[2] - last->p[2]));
+		if (d < TRAJECTORY_EPSILON)
+			return TRAJECTORY_ERR_SUCCESS;
+	}
+	if (points->count == points->allocated) {
+		points->allocated = (points->allocated > 0) ? 2 * points->allocated : 1024;
+		grown = realloc(points->points, points->allocated * sizeof(*grown));
+		if (grown == NULL)
+			return TRAJECTORY_ERR_MEMORY;
+		points->points = grown;
+	}
+	memset(&points->points[points->count], 0, sizeof(points->points[0]));
+	memcpy(points->points[points->count].p, p, sizeof(points->points[0].p));
+	points->count++;
+	return TRAJECTORY_ERR_SUCCESS;
+}
+
+/**
+ * Samples the path every step metres, corners rounded with a quadratic Bezier curve sampled
+ * TRAJECTORY_CORNER_DIVISIONS times closer and at least every TRAJECTORY_CORNER_TURN of its turn
+ *
+ * @param[in]		path The path
+ * @param[in]		step Spacing of the points
+ * @param[in,out]	points The sampled path, empty to start with
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_MEMORY if the path could not grow
+ */
+static int trajectory_sample(const struct trajectory_path_t *path, double step, struct trajectory_points_t *points)
+{
+	double blend[TRAJECTORY_MAX_WAYPOINTS], length[TRAJECTORY_MAX_WAYPOINTS];
+	double dir[TRAJECTORY_MAX_WAYPOINTS][3];
+	double start[3], end[3], next[3], p[3], piece, f, turn;
+	int n = path->waypoints, pieces;
+
+	for (int k=0; k<n-1; k++) {
+		length[k] = 0.0;
+		for (int c=0; c<3; c++) {
+			dir[k][c] = path->points[k + 1][c] - path->points[k][c];
+			length[k] += dir[k][c] * dir[k][c];
+		}
+		length[k] = sqrt(length[k]);
+		for (int c=0; c<3; c++)
+			dir[k][c] = (length[k] > TRAJECTORY_EPSILON) ? dir[k][c] / length[k] : 0.0;
+	}
+	/* a corner may use at most half of each segment next to it */
+	blend[0] = blend[n - 1] = 0.0;
+	for (int k=1; k<n-1; k++) {
+		blend[k] = path->blend;
+		if (blend[k] > length[k - 1] / 2.0)
+			blend[k] = length[k - 1] / 2.0;
+		if (blend[k] > length[k] / 2.0)
+			blend[k] = length[k] / 2.0;
+	}
+
+	for (int k=0; k<n-1; k++) {
+		/* straight part of the segment */
+		for (int c=0; c<3; c++) {
+			start[c] = path->points[k][c] + blend[k] * dir[k][c];
+			end[c] = path->points[k + 1][c] - blend[k + 1] * dir[k][c];
+		}
+		piece = length[k] - blend[k] - blend[k + 1];
+		pieces = (int) ceil(piece / step);
+		for (int i=0; i<pieces; i++) {
+			for (int c=0; c<3; c++)
+				p[c] = start[c] + (end[c] - start[c]) * i / pieces;
+			if (trajectory_add_point(points, p) < 0)
+				return TRAJECTORY_ERR_MEMORY;
+		}
+
+		/* rounded corner at the end of the segment, through to the start of the next one */
+		if (k + 1 < n - 1 && blend[k + 1] > 0.0) {
+			for (int c=0; c<3; c++)
+				next[c] = path->points[k + 1][c] + blend[k + 1] * dir[k + 1][c];
+			/* closer together, the joints' acceleration changes fastest where the path bends */
+			pieces = (int) ceil(2.0 * blend[k + 1] / (step / TRAJECTORY_CORNER_DIVISIONS));
+			turn = acos(fmax(-1.0, fmin(1.0, dir[k][0] * dir[k + 1][0] + dir[k][1] * dir[k + 1][1] + dir[k][2] * dir[k + 1][2])));
+			if (pieces < (int) ceil(turn / TRAJECTORY_CORNER_TURN))
+				pieces = (int) ceil(turn / TRAJECTORY_CORNER_TURN);
+			for (int i=0; i<pieces; i++) {
+				f = (double) i / pieces;
+				for (int c=0; c<3; c++)
+					p[c] = (1 - f) * (1 - f) * end[c] + 2 * (1 - f) * f * path->points[k + 1][c] + f * f * next[c];
+				if (trajectory_add_point(points, p) < 0)
+					return TRAJECTORY_ERR_MEMORY;
+			}
+		}
+	}
+	return trajectory_add_point(points, path->points[n - 1]);
+}
+
+/**
+ * Works out the range of path accelerations every joint allows at a point
+ *
+ * @param[in]	point The point
+ * @param[in]	u The squared path speed
+ * @param[out]	lowest The hardest deceleration, negative
+ * @param[out]	highest The hardest acceleration
+ * @return 1 if there is an acceleration every joint allows, 0 if the speed is too high for that
+ */
+static int trajectory_accelerations(const struct trajectory_point_t *point, double u, double *lowest, double *highest)
+{
+	double a, b1, b2;
+
+	*lowest = -INFINITY;
+	*highest = INFINITY;
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		a = point->limits.acceleration[j];
+		if (fabs(point->dq[j]) < TRAJECTORY_EPSILON) {
+			/* the joint only sees the curvature */
+			if (fabs(point->ddq[j] * u) > a)
+				return 0;
+			continue;
+		}
+		b1 = (-a - point->ddq[j] * u) / point->dq[j];
+		b2 = (a - point->ddq[j] * u) / point->dq[j];
+		if (b1 > b2) {
+			double swap = b1;
+			b1 = b2;
+			b2 = swap;
+		}
+		if (b1 > *lowest)
+			*lowest = b1;
+		if (b2 < *highest)
+			*highest = b2;
+	}
+	return *lowest <= *highest;
+}
+
+/**
+ * Takes the moving frame's share off a point's joint limits
+ *
+ * dq/ds is worked out from the Jacobian at the pose the frame has carried the point to. The joints
+ * also accelerate as the pose changes under the frame, at belt speeds that is small and left to
+ * the drives' margin.
+ * @param[in]		robot The robot
+ * @param[in]		path The path
+ * @param[in]		duration How long the move took when last timed, 0 if it has not been yet
+ * @param[in]		w Where the point is
+ * @param[in]		tangent Direction of the path at the point, unit length
+ * @param[in,out]	point The point, its joint angles worked out
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_UNREACHABLE if the frame alone uses up
+ * a joint's limits
+ */
+static int trajectory_drift_limits(const struct delta_robot_t *robot, const struct trajectory_path_t *path, double duration,
+	const double w[3], const double tangent[3], struct trajectory_point_t *point)
+{
+	double dq_dp[DELTA_NUM_JOINTS][3], rate, coupling, headroom;
+
+	if (delta_inverse_jacobian(robot, w, point->q, dq_dp) < 0)
+		return TRAJECTORY_ERR_UNREACHABLE;
+	coupling = (path->coupling[0] > path->coupling[1]) ? path->coupling[0] : path->coupling[1];
+	/* the largest change of 3x^2 - 2x^3 is 1.5 / duration */
+	headroom = (duration > 0.0) ? 1.5 * fabs(path->coupling[1] - path->coupling[0]) / duration : 0.0;
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		point->dq[j] = dq_dp[j][0] * tangent[0] + dq_dp[j][1] * tangent[1] + dq_dp[j][2] * tangent[2];
+		rate = fabs(dq_dp[j][0] * path->drift[0] + dq_dp[j][1] * path->drift[1] + dq_dp[j][2] * path->drift[2]);
+		point->limits.velocity[j] -= rate * coupling;
+		point->limits.acceleration[j] -= rate * headroom;
+		if (point->limits.velocity[j] <= 0.0 || point->limits.acceleration[j] <= 0.0)
+			return TRAJECTORY_ERR_UNREACHABLE;
+	}
+	return TRAJECTORY_ERR_SUCCESS;
+}
+
+/**
+ * Works out the joint angles, derivatives and limits at every point, and the highest speed there
+ *
+ * @param[in]		robot The robot
+ * @param[in]		path The path
+ * @param[in]		duration How long the move took when last timed, 0 if it has not been yet
+ * @param[in,out]	points The sampled path, the times of the last timing kept for a moving frame
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_UNREACHABLE if a point is outside
+ * the workspace or singular
+ */
+static int trajectory_joints(const struct delta_robot_t *robot, const struct trajectory_path_t *path, double duration, struct trajectory_points_t *points)
+{
+	struct trajectory_point_t *pt = points->points;
+	uint32_t n = points->count, prev, next;
+	double u, low, high, lowest, highest, span, shift;
+	double w[3], tangent[3];
+	int drifting = trajectory_drifting(path);
+
+	for (uint32_t i=0; i<n; i++) {
+		shift = drifting ? trajectory_drift(path, duration, pt[i].t, NULL) : 0.0;
+		for (int c=0; c<3; c++)
+			w[c] = pt[i].p[c] + path->drift[c] * shift;
+		if (delta_inverse(robot, w, pt[i].q) < 0 || delta_limits(robot, w, pt[i].q, &pt[i].limits) < 0)
+			return TRAJECTORY_ERR_UNREACHABLE;
+		if (i + 1 < n)
+			pt[i].ds = sqrt((pt[i + 1].p[0] - pt[i].p[0]) * (pt[i + 1].p[0] - pt[i].p[0])
+				+ (pt[i + 1].p[1] - pt[i].p[1]) * (pt[i + 1].p[1] - pt[i].p[1])
+				+ (pt[i + 1].p[2] - pt[i].p[2]) * (pt[i + 1].p[2] - pt[i].p[2]));
+	}
+
+	/* central differences, one sided at the ends */
+	for (uint32_t i=0; i<n; i++) {
+		prev = (i > 0) ? i - 1 : i;
+		next = (i + 1 < n) ? i + 1 : i;
+		span = 0.0;
+		for (uint32_t k=prev; k<next; k++)
+			span += pt[k].ds;
+		if (!drifting) {
+			for (int j=0; j<DELTA_NUM_JOINTS; j++)
+				pt[i].dq[j] = (span > 0.0) ? (pt[next].q[j] - pt[prev].q[j]) / span : 0.0;
+			continue;
+		}
+		shift = trajectory_drift(path, duration, pt[i].t, NULL);
+		for (int c=0; c<3; c++) {
+			w[c] = pt[i].p[c] + path->drift[c] * shift;
+			tangent[c] = (span > 0.0) ? (pt[next].p[c] - pt[prev].p[c]) / span : 0.0;
+		}
+		if (trajectory_drift_limits(robot, path, duration, w, tangent, &pt[i]) < 0)
+			return TRAJECTORY_ERR_UNREACHABLE;
+	}
+	for (uint32_t i=0; i<n; i++) {
+		prev = (i > 0) ? i - 1 : i;
+		next = (i + 1 < n) ? i + 1 : i;
+		span = 0.0;
+		for (uint32_t k=prev; k<next; k++)
+			span += pt[k].ds;
+		if (drifting || prev == i || next == i) {
+			for (int j=0; j<DELTA_NUM_JOINTS; j++)
+				pt[i].ddq[j] = (span > 0.0) ? (pt[next].dq[j] - pt[prev].dq[j]) / span : 0.0;
+			continue;
+		}
+		/*
+		 * the change of slope from one step to the next, not the wider central difference of q':
+		 * that smooths where the path starts to bend over four steps, and the setpoints between
+		 * the points bend sooner than it lets the planner see
+		 */
+		for (int j=0; j<DELTA_NUM_JOINTS; j++)
+			pt[i].ddq[j] = ((pt[next].q[j] - pt[i].q[j]) / pt[i].ds - (pt[i].q[j] - pt[prev].q[j]) / pt[prev].ds) * 2.0 / span;
+	}
+
+	for (uint32_t i=0; i<n; i++) {
+		/* velocity limits */
+		u = INFINITY;
+		for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+			if (fabs(pt[i].dq[j]) < TRAJECTORY_EPSILON)
+				continue;
+			if ((pt[i].limits.velocity[j] / pt[i].dq[j]) * (pt[i].limits.velocity[j] / pt[i].dq[j]) < u)
+				u = (pt[i].limits.velocity[j] / pt[i].dq[j]) * (pt[i].limits.velocity[j] / pt[i].dq[j]);
+		}
+		if (isinf(u))
+			return TRAJECTORY_ERR_UNREACHABLE;
+
+		/* the curvature may not leave any acceleration at that speed */
+		if (!trajectory_accelerations(&pt[i], u, &lowest, &highest)) {
+			low = 0.0;
+			high = u;
+			for (int k=0; k<TRAJECTORY_BISECTIONS; k++) {
+				u = (low + high) / 2.0;
+				if (trajectory_accelerations(&pt[i], u, &lowest, &highest))
+					low = u;
+				else
+					high = u;
+			}
+			u = low;
+		}
+		pt[i].u_max = u;
+	}
+	return TRAJECTORY_ERR_SUCCESS;
+}
+
+/**
+ * Narrows the squared speed at one end of a step to what one joint allows
+ *
+ * With the other end's u fixed, the step's acceleration a = (u1 - u0) / 2ds is linear in this
+ * end's u, and so is the joint's q'' u + q' a at either end of the step, written here as k u + m.
+ * @param[in]		k How the joint's acceleration changes with u
+ * @param[in]		m The joint's acceleration at u = 0
+ * @param[in]		limit The joint's acceleration limit
+ * @param[in,out]	low The lowest u allowed so far
+ * @param[in,out]	high The highest u allowed so far
+ */
+static void trajectory_narrow(double k, double m, double limit, double *low, double *high)
+{
+	double b1, b2;
+
+	if (fabs(k) < TRAJECTORY_EPSILON) {
+		if (fabs(m) > limit)
+			*low = INFINITY;
+		return;
+	}
+	b1 = (-limit - m) / k;
+	b2 = (limit - m) / k;
+	if (b1 > b2) {
+		double swap = b1;
+		b1 = b2;
+		b2 = swap;
+	}
+	if (b1 > *low)
+		*low = b1;
+	if (b2 < *high)
+		*high = b2;
+}
+
+/**
+ * Finds the highest squared speed at the end of a step reached from its start
+ *
+ * Every joint is held within its acceleration limit at both ends of the step.
+ * @param[in]	from The start of the step, its u fixed
+ * @param[in]	to The end of the step
+ * @param[in]	high The highest u wanted at the end
+ * @param[out]	u The highest u at the end
+ * @return 1 if some u at the end keeps every joint within its limits, 0 if the start is too fast
+ * to brake for the end, u is then left as it is for the backward pass to slow the start down
+ */
+static int trajectory_step_forward(const struct trajectory_point_t *from, const struct trajectory_point_t *to, double high, double *u)
+{
+	double h = 1.0 / (2.0 * from->ds), low = 0.0;
+
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		trajectory_narrow(from->dq[j] * h, (from->ddq[j] - from->dq[j] * h) * from->u, from->limits.acceleration[j], &low, &high);
+		trajectory_narrow(to->ddq[j] + to->dq[j] * h, -to->dq[j] * h * from->u, to->limits.acceleration[j], &low, &high);
+	}
+	/* a speed set to one bound in one pass is found again within rounding of it in the next */
+	if (low > high + TRAJECTORY_EPSILON * (1.0 + high))
+		return 0;
+	*u = (high > 0.0) ? high : 0.0;
+	return 1;
+}
+
+/**
+ * Finds the highest squared speed at the start of a step that brakes to its end
+ *
+ * Every joint is held within its acceleration limit at both ends of the step.
+ * @param[in]	from The start of the step
+ * @param[in]	to The end of the step, its u fixed
+ * @param[in]	high The highest u wanted at the start
+ * @param[out]	u The highest u at the start
+ * @return 1 if some u at the start keeps every joint within its limits, 0 if the end is too fast
+ * to be reached
+ */
+static int trajectory_step_backward(const struct trajectory_point_t *from, const struct trajectory_point_t *to, double high, double *u)
+{
+	double h = 1.0 / (2.0 * from->ds), low = 0.0;
+
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		trajectory_narrow(from->ddq[j] - from->dq[j] * h, from->dq[j] * h * to->u, from->limits.acceleration[j], &low, &high);
+		trajectory_narrow(-to->dq[j] * h, (to->ddq[j] + to->dq[j] * h) * to->u, to->limits.acceleration[j], &low, &high);
+	}
+	*u = (high > 0.0) ? high : 0.0;
+	/* a speed set to one bound in one pass is found again within rounding of it in the next */
+	return low <= high + TRAJECTORY_EPSILON * (1.0 + high);
+}
+
+/**
+ * Plans the fastest speed along the path and times it
+ *
+ * The forward pass accelerates as hard as both ends of each step allow, the backward pass brakes
+ * from the end the same way and only ever lowers the speed. Where the backward pass finds a step
+ * whose end is too fast to reach from below, it lowers that end and the passes are run again from
+ * there, until every step keeps every joint within its limits at both of its ends.
+ * @param[in,out]	points The sampled path with its joints worked out
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_UNREACHABLE if the path cannot be
+ * moved along, a point where no joint may move
+ */
+static int trajectory_time(struct trajectory_points_t *points)
+{
+	struct trajectory_point_t *pt = points->points;
+	uint32_t n = points->count;
+	double u, v, low, high;
+	int clean = 0;
+
+	/* from rest at the start, as hard as possible */
+	pt[0].u = 0.0;
+	for (uint32_t i=0; i+1<n; i++) {
+		u = pt[i + 1].u_max;
+		trajectory_step_forward(&pt[i], &pt[i + 1], pt[i + 1].u_max, &u);
+		pt[i + 1].u = u;
+	}
+
+	/* to rest at the end, braking as hard as possible */
+	for (int pass=0; pass<TRAJECTORY_TIME_PASSES && !clean; pass++) {
+		pt[n - 1].u = 0.0;
+		clean = 1;
+		for (uint32_t i=n-1; i>0; i--) {
+			if (trajectory_step_backward(&pt[i - 1], &pt[i], pt[i - 1].u, &u)) {
+				pt[i - 1].u = u;
+				continue;
+			}
+			/*
+			 * the end of the step is too fast for any start: the feasible speeds of the two ends are
+			 * a convex set about both at rest, so the fastest end some start still reaches is found
+			 * by halving, and the steps after it are planned again from there
+			 */
+			clean = 0;
+			low = 0.0;
+			high = pt[i].u;
+			for (int k=0; k<TRAJECTORY_BISECTIONS; k++) {
+				pt[i].u = (low + high) / 2.0;
+				if (trajectory_step_backward(&pt[i - 1], &pt[i], pt[i - 1].u, &u))
+					low = pt[i].u;
+				else
+					high = pt[i].u;
+			}
+			pt[i].u = low;
+			trajectory_step_backward(&pt[i - 1], &pt[i], pt[i - 1].u, &u);
+			pt[i - 1].u = u;
+			for (uint32_t k=i; k+1<n; k++) {
+				u = pt[k + 1].u;
+				trajectory_step_forward(&pt[k], &pt[k + 1], pt[k + 1].u, &u);
+				pt[k + 1].u = u;
+			}
+		}
+	}
+	if (!clean)
+		return TRAJECTORY_ERR_UNREACHABLE;
+
+	pt[0].t = 0.0;
+	for (uint32_t i=0; i+1<n; i++) {
+		v = sqrt(pt[i].u) + sqrt(pt[i + 1].u);
+		if (v < TRAJECTORY_EPSILON)
+			return TRAJECTORY_ERR_UNREACHABLE;
+		pt[i + 1].t = pt[i].t + 2.0 * pt[i].ds / v;
+	}
+	return TRAJECTORY_ERR_SUCCESS;
+}
+
+/**
+ * Works out the setpoint of a path in a moving frame
+ *
+ * The joint angles are worked out afresh where the frame has carried the effector, interpolating
+ * them between the points would leave out the frame's motion.
+ * @param[in]		robot The robot
+ * @param[in]		path The path
+ * @param[in]		t Time into the move
+ * @param[in]		p Where the effector is on the path
+ * @param[in]		v How fast it moves along the path, m/s
+ * @param[out]		setpoint The setpoint
+ * @param[in,out]	trajectory The trajectory, its duration set
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_UNREACHABLE if the frame carried the
+ * effector out of the workspace
+ */
+static int trajectory_drift_setpoint(const struct delta_robot_t *robot, const struct trajectory_path_t *path, double t,
+	const double p[3], const double v[3], struct trajectory_setpoint_t *setpoint, struct trajectory_t *trajectory)
+{
+	double counts_per_rad = robot->drive.gear_ratio * robot->drive.counts_per_rev / (2.0 * M_PI);
+	double w[3], q[DELTA_NUM_JOINTS], dq_dp[DELTA_NUM_JOINTS][3], rate, shift, velocity;
+
+	shift = trajectory_drift(path, trajectory->duration, t, &rate);
+	for (int c=0; c<3; c++)
+		w[c] = p[c] + path->drift[c] * shift;
+	if (delta_inverse(robot, w, q) < 0 || delta_inverse_jacobian(robot, w, q, dq_dp) < 0)
+		return TRAJECTORY_ERR_UNREACHABLE;
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		velocity = 0.0;
+		for (int c=0; c<3; c++)
+			velocity += dq_dp[j][c] * (v[c] + path->drift[c] * rate);
+		setpoint->position[j] = delta_counts(robot, q[j]);
+		setpoint->velocity[j] = (int32_t) lround(velocity * counts_per_rad);
+		if (fabs(velocity) > trajectory->peak_velocity[j])
+			trajectory->peak_velocity[j] = fabs(velocity);
+	}
+	memcpy(trajectory->end, w, sizeof(trajectory->end));
+	return TRAJECTORY_ERR_SUCCESS;
+}
+
+/**
+ * Samples the timed path into one setpoint per cycle
+ *
+ * A path in a moving frame carries on moving with it after the end as far as it is coupled then.
+ * @param[in]		robot The robot
+ * @param[in]		path The path
+ * @param[in]		points The timed path
+ * @param[in,out]	trajectory The trajectory, cycle_ns set
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_MEMORY if there is no room for the setpoints,
+ * TRAJECTORY_ERR_UNREACHABLE if a moving frame carried the effector out of the workspace
+ */
+static int trajectory_setpoints(const struct delta_robot_t *robot, const struct trajectory_path_t *path, const struct trajectory_points_t *points, struct trajectory_t *trajectory)
+{
+	const struct trajectory_point_t *pt = points->points;
+	uint32_t n = points->count, i = 0;
+	double cycle = trajectory->cycle_ns * 1e-9;
+	double t, tau, a, s, speed, f, q, velocity, p[3], v[3];
+	double counts_per_rad = robot->drive.gear_ratio * robot->drive.counts_per_rev / (2.0 * M_PI);
+	int drifting = trajectory_drifting(path);
+
+	trajectory->duration = pt[n - 1].t;
+	trajectory->cycles = (uint32_t) ceil(trajectory->duration / cycle) + 1;
+	trajectory->setpoints = malloc(trajectory->cycles * sizeof(*trajectory->setpoints));
+	if (trajectory->setpoints == NULL)
+		return TRAJECTORY_ERR_MEMORY;
+
+	for (uint32_t k=0; k<trajectory->cycles; k++) {
+		struct trajectory_setpoint_t *setpoint = &trajectory->setpoints[k];
+
+		t = k * cycle;
+		while (i + 2 < n && pt[i + 1].t <= t)
+			i++;
+		if (t >= pt[n - 1].t && drifting) {
+			memset(v, 0, sizeof(v));
+			if (trajectory_drift_setpoint(robot, path, t, pt[n - 1].p, v, setpoint, trajectory) < 0)
+				return TRAJECTORY_ERR_UNREACHABLE;
+			continue;
+		}
+		if (t >= pt[n - 1].t) {
+			memcpy(trajectory->end, pt[n - 1].p, sizeof(trajectory->end));
+			for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+				setpoint->position[j] = delta_counts(robot, pt[n - 1].q[j]);
+				setpoint->velocity[j] = 0;
+			}
+			continue;
+		}
+
+		/* constant acceleration between the points */
+		tau = t - pt[i].t;
+		a = (pt[i + 1].u - pt[i].u) / (2.0 * pt[i].ds);
+		speed = sqrt(pt[i].u) + a * tau;
+		s = sqrt(pt[i].u) * tau + 0.5 * a * tau * tau;
+		f = s / pt[i].ds;
+		if (f < 0.0)
+			f = 0.0;
+		else if (f > 1.0)
+			f = 1.0;
+		if (drifting) {
+			for (int c=0; c<3; c++) {
+				p[c] = pt[i].p[c] + f * (pt[i + 1].p[c] - pt[i].p[c]);
+				v[c] = (pt[i + 1].p[c] - pt[i].p[c]) / pt[i].ds * speed;
+			}
+			if (trajectory_drift_setpoint(robot, path, t, p, v, setpoint, trajectory) < 0)
+				return TRAJECTORY_ERR_UNREACHABLE;
+			continue;
+		}
+		/*
+		 * cubic between the points with their q' at either end, straight lines would turn the
+		 * joints at every point and the drives would see the acceleration come in steps
+		 */
+		for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+			q = (2.0 * f * f * f - 3.0 * f * f + 1.0) * pt[i].q[j] + (f * f * f - 2.0 * f * f + f) * pt[i].ds * pt[i].dq[j]
+				+ (3.0 * f * f - 2.0 * f * f * f) * pt[i + 1].q[j] + (f * f * f - f * f) * pt[i].ds * pt[i + 1].dq[j];
+			velocity = ((6.0 * f * f - 6.0 * f) * (pt[i].q[j] - pt[i + 1].q[j]) / pt[i].ds
+				+ (3.0 * f * f - 4.0 * f + 1.0) * pt[i].dq[j] + (3.0 * f * f - 2.0 * f) * pt[i + 1].dq[j]) * speed;
+			setpoint->position[j] = delta_counts(robot, q);
+			setpoint->velocity[j] = (int32_t) lround(velocity * counts_per_rad);
+			if (fabs(velocity) > trajectory->peak_velocity[j])
+				trajectory->peak_velocity[j] = fabs(velocity);
+		}
+	}
+	return TRAJECTORY_ERR_SUCCESS;
+}
+
+/**
+ * Samples a path and times it
+ *
+ * @param[in]	robot The robot
+ * @param[in]	path The path
+ * @param[in]	step Spacing of the points the path is timed at
+ * @param[out]	points The timed points, freed by the caller whatever the outcome
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_PATH if the path or step is unusable,
+ * TRAJECTORY_ERR_UNREACHABLE if part of the path is outside the workspace,
+ * TRAJECTORY_ERR_MEMORY if there was no memory to plan in
+ */
+static int trajectory_timed(const struct delta_robot_t *robot, const struct trajectory_path_t *path, double step, struct trajectory_points_t *points)
+{
+	int err;
+
+	if (path->waypoints < 2 || path->waypoints > TRAJECTORY_MAX_WAYPOINTS || step <= 0.0)
+		return TRAJECTORY_ERR_PATH;
+
+	err = trajectory_sample(path, step, points);
+	if (err == TRAJECTORY_ERR_SUCCESS && points->count < 2)
+		err = TRAJECTORY_ERR_PATH;
+	if (err == TRAJECTORY_ERR_SUCCESS)
+		err = trajectory_joints(robot, path, 0.0, points);
+	if (err == TRAJECTORY_ERR_SUCCESS)
+		err = trajectory_time(points);
+	/* again where the frame takes the poses, with the headroom for its change in speed */
+	for (int pass=0; pass<TRAJECTORY_DRIFT_PASSES && err == TRAJECTORY_ERR_SUCCESS && trajectory_drifting(path); pass++) {
+		err = trajectory_joints(robot, path, points->points[points->count - 1].t, points);
+		if (err == TRAJECTORY_ERR_SUCCESS)
+			err = trajectory_time(points);
+	}
+	return err;
+}
+
+/**
+ * Plans the fastest trajectory along a path
+ *
+ * Starts and ends at rest, or moving with the path's frame as far as it is coupled there.
+ * Allocates, call trajectory_free() once done with the setpoints.
+ * @param[in]	robot The robot
+ * @param[in]	path The path, at least two waypoints
+ * @param[in]	step Spacing of the points the path is timed at, metres, TRAJECTORY_DEFAULT_STEP normally
+ * @param[in]	cycle_ns The cycle the setpoints are played back at
+ * @param[out]	trajectory The trajectory
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_PATH if the path or step is unusable,
+ * TRAJECTORY_ERR_UNREACHABLE if part of the path is outside the workspace,
+ * TRAJECTORY_ERR_MEMORY if there was no memory to plan in
+ */
+int trajectory_plan(const struct delta_robot_t *robot, const struct trajectory_path_t *path, double step, uint32_t cycle_ns, struct trajectory_t *trajectory)
+{
+	struct trajectory_points_t points = {NULL, 0, 0};
+	int err;
+
+	memset(trajectory, 0, sizeof(*trajectory));
+	trajectory->cycle_ns = cycle_ns;
+	if (cycle_ns == 0)
+		return TRAJECTORY_ERR_PATH;
+
+	err = trajectory_timed(robot, path, step, &points);
+	if (err == TRAJECTORY_ERR_SUCCESS) {
+		trajectory->points = points.count;
+		for (uint32_t i=0; i+1<points.count; i++)
+			trajectory->length += points.points[i].ds;
+		err = trajectory_setpoints(robot, path, &points, trajectory);
+	}
+
+	free(points.points);
+	return err;
+}
+
+/**
+ * Works out how long the fastest trajectory along a path takes, without planning its setpoints
+ *
+ * The time model for choosing between paths, a coarser step than the plan's is close enough and
+ * much quicker. Allocates while it runs.
+ * @param[in]	robot The robot
+ * @param[in]	path The path, at least two waypoints
+ * @param[in]	step Spacing of the points the path is timed at, metres, TRAJECTORY_MODEL_STEP normally
+ * @param[out]	duration How long it takes, seconds
+ * @return TRAJECTORY_ERR_SUCCESS on success, TRAJECTORY_ERR_PATH if the path or step is unusable,
+ * TRAJECTORY_ERR_UNREACHABLE if part of the path is outside the workspace,
+ * TRAJECTORY_ERR_MEMORY if there was no memory to time it in
+ */
+int trajectory_duration(const struct delta_robot_t *robot, const struct trajectory_path_t *path, double step, double *duration)
+{
+	struct trajectory_points_t points = {NULL, 0, 0};
+	int err;
+
+	err = trajectory_timed(robot, path, step, &points);
+	if (err == TRAJECTORY_ERR_SUCCESS)
+		*duration = points.points[points.count - 1].t;
+	free(points.points);
+	return err;
+}
+
+/**
+ * Checks a planned trajectory against the joint limits of every pose it goes through
+ *
+ * Each joint's velocity and acceleration are worked out from the setpoints over
+ * TRAJECTORY_CHECK_WINDOW_NS either side of every cycle, the way the drive gets them, and compared
+ * with delta_limits() where the setpoints put the effector. What rounding the setpoints to counts
+ * can account for, a count in the velocity and two in the acceleration, is taken off first. A
+ * moving frame's share is in the setpoints, so it is checked against the whole of the limits. The first and last window are
+ * left out, the trajectory starts and ends at rest or moving with the frame.
+ * @param[in]	robot The robot, with the payload it was planned for
+ * @param[in]	trajectory The planned trajectory
+ * @param[out]	worst The largest share of a limit any joint got to, 1.0 at the limit, may be NULL
+ * @return TRAJECTORY_ERR_SUCCESS if no joint went over a limit by more than
+ * TRAJECTORY_CHECK_TOLERANCE, TRAJECTORY_ERR_LIMITS if one did, TRAJECTORY_ERR_UNREACHABLE if a
+ * setpoint is outside the workspace
+ */
+int trajectory_check(const struct delta_robot_t *robot, const struct trajectory_t *trajectory, double *worst)
+{
+	uint32_t w = TRAJECTORY_CHECK_WINDOW_NS / trajectory->cycle_ns;
+	double count = delta_angle(robot, 1) - delta_angle(robot, 0);
+	double span, q[DELTA_NUM_JOINTS], p[3], before, after, velocity, acceleration, share, highest = 0.0;
+	struct delta_limits_t limits;
+	int err = TRAJECTORY_ERR_SUCCESS;
+
+	if (w == 0)
+		w = 1;
+	span = w * trajectory->cycle_ns * 1e-9;
+	for (uint32_t k=w; k+w<trajectory->cycles; k++) {
+		for (int j=0; j<DELTA_NUM_JOINTS; j++)
+			q[j] = delta_angle(robot, trajectory->setpoints[k].position[j]);
+		if (delta_forward(robot, q, p) < 0 || delta_limits(robot, p, q, &limits) < 0)
+			return TRAJECTORY_ERR_UNREACHABLE;
+		for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+			before = delta_angle(robot, trajectory->setpoints[k - w].position[j]);
+			after = delta_angle(robot, trajectory->setpoints[k + w].position[j]);
+			velocity = fmax(fabs(after - before) - count, 0.0) / (2.0 * span);
+			acceleration = fmax(fabs(after - 2.0 * q[j] + before) - 2.0 * count, 0.0) / (span * span);
+			share = velocity / limits.velocity[j];
+			if (acceleration / limits.acceleration[j] > share)
+				share = acceleration / limits.acceleration[j];
+			if (share > highest)
+				highest = share;
+			if (share > 1.0 + TRAJECTORY_CHECK_TOLERANCE)
+				err = TRAJECTORY_ERR_LIMITS;
+		}
+	}
+	if (worst)
+		*worst = highest;
+	return err;
+}
+
+/**
+ * Frees a trajectory's setpoints
+ *
+ * Those of a trajectory file are left alone, trajectory_file_unmap() takes care of them.
+ * @param[in,out]	trajectory The trajectory
+ */
+void trajectory_free(struct trajectory_t *trajectory)
+{
+	if (!trajectory->mapped)
+		free(trajectory->setpoints);
+	trajectory->setpoints = NULL;
+	trajectory->events = NULL;
+	trajectory->event_count = 0;
+	trajectory->cycles = 0;
+}
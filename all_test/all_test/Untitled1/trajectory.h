@@ -0,0 +1,89 @@
+/* trajectory.h
+ * this file defines the time optimal trajectory planner
+ * a Cartesian path through waypoints, with the corners rounded off, is timed so that at every
+ * point at least one joint is at its velocity or acceleration limit for that pose, and sampled
+ * into joint setpoints, one per cycle
+ * SOEM only
+ */
+
+#ifndef __TRAJECTORY_H__
+#define __TRAJECTORY_H__
+
+#include <stdint.h>
+
+#include "delta.h"
+
+#define TRAJECTORY_MAX_WAYPOINTS 16
+/* spacing of the points the path is timed at, metres */
+#define TRAJECTORY_DEFAULT_STEP 0.0005
+/* coarser spacing, for timing paths to choose between them (trajectory_duration()) */
+#define TRAJECTORY_MODEL_STEP 0.002
+/* default corner rounding, metres from the corner where the rounding starts */
+#define TRAJECTORY_DEFAULT_BLEND 0.020
+/* default height of the pick path above the pick and place points */
+#define TRAJECTORY_DEFAULT_LIFT 0.025
+/* trajectory_check() works the joint speeds out over this long, ns, short enough to see a step
+ * and long enough for a count of rounding to be noise */
+#define TRAJECTORY_CHECK_WINDOW_NS 1000000
+/* how far over a limit trajectory_check() lets the setpoints go, for the interpolation between
+ * the points the path is timed at */
+#define TRAJECTORY_CHECK_TOLERANCE 0.01
+
+#define TRAJECTORY_ERR_SUCCESS 0
+#define TRAJECTORY_ERR_PATH -1
+#define TRAJECTORY_ERR_UNREACHABLE -2
+#define TRAJECTORY_ERR_MEMORY -3
+#define TRAJECTORY_ERR_LIMITS -4
+
+struct trajectory_path_t {
+	int waypoints;
+	double points[TRAJECTORY_MAX_WAYPOINTS][3];
+	double blend;
+	/* velocity of the frame the points are in, m/s, zero for a path standing still (a conveyor belt
+	 * for a pick on the move), and how much the path moves with it at the start and at the end, from
+	 * 0 not at all to 1 fully. The coupling changes smoothly over the move, see trajectory_plan() */
+	double drift[3];
+	double coupling[2];
+};
+
+struct trajectory_setpoint_t {
+	int32_t position[DELTA_NUM_JOINTS]; /* drive position units */
+	int32_t velocity[DELTA_NUM_JOINTS]; /* drive position units per second */
+};
+
+/* a change of the gripper's outputs (OUTPUT_MAGNET, see output_events.h) at a cycle of the trajectory */
+struct trajectory_event_t {
+	uint32_t cycle;
+	uint8_t mask;
+	uint8_t value;
+	uint16_t reserved;
+};
+
+struct trajectory_t {
+	uint32_t cycle_ns;
+	uint32_t cycles;
+	struct trajectory_setpoint_t *setpoints; /* cycles of them, the last one at rest on the end */
+	/* output changes in cycle order, none for a planned trajectory */
+	const struct trajectory_event_t *events;
+	uint32_t event_count;
+	int mapped; /* setpoints and events belong to a trajectory file, not freed here */
+	/* cycle_count of the cycle the first setpoint has to go out in, 0 to follow on from the one
+	 * queued before whenever that ends */
+	uint32_t start_cycle;
+
+	/* what the plan came to */
+	double duration; /* seconds */
+	double length; /* metres */
+	double peak_velocity[DELTA_NUM_JOINTS]; /* rad/s */
+	uint32_t points; /* points the path was timed at */
+	double end[3]; /* where the last setpoint is, metres */
+};
+
+void trajectory_pick_path(struct trajectory_path_t *path, const double from[3], const double to[3], double lift);
+double trajectory_drift(const struct trajectory_path_t *path, double duration, double t, double *rate);
+int trajectory_plan(const struct delta_robot_t *robot, const struct trajectory_path_t *path, double step, uint32_t cycle_ns, struct trajectory_t *trajectory);
+int trajectory_duration(const struct delta_robot_t *robot, const struct trajectory_path_t *path, double step, double *duration);
+int trajectory_check(const struct delta_robot_t *robot, const struct trajectory_t *trajectory, double *worst);
+void trajectory_free(struct trajectory_t *trajectory);
+
+#endif /* __TRAJECTORY_H__ */
@@ -0,0 +1,224 @@
+/** \file
+ * \brief Times pick paths with the time optimal planner
+ *
+ * Plans the standard pick cycle (25mm up, 305mm across, 25mm down and back) and a set of random
+ * pick and place pairs across the workspace, each one twice: with the limits of every pose
+ * (trajectory.c) and with the same limits everywhere, the worst the workspace has, which is what
+ * a fixed velocity and acceleration has to be set to. Reports the time of each path, the
+ * difference, and how long planning took. Every planned trajectory is checked against the joint
+ * limits (trajectory_check()), the bench fails if one goes over.
+ * Usage: trajectory_bench [random paths] [cycle in us] [payload in kg]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trajectory.h"
+
+/* workspace the random paths are drawn from, a cylinder below the base, metres */
+#define BENCH_RADIUS 0.150
+#define BENCH_Z_TOP -0.400
+#define BENCH_Z_BOTTOM -0.480
+/* standard pick cycle */
+#define BENCH_STANDARD_ACROSS 0.305
+#define BENCH_STANDARD_Z -0.450
+
+struct bench_result_t {
+	double optimal;
+	double fixed;
+	double plan_us;
+	uint32_t cycles;
+	double worst; /* largest share of a joint limit, either plan */
+	int over; /* plans that went over a limit */
+};
+
+/**
+ * Reads the monotonic clock
+ *
+ * @return the time, ns
+ */
+static int64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Picks a random point in the workspace
+ *
+ * @param[out]	p The point
+ */
+static void bench_point(double p[3])
+{
+	double x, y;
+
+	do {
+		x = (2.0 * rand() / RAND_MAX - 1.0) * BENCH_RADIUS;
+		y = (2.0 * rand() / RAND_MAX - 1.0) * BENCH_RADIUS;
+	} while (x * x + y * y > BENCH_RADIUS * BENCH_RADIUS);
+	p[0] = x;
+	p[1] = y;
+	p[2] = BENCH_Z_BOTTOM + (BENCH_Z_TOP - BENCH_Z_BOTTOM) * rand() / RAND_MAX;
+}
+
+/**
+ * Finds the worst limits in the workspace, the fixed limits a planner without the pose has to use
+ *
+ * @param[in]	robot The robot
+ * @param[out]	worst The lowest velocity and acceleration of any joint anywhere
+ */
+static void bench_worst_limits(const struct delta_robot_t *robot, struct delta_limits_t *worst)
+{
+	struct delta_limits_t limits;
+	double p[3], q[DELTA_NUM_JOINTS];
+
+	for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+		worst->velocity[j] = 1e9;
+		worst->acceleration[j] = 1e9;
+	}
+	/* the lift of the pick path goes above the top of the workspace */
+	for (double z=BENCH_Z_BOTTOM; z<=BENCH_Z_TOP+TRAJECTORY_DEFAULT_LIFT+1e-9; z+=0.005) {
+		for (double x=-BENCH_RADIUS; x<=BENCH_RADIUS+1e-9; x+=0.005) {
+			for (double y=-BENCH_RADIUS; y<=BENCH_RADIUS+1e-9; y+=0.005) {
+				if (x * x + y * y > BENCH_RADIUS * BENCH_RADIUS)
+					continue;
+				p[0] = x;
+				p[1] = y;
+				p[2] = z;
+				if (delta_inverse(robot, p, q) < 0 || delta_limits(robot, p, q, &limits) < 0)
+					continue;
+				for (int j=0; j<DELTA_NUM_JOINTS; j++) {
+					for (int k=0; k<DELTA_NUM_JOINTS; k++) {
+						if (limits.velocity[j] < worst->velocity[k])
+							worst->velocity[k] = limits.velocity[j];
+						if (limits.acceleration[j] < worst->acceleration[k])
+							worst->acceleration[k] = limits.acceleration[j];
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Plans one path both ways
+ *
+ * @param[in]	robot The robot
+ * @param[in]	worst The fixed limits
+ * @param[in]	from Where the path starts
+ * @param[in]	to Where it ends
+ * @param[in]	cycle_ns The cycle
+ * @param[out]	result The times
+ * @return TRAJECTORY_ERR_SUCCESS on success, otherwise the planner's error
+ */
+static int bench_path(const struct delta_robot_t *robot, const struct delta_limits_t *worst, const double from[3], const double to[3], uint32_t cycle_ns, struct bench_result_t *result)
+{
+	struct delta_robot_t fixed = *robot;
+	struct trajectory_path_t path;
+	struct trajectory_t trajectory;
+	int64_t start;
+	double share;
+	int err;
+
+	trajectory_pick_path(&path, from, to, TRAJECTORY_DEFAULT_LIFT);
+	result->worst = 0.0;
+	result->over = 0;
+
+	start = bench_now();
+	err = trajectory_plan(robot, &path, TRAJECTORY_DEFAULT_STEP, cycle_ns, &trajectory);
+	result->plan_us = (bench_now() - start) / 1000.0;
+	if (err < 0)
+		return err;
+	result->optimal = trajectory.duration;
+	result->cycles = trajectory.cycles;
+	if (trajectory_check(robot, &trajectory, &share) == TRAJECTORY_ERR_LIMITS)
+		result->over++;
+	result->worst = share;
+	trajectory_free(&trajectory);
+
+	fixed.fixed_limits = worst;
+	err = trajectory_plan(&fixed, &path, TRAJECTORY_DEFAULT_STEP, cycle_ns, &trajectory);
+	if (err < 0)
+		return err;
+	result->fixed = trajectory.duration;
+	if (trajectory_check(&fixed, &trajectory, &share) == TRAJECTORY_ERR_LIMITS)
+		result->over++;
+	if (share > result->worst)
+		result->worst = share;
+	trajectory_free(&trajectory);
+	return TRAJECTORY_ERR_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	int paths = (argc > 1) ? atoi(argv[1]) : 200;
+	uint32_t cycle_ns = (argc > 2) ? atoi(argv[2]) * 1000 : 100000;
+	struct delta_robot_t robot;
+	struct delta_limits_t worst;
+	struct bench_result_t out, back, r;
+	double from[3], to[3];
+	double optimal = 0.0, fixed = 0.0, plan_us = 0.0, plan_us_max = 0.0, saved_max = 0.0, worst_share = 0.0;
+	int planned = 0, failed = 0, over = 0;
+
+	if (paths <= 0 || cycle_ns == 0) {
+		printf("usage: %s [random paths] [cycle in us] [payload in kg]\n", argv[0]);
+		return 1;
+	}
+	delta_defaults(&robot);
+	if (argc > 3)
+		robot.payload = atof(argv[3]);
+	srand(1);
+
+	bench_worst_limits(&robot, &worst);
+	printf("worst case in the workspace: %.1f rad/s, %.0f rad/s^2\n", worst.velocity[0], worst.acceleration[0]);
+
+	from[0] = -BENCH_STANDARD_ACROSS / 2.0;
+	to[0] = BENCH_STANDARD_ACROSS / 2.0;
+	from[1] = to[1] = 0.0;
+	from[2] = to[2] = BENCH_STANDARD_Z;
+	if (bench_path(&robot, &worst, from, to, cycle_ns, &out) < 0 || bench_path(&robot, &worst, to, from, cycle_ns, &back) < 0) {
+		printf("standard cycle is outside the workspace\n");
+	} else {
+		printf("standard cycle: %.1f ms (fixed limits %.1f ms), %.0f picks per minute (fixed %.0f), planned in %.0f us\n",
+			(out.optimal + back.optimal) * 1e3, (out.fixed + back.fixed) * 1e3,
+			60.0 / (out.optimal + back.optimal), 60.0 / (out.fixed + back.fixed), out.plan_us + back.plan_us);
+		over += out.over + back.over;
+		worst_share = (out.worst > back.worst) ? out.worst : back.worst;
+	}
+
+	for (int i=0; i<paths; i++) {
+		bench_point(from);
+		bench_point(to);
+		if (bench_path(&robot, &worst, from, to, cycle_ns, &r) < 0) {
+			failed++;
+			continue;
+		}
+		if (paths <= 20)
+			printf("  (%4.0f %4.0f %4.0f) -> (%4.0f %4.0f %4.0f): %6.1f ms, fixed %6.1f ms, %u cycles, planned in %.0f us\n",
+				from[0] * 1e3, from[1] * 1e3, from[2] * 1e3, to[0] * 1e3, to[1] * 1e3, to[2] * 1e3,
+				r.optimal * 1e3, r.fixed * 1e3, r.cycles, r.plan_us);
+		planned++;
+		optimal += r.optimal;
+		fixed += r.fixed;
+		plan_us += r.plan_us;
+		if (r.plan_us > plan_us_max)
+			plan_us_max = r.plan_us;
+		if (r.fixed - r.optimal > saved_max)
+			saved_max = r.fixed - r.optimal;
+		over += r.over;
+		if (r.worst > worst_share)
+			worst_share = r.worst;
+	}
+	if (planned == 0) {
+		printf("no random path could be planned (%d outside the workspace)\n", failed);
+		return 1;
+	}
+	printf("%d random paths (%d outside the workspace): %.1f ms on average, fixed limits %.1f ms, %.1f ms saved (at most %.1f ms)\n",
+		planned, failed, optimal / planned * 1e3, fixed / planned * 1e3, (fixed - optimal) / planned * 1e3, saved_max * 1e3);
+	printf("planning took %.0f us on average, %.0f us at most\n", plan_us / planned, plan_us_max);
+	printf("limits: %d plans over, at most %.1f%% of a joint limit\n", over, worst_share * 100.0);
+	return (over > 0) ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+/** \file
+ * \brief Precomputed trajectory files
+ *
+ * A fixed recipe moves the same way every time, so its setpoints are planned once, offline
+ * (trajectory_gen), and kept in a file laid out exactly like struct trajectory_t's setpoints and
+ * events. trajectory_file_map() maps the file read only, faults every page in and locks it, then
+ * checks the header and both checksums once. After that the setpoints are used where they are:
+ * the trajectory handed to the planner (planner_submit_trajectory()) points into the mapping, so
+ * the cycle reads them straight from the page cache with nothing parsed or copied, and changing
+ * recipe is mapping another file.
+ *
+ * Files are written to a temporary name and renamed, a controller mapping the old file keeps it.
+ * They are in the controller's byte order, little endian on every target we have.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trajectory_file.h"
+
+static uint32_t trajectory_file_crc_table[256];
+static int trajectory_file_crc_ready = 0;
+
+/**
+ * Works out a CRC-32 (IEEE 802.3, the one zip uses)
+ *
+ * @param[in]	crc The CRC of what came before, 0 to start
+ * @param[in]	data The data
+ * @param[in]	size Number of bytes
+ * @return the CRC including data
+ */
+uint32_t trajectory_file_crc(uint32_t crc, const void *data, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t *) data;
+	uint32_t c;
+
+	if (!trajectory_file_crc_ready) {
+		for (uint32_t n=0; n<256; n++) {
+			c = n;
+			for (int k=0; k<8; k++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			trajectory_file_crc_table[n] = c;
+		}
+		trajectory_file_crc_ready = 1;
+	}
+
+	crc = ~crc;
+	for (size_t i=0; i<size; i++)
+		crc = trajectory_file_crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+/**
+ * Writes a trajectory to a file
+ *
+ * @param[in]	name The file
+ * @param[in]	trajectory The trajectory, its events in cycle order
+ * @return TRAJECTORY_FILE_ERR_SUCCESS on success, TRAJECTORY_FILE_ERR_FORMAT if the trajectory is
+ * empty or its events are out of order, TRAJECTORY_FILE_ERR_WRITE if the file could not be written
+ */
+int trajectory_file_write(const char *name, const struct trajectory_t *trajectory)
+{
+	struct trajectory_file_header_t header;
+	char temporary[4096];
+	FILE *file;
+	int ok;
+
+	if (trajectory->cycles == 0)
+		return TRAJECTORY_FILE_ERR_FORMAT;
+	for (uint32_t i=0; i<trajectory->event_count; i++) {
+		if (trajectory->events[i].cycle >= trajectory->cycles || (i > 0 && trajectory->events[i].cycle < trajectory->events[i - 1].cycle))
+			return TRAJECTORY_FILE_ERR_FORMAT;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = TRAJECTORY_FILE_MAGIC;
+	header.version = TRAJECTORY_FILE_VERSION;
+	header.header_size = sizeof(header);
+	header.joints = DELTA_NUM_JOINTS;
+	header.cycle_ns = trajectory->cycle_ns;
+	header.cycles = trajectory->cycles;
+	header.event_count = trajectory->event_count;
+	header.setpoint_size = sizeof(struct trajectory_setpoint_t);
+	header.event_size = sizeof(struct trajectory_event_t);
+	header.data_crc = trajectory_file_crc(0, trajectory->setpoints, (size_t) trajectory->cycles * sizeof(struct trajectory_setpoint_t));
+	header.data_crc = trajectory_file_crc(header.data_crc, trajectory->events, (size_t) trajectory->event_count * sizeof(struct trajectory_event_t));
+	header.header_crc = trajectory_file_crc(0, &header, offsetof(struct trajectory_file_header_t, header_crc));
+
+	snprintf(temporary, sizeof(temporary), "%s.tmp", name);
+	file = fopen(temporary, "wb");
+	if (file == NULL)
+		return TRAJECTORY_FILE_ERR_WRITE;
+	ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(trajectory->setpoints, sizeof(struct trajectory_setpoint_t), trajectory->cycles, file) == trajectory->cycles
+		&& (trajectory->event_count == 0 || fwrite(trajectory->events, sizeof(struct trajectory_event_t), trajectory->event_count, file) == trajectory->event_count)
+		&& fflush(file) == 0 && fsync(fileno(file)) == 0;
+	if (fclose(file) != 0)
+		ok = 0;
+	if (!ok || rename(temporary, name) != 0) {
+		unlink(temporary);
+		return TRAJECTORY_FILE_ERR_WRITE;
+	}
+	return TRAJECTORY_FILE_ERR_SUCCESS;
+}
+
+/**
+ * Checks a mapped file
+ *
+ * @param[in]	file The mapping
+ * @return TRAJECTORY_FILE_ERR_SUCCESS if it is a complete trajectory, otherwise what is wrong with it
+ */
+static int trajectory_file_check(const struct trajectory_file_t *file)
+{
+	const struct trajectory_file_header_t *header = (const struct trajectory_file_header_t *) file->map;
+	const struct trajectory_event_t *events;
+	size_t setpoints, expected;
+	uint32_t crc;
+
+	if (file->size < sizeof(*header) || header->magic != TRAJECTORY_FILE_MAGIC)
+		return TRAJECTORY_FILE_ERR_FORMAT;
+	if (header->version != TRAJECTORY_FILE_VERSION)
+		return TRAJECTORY_FILE_ERR_VERSION;
+	if (trajectory_file_crc(0, header, offsetof(struct trajectory_file_header_t, header_crc)) != header->header_crc)
+		return TRAJECTORY_FILE_ERR_CHECKSUM;
+	if (header->header_size != sizeof(*header) || header->joints != DELTA_NUM_JOINTS || header->cycles == 0 ||
+		header->setpoint_size != sizeof(struct trajectory_setpoint_t) || header->event_size != sizeof(struct trajectory_event_t))
+		return TRAJECTORY_FILE_ERR_FORMAT;
+
+	setpoints = (size_t) header->cycles * sizeof(struct trajectory_setpoint_t);
+	expected = sizeof(*header) + setpoints + (size_t) header->event_count * sizeof(struct trajectory_event_t);
+	if (file->size != expected)
+		return TRAJECTORY_FILE_ERR_FORMAT;
+
+	crc = trajectory_file_crc(0, (const uint8_t *) file->map + sizeof(*header), expected - sizeof(*header));
+	if (crc != header->data_crc)
+		return TRAJECTORY_FILE_ERR_CHECKSUM;
+
+	events = (const struct trajectory_event_t *) ((const uint8_t *) file->map + sizeof(*header) + setpoints);
+	for (uint32_t i=0; i<header->event_count; i++) {
+		if (events[i].cycle >= header->cycles || (i > 0 && events[i].cycle < events[i - 1].cycle))
+			return TRAJECTORY_FILE_ERR_FORMAT;
+	}
+	return TRAJECTORY_FILE_ERR_SUCCESS;
+}
+
+/**
+ * Maps a trajectory file
+ *
+ * Reads the whole file in, locks it in memory where allowed and checks it. Blocks, call before the
+ * trajectory is needed. file->trajectory is ready to be queued with planner_submit_trajectory().
+ * @param[in]	name The file
+ * @param[out]	file The mapping
+ * @return TRAJECTORY_FILE_ERR_SUCCESS on success, TRAJECTORY_FILE_ERR_OPEN if the file could not
+ * be opened or mapped, TRAJECTORY_FILE_ERR_FORMAT, TRAJECTORY_FILE_ERR_VERSION or
+ * TRAJECTORY_FILE_ERR_CHECKSUM if it is not a trajectory this controller can play
+ */
+int trajectory_file_map(const char *name, struct trajectory_file_t *file)
+{
+	const struct trajectory_file_header_t *header;
+	struct stat st;
+	int fd, err;
+
+	memset(file, 0, sizeof(*file));
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return TRAJECTORY_FILE_ERR_OPEN;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return TRAJECTORY_FILE_ERR_OPEN;
+	}
+	file->size = st.st_size;
+	file->map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (file->map == MAP_FAILED) {
+		file->map = NULL;
+		return TRAJECTORY_FILE_ERR_OPEN;
+	}
+	/* the cycle must never wait for a page, without the permission it at least starts populated */
+	file->locked = (mlock(file->map, file->size) == 0);
+
+	err = trajectory_file_check(file);
+	if (err < 0) {
+		trajectory_file_unmap(file);
+		return err;
+	}
+
+	header = (const struct trajectory_file_header_t *) file->map;
+	file->trajectory.cycle_ns = header->cycle_ns;
+	file->trajectory.cycles = header->cycles;
+	file->trajectory.setpoints = (struct trajectory_setpoint_t *) ((uint8_t *) file->map + sizeof(*header));
+	file->trajectory.events = (const struct trajectory_event_t *) (file->trajectory.setpoints + header->cycles);
+	file->trajectory.event_count = header->event_count;
+	file->trajectory.mapped = 1;
+	file->trajectory.duration = header->cycles * (header->cycle_ns * 1e-9);
+	return TRAJECTORY_FILE_ERR_SUCCESS;
+}
+
+/**
+ * Unmaps a trajectory file
+ *
+ * Only once nothing is playing it any more.
+ * @param[in,out]	file The mapping
+ */
+void trajectory_file_unmap(struct trajectory_file_t *file)
+{
+	if (file->map == NULL)
+		return;
+	if (file->locked)
+		munlock(file->map, file->size);
+	munmap(file->map, file->size);
+	memset(file, 0, sizeof(*file));
+}
@@ -0,0 +1,55 @@
+/* trajectory_file.h
+ * this file defines the precomputed trajectory file
+ * a recipe's motion is planned offline into per cycle joint setpoints and output changes, written
+ * to a versioned, checksummed file and memory mapped by the controller, which plays the setpoints
+ * straight out of the mapping
+ * SOEM only
+ */
+
+#ifndef __TRAJECTORY_FILE_H__
+#define __TRAJECTORY_FILE_H__
+
+#include <stdint.h>
+
+#include "trajectory.h"
+
+#define TRAJECTORY_FILE_MAGIC 0x4a545244 /* "DRTJ" */
+/* bump whenever the layout changes, older files are refused */
+#define TRAJECTORY_FILE_VERSION 1
+
+#define TRAJECTORY_FILE_ERR_SUCCESS 0
+#define TRAJECTORY_FILE_ERR_OPEN -1
+#define TRAJECTORY_FILE_ERR_FORMAT -2
+#define TRAJECTORY_FILE_ERR_VERSION -3
+#define TRAJECTORY_FILE_ERR_CHECKSUM -4
+#define TRAJECTORY_FILE_ERR_WRITE -5
+
+/* the file starts with this, then cycles setpoints and event_count events, all little endian */
+struct trajectory_file_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t joints; /* DELTA_NUM_JOINTS */
+	uint32_t cycle_ns;
+	uint32_t cycles;
+	uint32_t event_count;
+	uint32_t setpoint_size; /* sizeof(struct trajectory_setpoint_t) */
+	uint32_t event_size; /* sizeof(struct trajectory_event_t) */
+	uint32_t data_crc; /* CRC-32 of the setpoints and events */
+	uint32_t reserved[5];
+	uint32_t header_crc; /* CRC-32 of the header up to here */
+};
+
+struct trajectory_file_t {
+	void *map;
+	size_t size;
+	int locked; /* the mapping is locked in memory */
+	struct trajectory_t trajectory; /* points into the mapping */
+};
+
+uint32_t trajectory_file_crc(uint32_t crc, const void *data, size_t size);
+int trajectory_file_write(const char *name, const struct trajectory_t *trajectory);
+int trajectory_file_map(const char *name, struct trajectory_file_t *file);
+void trajectory_file_unmap(struct trajectory_file_t *file);
+
+#endif /* __TRAJECTORY_FILE_H__ */
@@ -0,0 +1,157 @@
+/** \file
+ * \brief Plans a recipe offline into a trajectory file
+ *
+ * The robot starts at the first point and visits the others in turn, alternately picking and
+ * placing: the magnet goes on once it has arrived at a pick point and off at a place point, and it
+ * waits dwell ms at each for the gripper. Every leg is a pick path (trajectory_pick_path()) planned
+ * with trajectory_plan(), legs that carry a part are planned with the payload.
+ * The legs are joined into one trajectory and written with trajectory_file_write(), for soem_main -f.
+ * Usage: trajectory_gen [-c cycle in us] [-d dwell in ms] [-l lift in mm] [-p payload in kg] file x y z x y z ...
+ *        trajectory_gen -v file (checks a file and prints what is in it)
+ * Points are in mm in the robot's base frame, options stop at the file so they can be negative.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trajectory_file.h"
+#include "output_events.h"
+
+/**
+ * Checks a trajectory file and prints what is in it
+ *
+ * @param[in]	name The file
+ * @return 0 if the file can be played, 1 if not
+ */
+static int gen_verify(const char *name)
+{
+	struct trajectory_file_t file;
+	int err = trajectory_file_map(name, &file);
+
+	if (err < 0) {
+		printf("%s cannot be played (%d)\n", name, err);
+		return 1;
+	}
+	printf("%s: version %d, %u cycles of %u ns (%.3f s), %u output changes, %zu bytes%s\n",
+		name, TRAJECTORY_FILE_VERSION, file.trajectory.cycles, file.trajectory.cycle_ns, file.trajectory.duration,
+		file.trajectory.event_count, file.size, file.locked ? "" : ", could not be locked in memory");
+	trajectory_file_unmap(&file);
+	return 0;
+}
+
+/**
+ * Appends setpoints to the recipe
+ *
+ * @param[in,out]	recipe The recipe
+ * @param[in]		setpoints The setpoints
+ * @param[in]		count Number of setpoints
+ * @return 0 on success, -1 if out of memory
+ */
+static int gen_append(struct trajectory_t *recipe, const struct trajectory_setpoint_t *setpoints, uint32_t count)
+{
+	struct trajectory_setpoint_t *grown;
+
+	grown = realloc(recipe->setpoints, (recipe->cycles + count) * sizeof(*grown));
+	if (grown == NULL)
+		return -1;
+	recipe->setpoints = grown;
+	memcpy(&recipe->setpoints[recipe->cycles], setpoints, count * sizeof(*grown));
+	recipe->cycles += count;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t cycle_ns = 100000;
+	double dwell_ms = 50.0, lift = TRAJECTORY_DEFAULT_LIFT, payload = 0.0;
+	struct delta_robot_t robot;
+	struct trajectory_t recipe, leg;
+	struct trajectory_path_t path;
+	struct trajectory_event_t *events;
+	struct trajectory_setpoint_t hold;
+	double from[3], to[3];
+	int c, points, err;
+	uint32_t dwell;
+
+	while ((c = getopt(argc, argv, "+c:d:l:p:v:")) != -1) {
+		switch (c) {
+		case 'c':
+			cycle_ns = atoi(optarg) * 1000;
+			break;
+		case 'd':
+			dwell_ms = atof(optarg);
+			break;
+		case 'l':
+			lift = atof(optarg) / 1000.0;
+			break;
+		case 'p':
+			payload = atof(optarg);
+			break;
+		case 'v':
+			return gen_verify(optarg);
+		default:
+			cycle_ns = 0;
+			break;
+		}
+	}
+	points = (argc - optind - 1) / 3;
+	if (cycle_ns == 0 || points < 2 || (argc - optind - 1) % 3 != 0) {
+		printf("usage: %s [-c cycle in us] [-d dwell in ms] [-l lift in mm] [-p payload in kg] file x y z x y z ...\n", argv[0]);
+		printf("       %s -v file\n", argv[0]);
+		return 1;
+	}
+
+	delta_defaults(&robot);
+	memset(&recipe, 0, sizeof(recipe));
+	recipe.cycle_ns = cycle_ns;
+	events = calloc(points, sizeof(*events));
+	if (events == NULL)
+		return 1;
+	dwell = (uint32_t) (dwell_ms * 1e6 / cycle_ns);
+
+	for (int k=0; k<3; k++)
+		from[k] = atof(argv[optind + 1 + k]) / 1000.0;
+	for (int i=1; i<points; i++) {
+		for (int k=0; k<3; k++)
+			to[k] = atof(argv[optind + 1 + 3 * i + k]) / 1000.0;
+
+		/* odd points are picks, the legs to the even ones carry the part */
+		robot.payload = (i % 2 == 0) ? payload : 0.0;
+		trajectory_pick_path(&path, from, to, lift);
+		err = trajectory_plan(&robot, &path, TRAJECTORY_DEFAULT_STEP, cycle_ns, &leg);
+		if (err < 0) {
+			printf("leg %d to (%.1f %.1f %.1f) cannot be planned (%d)\n", i, to[0] * 1e3, to[1] * 1e3, to[2] * 1e3, err);
+			return 1;
+		}
+		/* the first setpoint of a leg is the last of the one before */
+		if (gen_append(&recipe, leg.setpoints + (i > 1), leg.cycles - (i > 1)) < 0)
+			return 1;
+		printf("leg %d: %.1f ms, %.1f mm\n", i, leg.duration * 1e3, leg.length * 1e3);
+
+		/* at rest on the point while the gripper acts */
+		events[recipe.event_count].cycle = recipe.cycles - 1;
+		events[recipe.event_count].mask = OUTPUT_MAGNET;
+		events[recipe.event_count].value = (i % 2 == 1) ? OUTPUT_MAGNET : 0;
+		recipe.event_count++;
+		hold = leg.setpoints[leg.cycles - 1];
+		for (uint32_t k=0; k<dwell; k++) {
+			if (gen_append(&recipe, &hold, 1) < 0)
+				return 1;
+		}
+		trajectory_free(&leg);
+		memcpy(from, to, sizeof(from));
+	}
+	recipe.events = events;
+
+	err = trajectory_file_write(argv[optind], &recipe);
+	if (err < 0) {
+		printf("could not write %s (%d)\n", argv[optind], err);
+		return 1;
+	}
+	printf("%s: %u cycles (%.3f s) with %u output changes\n", argv[optind], recipe.cycles, recipe.cycles * (cycle_ns * 1e-9), recipe.event_count);
+	free(recipe.setpoints);
+	free(events);
+	return 0;
+}
@@ -0,0 +1,218 @@
+/** \file
+ * \brief Non-blocking mailbox driver for the wago steppers
+ *
+ * Each stepper has its own mailbox in its process image so all steppers run transactions at the
+ * same time. Requests are queued per stepper with wago_mbx_submit() and completed by the cycle.
+ * Between requests the mailbox polls the actual position (DIAG_RD_VAR of the measured position)
+ * so feedback is refreshed as often as the positioning data allows.
+ *
+ * Mailbox mode replaces the positioning setpoints in the process image, so the mailbox is only
+ * entered while the move queue does not need them and is left as soon as a move is waiting.
+ * A running move is not affected by mailbox mode.
+ *
+ * The handshake is the one in the 750-671 manual (2.1.2.7.4): the terminal carries out a request
+ * when the toggle in Control_MBX differs from the one in Status_MBX, and answers by copying the
+ * toggle back with the return code and the opcode it carried out. A reply is only taken if it is
+ * for the opcode that was sent.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include "wago_mailbox.h"
+#include "wago_move_queue.h"
+#include "wago_velocity.h"
+#include "homing.h"
+#include "cycle.h"
+
+/* a transaction not answered within this many cycles is abandoned */
+#define WAGO_MBX_DEFAULT_TIMEOUT 100
+
+struct wago_mailbox_t wago_mailboxes[WAGO_NUM_STEPPERS];
+int wago_mbx_poll_position = 1;
+
+/* the request used for position polls, never handed to callers */
+static struct wago_mbx_request_t position_polls[WAGO_NUM_STEPPERS];
+
+/**
+ * Queues a mailbox request for a stepper
+ *
+ * The request completes asynchronously, check request->state for WAGO_MBX_REQUEST_DONE or WAGO_MBX_REQUEST_FAILED.
+ * @param[in]		device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @param[in,out]	request The request to send, opcode and data must be filled in
+ * @return WAGO_ERR_SUCCESS on success, WAGO_ERR_QUEUE_FULL if the request could not be queued
+ */
+int wago_mbx_submit(int device, struct wago_mbx_request_t *request)
+{
+	struct wago_mailbox_t *mbx = &wago_mailboxes[device];
+
+	IO_LOCK;
+	if (mbx->head - mbx->tail >= WAGO_MBX_QUEUE_LENGTH) {
+		IO_UNLOCK;
+		return WAGO_ERR_QUEUE_FULL;
+	}
+	request->state = WAGO_MBX_REQUEST_QUEUED;
+	mbx->requests[mbx->head & (WAGO_MBX_QUEUE_LENGTH-1)] = request;
+	mbx->head++;
+	IO_UNLOCK;
+
+	return WAGO_ERR_SUCCESS;
+}
+
+/**
+ * Checks whether a stepper's process image is currently being used as a mailbox
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return 1 if the positioning data is unavailable, 0 otherwise
+ */
+int wago_mbx_active(int device)
+{
+	return wago_mailboxes[device].state != WAGO_MBX_OFF;
+}
+
+/**
+ * Returns the last actual position read from a stepper
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @param[out]	age_cycles If not NULL, set to the number of cycles since the position was read
+ * @return the actual position in the same units as wago_set_position()
+ */
+int32_t wago_mbx_actual_position(int device, uint32_t *age_cycles)
+{
+	if (age_cycles)
+		*age_cycles = cycle_count - wago_mailboxes[device].position_cycle;
+	return wago_mailboxes[device].actual_position;
+}
+
+/**
+ * Picks the next transaction for a stepper
+ *
+ * Alternates between queued requests and position polls.
+ * @param[in,out]	mbx The stepper's mailbox
+ * @param[in]		device The wago stepper
+ * @return the request to send, or NULL if there is nothing to do
+ */
+static struct wago_mbx_request_t *wago_mbx_next(struct wago_mailbox_t *mbx, int device)
+{
+	int queued = (mbx->head != mbx->tail);
+
+	if (wago_mbx_poll_position && (mbx->poll_next || !queued)) {
+		mbx->poll_next = 0;
+		position_polls[device].opcode = WAGO_MBX_OP_DIAG_RD_VAR;
+		position_polls[device].data[0] = WAGO_MBX_VAR_ACTUAL_POSITION;
+		return &position_polls[device];
+	}
+	if (!queued)
+		return NULL;
+
+	mbx->poll_next = 1;
+	return mbx->requests[mbx->tail++ & (WAGO_MBX_QUEUE_LENGTH-1)];
+}
+
+/**
+ * Writes a request into the mailbox and toggles it
+ *
+ * @param[in,out]	out Output space of the stepper
+ * @param[in,out]	mbx The stepper's mailbox
+ * @param[in,out]	request The request to send
+ */
+static void wago_mbx_send(struct wago_stepper_t *out, struct wago_mailbox_t *mbx, struct wago_mbx_request_t *request)
+{
+	out->message.mailbox.opcode = request->opcode;
+	for (int i=0; i<4; i++)
+		out->message.mailbox.mail[i] = request->data[i];
+	out->message.mailbox.control ^= WAGO_MBX_TOGGLE;
+
+	request->state = WAGO_MBX_REQUEST_ACTIVE;
+	mbx->active = request;
+	mbx->timeout_cycles = 0;
+	mbx->state = WAGO_MBX_BUSY;
+}
+
+/**
+ * Services the mailbox of one stepper
+ *
+ * Must be called once per cycle, before wago_queue_update() for the same stepper.
+ * The io lock must already be held (see cycle_update()).
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to service, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ */
+void wago_mbx_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	struct wago_stepper_t *out = wago_steppers[device][WAGO_OUTPUT_SPACE];
+	struct wago_stepper_t *in = wago_steppers[device][WAGO_INPUT_SPACE];
+	struct wago_mailbox_t *mbx = &wago_mailboxes[device];
+	struct wago_mbx_request_t *request;
+	/* moves take priority, the mailbox gets out of the way as soon as one is waiting */
+	/* a velocity stream or a reference run needs the setpoints so the mailbox is not used at all */
+	int positioning_needed = !wago_queue_mbx_allowed(device) || wago_velocity_engaged(device) || homing_active(device);
+
+	switch (mbx->state) {
+	case WAGO_MBX_OFF:
+		if (positioning_needed)
+			break;
+		/* only poll once the axis is set up, requests are sent regardless */
+		if ((!wago_mbx_poll_position || !in->stat_cont1.bit.m_positioning) && (mbx->head == mbx->tail))
+			break;
+		out->stat_cont0.bit.mbx_mode = 1;
+		mbx->mode_switches++;
+		mbx->state = WAGO_MBX_ENTERING;
+		break;
+	case WAGO_MBX_ENTERING:
+		if (!in->stat_cont0.bit.mbx_mode)
+			break;
+		/* start from the toggle the terminal reports so the first request is seen as new */
+		out->message.mailbox.control = in->message.mailbox.control & WAGO_MBX_TOGGLE;
+		mbx->state = WAGO_MBX_READY;
+		/* fall through */
+	case WAGO_MBX_READY:
+		request = positioning_needed ? NULL : wago_mbx_next(mbx, device);
+		if (request) {
+			wago_mbx_send(out, mbx, request);
+		} else {
+			out->stat_cont0.bit.mbx_mode = 0;
+			mbx->state = WAGO_MBX_LEAVING;
+		}
+		break;
+	case WAGO_MBX_BUSY:
+		request = mbx->active;
+		if ((in->message.mailbox.control & WAGO_MBX_TOGGLE) != (out->message.mailbox.control & WAGO_MBX_TOGGLE) ||
+			in->message.mailbox.opcode != request->opcode) {
+			if (++mbx->timeout_cycles < WAGO_MBX_DEFAULT_TIMEOUT)
+				break;
+			mbx->timeouts++;
+			request->state = WAGO_MBX_REQUEST_FAILED;
+		} else {
+			request->status = in->message.mailbox.control & WAGO_MBX_STATUS_MASK;
+			for (int i=0; i<4; i++)
+				request->response[i] = in->message.mailbox.mail[i];
+			request->state = request->status ? WAGO_MBX_REQUEST_FAILED : WAGO_MBX_REQUEST_DONE;
+			mbx->transactions++;
+
+			if (request == &position_polls[device] && request->state == WAGO_MBX_REQUEST_DONE) {
+				uint32_t raw = request->response[0] | (request->response[1]<<8) | (request->response[2]<<16) | ((uint32_t) request->response[3]<<24);
+				mbx->actual_position = (int32_t) raw;
+				mbx->position_cycle = cycle_count;
+				mbx->position_updates++;
+			}
+		}
+		mbx->active = NULL;
+
+		/* pipeline the next transaction into the same cycle */
+		request = positioning_needed ? NULL : wago_mbx_next(mbx, device);
+		if (request) {
+			wago_mbx_send(out, mbx, request);
+		} else {
+			out->stat_cont0.bit.mbx_mode = 0;
+			mbx->state = WAGO_MBX_LEAVING;
+		}
+		break;
+	case WAGO_MBX_LEAVING:
+		if (in->stat_cont0.bit.mbx_mode)
+			break;
+		mbx->state = WAGO_MBX_OFF;
+		break;
+	default:
+		mbx->state = WAGO_MBX_OFF;
+		break;
+	}
+}
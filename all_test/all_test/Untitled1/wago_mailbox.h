@@ -0,0 +1,93 @@
+/* wago_mailbox.h
+ * this file defines the non-blocking mailbox driver for the wago steppers
+ * in mailbox mode the 6 message bytes of the process image carry an opcode, a control byte
+ * and 4 bytes of data instead of the positioning setpoints (750-671 manual, 2.1.2.7.4)
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __WAGO_MAILBOX_H__
+#define __WAGO_MAILBOX_H__
+
+#include "wago_steppers.h"
+
+/* must be a power of two */
+#define WAGO_MBX_QUEUE_LENGTH 8
+
+/* Control_MBX/Status_MBX, toggled by the host to issue a request and by the terminal once it has been carried out */
+#define WAGO_MBX_TOGGLE 0x80
+/* the remaining bits of Status_MBX hold the return code, 0 is success */
+#define WAGO_MBX_STATUS_MASK 0x7f
+
+/* opcodes, 750-671 manual appendix 3.1, the reply carries the opcode back */
+#define WAGO_MBX_OP_IDLE 0x00
+#define WAGO_MBX_OP_DIAG_RD_ERROR 0x49 /* reply: error code, extra information, 16 bit each */
+#define WAGO_MBX_OP_DIAG_QUIT_ERROR 0x4A
+#define WAGO_MBX_OP_DIAG_RD_VAR 0x4C /* request: variable number, reply: 32 bit value */
+#define WAGO_MBX_OP_CONFIG_SET_PTR 0x50 /* request: 16 bit address, number of bytes 1 to 4 */
+#define WAGO_MBX_OP_CONFIG_WR 0x51 /* request: value at the address set with CONFIG_SET_PTR */
+#define WAGO_MBX_OP_CONFIG_RD 0x52 /* reply: value at the address set with CONFIG_SET_PTR */
+
+/* internal status variables read with DIAG_RD_VAR, appendix 3.6 */
+#define WAGO_MBX_VAR_ACTUAL_POSITION 0x01 /* measured, in the units of the position setpoint */
+
+enum wago_mbx_request_states {
+	WAGO_MBX_REQUEST_FREE = 0,
+	WAGO_MBX_REQUEST_QUEUED,
+	WAGO_MBX_REQUEST_ACTIVE,
+	WAGO_MBX_REQUEST_DONE,
+	WAGO_MBX_REQUEST_FAILED
+};
+
+/* request storage is owned by the caller and must stay valid until the request is DONE or FAILED */
+struct wago_mbx_request_t {
+	uint8_t opcode;
+	uint8_t data[4]; /* little endian */
+	volatile enum wago_mbx_request_states state;
+	uint8_t status; /* status bits returned by the terminal */
+	uint8_t response[4];
+};
+
+/* states of a stepper's mailbox */
+enum wago_mbx_states {
+	WAGO_MBX_OFF = 0,	/* process image holds positioning data */
+	WAGO_MBX_ENTERING,	/* mbx_mode requested, waiting for the terminal */
+	WAGO_MBX_READY,		/* in mailbox mode, no transaction outstanding */
+	WAGO_MBX_BUSY,		/* transaction outstanding, waiting for the toggle to come back */
+	WAGO_MBX_LEAVING	/* mbx_mode dropped, waiting for the terminal */
+};
+
+struct wago_mailbox_t {
+	struct wago_mbx_request_t *requests[WAGO_MBX_QUEUE_LENGTH];
+	unsigned int head;
+	unsigned int tail;
+	enum wago_mbx_states state;
+	struct wago_mbx_request_t *active; /* request occupying the mailbox, NULL for a position poll */
+	int poll_next; /* alternate position polls with queued requests so neither starves */
+	uint32_t timeout_cycles;
+
+	/* feedback */
+	int32_t actual_position;
+	uint32_t position_cycle; /* cycle_count at which actual_position was received */
+	uint32_t position_updates;
+
+	/* statistics */
+	uint32_t transactions;
+	uint32_t timeouts;
+	uint32_t mode_switches;
+};
+
+extern struct wago_mailbox_t wago_mailboxes[WAGO_NUM_STEPPERS];
+/* when set the mailbox keeps polling the actual position whenever the positioning data allows it */
+extern int wago_mbx_poll_position;
+
+int wago_mbx_submit(int device, struct wago_mbx_request_t *request);
+int wago_mbx_active(int device);
+int32_t wago_mbx_actual_position(int device, uint32_t *age_cycles);
+
+void wago_mbx_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+
+#endif /* __WAGO_MAILBOX_H__ */
@@ -0,0 +1,254 @@
+/** \file
+ * \brief Per-axis positioning move queue for the wago steppers
+ *
+ * Moves are pushed onto a queue by the state machine and loaded into the process image by
+ * the cycle. While a move is running the next move in the queue is written to the terminal
+ * and pre_calc is set. Once the terminal acknowledges with precalc_ack, start is dropped and
+ * raised again on the cycle the current move reports on_target. The terminal then begins the
+ * pre-calculated move immediately rather than waiting for the move to be reprogrammed.
+ *
+ * The handshake is:
+ *   IDLE -> (ARMING) -> STARTING -> RUNNING -> PRECALC -> PRIMED -> STARTING ...
+ * Loading a move waits for the mailbox (wago_mailbox.c) to give the process image back, and
+ * for the velocity stream (wago_velocity.c) to let go of the axis.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include "wago_move_queue.h"
+#include "wago_mailbox.h"
+#include "wago_velocity.h"
+#include "homing.h"
+#include "safety.h"
+#include "cycle.h"
+
+struct wago_move_queue_t wago_move_queues[WAGO_NUM_STEPPERS];
+
+/**
+ * Adds a positioning move to the end of an axis queue
+ *
+ * Called from outside the cycle, a script in it uses wago_queue_move_locked(). The queue is single
+ * producer, single consumer.
+ * @param[in]	device The wago stepper to queue the move for, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @param[in]	position The position to go to, see wago_set_position()
+ * @param[in]	velocity The maximum velocity for the move, see wago_set_velocity_limit()
+ * @param[in]	acceleration The maximum acceleration for the move, see wago_set_acceleration_limit()
+ * @return WAGO_ERR_SUCCESS on success, WAGO_ERR_POSITION_TOO_LARGE if the position does not fit in 24 bits, WAGO_ERR_QUEUE_FULL if there is no room in the queue
+ */
+int wago_queue_move(int device, uint32_t position, uint16_t velocity, uint16_t acceleration)
+{
+	int err;
+
+	IO_LOCK;
+	err = wago_queue_move_locked(device, position, velocity, acceleration);
+	IO_UNLOCK;
+	return err;
+}
+
+/**
+ * Adds a positioning move to the end of an axis queue, with the io lock already held
+ *
+ * As wago_queue_move(), for scripts (see script.h).
+ * @param[in]	device The wago stepper to queue the move for, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @param[in]	position The position to go to, see wago_set_position()
+ * @param[in]	velocity The maximum velocity for the move, see wago_set_velocity_limit()
+ * @param[in]	acceleration The maximum acceleration for the move, see wago_set_acceleration_limit()
+ * @return WAGO_ERR_SUCCESS on success, WAGO_ERR_POSITION_TOO_LARGE if the position does not fit in 24 bits, WAGO_ERR_QUEUE_FULL if there is no room in the queue
+ */
+int wago_queue_move_locked(int device, uint32_t position, uint16_t velocity, uint16_t acceleration)
+{
+	struct wago_move_queue_t *queue = &wago_move_queues[device];
+	struct wago_move_t *move;
+
+	if (position > 0x00ffffff)
+		return WAGO_ERR_POSITION_TOO_LARGE;
+	if (queue->head - queue->tail >= WAGO_MOVE_QUEUE_LENGTH)
+		return WAGO_ERR_QUEUE_FULL;
+
+	move = &queue->moves[queue->head & (WAGO_MOVE_QUEUE_LENGTH-1)];
+	move->position = position;
+	move->velocity = velocity;
+	move->acceleration = acceleration;
+	queue->head++;
+
+	return WAGO_ERR_SUCCESS;
+}
+
+/**
+ * Returns the number of moves waiting to be loaded into the terminal
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return number of queued moves
+ */
+int wago_queue_pending(int device)
+{
+	return (int) (wago_move_queues[device].head - wago_move_queues[device].tail);
+}
+
+/**
+ * Returns the number of the move most recently queued
+ *
+ * Used to attach things to a move, see output_event_after_move().
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return the move number
+ */
+unsigned int wago_queue_last(int device)
+{
+	return wago_move_queues[device].head - 1;
+}
+
+/**
+ * Checks whether an axis has finished every queued move
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return 1 if the queue is empty and no move is running, 0 otherwise
+ */
+int wago_queue_idle(int device)
+{
+	return (wago_queue_pending(device) == 0) && (wago_move_queues[device].state == WAGO_QUEUE_IDLE);
+}
+
+/**
+ * Discards every move that has not yet been loaded into the terminal
+ *
+ * A move that is already running or pre-calculated is not affected.
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ */
+void wago_queue_clear(int device)
+{
+	IO_LOCK;
+	wago_move_queues[device].head = wago_move_queues[device].tail;
+	IO_UNLOCK;
+}
+
+/**
+ * Checks whether the positioning data of an axis can be given up for mailbox mode
+ *
+ * The setpoints are only needed from the time a move is loaded until the terminal has taken it,
+ * either by echoing start or by acknowledging pre_calc.
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return 1 if the mailbox may use the process image, 0 otherwise
+ */
+int wago_queue_mbx_allowed(int device)
+{
+	switch (wago_move_queues[device].state) {
+	case WAGO_QUEUE_IDLE:
+	case WAGO_QUEUE_RUNNING:
+	case WAGO_QUEUE_PRIMED:
+		return wago_queue_pending(device) == 0;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Writes the next queued move into the output process image and removes it from the queue
+ *
+ * @param[in,out]	out Output space of the stepper
+ * @param[in,out]	queue Queue belonging to the stepper
+ */
+static void wago_queue_load(struct wago_stepper_t *out, struct wago_move_queue_t *queue)
+{
+	struct wago_move_t *move = &queue->moves[queue->tail & (WAGO_MOVE_QUEUE_LENGTH-1)];
+
+	out->message.positioning.velocity_lbyte = (uint8_t) ((move->velocity>>0)&0xFF);
+	out->message.positioning.velocity_hbyte = (uint8_t) ((move->velocity>>8)&0xFF);
+	out->message.positioning.acceleration_lbyte = (uint8_t) ((move->acceleration>>0)&0xFF);
+	out->message.positioning.acceleration_hbyte = (uint8_t) ((move->acceleration>>8)&0xFF);
+	out->message.positioning.position_lbyte = (uint8_t) ((move->position>>0)&0xff);
+	out->message.positioning.position_mbyte = (uint8_t) ((move->position>>8)&0xff);
+	out->message.positioning.position_hbyte = (uint8_t) ((move->position>>16)&0xff);
+
+	queue->loaded_move = queue->tail;
+	queue->tail++;
+}
+
+/**
+ * Services the move queue of one axis
+ *
+ * Must be called once per cycle, after the inputs have been received and before the outputs
+ * are sent. The io lock must already be held (see cycle_update()).
+ * The axis must already be in positioning mode.
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to service, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ */
+void wago_queue_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	struct wago_stepper_t *out = wago_steppers[device][WAGO_OUTPUT_SPACE];
+	struct wago_stepper_t *in = wago_steppers[device][WAGO_INPUT_SPACE];
+	struct wago_move_queue_t *queue = &wago_move_queues[device];
+	int pending = (int) (queue->head - queue->tail);
+
+	/* the safety reaction owns start while it holds the axes, whatever was loaded is abandoned */
+	if (safety_stopped()) {
+		out->stat_cont2.control_bits.pre_calc = 0;
+		queue->state = WAGO_QUEUE_IDLE;
+		return;
+	}
+
+	switch (queue->state) {
+	case WAGO_QUEUE_IDLE:
+		/* the mailbox leaves as soon as it sees a pending move */
+		if (!pending || wago_mbx_active(device) || homing_active(device) || wago_velocity_engaged(device))
+			break;
+		wago_queue_load(out, queue);
+		queue->starting_move = queue->loaded_move;
+		/* start is edge triggered, if it was left high it has to drop for a cycle first */
+		if (out->stat_cont1.bit.start || in->stat_cont1.bit.start) {
+			out->stat_cont1.bit.start = 0;
+			queue->state = WAGO_QUEUE_ARMING;
+		} else {
+			out->stat_cont1.bit.start = 1;
+			queue->state = WAGO_QUEUE_STARTING;
+		}
+		break;
+	case WAGO_QUEUE_ARMING:
+		if (in->stat_cont1.bit.start)
+			break;
+		out->stat_cont1.bit.start = 1;
+		queue->state = WAGO_QUEUE_STARTING;
+		break;
+	case WAGO_QUEUE_STARTING:
+		/* on_target is stale until the terminal has seen the start edge */
+		if (!in->stat_cont1.bit.start)
+			break;
+		queue->running_move = queue->starting_move;
+		queue->running_since = cycle_count;
+		queue->moves_started++;
+		/* on_target in the image that echoes start may still be the last move's, it is only taken
+		 * from the next cycle on, which is also when the next move is pre-calculated */
+		queue->state = WAGO_QUEUE_RUNNING;
+		break;
+	case WAGO_QUEUE_RUNNING:
+		if (pending && !wago_mbx_active(device)) {
+			wago_queue_load(out, queue);
+			out->stat_cont2.control_bits.pre_calc = 1;
+			queue->state = WAGO_QUEUE_PRECALC;
+		} else if (!pending && in->stat_cont2.status_bits.on_target) {
+			queue->moves_completed++;
+			queue->state = WAGO_QUEUE_IDLE;
+		}
+		break;
+	case WAGO_QUEUE_PRECALC:
+		if (!in->stat_cont2.status_bits.precalc_ack)
+			break;
+		/* dropping start does not stop the running move, it only arms the next edge */
+		out->stat_cont1.bit.start = 0;
+		queue->state = WAGO_QUEUE_PRIMED;
+		break;
+	case WAGO_QUEUE_PRIMED:
+		if (in->stat_cont1.bit.start || !in->stat_cont2.status_bits.on_target)
+			break;
+		/* hand off on the same cycle the current move finishes */
+		out->stat_cont1.bit.start = 1;
+		out->stat_cont2.control_bits.pre_calc = 0;
+		queue->starting_move = queue->loaded_move;
+		queue->moves_completed++;
+		queue->precalc_handoffs++;
+		queue->state = WAGO_QUEUE_STARTING;
+		break;
+	default:
+		queue->state = WAGO_QUEUE_IDLE;
+		break;
+	}
+}
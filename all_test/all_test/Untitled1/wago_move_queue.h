@@ -0,0 +1,66 @@
+/* wago_move_queue.h
+ * this file defines the per-axis queue of positioning moves for the wago steppers
+ * moves are handed to the terminal using the 750-671 pre-calculation mechanism so
+ * consecutive moves run back to back without stopping
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __WAGO_MOVE_QUEUE_H__
+#define __WAGO_MOVE_QUEUE_H__
+
+#include "wago_steppers.h"
+
+/* must be a power of two */
+#define WAGO_MOVE_QUEUE_LENGTH 16
+
+struct wago_move_t {
+	uint32_t position;
+	uint16_t velocity;
+	uint16_t acceleration;
+};
+
+/* states of the start/pre_calc handshake with the terminal */
+enum wago_queue_states {
+	WAGO_QUEUE_IDLE = 0,	/* no move loaded */
+	WAGO_QUEUE_ARMING,	/* start is being dropped so the next start is an edge */
+	WAGO_QUEUE_STARTING,	/* start raised, waiting for the terminal to echo it */
+	WAGO_QUEUE_RUNNING,	/* move running, nothing pre-calculated */
+	WAGO_QUEUE_PRECALC,	/* next move loaded, waiting for precalc_ack */
+	WAGO_QUEUE_PRIMED	/* next move pre-calculated, waiting for on_target to hand off */
+};
+
+struct wago_move_queue_t {
+	struct wago_move_t moves[WAGO_MOVE_QUEUE_LENGTH];
+	unsigned int head; /* next slot to write, changed by wago_queue_move() only */
+	unsigned int tail; /* next slot to load, changed by the cycle only */
+	enum wago_queue_states state;
+
+	/* moves are numbered by the value of head when they were queued */
+	unsigned int loaded_move; /* last move written to the terminal */
+	unsigned int starting_move; /* move the current start edge belongs to */
+	unsigned int running_move; /* move the terminal is running, valid once moves_started is non zero */
+	uint32_t running_since; /* cycle_count when running_move started */
+
+	/* statistics */
+	uint32_t moves_started;
+	uint32_t moves_completed;
+	uint32_t precalc_handoffs;
+};
+
+extern struct wago_move_queue_t wago_move_queues[WAGO_NUM_STEPPERS];
+
+int wago_queue_move(int device, uint32_t position, uint16_t velocity, uint16_t acceleration);
+int wago_queue_move_locked(int device, uint32_t position, uint16_t velocity, uint16_t acceleration);
+int wago_queue_pending(int device);
+unsigned int wago_queue_last(int device);
+int wago_queue_idle(int device);
+void wago_queue_clear(int device);
+int wago_queue_mbx_allowed(int device);
+
+void wago_queue_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+
+#endif /* __WAGO_MOVE_QUEUE_H__ */
@@ -9,14 +9,11 @@
  */
 
 #include "wago_steppers.h"
+#include "wago_velocity.h"
 
-/* Allow pthread locking using SOEM. Not needed when using TwinCAT3 */
-#ifdef TC_VER /* If a twincat 3 version is defined */
-#define IO_LOCK NULL
-#define IO_UNLOCK NULL
-#else
-#define IO_LOCK pthread_mutex_lock(&io_mutex)
-#define IO_UNLOCK pthread_mutex_unlock(&io_mutex)
+/* IO_LOCK/IO_UNLOCK are defined in wago_steppers.h
+ * not recursive, code that runs with the lock held (the cycle, scripts) calls the _locked variants */
+#ifndef TC_VER
 pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
@@ -30,11 +27,27 @@ pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
  */
 int wago_terminate_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
 {
+	int ret;
+
 	IO_LOCK;
+	ret = wago_terminate_mode_locked(wago_steppers, device);
+	IO_UNLOCK;
+	return ret;
+}
+
+/**
+ * Terminates the current operating mode, with the io lock already held
+ *
+ * As wago_terminate_mode(), for scripts (see script.h).
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to terminate, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return WAGO_ERR_SUCCESS on success, WAGO error code on failure
+ */
+int wago_terminate_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
 	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.enable = 0;
 	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.stop2_n = 0;
 	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.start = 0;
-	IO_UNLOCK;
 
 	return WAGO_ERR_SUCCESS;
 }
@@ -49,18 +62,35 @@ int wago_terminate_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][
  */
 int wago_confirm_terminate_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
 {
+	int ret;
+
 	IO_LOCK;
+	ret = wago_confirm_terminate_mode_locked(wago_steppers, device);
+	IO_UNLOCK;
+	return ret;
+}
+
+/**
+ * Verifies termination of the current operating mode, with the io lock already held
+ *
+ * As wago_confirm_terminate_mode(), for scripts (see script.h).
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to terminate, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return WAGO_ERR_SUCCESS on success, WAGO error code on failure
+ */
+int wago_confirm_terminate_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	int ret = WAGO_ERR_SUCCESS;
 	if (wago_steppers[device][WAGO_INPUT_SPACE]->stat_cont1.bit.enable != 0) {
-		return WAGO_ERR_TERMINATE_NOT_SET;
+		ret = WAGO_ERR_TERMINATE_NOT_SET;
 	}
 	if (wago_steppers[device][WAGO_INPUT_SPACE]->stat_cont1.bit.stop2_n != 0) {
-		return WAGO_ERR_TERMINATE_NOT_SET;
+		ret = WAGO_ERR_TERMINATE_NOT_SET;
 	}
 	if (wago_steppers[device][WAGO_INPUT_SPACE]->stat_cont1.bit.start != 0) {
-		return WAGO_ERR_TERMINATE_NOT_SET;
+		ret = WAGO_ERR_TERMINATE_NOT_SET;
 	}
-	IO_UNLOCK;
-	return WAGO_ERR_SUCCESS;
+	return ret;
 }
 
 /**
@@ -74,11 +104,27 @@ int wago_confirm_terminate_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_ST
  */
 int wago_set_setup_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
 {
+	int ret;
+
 	IO_LOCK;
+	ret = wago_set_setup_mode_locked(wago_steppers, device);
+	IO_UNLOCK;
+	return ret;
+}
+
+/**
+ * Configures a stepper motor to be ready for setting an operating mode, with the io lock already held
+ *
+ * As wago_set_setup_mode(), for scripts (see script.h).
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to terminate, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return WAGO_ERR_SUCCESS on success, WAGO error code on failure
+ */
+int wago_set_setup_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
 	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.enable = 1;
 	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.stop2_n = 1;
 	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.start = 0;
-	IO_UNLOCK;
 
 	return WAGO_ERR_SUCCESS;
 }
@@ -93,18 +139,35 @@ int wago_set_setup_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][
  */
 int wago_confirm_setup_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
 {
+	int ret;
+
 	IO_LOCK;
+	ret = wago_confirm_setup_mode_locked(wago_steppers, device);
+	IO_UNLOCK;
+	return ret;
+}
+
+/**
+ * Verifies device is ready for operating mode selection, with the io lock already held
+ *
+ * As wago_confirm_setup_mode(), for scripts (see script.h).
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to terminate, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return WAGO_ERR_SUCCESS on success, WAGO error code on failure
+ */
+int wago_confirm_setup_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	int ret = WAGO_ERR_SUCCESS;
 	if (wago_steppers[device][WAGO_INPUT_SPACE]->stat_cont1.bit.enable != 1) {
-		return WAGO_ERR_SETUP_NOT_SET;
+		ret = WAGO_ERR_SETUP_NOT_SET;
 	}
 	if (wago_steppers[device][WAGO_INPUT_SPACE]->stat_cont1.bit.stop2_n != 1) {
-		return WAGO_ERR_SETUP_NOT_SET;
+		ret = WAGO_ERR_SETUP_NOT_SET;
 	}
 	if (wago_steppers[device][WAGO_INPUT_SPACE]->stat_cont1.bit.start != 0) {
-		return WAGO_ERR_SETUP_NOT_SET;
+		ret = WAGO_ERR_SETUP_NOT_SET;
 	}
-	IO_UNLOCK;
-	return WAGO_ERR_SUCCESS;
+	return ret;
 }
 
 /**
@@ -118,10 +181,26 @@ int wago_confirm_setup_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPE
  */
 int wago_set_positioning_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
 {
-	/* TODO: Perform checks to make sure the device is in a state from which positioning mode can be activated */
+	int ret;
+
 	IO_LOCK;
-	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.m_positioning = 1;
+	ret = wago_set_positioning_mode_locked(wago_steppers, device);
 	IO_UNLOCK;
+	return ret;
+}
+
+/**
+ * Enables positioning mode, with the io lock already held
+ *
+ * As wago_set_positioning_mode(), for scripts (see script.h).
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to terminate, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return WAGO_ERR_SUCCESS on success, WAGO error code on failure
+ */
+int wago_set_positioning_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	/* TODO: Perform checks to make sure the device is in a state from which positioning mode can be activated */
+	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.m_positioning = 1;
 
 	return WAGO_ERR_SUCCESS;
 }
@@ -147,6 +226,45 @@ int wago_confirm_positioning_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_
 	return ret;
 }
 
+/**
+ * Enables velocity mode
+ * 
+ * the terminal has no velocity mode of its own on the positioning application, jog mode only
+ * runs at the setup speed, so this is positioning mode with the setpoints written on the fly
+ * by wago_velocity_update() (see wago_velocity.c) instead of the move queue
+ * the device must be in the 'setup mode' or positioning mode state for this to work
+ * the stream starts at a speed of 0, wago_velocity_release() hands the axis back to the queue
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to configure, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return WAGO_ERR_SUCCESS on success, WAGO error code on failure
+ */
+int wago_set_velocity_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	IO_LOCK;
+	wago_velocity_streams[device].target = 0;
+	wago_velocity_streams[device].releasing = 0;
+	wago_velocity_streams[device].engaged = 1;
+	wago_steppers[device][WAGO_OUTPUT_SPACE]->stat_cont1.bit.m_positioning = 1;
+	IO_UNLOCK;
+
+	return WAGO_ERR_SUCCESS;
+}
+
+/**
+ * Verifies device has entered velocity mode
+ * 
+ * according to manual this is done by checking the status bit m_positioning
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to check, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return WAGO_ERR_SUCCESS on success, WAGO error code on failure
+ */
+int wago_confirm_velocity_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	if (wago_steppers[device][WAGO_INPUT_SPACE]->stat_cont1.bit.m_positioning && wago_velocity_streams[device].engaged)
+		return WAGO_ERR_SUCCESS;
+	return WAGO_ERR_VELOCITY_NOT_SET;
+}
+
 /**
  * Sets the maximum allowable velocity of the stepper motor
  * 
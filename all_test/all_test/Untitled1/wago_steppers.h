@@ -18,9 +18,15 @@
 #define WAGO_ERR_POSITIONING_NOT_SET -2
 #define WAGO_ERR_SETUP_NOT_SET -3
 #define WAGO_ERR_POSITION_TOO_LARGE -4
+#define WAGO_ERR_QUEUE_FULL -5
+#define WAGO_ERR_VELOCITY_NOT_SET -6
 
 #define WAGO_NUM_STEPPERS 3
 
+/* identity of the 750-354 EtherCAT coupler the stepper modules sit on */
+#define WAGO_VENDOR_ID 0x00000021
+#define WAGO_COUPLER_PRODUCT_CODE 0x07500354
+
 enum {
 	WAGO_OUTPUT_SPACE = 0,
 	WAGO_INPUT_SPACE,
@@ -36,6 +42,15 @@ enum {
 extern pthread_mutex_t io_mutex;
 #endif
 
+/* Allow pthread locking using SOEM. Not needed when using TwinCAT3 */
+#ifdef TC_VER /* If a twincat 3 version is defined */
+#define IO_LOCK NULL
+#define IO_UNLOCK NULL
+#else
+#define IO_LOCK pthread_mutex_lock(&io_mutex)
+#define IO_UNLOCK pthread_mutex_unlock(&io_mutex)
+#endif
+
 #ifdef _MSC_VER
 __pragma( pack(push, 1) )
 struct wago_stepper_t {
@@ -91,7 +106,11 @@ struct __attribute__((__packed__)) wago_stepper_t {
 		} status_bits;
 
 		struct {
-			uint8_t to_be_defined : 8;
+			uint8_t freq_range_sel : 1;
+			uint8_t acc_range_sel : 1;
+			uint8_t reserved : 4;
+			uint8_t pre_calc : 1;
+			uint8_t error_quit : 1;
 		} control_bits;
 	} stat_cont2;
 	union {
@@ -113,14 +132,22 @@ __pragma( pack(pop) )
 #endif /* _MSC_VER */ 
 
 int wago_terminate_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+int wago_terminate_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
 int wago_confirm_terminate_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+int wago_confirm_terminate_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
 
 int wago_set_setup_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+int wago_set_setup_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
 int wago_confirm_setup_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+int wago_confirm_setup_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
 
 int wago_set_positioning_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+int wago_set_positioning_mode_locked(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
 int wago_confirm_positioning_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
 
+int wago_set_velocity_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+int wago_confirm_velocity_mode(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+
 int wago_set_velocity_limit(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device, uint16_t max_vel);
 int wago_set_acceleration_limit(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device, uint16_t max_accel);
 
@@ -0,0 +1,262 @@
+/** \file
+ * \brief Continuous velocity streaming for the wago steppers
+ *
+ * The source only sets a target speed, the cycle limits how much the commanded speed may change
+ * each cycle so a jumpy source (a teleoperation device, a coarse trajectory) cannot demand more
+ * acceleration than the motor can give. wago_velocity_stop() ramps down with a steeper limit.
+ *
+ * The 750-671 manual gives no way to stream a signed speed on the positioning application: jog
+ * mode runs at the setup speed in the direction of Direction_Pos/Direction_Neg, and the
+ * positioning setpoint velocity is a magnitude of 1 ... 25000, 0 and negative values are errors.
+ * What positioning mode does allow is a new setpoint on every rising edge of start while the
+ * drive runs, taken on the fly (2.1.2.11.1.4). So the stream runs in positioning mode: a speed goes
+ * out as its magnitude with the end of travel in its direction as the target, and a speed of 0 as
+ * the lowest speed with the position the terminal reports as the target, which brings the axis to
+ * a stop where it is. Each setpoint needs its own start edge, so the terminal takes a new speed
+ * every other cycle at best, the ramp in between is the terminal's own at the acceleration
+ * setpoint.
+ *
+ * While the stream is engaged the move queue does not load moves, the stream takes over once the
+ * queue has finished the move it is running.
+ * \warning Building this file in visual studio requires setting the /TP build option
+ * (Project->Properties->c/c++->commandline->additional options)
+ */
+
+#include "wago_velocity.h"
+#include "wago_move_queue.h"
+#include "wago_mailbox.h"
+#include "homing.h"
+#include "safety.h"
+
+#define WAGO_VELOCITY_STREAM_DEFAULT { \
+	0, 0, 0, 0, 0, 0, 0, \
+	WAGO_VELOCITY_DEFAULT_RAMP, WAGO_VELOCITY_DEFAULT_STOP_RAMP, WAGO_VELOCITY_MAX, WAGO_VELOCITY_MAX_ACCELERATION, \
+	WAGO_POSITION_MIN, WAGO_POSITION_MAX, \
+	0, 0 \
+}
+
+struct wago_velocity_stream_t wago_velocity_streams[WAGO_NUM_STEPPERS] = {
+	WAGO_VELOCITY_STREAM_DEFAULT,
+	WAGO_VELOCITY_STREAM_DEFAULT,
+	WAGO_VELOCITY_STREAM_DEFAULT
+};
+
+/**
+ * Sets the limits applied to a stepper's velocity stream
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @param[in]	limit The largest speed that will be commanded in either direction, at most WAGO_VELOCITY_MAX
+ * @param[in]	ramp The largest change in speed per cycle
+ * @param[in]	stop_ramp The largest change in speed per cycle after wago_velocity_stop()
+ */
+void wago_velocity_configure(int device, int16_t limit, uint16_t ramp, uint16_t stop_ramp)
+{
+	if (limit > WAGO_VELOCITY_MAX)
+		limit = WAGO_VELOCITY_MAX;
+	if (limit < 0)
+		limit = 0;
+
+	IO_LOCK;
+	wago_velocity_streams[device].limit = limit;
+	wago_velocity_streams[device].ramp = ramp;
+	wago_velocity_streams[device].stop_ramp = stop_ramp;
+	IO_UNLOCK;
+}
+
+/**
+ * Sets where a stepper may run to and how hard the terminal ramps between setpoints
+ *
+ * The axis stops at the end of travel by itself, whatever speed is streamed.
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @param[in]	travel_min The lowest position, at least WAGO_POSITION_MIN
+ * @param[in]	travel_max The highest position, at most WAGO_POSITION_MAX
+ * @param[in]	acceleration The acceleration setpoint, 1 ... WAGO_VELOCITY_MAX_ACCELERATION
+ */
+void wago_velocity_travel(int device, int32_t travel_min, int32_t travel_max, uint16_t acceleration)
+{
+	if (travel_min < WAGO_POSITION_MIN)
+		travel_min = WAGO_POSITION_MIN;
+	if (travel_max > WAGO_POSITION_MAX)
+		travel_max = WAGO_POSITION_MAX;
+	if (acceleration < 1)
+		acceleration = 1;
+	if (acceleration > WAGO_VELOCITY_MAX_ACCELERATION)
+		acceleration = WAGO_VELOCITY_MAX_ACCELERATION;
+
+	IO_LOCK;
+	wago_velocity_streams[device].travel_min = travel_min;
+	wago_velocity_streams[device].travel_max = travel_max;
+	wago_velocity_streams[device].acceleration = acceleration;
+	IO_UNLOCK;
+}
+
+/**
+ * Sets the speed a stepper should run at
+ *
+ * May be called as often as the source likes, only the latest value is used each cycle.
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @param[in]	velocity The requested speed, the sign gives the direction
+ */
+void wago_velocity_set(int device, int16_t velocity)
+{
+	wago_velocity_streams[device].target = velocity;
+	wago_velocity_streams[device].fast_stop = 0;
+}
+
+/**
+ * Brings a stepper to a stop using the stop ramp
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ */
+void wago_velocity_stop(int device)
+{
+	wago_velocity_streams[device].target = 0;
+	wago_velocity_streams[device].fast_stop = 1;
+}
+
+/**
+ * Hands a stepper back to the move queue
+ *
+ * The stream ramps the axis down first, it stays engaged until the terminal has taken the stop.
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ */
+void wago_velocity_release(int device)
+{
+	wago_velocity_streams[device].target = 0;
+	wago_velocity_streams[device].releasing = 1;
+}
+
+/**
+ * Checks whether a stepper belongs to the velocity stream
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return 1 from wago_set_velocity_mode() until a release has stopped the axis, 0 otherwise
+ */
+int wago_velocity_engaged(int device)
+{
+	return wago_velocity_streams[device].engaged;
+}
+
+/**
+ * Checks whether a stepper is being driven by the velocity stream
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return 1 if the stream writes the setpoints, 0 otherwise
+ */
+int wago_velocity_active(int device)
+{
+	return wago_velocity_streams[device].active;
+}
+
+/**
+ * Checks whether the commanded speed of a stepper has reached zero
+ *
+ * @param[in]	device The wago stepper, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ * @return 1 if the stepper is commanded to stand still, 0 otherwise
+ */
+int wago_velocity_stopped(int device)
+{
+	return wago_velocity_streams[device].command == 0;
+}
+
+/**
+ * Writes a speed into the positioning setpoints
+ *
+ * @param[in,out]	out Output space of the stepper
+ * @param[in]		in Input space of the stepper, for the position a stop is made at
+ * @param[in]		stream The stepper's stream
+ * @param[in]		command The speed
+ */
+static void wago_velocity_load(struct wago_stepper_t *out, const struct wago_stepper_t *in, const struct wago_velocity_stream_t *stream, int32_t command)
+{
+	uint32_t speed;
+	uint32_t position;
+
+	if (command > 0) {
+		speed = (uint32_t) command;
+		position = (uint32_t) stream->travel_max;
+	} else if (command < 0) {
+		speed = (uint32_t) -command;
+		position = (uint32_t) stream->travel_min;
+	} else {
+		/* there is no speed of 0, run to where the axis is at the lowest */
+		speed = 1;
+		position = in->message.positioning.position_lbyte | (in->message.positioning.position_mbyte << 8)
+			| ((uint32_t) in->message.positioning.position_hbyte << 16);
+	}
+
+	out->message.positioning.velocity_lbyte = (uint8_t) ((speed>>0)&0xFF);
+	out->message.positioning.velocity_hbyte = (uint8_t) ((speed>>8)&0xFF);
+	out->message.positioning.acceleration_lbyte = (uint8_t) ((stream->acceleration>>0)&0xFF);
+	out->message.positioning.acceleration_hbyte = (uint8_t) ((stream->acceleration>>8)&0xFF);
+	out->message.positioning.position_lbyte = (uint8_t) ((position>>0)&0xff);
+	out->message.positioning.position_mbyte = (uint8_t) ((position>>8)&0xff);
+	out->message.positioning.position_hbyte = (uint8_t) ((position>>16)&0xff);
+}
+
+/**
+ * Writes the next speed setpoint of one stepper
+ *
+ * Must be called once per cycle after wago_queue_update(), the io lock must already be held (see
+ * cycle_update()). Does nothing unless the stream is engaged, the terminal reports positioning
+ * mode, the mailbox has given the process image back and the move queue has no move running.
+ * @param[in,out]	wago_steppers Pointer to the array holding addresses of wago stepper motor io spaces
+ * @param[in]		device The wago stepper to service, should start from 0 and go to WAGO_NUM_STEPPERS-1
+ */
+void wago_velocity_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device)
+{
+	struct wago_stepper_t *out = wago_steppers[device][WAGO_OUTPUT_SPACE];
+	struct wago_stepper_t *in = wago_steppers[device][WAGO_INPUT_SPACE];
+	struct wago_velocity_stream_t *stream = &wago_velocity_streams[device];
+	int32_t target = stream->target;
+	int32_t step = stream->fast_stop ? stream->stop_ramp : stream->ramp;
+	int32_t command;
+
+	/* the safety reaction owns stop2_n and start while it holds the axes, the mode has ended */
+	stream->active = stream->engaged && !safety_stopped() && !homing_active(device) && !wago_mbx_active(device)
+		&& out->stat_cont1.bit.m_positioning && in->stat_cont1.bit.m_positioning
+		&& wago_move_queues[device].state == WAGO_QUEUE_IDLE;
+	if (!stream->active) {
+		stream->command = 0;
+		stream->sent = 0;
+		return;
+	}
+
+	if (stream->releasing)
+		target = 0;
+	if (target > stream->limit)
+		target = stream->limit;
+	if (target < -stream->limit)
+		target = -stream->limit;
+
+	command = target;
+	if (command > stream->command + step)
+		command = stream->command + step;
+	if (command < stream->command - step)
+		command = stream->command - step;
+	if (command != target)
+		stream->limited_cycles++;
+	stream->command = (int16_t) command;
+
+	/* start is edge triggered, it is dropped once the terminal has taken a setpoint */
+	if (out->stat_cont1.bit.start) {
+		if (in->stat_cont1.bit.start) {
+			out->stat_cont1.bit.start = 0;
+			stream->setpoints++;
+		}
+		return;
+	}
+	if (in->stat_cont1.bit.start)
+		return;
+
+	if (command != stream->sent) {
+		wago_velocity_load(out, in, stream, command);
+		out->stat_cont1.bit.start = 1;
+		stream->sent = (int16_t) command;
+	} else if (command == 0 && stream->releasing) {
+		/* the stop has been taken, the queue may have the axis */
+		stream->releasing = 0;
+		stream->engaged = 0;
+		stream->active = 0;
+	}
+}
@@ -0,0 +1,65 @@
+/* wago_velocity.h
+ * this file defines continuous velocity streaming for the wago steppers
+ * a source sets a speed for each stepper whenever it likes, the cycle ramps the commanded speed
+ * towards it and hands it to the terminal as an on the fly positioning setpoint
+ * the 750-671 has no signed speed setpoint in its positioning image (jog mode runs at the
+ * configured setup speed only), so a speed goes out as its magnitude with the end of travel in
+ * its direction as the target
+ * this header file is designed to work with both SOEM and TwinCAT3
+ */
+
+#ifdef _MSC_VER /* If a twincat 3 version is defined */
+#pragma once
+#endif
+
+#ifndef __WAGO_VELOCITY_H__
+#define __WAGO_VELOCITY_H__
+
+#include "wago_steppers.h"
+
+/* largest speed the terminal takes, raw velocity units (750-671 manual, 2.1.2.10.7.1.3) */
+#define WAGO_VELOCITY_MAX 25000
+/* the acceleration setpoint range is 1 ... 32767 */
+#define WAGO_VELOCITY_MAX_ACCELERATION 32767
+/* default change in speed allowed per cycle, raw velocity units */
+#define WAGO_VELOCITY_DEFAULT_RAMP 50
+/* default change in speed allowed per cycle while stopping quickly */
+#define WAGO_VELOCITY_DEFAULT_STOP_RAMP 500
+/* positions are 24 bit two's complement */
+#define WAGO_POSITION_MIN (-8388608)
+#define WAGO_POSITION_MAX 8388607
+
+struct wago_velocity_stream_t {
+	volatile int16_t target; /* set by the source */
+	volatile int fast_stop; /* set by wago_velocity_stop(), cleared by the next wago_velocity_set() */
+	volatile int engaged; /* set by wago_set_velocity_mode(), cleared once a release has stopped the axis */
+	volatile int releasing; /* set by wago_velocity_release() */
+	int active; /* engaged and the terminal reports positioning mode with no move running, updated every cycle */
+	int16_t command; /* speed the stream is at this cycle */
+	int16_t sent; /* speed of the last setpoint written to the terminal */
+	uint16_t ramp;
+	uint16_t stop_ramp;
+	int16_t limit; /* largest speed that will be commanded in either direction */
+	uint16_t acceleration; /* setpoint for the terminal's own ramp, the stream's ramp should be the tighter one */
+	int32_t travel_min; /* targets the axis runs towards */
+	int32_t travel_max;
+
+	/* statistics */
+	uint32_t limited_cycles; /* cycles where the ramp held the command back */
+	uint32_t setpoints; /* setpoints taken by the terminal */
+};
+
+extern struct wago_velocity_stream_t wago_velocity_streams[WAGO_NUM_STEPPERS];
+
+void wago_velocity_configure(int device, int16_t limit, uint16_t ramp, uint16_t stop_ramp);
+void wago_velocity_travel(int device, int32_t travel_min, int32_t travel_max, uint16_t acceleration);
+void wago_velocity_set(int device, int16_t velocity);
+void wago_velocity_stop(int device);
+void wago_velocity_release(int device);
+int wago_velocity_engaged(int device);
+int wago_velocity_active(int device);
+int wago_velocity_stopped(int device);
+
+void wago_velocity_update(struct wago_stepper_t *wago_steppers[WAGO_NUM_STEPPERS][WAGO_LENGTH_SPACE], int device);
+
+#endif /* __WAGO_VELOCITY_H__ */